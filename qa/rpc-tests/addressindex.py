@@ -0,0 +1,101 @@
+#!/usr/bin/env python2
+# Copyright (c) 2017 The Sling core developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#
+# Test the address and spent indexes (-addressindex, -spentindex)
+#
+
+from test_framework import BitcoinTestFramework
+from bitcoinrpc.authproxy import AuthServiceProxy, JSONRPCException
+from util import *
+
+class AddressIndexTest(BitcoinTestFramework):
+
+    def setup_chain(self):
+        print("Initializing test directory "+self.options.tmpdir)
+        initialize_chain_clean(self.options.tmpdir, 2)
+
+    def setup_network(self):
+        self.nodes = []
+        self.is_network_split = False
+        self.nodes.append(start_node(0, self.options.tmpdir, ["-debug", "-addressindex", "-spentindex"]))
+        self.nodes.append(start_node(1, self.options.tmpdir, ["-debug"]))
+        connect_nodes_bi(self.nodes, 0, 1)
+        self.sync_all()
+
+    def run_test(self):
+        print "Mining blocks..."
+        self.nodes[1].setgenerate(True, 101)
+        self.sync_all()
+
+        # the indexes are off on node 1
+        try:
+            self.nodes[1].getaddressbalance(self.nodes[1].getnewaddress())
+            raise AssertionError("getaddressbalance worked without -addressindex")
+        except JSONRPCException:
+            pass
+
+        print "Paying an address..."
+        address = self.nodes[0].getnewaddress()
+        txid = self.nodes[1].sendtoaddress(address, 10)
+        self.nodes[1].setgenerate(True, 1)
+        self.sync_all()
+        height = self.nodes[0].getblockcount()
+
+        balance = self.nodes[0].getaddressbalance(address)
+        assert_equal(balance['balance'], 10)
+        assert_equal(balance['received'], 10)
+        utxos = self.nodes[0].getaddressutxos({"addresses": [address]})
+        assert_equal(len(utxos), 1)
+        assert_equal(utxos[0]['txid'], txid)
+        assert_equal(utxos[0]['satoshis'], 1000000000)
+        assert_equal(utxos[0]['height'], height)
+        assert_equal(self.nodes[0].getaddresstxids(address), [txid])
+
+        print "Spending from it..."
+        vout = find_output(self.nodes[0], txid, 10)
+        spendtxid = self.nodes[0].sendtoaddress(self.nodes[1].getnewaddress(), 5)
+        self.nodes[0].setgenerate(True, 1)
+        self.sync_all()
+
+        balance = self.nodes[0].getaddressbalance(address)
+        assert_equal(balance['balance'], 0)
+        assert_equal(balance['received'], 10)
+        assert_equal(len(self.nodes[0].getaddressutxos(address)), 0)
+        assert_equal(self.nodes[0].getaddresstxids(address), [txid, spendtxid])
+        spent = self.nodes[0].getspentinfo({"txid": txid, "index": vout})
+        assert_equal(spent['txid'], spendtxid)
+        assert_equal(spent['height'], height + 1)
+
+        # height ranges page through the history
+        assert_equal(self.nodes[0].getaddresstxids({"addresses": [address], "start": height, "end": height}), [txid])
+        assert_equal(self.nodes[0].getaddresstxids({"addresses": [address], "start": height + 1}), [spendtxid])
+        assert_equal(self.nodes[0].getaddresstxids({"addresses": [address], "start": height + 2}), [])
+
+        print "Disconnecting the spend..."
+        self.nodes[0].invalidateblock(self.nodes[0].getbestblockhash())
+        assert_equal(self.nodes[0].getblockcount(), height)
+        balance = self.nodes[0].getaddressbalance(address)
+        assert_equal(balance['balance'], 10)
+        assert_equal(balance['received'], 10)
+        assert_equal(len(self.nodes[0].getaddressutxos(address)), 1)
+        assert_equal(self.nodes[0].getaddresstxids(address), [txid])
+        try:
+            self.nodes[0].getspentinfo({"txid": txid, "index": vout})
+            raise AssertionError("spent info survived a disconnect")
+        except JSONRPCException:
+            pass
+
+        print "Disconnecting the payment..."
+        self.nodes[0].invalidateblock(self.nodes[0].getbestblockhash())
+        balance = self.nodes[0].getaddressbalance(address)
+        assert_equal(balance['balance'], 0)
+        assert_equal(balance['received'], 0)
+        assert_equal(self.nodes[0].getaddresstxids(address), [])
+
+        print "Success"
+
+if __name__ == '__main__':
+    AddressIndexTest().main()
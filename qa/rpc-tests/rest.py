@@ -20,9 +20,9 @@ try:
 except ImportError:
     import urlparse
 
-def http_get_call(host, port, path, response_object = 0):
+def http_get_call(host, port, path, response_object = 0, headers = {}):
     conn = httplib.HTTPConnection(host, port)
-    conn.request('GET', path)
+    conn.request('GET', path, headers=headers)
     
     if response_object:
         return conn.getresponse()
@@ -82,6 +82,44 @@ class RESTTest (BitcoinTestFramework):
         json_obj = json.loads(json_string)
         for tx in txs:
             assert_equal(tx in json_obj['tx'], True)
+
+        # headers from a block on, in binary (80 bytes each) and json
+        response = http_get_call(url.hostname, url.port, '/rest/headers/2/'+bb_hash+self.FORMAT_SEPARATOR+'bin', True)
+        assert_equal(response.status, 200)
+        assert_equal(len(response.read()), 160)
+        json_string = http_get_call(url.hostname, url.port, '/rest/headers/2/'+bb_hash+self.FORMAT_SEPARATOR+'json')
+        json_obj = json.loads(json_string)
+        assert_equal(len(json_obj), 2)
+        assert_equal(json_obj[0]['hash'], bb_hash)
+        assert_equal(json_obj[1]['hash'], newblockhash[0])
+
+        # an unchanged block is not sent again
+        response = http_get_call(url.hostname, url.port, '/rest/block/'+bb_hash+self.FORMAT_SEPARATOR+'bin', True)
+        etag = response.getheader('etag')
+        response.read()
+        response = http_get_call(url.hostname, url.port, '/rest/block/'+bb_hash+self.FORMAT_SEPARATOR+'bin', True, {'If-None-Match': etag})
+        assert_equal(response.status, 304)
+
+        # a wildcard tag doesn't hide that a transaction is unknown
+        response = http_get_call(url.hostname, url.port, '/rest/tx/'+'0'*64+self.FORMAT_SEPARATOR+'hex', True, {'If-None-Match': '*'})
+        assert_equal(response.status, 404)
+
+        # chain info and mempool
+        json_obj = json.loads(http_get_call(url.hostname, url.port, '/rest/chaininfo.json'))
+        assert_equal(json_obj['bestblockhash'], self.nodes[0].getbestblockhash())
+        json_obj = json.loads(http_get_call(url.hostname, url.port, '/rest/mempool/info.json'))
+        assert_equal(json_obj['size'], 0)
+        json_obj = json.loads(http_get_call(url.hostname, url.port, '/rest/mempool/contents.json'))
+        assert_equal(len(json_obj), 0)
+
+        # the outputs of the mined transactions are unspent
+        json_string = http_get_call(url.hostname, url.port, '/rest/getutxos/'+txs[0]+'-0/'+txs[0]+'-1'+self.FORMAT_SEPARATOR+'json')
+        json_obj = json.loads(json_string)
+        assert_equal(json_obj['chaintipHash'], newblockhash[0])
+        assert_equal(json_obj['bitmap'], '11')
+        assert_equal(len(json_obj['utxos']), 2)
+        response = http_get_call(url.hostname, url.port, '/rest/getutxos/'+'/'.join([txs[0]+'-0'] * 16)+self.FORMAT_SEPARATOR+'json', True)
+        assert_equal(response.status, 400)
                 
         
 
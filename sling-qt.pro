@@ -570,6 +570,8 @@ SOURCES += \
     src/qt/guiutil.cpp \
     src/qt/intro.cpp \
     src/qt/masternodelist.cpp \
+    src/qt/transactionrecord.cpp \
+    src/qt/transactiontablemodel.cpp \
     src/compat/glibcxx_compat.cpp \
     src/compat/glibcxx_sanity.cpp \
     src/compat/strnlen.cpp \
@@ -0,0 +1,192 @@
+// Copyright (c) 2017 The Sling core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_ADDRESSINDEX_H
+#define BITCOIN_ADDRESSINDEX_H
+
+#include "amount.h"
+#include "crypto/common.h"
+#include "script/script.h"
+#include "serialize.h"
+#include "uint256.h"
+
+#include <utility>
+#include <vector>
+
+//! Kinds of address the indexes know; the hash is a key ID or a script ID
+enum AddressIndexType {
+    ADDRESS_TYPE_NONE = 0,
+    ADDRESS_TYPE_P2PKH = 1,
+    ADDRESS_TYPE_P2SH = 2,
+};
+
+/**
+ * Key of the address index: one record per output paid to an address and
+ * one per input spending such an output.
+ *
+ * The block height and the position of the transaction in its block are
+ * serialized big-endian, so the records of an address are kept in order of
+ * height in the database and a range of heights is read with one seek.
+ */
+class CAddressIndexKey
+{
+public:
+    unsigned char nAddressType;
+    uint160 hashBytes;
+    int nBlockHeight;
+    unsigned int nTxIndex;
+    uint256 txhash;
+    unsigned int nIndex;
+    bool fSpending;
+
+    CAddressIndexKey() : nAddressType(ADDRESS_TYPE_NONE), nBlockHeight(0), nTxIndex(0), nIndex(0), fSpending(false) {}
+    CAddressIndexKey(int nTypeIn, const uint160& hashBytesIn, int nBlockHeightIn, unsigned int nTxIndexIn, const uint256& txhashIn, unsigned int nIndexIn, bool fSpendingIn) : nAddressType(nTypeIn), hashBytes(hashBytesIn), nBlockHeight(nBlockHeightIn), nTxIndex(nTxIndexIn), txhash(txhashIn), nIndex(nIndexIn), fSpending(fSpendingIn) {}
+
+    unsigned int GetSerializeSize(int nType, int nVersion) const
+    {
+        return 1 + 20 + 4 + 4 + 32 + 4 + 1;
+    }
+
+    template <typename Stream>
+    void Serialize(Stream& s, int nType, int nVersion) const
+    {
+        ::Serialize(s, nAddressType, nType, nVersion);
+        ::Serialize(s, hashBytes, nType, nVersion);
+        unsigned char buf[4];
+        WriteBE32(buf, nBlockHeight);
+        s.write((const char*)buf, sizeof(buf));
+        WriteBE32(buf, nTxIndex);
+        s.write((const char*)buf, sizeof(buf));
+        ::Serialize(s, txhash, nType, nVersion);
+        ::Serialize(s, nIndex, nType, nVersion);
+        ::Serialize(s, fSpending, nType, nVersion);
+    }
+
+    template <typename Stream>
+    void Unserialize(Stream& s, int nType, int nVersion)
+    {
+        ::Unserialize(s, nAddressType, nType, nVersion);
+        ::Unserialize(s, hashBytes, nType, nVersion);
+        unsigned char buf[4];
+        s.read((char*)buf, sizeof(buf));
+        nBlockHeight = ReadBE32(buf);
+        s.read((char*)buf, sizeof(buf));
+        nTxIndex = ReadBE32(buf);
+        ::Unserialize(s, txhash, nType, nVersion);
+        ::Unserialize(s, nIndex, nType, nVersion);
+        ::Unserialize(s, fSpending, nType, nVersion);
+    }
+};
+
+/** Key of the index of unspent outputs by address */
+class CAddressUnspentKey
+{
+public:
+    unsigned char nAddressType;
+    uint160 hashBytes;
+    uint256 txhash;
+    unsigned int nIndex;
+
+    CAddressUnspentKey() : nAddressType(ADDRESS_TYPE_NONE), nIndex(0) {}
+    CAddressUnspentKey(int nTypeIn, const uint160& hashBytesIn, const uint256& txhashIn, unsigned int nIndexIn) : nAddressType(nTypeIn), hashBytes(hashBytesIn), txhash(txhashIn), nIndex(nIndexIn) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion)
+    {
+        READWRITE(nAddressType);
+        READWRITE(hashBytes);
+        READWRITE(txhash);
+        READWRITE(nIndex);
+    }
+};
+
+/** An unspent output of an address; a null value in an update erases the record */
+class CAddressUnspentValue
+{
+public:
+    CAmount nSatoshis;
+    CScript script;
+    int nBlockHeight;
+
+    CAddressUnspentValue() : nSatoshis(-1), nBlockHeight(0) {}
+    CAddressUnspentValue(CAmount nSatoshisIn, const CScript& scriptIn, int nBlockHeightIn) : nSatoshis(nSatoshisIn), script(scriptIn), nBlockHeight(nBlockHeightIn) {}
+
+    bool IsNull() const { return nSatoshis == -1; }
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion)
+    {
+        READWRITE(nSatoshis);
+        READWRITE(script);
+        READWRITE(nBlockHeight);
+    }
+};
+
+/** Key of the spent index: the output that was spent */
+class CSpentIndexKey
+{
+public:
+    uint256 txid;
+    unsigned int nOutputIndex;
+
+    CSpentIndexKey() : nOutputIndex(0) {}
+    CSpentIndexKey(const uint256& txidIn, unsigned int nOutputIndexIn) : txid(txidIn), nOutputIndex(nOutputIndexIn) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion)
+    {
+        READWRITE(txid);
+        READWRITE(nOutputIndex);
+    }
+};
+
+/** The input that spent an output; a null value in an update erases the record */
+class CSpentIndexValue
+{
+public:
+    uint256 txid;
+    unsigned int nInputIndex;
+    int nBlockHeight;
+    CAmount nSatoshis;
+    unsigned char nAddressType;
+    uint160 addressHash;
+
+    CSpentIndexValue() : nInputIndex(0), nBlockHeight(-1), nSatoshis(0), nAddressType(ADDRESS_TYPE_NONE) {}
+    CSpentIndexValue(const uint256& txidIn, unsigned int nInputIndexIn, int nBlockHeightIn, CAmount nSatoshisIn, int nAddressTypeIn, const uint160& addressHashIn) : txid(txidIn), nInputIndex(nInputIndexIn), nBlockHeight(nBlockHeightIn), nSatoshis(nSatoshisIn), nAddressType(nAddressTypeIn), addressHash(addressHashIn) {}
+
+    bool IsNull() const { return nBlockHeight == -1; }
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion)
+    {
+        READWRITE(txid);
+        READWRITE(nInputIndex);
+        READWRITE(nBlockHeight);
+        READWRITE(nSatoshis);
+        READWRITE(nAddressType);
+        READWRITE(addressHash);
+    }
+};
+
+/** What connecting or disconnecting a block changes in the indexes, written in one batch */
+class CAddressIndexUpdate
+{
+public:
+    std::vector<std::pair<CAddressIndexKey, CAmount> > vAddressIndex;
+    std::vector<CAddressIndexKey> vAddressIndexErase;
+    std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > vAddressUnspent;
+    std::vector<std::pair<CSpentIndexKey, CSpentIndexValue> > vSpent;
+
+    bool IsEmpty() const { return vAddressIndex.empty() && vAddressIndexErase.empty() && vAddressUnspent.empty() && vSpent.empty(); }
+};
+
+#endif // BITCOIN_ADDRESSINDEX_H
@@ -0,0 +1,111 @@
+// Copyright (c) 2017 The Sling core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockfilemap.h"
+
+#include "crypto/common.h"
+#include "main.h"
+#include "util.h"
+
+#include <algorithm>
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+CMappedBlockFile::~CMappedBlockFile()
+{
+#ifndef WIN32
+    munmap((void*)pchData, nSize);
+#endif
+}
+
+std::shared_ptr<const CMappedBlockFile> CBlockFileMapper::GetMapping(const CDiskBlockPos& pos, const char* prefix, unsigned int nValidSize)
+{
+    FileKey key(prefix[0], pos.nFile);
+    {
+        LOCK(cs);
+        std::map<FileKey, MappingList::iterator>::iterator it = mapMappings.find(key);
+        if (it != mapMappings.end()) {
+            // An undo file can still grow after it was mapped
+            if (it->second->second->size() >= nValidSize) {
+                lMappings.splice(lMappings.begin(), lMappings, it->second);
+                return lMappings.front().second;
+            }
+            lMappings.erase(it->second);
+            mapMappings.erase(it);
+        }
+    }
+
+#ifdef WIN32
+    return std::shared_ptr<const CMappedBlockFile>();
+#else
+    boost::filesystem::path path = GetBlockPosFilename(pos, prefix);
+    int fd = open(path.string().c_str(), O_RDONLY);
+    if (fd < 0)
+        return std::shared_ptr<const CMappedBlockFile>();
+    struct stat st;
+    void* p = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && (uint64_t)st.st_size >= nValidSize && st.st_size > 0)
+        p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        LogPrint("blockfiles", "%s : could not map %s\n", __func__, path.string());
+        return std::shared_ptr<const CMappedBlockFile>();
+    }
+    // Blocks are read one at a time from all over the file
+    madvise(p, st.st_size, MADV_RANDOM);
+    std::shared_ptr<const CMappedBlockFile> mapping = std::make_shared<const CMappedBlockFile>((const char*)p, st.st_size);
+    LogPrint("blockfiles", "Mapped %s (%u bytes)\n", path.filename().string(), (unsigned int)st.st_size);
+
+    LOCK(cs);
+    // Another thread may have mapped the file meanwhile; the newer mapping wins
+    std::map<FileKey, MappingList::iterator>::iterator it = mapMappings.find(key);
+    if (it != mapMappings.end()) {
+        lMappings.erase(it->second);
+        mapMappings.erase(it);
+    }
+    lMappings.push_front(std::make_pair(key, mapping));
+    mapMappings[key] = lMappings.begin();
+    while (lMappings.size() > nMaxMappings) {
+        mapMappings.erase(lMappings.back().first);
+        lMappings.pop_back();
+    }
+    return mapping;
+#endif
+}
+
+void CBlockFileMapper::Open(const CDiskBlockPos& pos, const char* prefix, unsigned int nValidSize, CMappedFileReader& reader)
+{
+    reader.file.reset();
+    // Records are preceded by the network magic and their size
+    if (pos.IsNull() || pos.nPos < 8 || pos.nPos >= nValidSize)
+        return;
+    std::shared_ptr<const CMappedBlockFile> mapping = GetMapping(pos, prefix, nValidSize);
+    if (!mapping)
+        return;
+
+#ifndef WIN32
+    // Ask for the record's pages (plus an undo checksum) before deserializing
+    uint32_t nRecordSize = ReadLE32((const unsigned char*)mapping->data() + pos.nPos - 4);
+    size_t nPageSize = sysconf(_SC_PAGESIZE);
+    size_t nBegin = pos.nPos - pos.nPos % nPageSize;
+    size_t nEnd = std::min<uint64_t>((uint64_t)pos.nPos + nRecordSize + 32, nValidSize);
+    madvise((void*)(mapping->data() + nBegin), nEnd - nBegin, MADV_WILLNEED);
+#endif
+
+    reader.file = mapping;
+    reader.nReadPos = pos.nPos;
+    reader.nEnd = nValidSize;
+}
+
+void CBlockFileMapper::Clear()
+{
+    LOCK(cs);
+    mapMappings.clear();
+    lMappings.clear();
+}
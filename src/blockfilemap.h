@@ -0,0 +1,133 @@
+// Copyright (c) 2017 The Sling core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BLOCKFILEMAP_H
+#define BITCOIN_BLOCKFILEMAP_H
+
+#include "serialize.h"
+#include "sync.h"
+
+#include <ios>
+#include <list>
+#include <map>
+#include <memory>
+#include <stdint.h>
+#include <string.h>
+#include <utility>
+
+struct CDiskBlockPos;
+
+//! Number of block and undo files kept mapped at most
+static const unsigned int MAX_BLOCKFILE_MAPPINGS = sizeof(void*) > 4 ? 64 : 4;
+
+/** A whole blk or rev file mapped read-only */
+class CMappedBlockFile
+{
+public:
+    CMappedBlockFile(const char* pchDataIn, size_t nSizeIn) : pchData(pchDataIn), nSize(nSizeIn) {}
+    ~CMappedBlockFile();
+
+    const char* data() const { return pchData; }
+    size_t size() const { return nSize; }
+
+private:
+    const char* pchData;
+    size_t nSize;
+
+    CMappedBlockFile(const CMappedBlockFile&);
+    CMappedBlockFile& operator=(const CMappedBlockFile&);
+};
+
+/**
+ * Stream subset that deserializes straight from a mapped file. The mapping
+ * stays alive while the reader holds it, even if the mapper drops it.
+ */
+class CMappedFileReader
+{
+public:
+    CMappedFileReader(int nTypeIn, int nVersionIn) : nType(nTypeIn), nVersion(nVersionIn), nReadPos(0), nEnd(0) {}
+
+    bool IsNull() const { return !file; }
+
+    //
+    // Stream subset
+    //
+    int GetType() { return nType; }
+    int GetVersion() { return nVersion; }
+
+    CMappedFileReader& read(char* pch, size_t nSize)
+    {
+        if (!file)
+            throw std::ios_base::failure("CMappedFileReader::read : no mapping");
+        if (nSize > nEnd - nReadPos)
+            throw std::ios_base::failure("CMappedFileReader::read : end of data");
+        memcpy(pch, file->data() + nReadPos, nSize);
+        nReadPos += nSize;
+        return (*this);
+    }
+
+    void ignore(size_t nSize)
+    {
+        if (nSize > nEnd - nReadPos)
+            throw std::ios_base::failure("CMappedFileReader::ignore : end of data");
+        nReadPos += nSize;
+    }
+
+    template <typename T>
+    CMappedFileReader& operator>>(T& obj)
+    {
+        // Unserialize from this stream
+        ::Unserialize(*this, obj, nType, nVersion);
+        return (*this);
+    }
+
+private:
+    friend class CBlockFileMapper;
+
+    int nType;
+    int nVersion;
+    std::shared_ptr<const CMappedBlockFile> file;
+    size_t nReadPos;
+    size_t nEnd;
+};
+
+/**
+ * Keeps finalized blk and rev files mapped read-only, so reading a block or
+ * its undo data costs neither a file open nor stdio copies.
+ *
+ * Only files that are no longer appended to at the end of the chain are
+ * mapped; the caller passes how much of the file holds records, and reads
+ * never go past that. The least recently used mapping is dropped once more
+ * than nMaxMappings files are mapped. Mappings are advised for random
+ * access, and the pages of each record read are requested ahead.
+ */
+class CBlockFileMapper
+{
+public:
+    explicit CBlockFileMapper(unsigned int nMaxMappingsIn = MAX_BLOCKFILE_MAPPINGS) : nMaxMappings(nMaxMappingsIn) {}
+
+    /**
+     * Point reader at pos in the file with the given prefix ("blk" or
+     * "rev"), of which the first nValidSize bytes hold records. Leaves the
+     * reader null if the file can't be mapped; read it through stdio then.
+     */
+    void Open(const CDiskBlockPos& pos, const char* prefix, unsigned int nValidSize, CMappedFileReader& reader);
+
+    //! Drop all mappings, for example because the files are rewritten
+    void Clear();
+
+private:
+    typedef std::pair<char, int> FileKey;
+    typedef std::list<std::pair<FileKey, std::shared_ptr<const CMappedBlockFile> > > MappingList;
+
+    CCriticalSection cs;
+    unsigned int nMaxMappings;
+    //! Most recently used first
+    MappingList lMappings;
+    std::map<FileKey, MappingList::iterator> mapMappings;
+
+    std::shared_ptr<const CMappedBlockFile> GetMapping(const CDiskBlockPos& pos, const char* prefix, unsigned int nValidSize);
+};
+
+#endif // BITCOIN_BLOCKFILEMAP_H
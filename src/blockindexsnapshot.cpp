@@ -0,0 +1,309 @@
+// Copyright (c) 2017 The Sling core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockindexsnapshot.h"
+
+#include "main.h"
+#include "pow.h"
+#include "uint256.h"
+#include "util.h"
+#include "utiltime.h"
+
+#include <algorithm>
+#include <string.h>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+namespace
+{
+const char SNAPSHOT_MAGIC[8] = {'s', 'l', 'i', 'd', 'x', 's', 'n', 'p'};
+//! Bump when the record layout changes. Also rejects files of the other byte order.
+const uint32_t SNAPSHOT_VERSION = 1;
+const uint32_t NO_RECORD = 0xffffffff;
+
+struct SnapshotHeader {
+    char magic[8];
+    uint32_t nVersion;
+    uint32_t nRecordSize;
+    uint64_t nRecords;
+    unsigned char hashBestBlock[32];
+};
+
+struct SnapshotRecord {
+    unsigned char hash[32];
+    unsigned char hashMerkleRoot[32];
+    unsigned char hashProofOfStake[32];
+    unsigned char hashPrevoutStake[32];
+    int64_t nMint;
+    int64_t nMoneySupply;
+    uint64_t nStakeModifier;
+    uint32_t nPrev;
+    uint32_t nNext;
+    int32_t nHeight;
+    int32_t nFile;
+    uint32_t nDataPos;
+    uint32_t nUndoPos;
+    int32_t nVersion;
+    uint32_t nTime;
+    uint32_t nBits;
+    uint32_t nNonce;
+    uint32_t nStatus;
+    uint32_t nTx;
+    uint32_t nFlags;
+    uint32_t nPrevoutStakeN;
+    uint32_t nStakeTime;
+    uint32_t nUnused;
+};
+
+static_assert(sizeof(SnapshotHeader) == 56, "snapshot header must not be padded");
+static_assert(sizeof(SnapshotRecord) == 216, "snapshot record must not be padded");
+
+boost::filesystem::path GetSnapshotPath()
+{
+    return GetDataDir() / "blocks" / "index.snapshot";
+}
+
+bool CompareByHeight(const CBlockIndex* a, const CBlockIndex* b)
+{
+    return a->nHeight < b->nHeight;
+}
+
+/** Read-only view of the snapshot file: mapped where possible, read into memory elsewhere */
+class CSnapshotFile
+{
+public:
+    CSnapshotFile() : pdata(NULL), nSize(0) {}
+    ~CSnapshotFile()
+    {
+#ifndef WIN32
+        if (pdata)
+            munmap((void*)pdata, nSize);
+#endif
+    }
+
+    bool Open(const boost::filesystem::path& path)
+    {
+#ifndef WIN32
+        int fd = open(path.string().c_str(), O_RDONLY);
+        if (fd < 0)
+            return false;
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+            close(fd);
+            return false;
+        }
+        void* p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (p == MAP_FAILED)
+            return false;
+        madvise(p, st.st_size, MADV_SEQUENTIAL);
+        pdata = (const unsigned char*)p;
+        nSize = st.st_size;
+#else
+        FILE* file = fopen(path.string().c_str(), "rb");
+        if (!file)
+            return false;
+        unsigned char buf[65536];
+        size_t nRead;
+        while ((nRead = fread(buf, 1, sizeof(buf), file)) > 0)
+            vData.insert(vData.end(), buf, buf + nRead);
+        fclose(file);
+        if (vData.empty())
+            return false;
+        pdata = &vData[0];
+        nSize = vData.size();
+#endif
+        return true;
+    }
+
+    const unsigned char* data() const { return pdata; }
+    size_t size() const { return nSize; }
+
+private:
+    const unsigned char* pdata;
+    size_t nSize;
+#ifdef WIN32
+    std::vector<unsigned char> vData;
+#endif
+
+    CSnapshotFile(const CSnapshotFile&);
+    CSnapshotFile& operator=(const CSnapshotFile&);
+};
+} // anon namespace
+
+bool WriteBlockIndexSnapshot(const uint256& hashBestBlock)
+{
+    AssertLockHeld(cs_main);
+    int64_t nStart = GetTimeMillis();
+
+    vector<const CBlockIndex*> vIndex;
+    vIndex.reserve(mapBlockIndex.size());
+    BOOST_FOREACH (const PAIRTYPE(uint256, CBlockIndex*) & item, mapBlockIndex)
+        vIndex.push_back(item.second);
+    sort(vIndex.begin(), vIndex.end(), CompareByHeight);
+
+    map<const CBlockIndex*, uint32_t> mapRecord;
+    for (size_t i = 0; i < vIndex.size(); i++)
+        mapRecord[vIndex[i]] = i;
+
+    boost::filesystem::path path = GetSnapshotPath();
+    boost::filesystem::path pathTmp = path;
+    pathTmp += ".new";
+    FILE* file = fopen(pathTmp.string().c_str(), "wb");
+    if (!file)
+        return error("%s : failed to open %s", __func__, pathTmp.string());
+
+    SnapshotHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.nVersion = SNAPSHOT_VERSION;
+    header.nRecordSize = sizeof(SnapshotRecord);
+    header.nRecords = vIndex.size();
+    memcpy(header.hashBestBlock, hashBestBlock.begin(), 32);
+    bool fOk = fwrite(&header, sizeof(header), 1, file) == 1;
+
+    for (size_t i = 0; i < vIndex.size() && fOk; i++) {
+        const CBlockIndex* pindex = vIndex[i];
+        SnapshotRecord rec;
+        memset(&rec, 0, sizeof(rec));
+        memcpy(rec.hash, pindex->GetBlockHash().begin(), 32);
+        memcpy(rec.hashMerkleRoot, pindex->hashMerkleRoot.begin(), 32);
+        memcpy(rec.hashProofOfStake, pindex->hashProofOfStake.begin(), 32);
+        memcpy(rec.hashPrevoutStake, pindex->prevoutStake.hash.begin(), 32);
+        rec.nMint = pindex->nMint;
+        rec.nMoneySupply = pindex->nMoneySupply;
+        rec.nStakeModifier = pindex->nStakeModifier;
+        rec.nPrev = pindex->pprev ? mapRecord[pindex->pprev] : NO_RECORD;
+        rec.nNext = pindex->pnext ? mapRecord[pindex->pnext] : NO_RECORD;
+        rec.nHeight = pindex->nHeight;
+        rec.nFile = pindex->nFile;
+        rec.nDataPos = pindex->nDataPos;
+        rec.nUndoPos = pindex->nUndoPos;
+        rec.nVersion = pindex->nVersion;
+        rec.nTime = pindex->nTime;
+        rec.nBits = pindex->nBits;
+        rec.nNonce = pindex->nNonce;
+        rec.nStatus = pindex->nStatus;
+        rec.nTx = pindex->nTx;
+        rec.nFlags = pindex->nFlags;
+        rec.nPrevoutStakeN = pindex->prevoutStake.n;
+        rec.nStakeTime = pindex->nStakeTime;
+        fOk = fwrite(&rec, sizeof(rec), 1, file) == 1;
+    }
+
+    if (fOk) {
+        fflush(file);
+        FileCommit(file);
+    }
+    fclose(file);
+    if (!fOk || !RenameOver(pathTmp, path)) {
+        boost::filesystem::remove(pathTmp);
+        return error("%s : failed to write %s", __func__, path.string());
+    }
+
+    LogPrintf("%s : wrote %u entries in %dms\n", __func__, vIndex.size(), GetTimeMillis() - nStart);
+    return true;
+}
+
+bool LoadBlockIndexSnapshot(const uint256& hashBestBlock)
+{
+    AssertLockHeld(cs_main);
+    int64_t nStart = GetTimeMillis();
+
+    boost::filesystem::path path = GetSnapshotPath();
+    CSnapshotFile file;
+    if (!file.Open(path))
+        return false;
+    // From here on the snapshot is used at most once
+    RemoveBlockIndexSnapshot();
+
+    if (file.size() < sizeof(SnapshotHeader))
+        return error("%s : truncated snapshot", __func__);
+    SnapshotHeader header;
+    memcpy(&header, file.data(), sizeof(header));
+    if (memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) != 0 || header.nVersion != SNAPSHOT_VERSION ||
+        header.nRecordSize != sizeof(SnapshotRecord))
+        return error("%s : unknown snapshot format", __func__);
+    if (header.nRecords >= NO_RECORD || file.size() != sizeof(SnapshotHeader) + header.nRecords * sizeof(SnapshotRecord))
+        return error("%s : snapshot size does not match its header", __func__);
+    if (memcmp(header.hashBestBlock, hashBestBlock.begin(), 32) != 0) {
+        LogPrintf("%s : snapshot was written for another chain tip, ignoring it\n", __func__);
+        return false;
+    }
+
+    const SnapshotRecord* vRecords = (const SnapshotRecord*)(file.data() + sizeof(SnapshotHeader));
+    size_t nRecords = header.nRecords;
+    for (size_t i = 0; i < nRecords; i++) {
+        if ((vRecords[i].nPrev != NO_RECORD && vRecords[i].nPrev >= i) ||
+            (vRecords[i].nNext != NO_RECORD && vRecords[i].nNext >= nRecords))
+            return error("%s : bad link in snapshot entry %u", __func__, i);
+    }
+
+    // Nothing has been inserted yet, so a bad snapshot above leaves the
+    // database path a clean mapBlockIndex to start from.
+    mapBlockIndex.reserve(nRecords);
+    vector<CBlockIndex*> vIndex(nRecords);
+    for (size_t i = 0; i < nRecords; i++) {
+        const SnapshotRecord& rec = vRecords[i];
+        uint256 hash;
+        memcpy(hash.begin(), rec.hash, 32);
+        vIndex[i] = InsertBlockIndex(hash);
+    }
+
+    for (size_t i = 0; i < nRecords; i++) {
+        const SnapshotRecord& rec = vRecords[i];
+        CBlockIndex* pindexNew = vIndex[i];
+        pindexNew->pprev = rec.nPrev == NO_RECORD ? NULL : vIndex[rec.nPrev];
+        pindexNew->pnext = rec.nNext == NO_RECORD ? NULL : vIndex[rec.nNext];
+        pindexNew->nHeight = rec.nHeight;
+        pindexNew->nFile = rec.nFile;
+        pindexNew->nDataPos = rec.nDataPos;
+        pindexNew->nUndoPos = rec.nUndoPos;
+        pindexNew->nVersion = rec.nVersion;
+        memcpy(pindexNew->hashMerkleRoot.begin(), rec.hashMerkleRoot, 32);
+        pindexNew->nTime = rec.nTime;
+        pindexNew->nBits = rec.nBits;
+        pindexNew->nNonce = rec.nNonce;
+        pindexNew->nStatus = rec.nStatus;
+        pindexNew->nTx = rec.nTx;
+
+        //Proof Of Stake
+        pindexNew->nMint = rec.nMint;
+        pindexNew->nMoneySupply = rec.nMoneySupply;
+        pindexNew->nFlags = rec.nFlags;
+        pindexNew->nStakeModifier = rec.nStakeModifier;
+        memcpy(pindexNew->prevoutStake.hash.begin(), rec.hashPrevoutStake, 32);
+        pindexNew->prevoutStake.n = rec.nPrevoutStakeN;
+        pindexNew->nStakeTime = rec.nStakeTime;
+        memcpy(pindexNew->hashProofOfStake.begin(), rec.hashProofOfStake, 32);
+
+        if (pindexNew->IsProofOfStake()) {
+            setStakeSeen.insert(make_pair(pindexNew->prevoutStake, pindexNew->nStakeTime));
+        } else if (pindexNew->nTime != 0 && !CheckProofOfWork(pindexNew->GetBlockHash(), pindexNew->nBits)) {
+            // Leave it to the database to decide whether the index is corrupted
+            mapBlockIndex.clear();
+            setStakeSeen.clear();
+            return error("%s : CheckProofOfWork failed: %s", __func__, pindexNew->ToString());
+        }
+    }
+
+    LogPrintf("%s : loaded %u entries in %dms\n", __func__, nRecords, GetTimeMillis() - nStart);
+    return true;
+}
+
+void RemoveBlockIndexSnapshot()
+{
+    boost::system::error_code ec;
+    boost::filesystem::remove(GetSnapshotPath(), ec);
+}
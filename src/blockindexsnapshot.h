@@ -0,0 +1,33 @@
+// Copyright (c) 2017 The Sling core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BLOCKINDEXSNAPSHOT_H
+#define BITCOIN_BLOCKINDEXSNAPSHOT_H
+
+#include <stdint.h>
+
+class uint256;
+
+/**
+ * Flat snapshot of mapBlockIndex, written at a clean shutdown and mapped at
+ * the next startup instead of walking the block tree database.
+ *
+ * The file is a fixed header followed by one fixed-size record per block
+ * index entry, ordered by height. Links between entries are stored as
+ * record indexes, so the file needs no fixups beyond turning them back into
+ * pointers. A snapshot is only trusted for the coins tip it was written
+ * with and is removed as soon as it has been read, so a node that stops
+ * uncleanly falls back to the database on the next start.
+ */
+
+static const bool DEFAULT_BLOCKINDEX_SNAPSHOT = true;
+
+//! Write the snapshot for the current block index. Requires cs_main.
+bool WriteBlockIndexSnapshot(const uint256& hashBestBlock);
+//! Fill mapBlockIndex from the snapshot if one exists for hashBestBlock. Requires cs_main.
+bool LoadBlockIndexSnapshot(const uint256& hashBestBlock);
+//! Delete the snapshot, for example because the block files are rebuilt
+void RemoveBlockIndexSnapshot();
+
+#endif // BITCOIN_BLOCKINDEXSNAPSHOT_H
@@ -76,4 +76,24 @@ uint256 CBlockIndex::GetBlockTrust() const
         uint256 bnPoWTrust = ((~uint256(0) >> 20) / (bnTarget + 1));
         return bnPoWTrust > 1 ? bnPoWTrust : 1;
     }
-}
\ No newline at end of file
+}
+
+/**
+ * CBlockIndexArena implementation
+ */
+CBlockIndex* CBlockIndexArena::Allocate()
+{
+    if (nUsed == CHUNK_SIZE) {
+        vChunks.push_back(new CBlockIndex[CHUNK_SIZE]);
+        nUsed = 0;
+    }
+    return &vChunks.back()[nUsed++];
+}
+
+void CBlockIndexArena::Clear()
+{
+    BOOST_FOREACH (CBlockIndex* pchunk, vChunks)
+        delete[] pchunk;
+    vChunks.clear();
+    nUsed = CHUNK_SIZE;
+}
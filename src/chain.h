@@ -232,7 +232,7 @@ public:
 
         if (block.IsProofOfStake()) {
             SetProofOfStake();
-            prevoutStake = block.vtx[1].vin[0].prevout;
+            prevoutStake = block.vtx[1]->vin[0].prevout;
             nStakeTime = block.nTime;
         } else {
             prevoutStake.SetNull();
@@ -389,6 +389,32 @@ public:
     const CBlockIndex* GetAncestor(int height) const;
 };
 
+/**
+ * Allocates CBlockIndex objects in chunks. Block index entries live until
+ * shutdown and are never freed one at a time, so this saves a heap
+ * allocation per block and keeps entries loaded together close in memory.
+ */
+class CBlockIndexArena
+{
+public:
+    static const size_t CHUNK_SIZE = 4096;
+
+    CBlockIndexArena() : nUsed(CHUNK_SIZE) {}
+    ~CBlockIndexArena() { Clear(); }
+
+    //! Return a default constructed CBlockIndex owned by the arena
+    CBlockIndex* Allocate();
+    //! Free every entry handed out so far
+    void Clear();
+
+private:
+    std::vector<CBlockIndex*> vChunks;
+    size_t nUsed;
+
+    CBlockIndexArena(const CBlockIndexArena&);
+    CBlockIndexArena& operator=(const CBlockIndexArena&);
+};
+
 /** Used to marshal pointers into hashes for db storage. */
 class CDiskBlockIndex : public CBlockIndex
 {
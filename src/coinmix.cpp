@@ -69,7 +69,7 @@ void CCoinMixPool::ProcessMessageCoinMix(CNode* pfrom, std::string& strCommand,
         }
 
         int nDenom;
-        CTransaction txCollateral;
+        CTransactionRef txCollateral;
         vRecv >> nDenom >> txCollateral;
 
         CMasternode* pmn = mnodeman.Find(activeMasternode.vin);
@@ -174,7 +174,7 @@ void CCoinMixPool::ProcessMessageCoinMix(CNode* pfrom, std::string& strCommand,
 
         std::vector<CTxIn> in;
         int64_t nAmount;
-        CTransaction txCollateral;
+        CTransactionRef txCollateral;
         std::vector<CTxOut> out;
         vRecv >> in >> nAmount >> txCollateral >> out;
 
@@ -671,10 +671,10 @@ void CCoinMixPool::ChargeFees()
     if (r > 33) return;
 
     if (state == POOL_STATUS_ACCEPTING_ENTRIES) {
-        BOOST_FOREACH (const CTransaction& txCollateral, vecSessionCollateral) {
+        BOOST_FOREACH (const CTransactionRef& txCollateral, vecSessionCollateral) {
             bool found = false;
             BOOST_FOREACH (const CCoinMixEntry& v, entries) {
-                if (v.collateral == txCollateral) {
+                if (*v.collateral == *txCollateral) {
                     found = true;
                 }
             }
@@ -689,7 +689,7 @@ void CCoinMixPool::ChargeFees()
 
     if (state == POOL_STATUS_SIGNING) {
         // who didn't sign?
-        BOOST_FOREACH (const CCoinMixEntry v, entries) {
+        BOOST_FOREACH (const CCoinMixEntry& v, entries) {
             BOOST_FOREACH (const CTxDSIn s, v.sev) {
                 if (!s.fHasSig) {
                     LogPrintf("CCoinMixPool::ChargeFees -- found uncooperative node (didn't sign). Found offence\n");
@@ -715,10 +715,10 @@ void CCoinMixPool::ChargeFees()
     r = rand() % 100;
 
     if (state == POOL_STATUS_ACCEPTING_ENTRIES) {
-        BOOST_FOREACH (const CTransaction& txCollateral, vecSessionCollateral) {
+        BOOST_FOREACH (const CTransactionRef& txCollateral, vecSessionCollateral) {
             bool found = false;
             BOOST_FOREACH (const CCoinMixEntry& v, entries) {
-                if (v.collateral == txCollateral) {
+                if (*v.collateral == *txCollateral) {
                     found = true;
                 }
             }
@@ -727,7 +727,7 @@ void CCoinMixPool::ChargeFees()
             if (!found && r > target) {
                 LogPrintf("CCoinMixPool::ChargeFees -- found uncooperative node (didn't send transaction). charging fees.\n");
 
-                CWalletTx wtxCollateral = CWalletTx(pwalletMain, txCollateral);
+                CWalletTx wtxCollateral = CWalletTx(pwalletMain, *txCollateral);
 
                 // Broadcast
                 if (!wtxCollateral.AcceptToMemoryPool(true)) {
@@ -742,12 +742,12 @@ void CCoinMixPool::ChargeFees()
 
     if (state == POOL_STATUS_SIGNING) {
         // who didn't sign?
-        BOOST_FOREACH (const CCoinMixEntry v, entries) {
+        BOOST_FOREACH (const CCoinMixEntry& v, entries) {
             BOOST_FOREACH (const CTxDSIn s, v.sev) {
                 if (!s.fHasSig && r > target) {
                     LogPrintf("CCoinMixPool::ChargeFees -- found uncooperative node (didn't sign). charging fees.\n");
 
-                    CWalletTx wtxCollateral = CWalletTx(pwalletMain, v.collateral);
+                    CWalletTx wtxCollateral = CWalletTx(pwalletMain, *v.collateral);
 
                     // Broadcast
                     if (!wtxCollateral.AcceptToMemoryPool(false)) {
@@ -769,7 +769,7 @@ void CCoinMixPool::ChargeRandomFees()
     if (fMasterNode) {
         int i = 0;
 
-        BOOST_FOREACH (const CTransaction& txCollateral, vecSessionCollateral) {
+        BOOST_FOREACH (const CTransactionRef& txCollateral, vecSessionCollateral) {
             int r = rand() % 100;
 
             /*
@@ -784,7 +784,7 @@ void CCoinMixPool::ChargeRandomFees()
             if (r <= 10) {
                 LogPrintf("CCoinMixPool::ChargeRandomFees -- charging random fees. %u\n", i);
 
-                CWalletTx wtxCollateral = CWalletTx(pwalletMain, txCollateral);
+                CWalletTx wtxCollateral = CWalletTx(pwalletMain, *txCollateral);
 
                 // Broadcast
                 if (!wtxCollateral.AcceptToMemoryPool(true)) {
@@ -1007,7 +1007,7 @@ bool CCoinMixPool::IsCollateralValid(const CTransaction& txCollateral)
 //
 // Add a clients transaction to the pool
 //
-bool CCoinMixPool::AddEntry(const std::vector<CTxIn>& newInput, const int64_t& nAmount, const CTransaction& txCollateral, const std::vector<CTxOut>& newOutput, int& errorID)
+bool CCoinMixPool::AddEntry(const std::vector<CTxIn>& newInput, const int64_t& nAmount, const CTransactionRef& txCollateral, const std::vector<CTxOut>& newOutput, int& errorID)
 {
     if (!fMasterNode) return false;
 
@@ -1020,7 +1020,7 @@ bool CCoinMixPool::AddEntry(const std::vector<CTxIn>& newInput, const int64_t& n
         }
     }
 
-    if (!IsCollateralValid(txCollateral)) {
+    if (!IsCollateralValid(*txCollateral)) {
         LogPrint("coinmix", "CCoinMixPool::AddEntry - collateral not valid!\n");
         errorID = ERR_INVALID_COLLATERAL;
         sessionUsers--;
@@ -1195,7 +1195,7 @@ void CCoinMixPool::SendCoinMixDenominate(std::vector<CTxIn>& vin, std::vector<CT
 
     // store our entry for later use
     CCoinMixEntry e;
-    e.Add(vin, amount, txCollateral, vout);
+    e.Add(vin, amount, MakeTransactionRef(txCollateral), vout);
     entries.push_back(e);
 
     RelayIn(entries[0].sev, entries[0].amount, txCollateral, entries[0].vout);
@@ -1839,7 +1839,7 @@ bool CCoinMixPool::IsCompatibleWithEntries(std::vector<CTxOut>& vout)
 {
     if (GetDenominations(vout) == 0) return false;
 
-    BOOST_FOREACH (const CCoinMixEntry v, entries) {
+    BOOST_FOREACH (const CCoinMixEntry& v, entries) {
         LogPrintf(" IsCompatibleWithEntries %d %d\n", GetDenominations(vout), GetDenominations(v.vout));
         /*
         BOOST_FOREACH(CTxOut o1, vout)
@@ -1854,13 +1854,13 @@ bool CCoinMixPool::IsCompatibleWithEntries(std::vector<CTxOut>& vout)
     return true;
 }
 
-bool CCoinMixPool::IsCompatibleWithSession(int64_t nDenom, CTransaction txCollateral, int& errorID)
+bool CCoinMixPool::IsCompatibleWithSession(int64_t nDenom, const CTransactionRef& txCollateral, int& errorID)
 {
     if (nDenom == 0) return false;
 
     LogPrintf("CCoinMixPool::IsCompatibleWithSession - sessionDenom %d sessionUsers %d\n", sessionDenom, sessionUsers);
 
-    if (!unitTest && !IsCollateralValid(txCollateral)) {
+    if (!unitTest && !IsCollateralValid(*txCollateral)) {
         LogPrint("coinmix", "CCoinMixPool::IsCompatibleWithSession - collateral not valid!\n");
         errorID = ERR_INVALID_COLLATERAL;
         return false;
@@ -2208,10 +2208,14 @@ bool CCoinMixQueue::Sign()
 
 bool CCoinMixQueue::Relay()
 {
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << *this;
+    CSerializedNetMsgRef msg = MakeSerializedNetMsg("dsq", ss);
+
     LOCK(cs_vNodes);
     BOOST_FOREACH (CNode* pnode, vNodes) {
         // always relay to everyone
-        pnode->PushMessage("dsq", (*this));
+        pnode->PushSerializedMessage(msg);
     }
 
     return true;
@@ -2238,9 +2242,13 @@ bool CCoinMixQueue::CheckSignature()
 
 void CCoinMixPool::RelayFinalTransaction(const int sessionID, const CTransaction& txNew)
 {
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << sessionID << txNew;
+    CSerializedNetMsgRef msg = MakeSerializedNetMsg("dsf", ss);
+
     LOCK(cs_vNodes);
     BOOST_FOREACH (CNode* pnode, vNodes) {
-        pnode->PushMessage("dsf", sessionID, txNew);
+        pnode->PushSerializedMessage(msg);
     }
 }
 
@@ -2266,16 +2274,24 @@ void CCoinMixPool::RelayIn(const std::vector<CTxDSIn>& vin, const int64_t& nAmou
 
 void CCoinMixPool::RelayStatus(const int sessionID, const int newState, const int newEntriesCount, const int newAccepted, const int errorID)
 {
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << sessionID << newState << newEntriesCount << newAccepted << errorID;
+    CSerializedNetMsgRef msg = MakeSerializedNetMsg("dssu", ss);
+
     LOCK(cs_vNodes);
     BOOST_FOREACH (CNode* pnode, vNodes)
-        pnode->PushMessage("dssu", sessionID, newState, newEntriesCount, newAccepted, errorID);
+        pnode->PushSerializedMessage(msg);
 }
 
 void CCoinMixPool::RelayCompletedTransaction(const int sessionID, const bool error, const int errorID)
 {
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << sessionID << error << errorID;
+    CSerializedNetMsgRef msg = MakeSerializedNetMsg("dsc", ss);
+
     LOCK(cs_vNodes);
     BOOST_FOREACH (CNode* pnode, vNodes)
-        pnode->PushMessage("dsc", sessionID, error, errorID);
+        pnode->PushSerializedMessage(msg);
 }
 
 //TODO: Rename/move to core
@@ -99,19 +99,18 @@ public:
     std::vector<CTxDSIn> sev;
     std::vector<CTxDSOut> vout;
     int64_t amount;
-    CTransaction collateral;
+    CTransactionRef collateral; //! shared with vecSessionCollateral on the masternode
     CTransaction txSupporting;
     int64_t addedTime; // time in UTC milliseconds
 
     CCoinMixEntry()
     {
         isSet = false;
-        collateral = CTransaction();
         amount = 0;
     }
 
     /// Add entries to use for CoinMix
-    bool Add(const std::vector<CTxIn> vinIn, int64_t amountIn, const CTransaction collateralIn, const std::vector<CTxOut> voutIn)
+    bool Add(const std::vector<CTxIn> vinIn, int64_t amountIn, const CTransactionRef& collateralIn, const std::vector<CTxOut> voutIn)
     {
         if (isSet) {
             return false;
@@ -285,7 +284,7 @@ private:
 
     int sessionUsers;            //N Users have said they'll join
     bool sessionFoundMasternode; //If we've found a compatible Masternode
-    std::vector<CTransaction> vecSessionCollateral;
+    std::vector<CTransactionRef> vecSessionCollateral;
 
     int cachedLastSuccess;
 
@@ -441,7 +440,7 @@ public:
     bool IsCompatibleWithEntries(std::vector<CTxOut>& vout);
 
     /// Is this amount compatible with other client in the pool?
-    bool IsCompatibleWithSession(int64_t nAmount, CTransaction txCollateral, int& errorID);
+    bool IsCompatibleWithSession(int64_t nAmount, const CTransactionRef& txCollateral, int& errorID);
 
     /// Passively run CoinMix in the background according to the configuration in settings (only for QT)
     bool DoAutomaticDenominating(bool fDryRun = false);
@@ -461,7 +460,7 @@ public:
     /// If the collateral is valid given by a client
     bool IsCollateralValid(const CTransaction& txCollateral);
     /// Add a clients entry to the pool
-    bool AddEntry(const std::vector<CTxIn>& newInput, const int64_t& nAmount, const CTransaction& txCollateral, const std::vector<CTxOut>& newOutput, int& errorID);
+    bool AddEntry(const std::vector<CTxIn>& newInput, const int64_t& nAmount, const CTransactionRef& txCollateral, const std::vector<CTxOut>& newOutput, int& errorID);
     /// Add signature to a vin
     bool AddScriptSig(const CTxIn& newVin);
     /// Check that all inputs are signed. (Are all inputs signed?)
@@ -7,6 +7,7 @@
 
 #include "random.h"
 
+#include <algorithm>
 #include <assert.h>
 
 /**
@@ -125,6 +126,12 @@ CCoinsModifier CCoinsViewCache::ModifyCoins(const uint256& txid)
             ret.first->second.flags = CCoinsCacheEntry::FRESH;
         }
     }
+    // An entry that still matches the parent starts tracking which of its
+    // outputs the modifications touch, so flushing it needs not rewrite the rest.
+    if (!(ret.first->second.flags & (CCoinsCacheEntry::DIRTY | CCoinsCacheEntry::FRESH))) {
+        ret.first->second.flags |= CCoinsCacheEntry::PARTIAL;
+        ret.first->second.vChanged.clear();
+    }
     // Assume that whenever ModifyCoins is called, the entry will be modified.
     ret.first->second.flags |= CCoinsCacheEntry::DIRTY;
     return CCoinsModifier(*this, ret.first);
@@ -178,6 +185,7 @@ bool CCoinsViewCache::BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlockIn
                     CCoinsCacheEntry& entry = cacheCoins[it->first];
                     entry.coins.swap(it->second.coins);
                     entry.flags = CCoinsCacheEntry::DIRTY | CCoinsCacheEntry::FRESH;
+                    entry.SetAllChanged();
                 }
             } else {
                 if ((itUs->second.flags & CCoinsCacheEntry::FRESH) && it->second.coins.IsPruned()) {
@@ -187,8 +195,20 @@ bool CCoinsViewCache::BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlockIn
                     cacheCoins.erase(itUs);
                 } else {
                     // A normal modification.
-                    itUs->second.coins.swap(it->second.coins);
-                    itUs->second.flags |= CCoinsCacheEntry::DIRTY;
+                    CCoinsCacheEntry& entry = itUs->second;
+                    entry.coins.swap(it->second.coins);
+                    if (!(it->second.flags & CCoinsCacheEntry::PARTIAL)) {
+                        entry.SetAllChanged();
+                    } else if (!(entry.flags & CCoinsCacheEntry::DIRTY)) {
+                        // We matched our parent, so the child's changes are all there is.
+                        entry.flags |= CCoinsCacheEntry::PARTIAL;
+                        entry.vChanged.swap(it->second.vChanged);
+                    } else if (entry.flags & CCoinsCacheEntry::PARTIAL) {
+                        for (unsigned int i = 0; i < it->second.vChanged.size(); i++)
+                            if (it->second.vChanged[i])
+                                entry.SetOutputChanged(i);
+                    }
+                    entry.flags |= CCoinsCacheEntry::DIRTY;
                 }
             }
         }
@@ -264,6 +284,17 @@ CCoinsModifier::CCoinsModifier(CCoinsViewCache& cache_, CCoinsMap::iterator it_)
 {
     assert(!cache.hasModifier);
     cache.hasModifier = true;
+
+    const CCoins& coins = it->second.coins;
+    fCoinBase = coins.fCoinBase;
+    fCoinStake = coins.fCoinStake;
+    nHeight = coins.nHeight;
+    nVersion = coins.nVersion;
+    if (it->second.flags & CCoinsCacheEntry::PARTIAL) {
+        vAvailable.resize(coins.vout.size());
+        for (unsigned int i = 0; i < coins.vout.size(); i++)
+            vAvailable[i] = !coins.vout[i].IsNull();
+    }
 }
 
 CCoinsModifier::~CCoinsModifier()
@@ -271,6 +302,17 @@ CCoinsModifier::~CCoinsModifier()
     assert(cache.hasModifier);
     cache.hasModifier = false;
     it->second.coins.Cleanup();
+    CCoinsCacheEntry& entry = it->second;
+    if (entry.flags & CCoinsCacheEntry::PARTIAL) {
+        const CCoins& coins = entry.coins;
+        if (coins.fCoinBase != fCoinBase || coins.fCoinStake != fCoinStake || coins.nHeight != nHeight || coins.nVersion != nVersion) {
+            entry.SetAllChanged();
+        } else {
+            for (unsigned int i = 0; i < std::max(vAvailable.size(), coins.vout.size()); i++)
+                if ((i < vAvailable.size() && vAvailable[i]) != coins.IsAvailable(i))
+                    entry.SetOutputChanged(i);
+        }
+    }
     if ((it->second.flags & CCoinsCacheEntry::FRESH) && it->second.coins.IsPruned()) {
         cache.cacheCoins.erase(it);
     }
@@ -307,13 +307,35 @@ public:
 struct CCoinsCacheEntry {
     CCoins coins; // The actual cached data.
     unsigned char flags;
+    std::vector<bool> vChanged; // With PARTIAL set, the outputs that may differ from the parent view.
 
     enum Flags {
-        DIRTY = (1 << 0), // This cache entry is potentially different from the version in the parent view.
-        FRESH = (1 << 1), // The parent view does not have this entry (or it is pruned).
+        DIRTY = (1 << 0),   // This cache entry is potentially different from the version in the parent view.
+        FRESH = (1 << 1),   // The parent view does not have this entry (or it is pruned).
+        PARTIAL = (1 << 2), // Only the outputs set in vChanged differ from the parent view; metadata is unchanged.
     };
 
     CCoinsCacheEntry() : coins(), flags(0) {}
+
+    //! Whether output nPos may differ from the parent view
+    bool IsOutputChanged(unsigned int nPos) const
+    {
+        return !(flags & PARTIAL) || (nPos < vChanged.size() && vChanged[nPos]);
+    }
+
+    void SetOutputChanged(unsigned int nPos)
+    {
+        if (nPos >= vChanged.size())
+            vChanged.resize(nPos + 1, false);
+        vChanged[nPos] = true;
+    }
+
+    //! Forget which outputs changed: the entry is written out whole
+    void SetAllChanged()
+    {
+        flags &= ~PARTIAL;
+        std::vector<bool>().swap(vChanged);
+    }
 };
 
 typedef boost::unordered_map<uint256, CCoinsCacheEntry, CCoinsKeyHasher> CCoinsMap;
@@ -392,12 +414,22 @@ static const unsigned int STANDARD_LOCKTIME_VERIFY_FLAGS = LOCKTIME_VERIFY_SEQUE
  * A reference to a mutable cache entry. Encapsulating it allows us to run
  *  cleanup code after the modification is finished, and keeping track of
  *  concurrent modifications. 
+ *
+ * For entries that track changed outputs (PARTIAL), an output whose
+ *  availability flips is recorded as changed, and a metadata change marks
+ *  the whole entry changed. Outputs that stay available must not be
+ *  rewritten in place.
  */
 class CCoinsModifier
 {
 private:
     CCoinsViewCache& cache;
     CCoinsMap::iterator it;
+    std::vector<bool> vAvailable; // Availability of the outputs before the modification (PARTIAL entries only)
+    bool fCoinBase;
+    bool fCoinStake;
+    int nHeight;
+    int nVersion;
     CCoinsModifier(CCoinsViewCache& cache_, CCoinsMap::iterator it_);
 
 public:
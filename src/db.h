@@ -27,8 +27,6 @@ struct CBlockLocator;
 
 extern unsigned int nWalletDBUpdated;
 
-void ThreadFlushWalletDB(const std::string& strWalletFile);
-
 
 class CDBEnv
 {
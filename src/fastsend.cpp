@@ -17,8 +17,8 @@
 using namespace std;
 using namespace boost;
 
-std::map<uint256, CTransaction> mapTxLockReq;
-std::map<uint256, CTransaction> mapTxLockReqRejected;
+std::map<uint256, CTransactionRef> mapTxLockReq;
+std::map<uint256, CTransactionRef> mapTxLockReqRejected;
 std::map<uint256, CConsensusVote> mapTxLockVote;
 std::map<uint256, CTransactionLock> mapTxLocks;
 std::map<COutPoint, uint256> mapLockedInputs;
@@ -79,7 +79,9 @@ void ProcessMessageFastSend(CNode* pfrom, std::string& strCommand, CDataStream&
 
             DoConsensusVote(tx, nBlockHeight);
 
-            mapTxLockReq.insert(make_pair(tx.GetHash(), tx));
+            // Share the copy the mempool holds
+            CTransactionRef ptx = mempool.get(tx.GetHash());
+            mapTxLockReq.insert(make_pair(tx.GetHash(), ptx ? ptx : MakeTransactionRef(tx)));
 
             LogPrintf("ProcessMessageFastSend::ix - Transaction Lock Request: %s %s : accepted %s\n",
                 pfrom->addr.ToString().c_str(), pfrom->cleanSubVer.c_str(),
@@ -88,7 +90,8 @@ void ProcessMessageFastSend(CNode* pfrom, std::string& strCommand, CDataStream&
             return;
 
         } else {
-            mapTxLockReqRejected.insert(make_pair(tx.GetHash(), tx));
+            CTransactionRef ptx = MakeTransactionRef(tx);
+            mapTxLockReqRejected.insert(make_pair(tx.GetHash(), ptx));
 
             // can we get the conflicting transaction as proof?
 
@@ -112,7 +115,7 @@ void ProcessMessageFastSend(CNode* pfrom, std::string& strCommand, CDataStream&
 
                         //reprocess the last 15 blocks
                         ReprocessBlocks(15);
-                        mapTxLockReq.insert(make_pair(tx.GetHash(), tx));
+                        mapTxLockReq.insert(make_pair(tx.GetHash(), ptx));
                     }
                 }
             }
@@ -345,7 +348,9 @@ bool ProcessConsensusVote(CNode* pnode, CConsensusVote& ctx)
         if ((*i).second.CountSignatures() >= FASTSEND_SIGNATURES_REQUIRED) {
             LogPrint("fastsend", "FastSend::ProcessConsensusVote - Transaction Lock Is Complete %s !\n", (*i).second.GetHash().ToString().c_str());
 
-            CTransaction& tx = mapTxLockReq[ctx.txHash];
+            std::map<uint256, CTransactionRef>::iterator itReq = mapTxLockReq.find(ctx.txHash);
+            static const CTransaction txUnknown;
+            const CTransaction& tx = itReq != mapTxLockReq.end() ? *itReq->second : txUnknown;
             if (!CheckForConflictingLocks(tx)) {
 #ifdef ENABLE_WALLET
                 if (pwalletMain) {
@@ -379,7 +384,7 @@ bool ProcessConsensusVote(CNode* pnode, CConsensusVote& ctx)
     return false;
 }
 
-bool CheckForConflictingLocks(CTransaction& tx)
+bool CheckForConflictingLocks(const CTransaction& tx)
 {
     /*
         It's possible (very unlikely though) to get 2 conflicting transaction locks approved by the network.
@@ -428,7 +433,7 @@ void CleanTransactionLocksList()
             LogPrintf("Removing old transaction lock %s\n", it->second.txHash.ToString().c_str());
 
             if (mapTxLockReq.count(it->second.txHash)) {
-                CTransaction& tx = mapTxLockReq[it->second.txHash];
+                const CTransaction& tx = *mapTxLockReq[it->second.txHash];
 
                 BOOST_FOREACH (const CTxIn& in, tx.vin)
                     mapLockedInputs.erase(in.prevout);
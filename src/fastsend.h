@@ -35,8 +35,8 @@ class CTransactionLock;
 
 static const int MIN_FASTSEND_PROTO_VERSION = 70103;
 
-extern map<uint256, CTransaction> mapTxLockReq;
-extern map<uint256, CTransaction> mapTxLockReqRejected;
+extern map<uint256, CTransactionRef> mapTxLockReq;
+extern map<uint256, CTransactionRef> mapTxLockReqRejected;
 extern map<uint256, CConsensusVote> mapTxLockVote;
 extern map<uint256, CTransactionLock> mapTxLocks;
 extern std::map<COutPoint, uint256> mapLockedInputs;
@@ -48,7 +48,7 @@ int64_t CreateNewLock(CTransaction tx);
 bool IsIXTXValid(const CTransaction& txCollateral);
 
 // if two conflicting locks are approved by the network, they will cancel out
-bool CheckForConflictingLocks(CTransaction& tx);
+bool CheckForConflictingLocks(const CTransaction& tx);
 
 void ProcessMessageFastSend(CNode* pfrom, std::string& strCommand, CDataStream& vRecv);
 
@@ -35,7 +35,7 @@ CBlock CreateGenesisBlock(const char* pszTimestamp, const CScript& genesisOutput
     genesis.nNonce   = nNonce;
     genesis.nVersion = nVersion;
     genesis.hashPrevBlock = 0;
-    genesis.vtx.push_back(txNew);
+    genesis.vtx.push_back(MakeTransactionRef(txNew));
     genesis.hashPrevBlock.SetNull();
     genesis.hashMerkleRoot = BlockMerkleRoot(genesis);
     return genesis;
@@ -9,6 +9,8 @@
 
 #include "addrman.h"
 #include "alert.h"
+#include "blockfilemap.h"
+#include "blockindexsnapshot.h"
 #include "chainparams.h"
 #include "checkpoints.h"
 #include "checkqueue.h"
@@ -20,6 +22,7 @@
 #include "merkleblock.h"
 #include "net.h"
 #include "coinmix.h"
+#include "perfstats.h"
 #include "pow.h"
 #include "spork.h"
 #include "fastsend.h"
@@ -29,9 +32,11 @@
 #include "util.h"
 #include "utilmoneystr.h"
 
+#include <atomic>
 #include <sstream>
 
 #include <boost/algorithm/string/replace.hpp>
+#include <boost/bind.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/filesystem/fstream.hpp>
 #include <boost/lexical_cast.hpp>
@@ -55,14 +60,20 @@ map<uint256, uint256> mapProofOfStake;
 set<pair<COutPoint, unsigned int> > setStakeSeen;
 map<unsigned int, unsigned int> mapHashedBlocks;
 CChain chainActive;
+CBlockIndexArena blockIndexArena;
+//! Accessed with std::atomic_load and std::atomic_store only
+static std::shared_ptr<const CChainTipSnapshot> chainTipSnapshot = std::make_shared<const CChainTipSnapshot>();
 CBlockIndex* pindexBestHeader = NULL;
 int64_t nTimeBestReceived = 0;
 CWaitableCriticalSection csBestBlock;
 CConditionVariable cvBlockChange;
 int nScriptCheckThreads = 0;
+int nBlockPrefetch = 0;
 bool fImporting = false;
 bool fReindex = false;
 bool fTxIndex = true;
+bool fAddressIndex = DEFAULT_ADDRESSINDEX;
+bool fSpentIndex = DEFAULT_SPENTINDEX;
 bool fIsBareMultisigStd = true;
 bool fCheckBlockIndex = false;
 unsigned int nCoinCacheSize = 5000;
@@ -136,6 +147,7 @@ multimap<CBlockIndex*, CBlockIndex*> mapBlocksUnlinked;
 CCriticalSection cs_LastBlockFile;
 std::vector<CBlockFileInfo> vinfoBlockFile;
 int nLastBlockFile = 0;
+CBlockFileMapper blockFileMapper;
 
 /**
      * Every received block is assigned a unique and increasing identifier, so we
@@ -185,7 +197,7 @@ namespace
 {
 struct CMainSignals {
     /** Notifies listeners of updated transaction data (transaction, and optionally the block it is found in. */
-    boost::signals2::signal<void(const CTransaction&, const CBlock*)> SyncTransaction;
+    boost::signals2::signal<void(const CTransactionRef&, const CBlock*)> SyncTransaction;
     /** Notifies listeners of an erased transaction (currently disabled, requires transaction replacement). */
 // XX42    boost::signals2::signal<void(const uint256&)> EraseTransaction;
     /** Notifies listeners of an updated transaction without new data (for now: a coinbase potentially becoming visible). */
@@ -235,9 +247,9 @@ void UnregisterAllValidationInterfaces()
     g_signals.SyncTransaction.disconnect_all_slots();
 }
 
-void SyncWithWallets(const CTransaction& tx, const CBlock* pblock)
+void SyncWithWallets(const CTransactionRef& ptx, const CBlock* pblock)
 {
-    g_signals.SyncTransaction(tx, pblock);
+    g_signals.SyncTransaction(ptx, pblock);
 }
 
 //////////////////////////////////////////////////////////////////////////////
@@ -584,6 +596,7 @@ CBlockIndex* FindForkInGlobalIndex(const CChain& chain, const CBlockLocator& loc
 }
 
 CCoinsViewCache* pcoinsTip = NULL;
+CCoinsViewDB* pcoinsdbview = NULL;
 CBlockTreeDB* pblocktree = NULL;
 
 //////////////////////////////////////////////////////////////////////////////
@@ -1133,6 +1146,7 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState& state, const CTransa
     }
 
 
+    CTransactionRef ptxAccepted;
     {
         CCoinsView dummy;
         CCoinsViewCache view(&dummy);
@@ -1262,9 +1276,10 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState& state, const CTransa
 
         // Store transaction in memory
         pool.addUnchecked(hash, entry);
+        ptxAccepted = entry.GetSharedTx();
     }
 
-    SyncWithWallets(tx, NULL);
+    SyncWithWallets(ptxAccepted, NULL);
 
     return true;
 }
@@ -1460,6 +1475,75 @@ bool AcceptableInputs(CTxMemPool& pool, CValidationState& state, const CTransact
     return true;
 }
 
+/**
+ * Bytes of a block (or undo) file that hold records, if the file is no longer
+ * the one blocks are appended to; 0 otherwise. Only such files are mapped.
+ */
+static unsigned int GetFinalizedFileSize(int nFile, bool fUndo)
+{
+    LOCK(cs_LastBlockFile);
+    if (nFile >= nLastBlockFile || nFile >= (int)vinfoBlockFile.size())
+        return 0;
+    return fUndo ? vinfoBlockFile[nFile].nUndoSize : vinfoBlockFile[nFile].nSize;
+}
+
+bool GetAddressIndexKey(const CTxDestination& dest, int& nType, uint160& hashBytes)
+{
+    if (const CKeyID* keyID = boost::get<CKeyID>(&dest)) {
+        nType = ADDRESS_TYPE_P2PKH;
+        hashBytes = *keyID;
+        return true;
+    }
+    if (const CScriptID* scriptID = boost::get<CScriptID>(&dest)) {
+        nType = ADDRESS_TYPE_P2SH;
+        hashBytes = *scriptID;
+        return true;
+    }
+    return false;
+}
+
+bool GetAddressIndexKey(const CScript& script, int& nType, uint160& hashBytes)
+{
+    CTxDestination dest;
+    if (!ExtractDestination(script, dest))
+        return false;
+    return GetAddressIndexKey(dest, nType, hashBytes);
+}
+
+bool GetAddressIndex(const uint160& hashBytes, int nType, std::vector<std::pair<CAddressIndexKey, CAmount> >& vAddressIndex, int nStart, int nEnd)
+{
+    if (!fAddressIndex)
+        return error("%s : address index not enabled", __func__);
+    if (!pblocktree->ReadAddressIndex(hashBytes, nType, vAddressIndex, nStart, nEnd))
+        return error("%s : unable to get txids for address", __func__);
+    return true;
+}
+
+bool GetAddressUnspent(const uint160& hashBytes, int nType, std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> >& vUnspent)
+{
+    if (!fAddressIndex)
+        return error("%s : address index not enabled", __func__);
+    if (!pblocktree->ReadAddressUnspentIndex(hashBytes, nType, vUnspent))
+        return error("%s : unable to get unspent outputs for address", __func__);
+    return true;
+}
+
+bool GetAddressReceived(const uint160& hashBytes, int nType, CAmount& nReceived)
+{
+    if (!fAddressIndex)
+        return error("%s : address index not enabled", __func__);
+    if (!pblocktree->ReadAddressReceived(hashBytes, nType, nReceived))
+        return error("%s : unable to get the total received by address", __func__);
+    return true;
+}
+
+bool GetSpentIndex(const CSpentIndexKey& key, CSpentIndexValue& value)
+{
+    if (!fSpentIndex)
+        return false;
+    return pblocktree->ReadSpentIndex(key, value);
+}
+
 /** Return transaction in tx, and if it was found inside a block, its hash is placed in hashBlock */
 bool GetTransaction(const uint256& hash, CTransaction& txOut, uint256& hashBlock, bool fAllowSlow)
 {
@@ -1475,14 +1559,24 @@ bool GetTransaction(const uint256& hash, CTransaction& txOut, uint256& hashBlock
         if (fTxIndex) {
             CDiskTxPos postx;
             if (pblocktree->ReadTxIndex(hash, postx)) {
-                CAutoFile file(OpenBlockFile(postx, true), SER_DISK, CLIENT_VERSION);
-                if (file.IsNull())
-                    return error("%s: OpenBlockFile failed", __func__);
                 CBlockHeader header;
                 try {
-                    file >> header;
-                    fseek(file.Get(), postx.nTxOffset, SEEK_CUR);
-                    file >> txOut;
+                    CMappedFileReader mapped(SER_DISK, CLIENT_VERSION);
+                    unsigned int nValidSize = GetFinalizedFileSize(postx.nFile, false);
+                    if (nValidSize)
+                        blockFileMapper.Open(postx, "blk", nValidSize, mapped);
+                    if (!mapped.IsNull()) {
+                        mapped >> header;
+                        mapped.ignore(postx.nTxOffset);
+                        mapped >> txOut;
+                    } else {
+                        CAutoFile file(OpenBlockFile(postx, true), SER_DISK, CLIENT_VERSION);
+                        if (file.IsNull())
+                            return error("%s: OpenBlockFile failed", __func__);
+                        file >> header;
+                        fseek(file.Get(), postx.nTxOffset, SEEK_CUR);
+                        file >> txOut;
+                    }
                 } catch (std::exception& e) {
                     return error("%s : Deserialize or I/O error - %s", __func__, e.what());
                 }
@@ -1509,7 +1603,8 @@ bool GetTransaction(const uint256& hash, CTransaction& txOut, uint256& hashBlock
     if (pindexSlow) {
         CBlock block;
         if (ReadBlockFromDisk(block, pindexSlow)) {
-            BOOST_FOREACH (const CTransaction& tx, block.vtx) {
+            BOOST_FOREACH (const CTransactionRef& ptx, block.vtx) {
+                const CTransaction& tx = *ptx;
                 if (tx.GetHash() == hash) {
                     txOut = tx;
                     hashBlock = pindexSlow->GetBlockHash();
@@ -1553,14 +1648,20 @@ bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos)
 {
     block.SetNull();
 
-    // Open history file to read
-    CAutoFile filein(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
-    if (filein.IsNull())
-        return error("ReadBlockFromDisk : OpenBlockFile failed");
-
-    // Read block
+    // Read block, from the mapping if the file is finalized
     try {
-        filein >> block;
+        CMappedFileReader mapped(SER_DISK, CLIENT_VERSION);
+        unsigned int nValidSize = GetFinalizedFileSize(pos.nFile, false);
+        if (nValidSize)
+            blockFileMapper.Open(pos, "blk", nValidSize, mapped);
+        if (!mapped.IsNull()) {
+            mapped >> block;
+        } else {
+            CAutoFile filein(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
+            if (filein.IsNull())
+                return error("ReadBlockFromDisk : OpenBlockFile failed");
+            filein >> block;
+        }
     } catch (std::exception& e) {
         return error("%s : Deserialize or I/O error - %s", __func__, e.what());
     }
@@ -1960,6 +2061,12 @@ bool DisconnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex
 
     bool fClean = true;
 
+    // Checks with pfClean disconnect into a throwaway view; only a real
+    // disconnect takes the block out of the address and spent indexes.
+    bool fUpdateAddressIndex = fAddressIndex && !pfClean;
+    bool fUpdateSpentIndex = fSpentIndex && !pfClean;
+    CAddressIndexUpdate indexUpdate;
+
     CBlockUndo blockUndo;
     CDiskBlockPos pos = pindex->GetUndoPos();
     if (pos.IsNull())
@@ -1972,7 +2079,7 @@ bool DisconnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex
 
     // undo transactions in reverse order
     for (int i = block.vtx.size() - 1; i >= 0; i--) {
-        const CTransaction& tx = block.vtx[i];
+        const CTransaction& tx = *block.vtx[i];
         uint256 hash = tx.GetHash();
 
         // Check that all outputs are available and match the outputs in the block itself
@@ -1997,6 +2104,17 @@ bool DisconnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex
             outs->Clear();
         }
 
+        if (fUpdateAddressIndex) {
+            for (unsigned int k = 0; k < tx.vout.size(); k++) {
+                int nType;
+                uint160 hashBytes;
+                if (!GetAddressIndexKey(tx.vout[k].scriptPubKey, nType, hashBytes))
+                    continue;
+                indexUpdate.vAddressIndexErase.push_back(CAddressIndexKey(nType, hashBytes, pindex->nHeight, i, hash, k, false));
+                indexUpdate.vAddressUnspent.push_back(make_pair(CAddressUnspentKey(nType, hashBytes, hash, k), CAddressUnspentValue()));
+            }
+        }
+
         // restore inputs
         if (i > 0) { // not coinbases
             const CTxUndo& txundo = blockUndo.vtxundo[i - 1];
@@ -2023,10 +2141,22 @@ bool DisconnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex
                 if (coins->vout.size() < out.n + 1)
                     coins->vout.resize(out.n + 1);
                 coins->vout[out.n] = undo.txout;
+
+                if (fUpdateSpentIndex)
+                    indexUpdate.vSpent.push_back(make_pair(CSpentIndexKey(out.hash, out.n), CSpentIndexValue()));
+                int nType;
+                uint160 hashBytes;
+                if (fUpdateAddressIndex && GetAddressIndexKey(undo.txout.scriptPubKey, nType, hashBytes)) {
+                    indexUpdate.vAddressIndexErase.push_back(CAddressIndexKey(nType, hashBytes, pindex->nHeight, i, hash, j, true));
+                    indexUpdate.vAddressUnspent.push_back(make_pair(CAddressUnspentKey(nType, hashBytes, out.hash, out.n), CAddressUnspentValue(undo.txout.nValue, undo.txout.scriptPubKey, coins->nHeight)));
+                }
             }
         }
     }
 
+    if (!indexUpdate.IsEmpty() && !pblocktree->WriteAddressIndexUpdate(indexUpdate))
+        return state.Abort("Failed to write address index");
+
     // move best block pointer to prevout block
     view.SetBestBlock(pindex->pprev->GetBlockHash());
 
@@ -2071,18 +2201,285 @@ void ThreadScriptCheck()
     scriptcheckqueue.Thread();
 }
 
-static int64_t nTimeVerify = 0;
-static int64_t nTimeConnect = 0;
-static int64_t nTimeIndex = 0;
-static int64_t nTimeCallbacks = 0;
-static int64_t nTimeTotal = 0;
+/** Stages of connecting a block to the active chain */
+enum BlockConnectStage {
+    STAGE_READ,        //! reading and deserializing the block
+    STAGE_PRECHECK,    //! merkle root and context-free transaction checks
+    STAGE_WAIT,        //! waiting for a block the prefetch threads are still on
+    STAGE_CONNECT,     //! applying the transactions to the coins view
+    STAGE_VERIFY,      //! waiting for the script checking threads
+    STAGE_INDEX,       //! undo data and index writes
+    STAGE_CALLBACKS,
+    STAGE_FLUSH,       //! flushing the view into pcoinsTip
+    STAGE_CHAINSTATE,  //! FlushStateToDisk
+    STAGE_POSTPROCESS, //! mempool, tip and wallet updates
+    STAGE_COUNT
+};
+
+static const char* const BLOCK_CONNECT_STAGE_NAMES[STAGE_COUNT] = {
+    "read", "precheck", "wait", "connect", "verify", "index", "callbacks", "flush", "chainstate", "postprocess"};
+
+static CPerfHistogram perfBlockStage[STAGE_COUNT] = {
+    {"block.read", "Reading and deserializing a block"},
+    {"block.precheck", "Merkle root and context-free transaction checks"},
+    {"block.wait", "Waiting for a block still being prefetched"},
+    {"block.connect", "Applying a block's transactions to the coins view"},
+    {"block.verify", "Waiting for script verification"},
+    {"block.index", "Writing undo data and index entries"},
+    {"block.callbacks", "ConnectBlock validation callbacks"},
+    {"block.flush", "Flushing a block's coins view into the tip"},
+    {"block.chainstate", "Writing the chain state to disk"},
+    {"block.postprocess", "Mempool, tip and wallet updates after connecting"}};
+static CPerfHistogram perfBlockTotal("block.total", "Connecting a block, all stages");
+static CPerfHistogram perfHeaderPoW("block.header_pow", "Proof-of-work check of a block header");
+static CPerfHistogram perfPoSKernel("block.pos_kernel", "Proof-of-stake kernel check");
+static CPerfHistogram perfMnPayments("block.mn_payments", "Masternode and budget payment check");
+static CPerfHistogram perfWalletCallbacks("block.wallet_callbacks", "Wallet notifications for a connected block");
+static CPerfCounter perfBlocksPrefetched("block.prefetched", "Blocks taken from the prefetch threads");
+static CPerfCounter perfBlocksReadDirect("block.read_direct", "Blocks read by ConnectTip itself");
+
+/** Microseconds spent per stage for the block being connected. Guarded by cs_main. */
+static int64_t nBlockStageTime[STAGE_COUNT];
+
+static void AddBlockStageTime(BlockConnectStage stage, int64_t nMicros)
+{
+    nBlockStageTime[stage] += nMicros;
+}
+
+/** Record the stage times of the block just connected in the histograms */
+static void RecordBlockStageTimes(const CBlockIndex* pindex)
+{
+    std::string strStages;
+    int64_t nTotal = 0;
+    for (int i = 0; i < STAGE_COUNT; i++) {
+        perfBlockStage[i].Add(nBlockStageTime[i]);
+        strStages += strprintf(" %s=%.2fms [%.2fs]", BLOCK_CONNECT_STAGE_NAMES[i], nBlockStageTime[i] * 0.001, perfBlockStage[i].GetSum() * 0.000001);
+        nTotal += nBlockStageTime[i];
+    }
+    perfBlockTotal.Add(nTotal);
+    LogPrint("bench", "- Connect block %d: %.2fms,%s\n", pindex->nHeight, nTotal * 0.001, strStages);
+}
+
+/** Context-free part of CheckBlock that is safe to run without cs_main */
+static bool PrecheckBlock(const CBlock& block)
+{
+    bool mutated;
+    uint256 hashMerkleRoot2 = block.BuildMerkleTree(&mutated);
+    if (block.hashMerkleRoot != hashMerkleRoot2 || mutated)
+        return false;
+
+    CValidationState state;
+    unsigned int nSigOps = 0;
+    BOOST_FOREACH (const CTransactionRef& ptx, block.vtx) {
+        const CTransaction& tx = *ptx;
+        if (!CheckTransaction(tx, state))
+            return false;
+        nSigOps += GetLegacySigOpCount(tx);
+    }
+    if (nSigOps > MAX_BLOCK_SIGOPS)
+        return false;
+
+    block.fPrechecked = true;
+    return true;
+}
+
+/**
+ * Reads and prechecks the blocks ActivateBestChainStep is about to connect on
+ * separate threads, so ConnectTip finds the next block deserialized with its
+ * context-free checks done. Everything that depends on the coins view stays
+ * sequential in ConnectTip. A block that failed to read or precheck is
+ * dropped and ConnectTip takes the normal path, which reports the error.
+ */
+class CBlockPrefetchQueue
+{
+private:
+    struct Entry {
+        CDiskBlockPos pos;
+        std::shared_ptr<CBlock> pblock; //! set once read and prechecked
+        bool fInFlight;
+        bool fStale; //! left the window while a thread was reading it
+        int64_t nReadTime;
+        int64_t nPrecheckTime;
+
+        Entry() : fInFlight(false), fStale(false), nReadTime(0), nPrecheckTime(0) {}
+    };
+
+    boost::mutex mutex;
+    boost::condition_variable condWorker;
+    boost::condition_variable condReady;
+    std::map<uint256, Entry> mapEntries;
+    std::deque<uint256> queuePending;
+
+public:
+    //! Make vpindex (in connect order) the set of blocks to prefetch
+    void SetWindow(const std::vector<CBlockIndex*>& vpindex)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        std::set<uint256> setWindow;
+        BOOST_FOREACH (const CBlockIndex* pindex, vpindex)
+            setWindow.insert(pindex->GetBlockHash());
+
+        std::map<uint256, Entry>::iterator it = mapEntries.begin();
+        while (it != mapEntries.end()) {
+            it->second.fStale = !setWindow.count(it->first);
+            if (it->second.fStale && !it->second.fInFlight)
+                mapEntries.erase(it++);
+            else
+                it++;
+        }
+
+        queuePending.clear();
+        BOOST_FOREACH (const CBlockIndex* pindex, vpindex) {
+            Entry& entry = mapEntries[pindex->GetBlockHash()];
+            if (entry.pos.IsNull())
+                entry.pos = pindex->GetBlockPos();
+            if (!entry.fInFlight && !entry.pblock)
+                queuePending.push_back(pindex->GetBlockHash());
+        }
+        condWorker.notify_all();
+    }
+
+    //! Take the prefetched block for pindex, waiting if a thread is reading it.
+    //! Returns NULL if the block is not being prefetched.
+    std::shared_ptr<CBlock> Take(const CBlockIndex* pindex, int64_t& nReadTime, int64_t& nPrecheckTime)
+    {
+        boost::this_thread::disable_interruption di;
+        boost::unique_lock<boost::mutex> lock(mutex);
+        std::shared_ptr<CBlock> pblock;
+        while (true) {
+            std::map<uint256, Entry>::iterator it = mapEntries.find(pindex->GetBlockHash());
+            if (it == mapEntries.end())
+                return pblock;
+            if (it->second.fInFlight) {
+                condReady.wait(lock);
+                continue;
+            }
+            // Not picked up by a thread yet: the caller reads it itself
+            pblock = it->second.pblock;
+            nReadTime = it->second.nReadTime;
+            nPrecheckTime = it->second.nPrecheckTime;
+            mapEntries.erase(it);
+            return pblock;
+        }
+    }
+
+    void Thread()
+    {
+        while (true) {
+            uint256 hash;
+            CDiskBlockPos pos;
+            {
+                boost::unique_lock<boost::mutex> lock(mutex);
+                while (queuePending.empty())
+                    condWorker.wait(lock);
+                hash = queuePending.front();
+                queuePending.pop_front();
+                std::map<uint256, Entry>::iterator it = mapEntries.find(hash);
+                if (it == mapEntries.end() || it->second.fInFlight || it->second.pblock)
+                    continue;
+                it->second.fInFlight = true;
+                pos = it->second.pos;
+            }
+
+            int64_t nTime1 = GetTimeMicros();
+            std::shared_ptr<CBlock> pblock = std::make_shared<CBlock>();
+            bool fOk = ReadBlockFromDisk(*pblock, pos) && pblock->GetHash() == hash;
+            int64_t nTime2 = GetTimeMicros();
+            fOk = fOk && PrecheckBlock(*pblock);
+            int64_t nTime3 = GetTimeMicros();
+
+            {
+                boost::unique_lock<boost::mutex> lock(mutex);
+                std::map<uint256, Entry>::iterator it = mapEntries.find(hash);
+                if (it != mapEntries.end()) {
+                    if (!fOk || it->second.fStale) {
+                        mapEntries.erase(it);
+                    } else {
+                        it->second.fInFlight = false;
+                        it->second.pblock = pblock;
+                        it->second.nReadTime = nTime2 - nTime1;
+                        it->second.nPrecheckTime = nTime3 - nTime2;
+                    }
+                }
+            }
+            condReady.notify_all();
+        }
+    }
+};
+
+static CBlockPrefetchQueue blockprefetchqueue;
+
+void ThreadBlockPrefetch()
+{
+    RenameThread("sling-prefetch");
+    blockprefetchqueue.Thread();
+}
+
+/** Hand pindexConnect and the nBlockPrefetch blocks after it to the prefetch threads */
+static void PrefetchBlocksToConnect(const std::vector<CBlockIndex*>& vpindexToConnect, const CBlockIndex* pindexConnect, const CBlockIndex* pindexSkip)
+{
+    if (nBlockPrefetch <= 0)
+        return;
+
+    // vpindexToConnect is ordered from the last block to connect to the first
+    std::vector<CBlockIndex*> vWindow;
+    std::vector<CBlockIndex*>::const_reverse_iterator it = std::find(vpindexToConnect.rbegin(), vpindexToConnect.rend(), pindexConnect);
+    for (; it != vpindexToConnect.rend() && (int)vWindow.size() <= nBlockPrefetch; it++) {
+        if (*it != pindexSkip && ((*it)->nStatus & BLOCK_HAVE_DATA))
+            vWindow.push_back(*it);
+    }
+    blockprefetchqueue.SetWindow(vWindow);
+}
+
+/**
+ * Collect what a transaction of a block being connected adds to the address
+ * and spent indexes. Inputs are read from the view, so this must run before
+ * the transaction's own UpdateCoins spends them.
+ */
+static void AddToAddressIndexUpdate(const CTransaction& tx, unsigned int nTx, int nHeight, const CCoinsViewCache& view, bool fUpdateAddressIndex, bool fUpdateSpentIndex, CAddressIndexUpdate& update)
+{
+    const uint256 hash = tx.GetHash();
+    int nType;
+    uint160 hashBytes;
+
+    if (!tx.IsCoinBase()) {
+        for (unsigned int j = 0; j < tx.vin.size(); j++) {
+            const CTxIn& input = tx.vin[j];
+            const CTxOut& prevout = view.GetOutputFor(input);
+            bool fHasAddress = GetAddressIndexKey(prevout.scriptPubKey, nType, hashBytes);
+            if (fUpdateAddressIndex && fHasAddress) {
+                update.vAddressIndex.push_back(make_pair(CAddressIndexKey(nType, hashBytes, nHeight, nTx, hash, j, true), -prevout.nValue));
+                update.vAddressUnspent.push_back(make_pair(CAddressUnspentKey(nType, hashBytes, input.prevout.hash, input.prevout.n), CAddressUnspentValue()));
+            }
+            if (fUpdateSpentIndex) {
+                if (!fHasAddress) {
+                    nType = ADDRESS_TYPE_NONE;
+                    hashBytes = 0;
+                }
+                update.vSpent.push_back(make_pair(CSpentIndexKey(input.prevout.hash, input.prevout.n), CSpentIndexValue(hash, j, nHeight, prevout.nValue, nType, hashBytes)));
+            }
+        }
+    }
+
+    if (!fUpdateAddressIndex)
+        return;
+    for (unsigned int k = 0; k < tx.vout.size(); k++) {
+        const CTxOut& out = tx.vout[k];
+        if (!GetAddressIndexKey(out.scriptPubKey, nType, hashBytes))
+            continue;
+        update.vAddressIndex.push_back(make_pair(CAddressIndexKey(nType, hashBytes, nHeight, nTx, hash, k, false), out.nValue));
+        update.vAddressUnspent.push_back(make_pair(CAddressUnspentKey(nType, hashBytes, hash, k), CAddressUnspentValue(out.nValue, out.scriptPubKey, nHeight)));
+    }
+}
 
 bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& view, bool fJustCheck)
 {
     AssertLockHeld(cs_main);
     // Check it again in case a previous version let a bad block in
+    int64_t nTimeCheck = GetTimeMicros();
     if (!CheckBlock(block, state, !fJustCheck, !fJustCheck))
         return false;
+    AddBlockStageTime(STAGE_PRECHECK, GetTimeMicros() - nTimeCheck);
 
     // verify that the view's current state corresponds to the previous block
     uint256 hashPrevBlock = pindex->pprev == NULL ? uint256(0) : pindex->pprev->GetBlockHash();
@@ -2116,7 +2513,8 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
                          !((pindex->nHeight == 91842 && pindex->GetBlockHash() == uint256("0x00000000000a4d0a398161ffc163c503763b1f4360639393e0e4c8e300e0caec")) ||
                              (pindex->nHeight == 91880 && pindex->GetBlockHash() == uint256("0x00000000000743f190a18c5577a3c2d2a1f610ae9601ac046a38084ccb7cd721")));
     if (fEnforceBIP30) {
-        BOOST_FOREACH (const CTransaction& tx, block.vtx) {
+        BOOST_FOREACH (const CTransactionRef& ptx, block.vtx) {
+            const CTransaction& tx = *ptx;
             const CCoins* coins = view.AccessCoins(tx.GetHash());
             if (coins && !coins->IsPruned())
                 return state.DoS(100, error("ConnectBlock() : tried to overwrite transaction"),
@@ -2149,8 +2547,11 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
     blockundo.vtxundo.reserve(block.vtx.size() - 1);
     int64_t nValueOut = 0;
     int64_t nValueIn = 0;
+    bool fUpdateAddressIndex = fAddressIndex && !fJustCheck;
+    bool fUpdateSpentIndex = fSpentIndex && !fJustCheck;
+    CAddressIndexUpdate indexUpdate;
     for (unsigned int i = 0; i < block.vtx.size(); i++) {
-        const CTransaction& tx = block.vtx[i];
+        const CTransaction& tx = *block.vtx[i];
 
         nInputs += tx.vin.size();
         nSigOps += GetLegacySigOpCount(tx);
@@ -2183,6 +2584,9 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
         }
         nValueOut += tx.GetValueOut();
 
+        if (fUpdateAddressIndex || fUpdateSpentIndex)
+            AddToAddressIndexUpdate(tx, i, pindex->nHeight, view, fUpdateAddressIndex, fUpdateSpentIndex, indexUpdate);
+
         CTxUndo undoDummy;
         if (i > 0) {
             blockundo.vtxundo.push_back(CTxUndo());
@@ -2201,21 +2605,19 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
         return error("Connect() : WriteBlockIndex for pindex failed");
 
     int64_t nTime1 = GetTimeMicros();
-    nTimeConnect += nTime1 - nTimeStart;
-    LogPrint("bench", "      - Connect %u transactions: %.2fms (%.3fms/tx, %.3fms/txin) [%.2fs]\n", (unsigned)block.vtx.size(), 0.001 * (nTime1 - nTimeStart), 0.001 * (nTime1 - nTimeStart) / block.vtx.size(), nInputs <= 1 ? 0 : 0.001 * (nTime1 - nTimeStart) / (nInputs - 1), nTimeConnect * 0.000001);
+    AddBlockStageTime(STAGE_CONNECT, nTime1 - nTimeStart);
 
     if (!IsInitialBlockDownload() && !IsBlockValueValid(block, GetBlockValue(pindex->pprev->nHeight + 1, nFees, block.IsProofOfStake()))) {
         return state.DoS(100,
             error("ConnectBlock() : reward pays too much (actual=%d vs limit=%d)",
-                block.vtx[0].GetValueOut(), GetBlockValue(pindex->pprev->nHeight + 1, nFees, block.IsProofOfStake())),
+                block.vtx[0]->GetValueOut(), GetBlockValue(pindex->pprev->nHeight + 1, nFees, block.IsProofOfStake())),
             REJECT_INVALID, "bad-cb-amount");
     }
 
     if (!control.Wait())
         return state.DoS(100, false);
     int64_t nTime2 = GetTimeMicros();
-    nTimeVerify += nTime2 - nTimeStart;
-    LogPrint("bench", "    - Verify %u txins: %.2fms (%.3fms/txin) [%.2fs]\n", nInputs - 1, 0.001 * (nTime2 - nTimeStart), nInputs <= 1 ? 0 : 0.001 * (nTime2 - nTimeStart) / (nInputs - 1), nTimeVerify * 0.000001);
+    AddBlockStageTime(STAGE_VERIFY, nTime2 - nTime1);
 
     if (fJustCheck)
         return true;
@@ -2242,21 +2644,21 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
         if (!pblocktree->WriteTxIndex(vPos))
             return state.Abort("Failed to write transaction index");
 
+    if (!indexUpdate.IsEmpty() && !pblocktree->WriteAddressIndexUpdate(indexUpdate))
+        return state.Abort("Failed to write address index");
+
     // add this block to the view's block chain
     view.SetBestBlock(pindex->GetBlockHash());
 
     int64_t nTime3 = GetTimeMicros();
-    nTimeIndex += nTime3 - nTime2;
-    LogPrint("bench", "    - Index writing: %.2fms [%.2fs]\n", 0.001 * (nTime3 - nTime2), nTimeIndex * 0.000001);
+    AddBlockStageTime(STAGE_INDEX, nTime3 - nTime2);
 
     // Watch for changes to the previous coinbase transaction.
     static uint256 hashPrevBestCoinBase;
     g_signals.UpdatedTransaction(hashPrevBestCoinBase);
-    hashPrevBestCoinBase = block.vtx[0].GetHash();
+    hashPrevBestCoinBase = block.vtx[0]->GetHash();
 
-    int64_t nTime4 = GetTimeMicros();
-    nTimeCallbacks += nTime4 - nTime3;
-    LogPrint("bench", "    - Callbacks: %.2fms [%.2fs]\n", 0.001 * (nTime4 - nTime3), nTimeCallbacks * 0.000001);
+    AddBlockStageTime(STAGE_CALLBACKS, GetTimeMicros() - nTime3);
 
     return true;
 }
@@ -2309,6 +2711,16 @@ bool static FlushStateToDisk(CValidationState& state, FlushStateMode mode)
             }
             pblocktree->Sync();
             // Finally flush the chainstate (which may refer to block index entries).
+            // Outside of forced flushes the coin database writes it in the
+            // background, as long as the flush only connects blocks on top of
+            // what the database holds: only that can be replayed after a crash.
+            if (mode != FLUSH_STATE_ALWAYS && GetBoolArg("-backgroundflush", DEFAULT_BACKGROUND_FLUSH)) {
+                if (!pcoinsdbview->WaitForBackgroundWrite())
+                    return state.Abort("Failed to write to coin database");
+                BlockMap::iterator it = mapBlockIndex.find(pcoinsdbview->GetBestBlock());
+                if (it != mapBlockIndex.end() && chainActive.Contains(it->second) && pcoinsTip->GetBestBlock() == chainActive.Tip()->GetBlockHash())
+                    pcoinsdbview->WriteNextBatchInBackground();
+            }
             if (!pcoinsTip->Flush())
                 return state.Abort("Failed to write to coin database");
             // Update best block in wallet (so we can detect restored wallets).
@@ -2329,10 +2741,34 @@ void FlushStateToDisk()
     FlushStateToDisk(state, FLUSH_STATE_ALWAYS);
 }
 
+CChainTipSnapshot::CChainTipSnapshot(const CBlockIndex* pindexIn) : pindex(pindexIn), nHeight(-1), hashBlock(0), nTime(0), nMedianTimePast(0), nMoneySupply(0)
+{
+    if (pindex) {
+        nHeight = pindex->nHeight;
+        hashBlock = pindex->GetBlockHash();
+        nTime = pindex->GetBlockTime();
+        nMedianTimePast = pindex->GetMedianTimePast();
+        nMoneySupply = pindex->nMoneySupply;
+    }
+}
+
+std::shared_ptr<const CChainTipSnapshot> GetChainTipSnapshot()
+{
+    return std::atomic_load(&chainTipSnapshot);
+}
+
+/** Set chainActive's tip and publish its snapshot */
+static void SetChainTip(CBlockIndex* pindexNew)
+{
+    chainActive.SetTip(pindexNew);
+    std::shared_ptr<const CChainTipSnapshot> snapshot = std::make_shared<const CChainTipSnapshot>(pindexNew);
+    std::atomic_store(&chainTipSnapshot, snapshot);
+}
+
 /** Update chainActive and related internal data structures. */
 void static UpdateTip(CBlockIndex* pindexNew)
 {
-    chainActive.SetTip(pindexNew);
+    SetChainTip(pindexNew);
 
     // New best block
     nTimeBestReceived = GetTime();
@@ -2389,9 +2825,10 @@ bool static DisconnectTip(CValidationState& state)
     if (!FlushStateToDisk(state, FLUSH_STATE_ALWAYS))
         return false;
     // Resurrect mempool transactions from the disconnected block.
-    BOOST_FOREACH (const CTransaction& tx, block.vtx) {
+    BOOST_FOREACH (const CTransactionRef& ptx, block.vtx) {
+        const CTransaction& tx = *ptx;
         // ignore validation errors in resurrected transactions
-        list<CTransaction> removed;
+        list<CTransactionRef> removed;
         CValidationState stateDummy;
         if (tx.IsCoinBase() || tx.IsCoinStake() || !AcceptToMemoryPool(mempool, stateDummy, tx, false, NULL))
             mempool.remove(tx, removed, true);
@@ -2402,18 +2839,11 @@ bool static DisconnectTip(CValidationState& state)
     UpdateTip(pindexDelete->pprev);
     // Let wallets know transactions went from 1-confirmed to
     // 0-confirmed or conflicted:
-    BOOST_FOREACH (const CTransaction& tx, block.vtx) {
-        SyncWithWallets(tx, NULL);
-    }
+    BOOST_FOREACH (const CTransactionRef& ptx, block.vtx)
+        SyncWithWallets(ptx, NULL);
     return true;
 }
 
-static int64_t nTimeReadFromDisk = 0;
-static int64_t nTimeConnectTotal = 0;
-static int64_t nTimeFlush = 0;
-static int64_t nTimeChainState = 0;
-static int64_t nTimePostConnect = 0;
-
 /**
  * Connect a new block to chainActive. pblock is either NULL or a pointer to a CBlock
  * corresponding to pindexNew, to bypass loading it again from disk.
@@ -2424,19 +2854,30 @@ bool static ConnectTip(CValidationState& state, CBlockIndex* pindexNew, CBlock*
     mempool.check(pcoinsTip);
     CCoinsViewCache view(pcoinsTip);
 
-    // Read block from disk.
+    // Read block from disk, or take it from the prefetch threads.
+    memset(nBlockStageTime, 0, sizeof(nBlockStageTime));
     int64_t nTime1 = GetTimeMicros();
     CBlock block;
+    std::shared_ptr<CBlock> pblockPrefetched;
     if (!pblock) {
-        if (!ReadBlockFromDisk(block, pindexNew))
-            return state.Abort("Failed to read block");
-        pblock = &block;
+        int64_t nReadTime, nPrecheckTime;
+        pblockPrefetched = blockprefetchqueue.Take(pindexNew, nReadTime, nPrecheckTime);
+        if (pblockPrefetched) {
+            perfBlocksPrefetched.Inc();
+            pblock = pblockPrefetched.get();
+            AddBlockStageTime(STAGE_READ, nReadTime);
+            AddBlockStageTime(STAGE_PRECHECK, nPrecheckTime);
+            AddBlockStageTime(STAGE_WAIT, GetTimeMicros() - nTime1);
+        } else {
+            perfBlocksReadDirect.Inc();
+            if (!ReadBlockFromDisk(block, pindexNew))
+                return state.Abort("Failed to read block");
+            pblock = &block;
+            AddBlockStageTime(STAGE_READ, GetTimeMicros() - nTime1);
+        }
     }
     // Apply the block atomically to the chain state.
-    int64_t nTime2 = GetTimeMicros();
-    nTimeReadFromDisk += nTime2 - nTime1;
     int64_t nTime3;
-    LogPrint("bench", "  - Load block from disk: %.2fms [%.2fs]\n", (nTime2 - nTime1) * 0.001, nTimeReadFromDisk * 0.000001);
     {
         CInv inv(MSG_BLOCK, pindexNew->GetBlockHash());
         bool rv = ConnectBlock(*pblock, state, pindexNew, view);
@@ -2448,13 +2889,10 @@ bool static ConnectTip(CValidationState& state, CBlockIndex* pindexNew, CBlock*
         }
         mapBlockSource.erase(inv.hash);
         nTime3 = GetTimeMicros();
-        nTimeConnectTotal += nTime3 - nTime2;
-        LogPrint("bench", "  - Connect total: %.2fms [%.2fs]\n", (nTime3 - nTime2) * 0.001, nTimeConnectTotal * 0.000001);
         assert(view.Flush());
     }
     int64_t nTime4 = GetTimeMicros();
-    nTimeFlush += nTime4 - nTime3;
-    LogPrint("bench", "  - Flush: %.2fms [%.2fs]\n", (nTime4 - nTime3) * 0.001, nTimeFlush * 0.000001);
+    AddBlockStageTime(STAGE_FLUSH, nTime4 - nTime3);
 
     // Write the chain state to disk, if necessary. Always write to disk if this is the first of a new file.
     FlushStateMode flushMode = FLUSH_STATE_IF_NEEDED;
@@ -2463,30 +2901,28 @@ bool static ConnectTip(CValidationState& state, CBlockIndex* pindexNew, CBlock*
     if (!FlushStateToDisk(state, flushMode))
         return false;
     int64_t nTime5 = GetTimeMicros();
-    nTimeChainState += nTime5 - nTime4;
-    LogPrint("bench", "  - Writing chainstate: %.2fms [%.2fs]\n", (nTime5 - nTime4) * 0.001, nTimeChainState * 0.000001);
+    AddBlockStageTime(STAGE_CHAINSTATE, nTime5 - nTime4);
 
     // Remove conflicting transactions from the mempool.
-    list<CTransaction> txConflicted;
+    list<CTransactionRef> txConflicted;
     mempool.removeForBlock(pblock->vtx, pindexNew->nHeight, txConflicted);
     mempool.check(pcoinsTip);
     // Update chainActive & related variables.
     UpdateTip(pindexNew);
-    // Tell wallet about transactions that went from mempool
-    // to conflicted:
-    BOOST_FOREACH (const CTransaction& tx, txConflicted) {
-        SyncWithWallets(tx, NULL);
-    }
-    // ... and about transactions that got confirmed:
-    BOOST_FOREACH (const CTransaction& tx, pblock->vtx) {
-        SyncWithWallets(tx, pblock);
+    {
+        CPerfTimer timer(perfWalletCallbacks);
+        // Tell wallet about transactions that went from mempool
+        // to conflicted:
+        BOOST_FOREACH (const CTransactionRef& tx, txConflicted) {
+            SyncWithWallets(tx, NULL);
+        }
+        // ... and about transactions that got confirmed:
+        BOOST_FOREACH (const CTransactionRef& ptx, pblock->vtx)
+            SyncWithWallets(ptx, pblock);
     }
 
-    int64_t nTime6 = GetTimeMicros();
-    nTimePostConnect += nTime6 - nTime5;
-    nTimeTotal += nTime6 - nTime1;
-    LogPrint("bench", "  - Connect postprocess: %.2fms [%.2fs]\n", (nTime6 - nTime5) * 0.001, nTimePostConnect * 0.000001);
-    LogPrint("bench", "- Connect block: %.2fms [%.2fs]\n", (nTime6 - nTime1) * 0.001, nTimeTotal * 0.000001);
+    AddBlockStageTime(STAGE_POSTPROCESS, GetTimeMicros() - nTime5);
+    RecordBlockStageTimes(pindexNew);
     return true;
 }
 
@@ -2522,7 +2958,7 @@ bool DisconnectBlockAndInputs(CValidationState& state, CTransaction txLock)
     bool foundConflictingTx = false;
 
     //remove anything conflicting in the memory pool
-    list<CTransaction> txConflicted;
+    list<CTransactionRef> txConflicted;
     mempool.removeConflicts(txLock, txConflicted);
 
 
@@ -2540,7 +2976,8 @@ bool DisconnectBlockAndInputs(CValidationState& state, CTransaction txLock)
         // Queue memory transactions to resurrect.
         // We only do this for blocks after the last checkpoint (reorganisation before that
         // point should only happen with -reindex/-loadblock, or a misbehaving peer.
-        BOOST_FOREACH (const CTransaction& tx, block.vtx) {
+        BOOST_FOREACH (const CTransactionRef& ptx, block.vtx) {
+            const CTransaction& tx = *ptx;
             if (!tx.IsCoinBase()) {
                 BOOST_FOREACH (const CTxIn& in1, txLock.vin) {
                     BOOST_FOREACH (const CTxIn& in2, tx.vin) {
@@ -2682,6 +3119,7 @@ static bool ActivateBestChainStep(CValidationState& state, CBlockIndex* pindexMo
 
         // Connect new blocks.
         BOOST_REVERSE_FOREACH (CBlockIndex* pindexConnect, vpindexToConnect) {
+            PrefetchBlocksToConnect(vpindexToConnect, pindexConnect, pblock ? pindexMostWork : NULL);
             if (!ConnectTip(state, pindexConnect, pindexConnect == pindexMostWork ? pblock : NULL)) {
                 if (state.IsInvalid()) {
                     // The block violates a consensus rule.
@@ -2853,8 +3291,8 @@ CBlockIndex* AddToBlockIndex(const CBlock& block)
         return it->second;
 
     // Construct new block index object
-    CBlockIndex* pindexNew = new CBlockIndex(block);
-    assert(pindexNew);
+    CBlockIndex* pindexNew = blockIndexArena.Allocate();
+    *pindexNew = CBlockIndex(block);
     // We assign the sequence id to blocks only when the full data is available,
     // to avoid miners withholding blocks but broadcasting headers, to get a
     // competitive advantage.
@@ -3041,9 +3479,12 @@ bool FindUndoPos(CValidationState& state, int nFile, CDiskBlockPos& pos, unsigne
 bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state, bool fCheckPOW)
 {
     // Check proof of work matches claimed amount
-    if (fCheckPOW && !CheckProofOfWork(block.GetHash(), block.nBits))
-        return state.DoS(50, error("CheckBlockHeader() : proof of work failed"),
-            REJECT_INVALID, "high-hash");
+    if (fCheckPOW) {
+        CPerfTimer timer(perfHeaderPoW);
+        if (!CheckProofOfWork(block.GetHash(), block.nBits))
+            return state.DoS(50, error("CheckBlockHeader() : proof of work failed"),
+                REJECT_INVALID, "high-hash");
+    }
 
     return true;
 }
@@ -3067,8 +3508,8 @@ bool CheckBlock(const CBlock& block, CValidationState& state, bool fCheckPOW, bo
             REJECT_INVALID, "time-too-new");
 
 
-    // Check the merkle root.
-    if (fCheckMerkleRoot) {
+    // Check the merkle root, unless the prefetch threads already did.
+    if (fCheckMerkleRoot && !block.fPrechecked) {
         bool mutated;
         uint256 hashMerkleRoot2 = block.BuildMerkleTree(&mutated);
         if (block.hashMerkleRoot != hashMerkleRoot2)
@@ -3093,31 +3534,32 @@ bool CheckBlock(const CBlock& block, CValidationState& state, bool fCheckPOW, bo
             REJECT_INVALID, "bad-blk-length");
 
     // First transaction must be coinbase, the rest must not be
-    if (block.vtx.empty() || !block.vtx[0].IsCoinBase())
+    if (block.vtx.empty() || !block.vtx[0]->IsCoinBase())
         return state.DoS(100, error("CheckBlock() : first tx is not coinbase"),
             REJECT_INVALID, "bad-cb-missing");
     for (unsigned int i = 1; i < block.vtx.size(); i++)
-        if (block.vtx[i].IsCoinBase())
+        if (block.vtx[i]->IsCoinBase())
             return state.DoS(100, error("CheckBlock() : more than one coinbase"),
                 REJECT_INVALID, "bad-cb-multiple");
 
     if (block.IsProofOfStake()) {
         // Coinbase output should be empty if proof-of-stake block
-        if (block.vtx[0].vout.size() != 1 || !block.vtx[0].vout[0].IsEmpty())
+        if (block.vtx[0]->vout.size() != 1 || !block.vtx[0]->vout[0].IsEmpty())
             return state.DoS(100, error("CheckBlock() : coinbase output not empty for proof-of-stake block"));
 
         // Second transaction must be coinstake, the rest must not be
-        if (block.vtx.empty() || !block.vtx[1].IsCoinStake())
+        if (block.vtx.empty() || !block.vtx[1]->IsCoinStake())
             return state.DoS(100, error("CheckBlock() : second tx is not coinstake"));
         for (unsigned int i = 2; i < block.vtx.size(); i++)
-            if (block.vtx[i].IsCoinStake())
+            if (block.vtx[i]->IsCoinStake())
                 return state.DoS(100, error("CheckBlock() : more than one coinstake"));
     }
 
     // ----------- FastSend transaction scanning -----------
 
     if (IsSporkActive(SPORK_3_FASTSEND_BLOCK_FILTERING)) {
-        BOOST_FOREACH (const CTransaction& tx, block.vtx) {
+        BOOST_FOREACH (const CTransactionRef& ptx, block.vtx) {
+            const CTransaction& tx = *ptx;
             if (!tx.IsCoinBase()) {
                 //only reject blocks when it's based on complete consensus
                 BOOST_FOREACH (const CTxIn& in, tx.vin) {
@@ -3151,6 +3593,7 @@ bool CheckBlock(const CBlock& block, CValidationState& state, bool fCheckPOW, bo
         }
 
         if (nHeight != 0 && !IsInitialBlockDownload()) {
+            CPerfTimer timer(perfMnPayments);
             if (!IsBlockPayeeValid(block, nHeight)) {
                 mapRejectedBlocks.insert(make_pair(block.GetHash(), GetTime()));
                 return state.DoS(100, error("CheckBlock() : Couldn't find masternode/budget payment"));
@@ -3163,14 +3606,18 @@ bool CheckBlock(const CBlock& block, CValidationState& state, bool fCheckPOW, bo
 
     // -------------------------------------------
 
+    // Transactions and sigops were covered by PrecheckBlock when prefetched
+    if (block.fPrechecked)
+        return true;
+
     // Check transactions
-    BOOST_FOREACH (const CTransaction& tx, block.vtx)
-        if (!CheckTransaction(tx, state))
+    BOOST_FOREACH (const CTransactionRef& ptx, block.vtx)
+        if (!CheckTransaction(*ptx, state))
             return error("CheckBlock() : CheckTransaction failed");
 
     unsigned int nSigOps = 0;
-    BOOST_FOREACH (const CTransaction& tx, block.vtx) {
-        nSigOps += GetLegacySigOpCount(tx);
+    BOOST_FOREACH (const CTransactionRef& ptx, block.vtx) {
+        nSigOps += GetLegacySigOpCount(*ptx);
     }
     if (nSigOps > MAX_BLOCK_SIGOPS)
         return state.DoS(100, error("CheckBlock() : out-of-bounds SigOpCount"),
@@ -3204,7 +3651,10 @@ bool CheckWork(const CBlock block, CBlockIndex* const pindexPrev)
         uint256 hashProofOfStake;
         uint256 hash = block.GetHash();
 
-        if(!CheckProofOfStake(block, hashProofOfStake)) {
+        int64_t nTimeKernel = GetTimeMicros();
+        bool fKernelValid = CheckProofOfStake(block, hashProofOfStake);
+        perfPoSKernel.Add(GetTimeMicros() - nTimeKernel);
+        if (!fKernelValid) {
             LogPrintf("WARNING: ProcessBlock(): check proof-of-stake failed for block %s\n", hash.ToString().c_str());
             return false;
         }
@@ -3268,8 +3718,8 @@ bool ContextualCheckBlock(const CBlock& block, CValidationState& state, CBlockIn
     const int nHeight = pindexPrev == NULL ? 0 : pindexPrev->nHeight + 1;
 
     // Check that all transactions are finalized
-    BOOST_FOREACH (const CTransaction& tx, block.vtx)
-        if (!IsFinalTx(tx, nHeight, block.GetBlockTime())) {
+    BOOST_FOREACH (const CTransactionRef& ptx, block.vtx)
+        if (!IsFinalTx(*ptx, nHeight, block.GetBlockTime())) {
             return state.DoS(10, error("%s : contains a non-final transaction", __func__), REJECT_INVALID, "bad-txns-nonfinal");
         }
 
@@ -3278,8 +3728,8 @@ bool ContextualCheckBlock(const CBlock& block, CValidationState& state, CBlockIn
     if (block.nVersion >= 2 &&
         CBlockIndex::IsSuperMajority(2, pindexPrev, Params().EnforceBlockUpgradeMajority())) {
         CScript expect = CScript() << nHeight;
-        if (block.vtx[0].vin[0].scriptSig.size() < expect.size() ||
-            !std::equal(expect.begin(), expect.end(), block.vtx[0].vin[0].scriptSig.begin())) {
+        if (block.vtx[0]->vin[0].scriptSig.size() < expect.size() ||
+            !std::equal(expect.begin(), expect.end(), block.vtx[0]->vin[0].scriptSig.begin())) {
             return state.DoS(100, error("%s : block height mismatch in coinbase", __func__), REJECT_INVALID, "bad-cb-height");
         }
     }
@@ -3631,9 +4081,7 @@ CBlockIndex* InsertBlockIndex(uint256 hash)
         return (*mi).second;
 
     // Create new
-    CBlockIndex* pindexNew = new CBlockIndex();
-    if (!pindexNew)
-        throw runtime_error("LoadBlockIndex() : new CBlockIndex failed");
+    CBlockIndex* pindexNew = blockIndexArena.Allocate();
     mi = mapBlockIndex.insert(make_pair(hash, pindexNew)).first;
 
     //mark as PoS seen
@@ -3645,14 +4093,77 @@ CBlockIndex* InsertBlockIndex(uint256 hash)
     return pindexNew;
 }
 
+static void VerifyBlockIndexHashRange(const std::vector<CBlockIndex*>& vIndex, size_t nBegin, size_t nEnd, std::atomic<bool>& fStop, std::atomic<CBlockIndex*>& pindexBad)
+{
+    for (size_t i = nBegin; i < nEnd && !fStop; i++) {
+        if ((i & 0xfff) == 0)
+            boost::this_thread::interruption_point();
+        CBlockIndex* pindex = vIndex[i];
+        if (pindex->GetBlockHeader().GetHash() != pindex->GetBlockHash()) {
+            pindexBad = pindex;
+            fStop = true;
+        }
+    }
+}
+
+/**
+ * LoadBlockIndexGuts trusts the hash stored in each record's key. Recompute
+ * the header hashes on all cores once the node is up, and shut down if the
+ * index on disk turns out to be corrupted.
+ */
+void ThreadVerifyBlockIndexHashes()
+{
+    RenameThread("sling-verifyidx");
+
+    // Entries only live as long as blockIndexArena, which is cleared at exit
+    std::vector<CBlockIndex*> vIndex;
+    {
+        LOCK(cs_main);
+        vIndex.reserve(mapBlockIndex.size());
+        BOOST_FOREACH (const PAIRTYPE(uint256, CBlockIndex*) & item, mapBlockIndex) {
+            // Skip placeholders for hashes that had no record of their own
+            if (item.second->nTime != 0)
+                vIndex.push_back(item.second);
+        }
+    }
+
+    int64_t nStart = GetTimeMillis();
+    int nThreads = std::max(1, (int)boost::thread::hardware_concurrency());
+    std::atomic<bool> fStop(false);
+    std::atomic<CBlockIndex*> pindexBad(NULL);
+    boost::thread_group workers;
+    for (int i = 0; i < nThreads; i++)
+        workers.create_thread(boost::bind(&VerifyBlockIndexHashRange, boost::cref(vIndex), vIndex.size() * i / nThreads, vIndex.size() * (i + 1) / nThreads, boost::ref(fStop), boost::ref(pindexBad)));
+    try {
+        workers.join_all();
+    } catch (boost::thread_interrupted&) {
+        fStop = true;
+        workers.join_all();
+        throw;
+    }
+
+    CBlockIndex* pindex = pindexBad;
+    if (pindex) {
+        LogPrintf("ERROR: %s : block index entry %s hashes to %s\n", __func__, pindex->GetBlockHash().ToString(), pindex->GetBlockHeader().GetHash().ToString());
+        uiInterface.ThreadSafeMessageBox(_("Corrupted block index detected. Please restart with -reindex."), "", CClientUIInterface::MSG_ERROR);
+        StartShutdown();
+        return;
+    }
+    LogPrintf("%s : verified %u block index hashes in %dms on %d threads\n", __func__, vIndex.size(), GetTimeMillis() - nStart, nThreads);
+}
+
 bool static LoadBlockIndexDB()
 {
-    if (!pblocktree->LoadBlockIndexGuts())
+    AssertLockHeld(cs_main);
+    bool fSnapshot = GetBoolArg("-blockindexsnapshot", DEFAULT_BLOCKINDEX_SNAPSHOT) && LoadBlockIndexSnapshot(pcoinsTip->GetBestBlock());
+    if (!fSnapshot && !pblocktree->LoadBlockIndexGuts())
         return false;
 
     boost::this_thread::interruption_point();
 
-    // Calculate nChainWork
+    // Calculate nChainWork. This walks the blocks by height because every
+    // entry builds on its pprev, so it stays on one thread.
+    int64_t nStart = GetTimeMillis();
     vector<pair<int, CBlockIndex*> > vSortedByHeight;
     vSortedByHeight.reserve(mapBlockIndex.size());
     BOOST_FOREACH (const PAIRTYPE(uint256, CBlockIndex*) & item, mapBlockIndex) {
@@ -3684,8 +4195,10 @@ bool static LoadBlockIndexDB()
         if (pindex->IsValid(BLOCK_VALID_TREE) && (pindexBestHeader == NULL || CBlockIndexWorkComparator()(pindexBestHeader, pindex)))
             pindexBestHeader = pindex;
     }
+    LogPrintf("%s: chain work computed in %dms\n", __func__, GetTimeMillis() - nStart);
 
     // Load block file info
+    nStart = GetTimeMillis();
     pblocktree->ReadLastBlockFile(nLastBlockFile);
     vinfoBlockFile.resize(nLastBlockFile + 1);
     LogPrintf("%s: last block file = %i\n", __func__, nLastBlockFile);
@@ -3717,6 +4230,14 @@ bool static LoadBlockIndexDB()
             return false;
         }
     }
+    LogPrintf("%s: block files checked in %dms\n", __func__, GetTimeMillis() - nStart);
+
+    // Finish a background flush of the coin database that did not complete
+    uint256 hashCoinsBest = pcoinsdbview->GetBestBlock();
+    if (!pcoinsdbview->ReplayInterruptedFlush())
+        return false;
+    if (pcoinsdbview->GetBestBlock() != hashCoinsBest)
+        pcoinsTip->SetBestBlock(pcoinsdbview->GetBestBlock());
 
     //Check if the shutdown procedure was followed on last client exit
     bool fLastShutdownWasPrepared = true;
@@ -3759,7 +4280,7 @@ bool static LoadBlockIndexDB()
         }
 
         //set the chain to the block before lastMeta so that the meta block will be seen as new
-        chainActive.SetTip(pindexLastMeta->pprev);
+        SetChainTip(pindexLastMeta->pprev);
 
         //Process the lastMetaBlock again, using the known location on disk
         CDiskBlockPos blockPos = pindexLastMeta->GetBlockPos();
@@ -3812,6 +4333,12 @@ bool static LoadBlockIndexDB()
     pblocktree->ReadFlag("txindex", fTxIndex);
     LogPrintf("LoadBlockIndexDB(): transaction index %s\n", fTxIndex ? "enabled" : "disabled");
 
+    // Check whether we have the address and spent indexes
+    pblocktree->ReadFlag("addressindex", fAddressIndex);
+    LogPrintf("LoadBlockIndexDB(): address index %s\n", fAddressIndex ? "enabled" : "disabled");
+    pblocktree->ReadFlag("spentindex", fSpentIndex);
+    LogPrintf("LoadBlockIndexDB(): spent index %s\n", fSpentIndex ? "enabled" : "disabled");
+
     // If this is written true before the next client init, then we know the shutdown process failed
     pblocktree->WriteFlag("shutdown", false);
 
@@ -3819,7 +4346,7 @@ bool static LoadBlockIndexDB()
     BlockMap::iterator it = mapBlockIndex.find(pcoinsTip->GetBestBlock());
     if (it == mapBlockIndex.end())
         return true;
-    chainActive.SetTip(it->second);
+    SetChainTip(it->second);
 
     PruneBlockIndexCandidates();
 
@@ -3922,12 +4449,24 @@ void UnloadBlockIndex()
 {
     mapBlockIndex.clear();
     setBlockIndexCandidates.clear();
-    chainActive.SetTip(NULL);
+    SetChainTip(NULL);
     pindexBestInvalid = NULL;
+    // A reindex may follow, which rebuilds the files the mappings cover
+    blockFileMapper.Clear();
 }
 
 bool LoadBlockIndex()
 {
+    // The RPC threads are already up during warmup, and the block index
+    // snapshot loader asserts cs_main
+    LOCK(cs_main);
+
+    // The block files are about to be rebuilt, a snapshot would point into the
+    // old ones. With snapshots off, one left by an earlier run may be stale by
+    // the time they are turned back on.
+    if (fReindex || !GetBoolArg("-blockindexsnapshot", DEFAULT_BLOCKINDEX_SNAPSHOT))
+        RemoveBlockIndexSnapshot();
+
     // Load block index from databases
     if (!fReindex && !LoadBlockIndexDB())
         return false;
@@ -3945,6 +4484,10 @@ bool InitBlockIndex()
     // Use the provided setting for -txindex in the new database
     fTxIndex = GetBoolArg("-txindex", true);
     pblocktree->WriteFlag("txindex", fTxIndex);
+    fAddressIndex = GetBoolArg("-addressindex", DEFAULT_ADDRESSINDEX);
+    pblocktree->WriteFlag("addressindex", fAddressIndex);
+    fSpentIndex = GetBoolArg("-spentindex", DEFAULT_SPENTINDEX);
+    pblocktree->WriteFlag("spentindex", fSpentIndex);
     LogPrintf("Initializing databases...\n");
 
     // Only add the genesis block if not reindexing (in which case we reuse the one already on disk)
@@ -4375,14 +4918,29 @@ void static ProcessGetData(CNode* pfrom)
                         }
                     }
                 }
-                if (send) {
+                if (send && inv.type == MSG_BLOCK) {
+                    // A new block is requested by most peers at about the same
+                    // time, so keep its framed message around and hand the same
+                    // buffer to all of them. Blocks encode the same at every
+                    // protocol version, see CSerializedNetMsgRef.
+                    static uint256 hashRecentBlockMsg;
+                    static CSerializedNetMsgRef recentBlockMsg;
+                    if (!recentBlockMsg || hashRecentBlockMsg != inv.hash) {
+                        CBlock block;
+                        if (!ReadBlockFromDisk(block, (*mi).second))
+                            assert(!"cannot load block from disk");
+                        CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+                        ss << block;
+                        recentBlockMsg = MakeSerializedNetMsg("block", ss);
+                        hashRecentBlockMsg = inv.hash;
+                    }
+                    pfrom->PushSerializedMessage(recentBlockMsg);
+                } else if (send) {
                     // Send block from disk
                     CBlock block;
                     if (!ReadBlockFromDisk(block, (*mi).second))
                         assert(!"cannot load block from disk");
-                    if (inv.type == MSG_BLOCK)
-                        pfrom->PushMessage("block", block);
-                    else // MSG_FILTERED_BLOCK)
+                    // MSG_FILTERED_BLOCK
                     {
                         LOCK(pfrom->cs_filter);
                         if (pfrom->pfilter) {
@@ -4397,12 +4955,13 @@ void static ProcessGetData(CNode* pfrom)
                             typedef std::pair<unsigned int, uint256> PairType;
                             BOOST_FOREACH (PairType& pair, merkleBlock.vMatchedTxn)
                                 if (!pfrom->setInventoryKnown.count(CInv(MSG_TX, pair.second)))
-                                    pfrom->PushMessage("tx", block.vtx[pair.first]);
+                                    pfrom->PushMessage("tx", *block.vtx[pair.first]);
                         }
                         // else
                         // no response
                     }
-
+                }
+                if (send) {
                     // Trigger them to send a getblocks request for the next batch of inventory
                     if (inv.hash == pfrom->hashContinue) {
                         // Bypass PushInventory, this must send even if redundant,
@@ -4419,19 +4978,19 @@ void static ProcessGetData(CNode* pfrom)
                 bool pushed = false;
                 {
                     LOCK(cs_mapRelay);
-                    map<CInv, CDataStream>::iterator mi = mapRelay.find(inv);
+                    map<CInv, CSerializedNetMsgRef>::iterator mi = mapRelay.find(inv);
                     if (mi != mapRelay.end()) {
-                        pfrom->PushMessage(inv.GetCommand(), (*mi).second);
+                        pfrom->PushSerializedMessage(mi->second);
                         pushed = true;
                     }
                 }
 
                 if (!pushed && inv.type == MSG_TX) {
-                    CTransaction tx;
-                    if (mempool.lookup(inv.hash, tx)) {
+                    CTransactionRef ptx = mempool.get(inv.hash);
+                    if (ptx) {
                         CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
                         ss.reserve(1000);
-                        ss << tx;
+                        ss << *ptx;
                         pfrom->PushMessage("tx", ss);
                         pushed = true;
                     }
@@ -4449,7 +5008,7 @@ void static ProcessGetData(CNode* pfrom)
                     if (mapTxLockReq.count(inv.hash)) {
                         CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
                         ss.reserve(1000);
-                        ss << mapTxLockReq[inv.hash];
+                        ss << *mapTxLockReq[inv.hash];
                         pfrom->PushMessage("ix", ss);
                         pushed = true;
                     }
@@ -5173,10 +5732,9 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
         vector<CInv> vInv;
         BOOST_FOREACH (uint256& hash, vtxid) {
             CInv inv(MSG_TX, hash);
-            CTransaction tx;
-            bool fInMemPool = mempool.lookup(hash, tx);
-            if (!fInMemPool) continue; // another thread removed since queryHashes, maybe...
-            if ((pfrom->pfilter && pfrom->pfilter->IsRelevantAndUpdate(tx)) ||
+            CTransactionRef ptx = mempool.get(hash);
+            if (!ptx) continue; // another thread removed since queryHashes, maybe...
+            if ((pfrom->pfilter && pfrom->pfilter->IsRelevantAndUpdate(*ptx)) ||
                 (!pfrom->pfilter))
                 vInv.push_back(inv);
             if (vInv.size() == MAX_INV_SZ) {
@@ -5492,8 +6050,11 @@ bool ProcessMessages(CNode* pfrom)
     }
 
     // In case the connection got shut down, its receive buffer was wiped
-    if (!pfrom->fDisconnect)
+    if (!pfrom->fDisconnect) {
+        for (std::deque<CNetMessage>::iterator itDone = pfrom->vRecvMsg.begin(); itDone != it; itDone++)
+            pfrom->nRecvSize -= itDone->hdr.nMessageSize + CMessageHeader::HEADER_SIZE;
         pfrom->vRecvMsg.erase(pfrom->vRecvMsg.begin(), it);
+    }
 
     return fOk;
 }
@@ -5756,16 +6317,23 @@ bool CBlockUndo::WriteToDisk(CDiskBlockPos& pos, const uint256& hashBlock)
 
 bool CBlockUndo::ReadFromDisk(const CDiskBlockPos& pos, const uint256& hashBlock)
 {
-    // Open history file to read
-    CAutoFile filein(OpenUndoFile(pos, true), SER_DISK, CLIENT_VERSION);
-    if (filein.IsNull())
-        return error("CBlockUndo::ReadFromDisk : OpenBlockFile failed");
-
-    // Read block
+    // Read undo data, from the mapping if the file is finalized
     uint256 hashChecksum;
     try {
-        filein >> *this;
-        filein >> hashChecksum;
+        CMappedFileReader mapped(SER_DISK, CLIENT_VERSION);
+        unsigned int nValidSize = GetFinalizedFileSize(pos.nFile, true);
+        if (nValidSize)
+            blockFileMapper.Open(pos, "rev", nValidSize, mapped);
+        if (!mapped.IsNull()) {
+            mapped >> *this;
+            mapped >> hashChecksum;
+        } else {
+            CAutoFile filein(OpenUndoFile(pos, true), SER_DISK, CLIENT_VERSION);
+            if (filein.IsNull())
+                return error("CBlockUndo::ReadFromDisk : OpenBlockFile failed");
+            filein >> *this;
+            filein >> hashChecksum;
+        }
     } catch (std::exception& e) {
         return error("%s : Deserialize or I/O error - %s", __func__, e.what());
     }
@@ -5793,10 +6361,8 @@ public:
     ~CMainCleanup()
     {
         // block headers
-        BlockMap::iterator it1 = mapBlockIndex.begin();
-        for (; it1 != mapBlockIndex.end(); it1++)
-            delete (*it1).second;
         mapBlockIndex.clear();
+        blockIndexArena.Clear();
 
         // orphan transactions
         mapOrphanTransactions.clear();
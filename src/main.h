@@ -12,6 +12,7 @@
 #include "config/sling-config.h"
 #endif
 
+#include "addressindex.h"
 #include "amount.h"
 #include "chain.h"
 #include "chainparams.h"
@@ -32,6 +33,7 @@
 #include <algorithm>
 #include <exception>
 #include <map>
+#include <memory>
 #include <set>
 #include <stdint.h>
 #include <string>
@@ -42,6 +44,7 @@
 
 class CBlockIndex;
 class CBlockTreeDB;
+class CCoinsViewDB;
 class CBloomFilter;
 class CInv;
 class CScriptCheck;
@@ -58,6 +61,9 @@ static const unsigned int DEFAULT_BLOCK_MIN_SIZE = 0;
 static const unsigned int DEFAULT_BLOCK_PRIORITY_SIZE = 50000;
 /** Default for accepting alerts from the P2P network. */
 static const bool DEFAULT_ALERTS = true;
+/** Defaults for -addressindex and -spentindex, the optional indexes used by explorers */
+static const bool DEFAULT_ADDRESSINDEX = false;
+static const bool DEFAULT_SPENTINDEX = false;
 /** The maximum size for transactions we're willing to relay/mine */
 static const unsigned int MAX_STANDARD_TX_SIZE = 100000;
 /** The maximum allowed number of signature check operations in a block (network rule) */
@@ -82,6 +88,12 @@ static const unsigned int LOCKTIME_THRESHOLD = 500000000; // Tue Nov  5 00:53:20
 static const int MAX_SCRIPTCHECK_THREADS = 16;
 /** -par default (number of script-checking threads, 0 = auto) */
 static const int DEFAULT_SCRIPTCHECK_THREADS = 0;
+/** -blockprefetch default (number of blocks read and prechecked ahead of the one being connected) */
+static const int DEFAULT_BLOCK_PREFETCH = 8;
+/** Maximum value of -blockprefetch */
+static const int MAX_BLOCK_PREFETCH = 32;
+/** Number of threads reading and prechecking blocks when -blockprefetch is enabled */
+static const int BLOCK_PREFETCH_THREADS = 2;
 /** Number of blocks that can be requested at any given time from a single peer. */
 static const int MAX_BLOCKS_IN_TRANSIT_PER_PEER = 16;
 /** Timeout in seconds during which a peer must stall block download progress before being disconnected. */
@@ -140,7 +152,10 @@ extern CConditionVariable cvBlockChange;
 extern bool fImporting;
 extern bool fReindex;
 extern int nScriptCheckThreads;
+extern int nBlockPrefetch;
 extern bool fTxIndex;
+extern bool fAddressIndex;
+extern bool fSpentIndex;
 extern bool fIsBareMultisigStd;
 extern bool fCheckBlockIndex;
 extern unsigned int nCoinCacheSize;
@@ -172,7 +187,7 @@ void UnregisterValidationInterface(CValidationInterface* pwalletIn);
 /** Unregister all wallets from core */
 void UnregisterAllValidationInterfaces();
 /** Push an updated transaction to all registered wallets */
-void SyncWithWallets(const CTransaction& tx, const CBlock* pblock = NULL);
+void SyncWithWallets(const CTransactionRef& ptx, const CBlock* pblock = NULL);
 
 /** Register with a network node to receive its signals */
 void RegisterNodeSignals(CNodeSignals& nodeSignals);
@@ -220,6 +235,10 @@ bool ProcessMessages(CNode* pfrom);
 bool SendMessages(CNode* pto, bool fSendTrickle);
 /** Run an instance of the script checking thread */
 void ThreadScriptCheck();
+/** Run an instance of the block prefetch thread */
+void ThreadBlockPrefetch();
+/** Recompute the hashes of the loaded block index and shut down on a mismatch */
+void ThreadVerifyBlockIndexHashes();
 
 // ***TODO*** probably not the right place for these 2
 /** Check whether a block hash satisfies the proof-of-work requirement specified by nBits */
@@ -230,6 +249,17 @@ bool IsInitialBlockDownload();
 std::string GetWarnings(std::string strFor);
 /** Retrieve a transaction (from memory pool, or from disk, if possible) */
 bool GetTransaction(const uint256& hash, CTransaction& tx, uint256& hashBlock, bool fAllowSlow = false);
+/** The address type and hash the address and spent indexes file a script or destination under */
+bool GetAddressIndexKey(const CScript& script, int& nType, uint160& hashBytes);
+bool GetAddressIndexKey(const CTxDestination& dest, int& nType, uint160& hashBytes);
+/** Read the confirmed history of an address between two heights (-addressindex) */
+bool GetAddressIndex(const uint160& hashBytes, int nType, std::vector<std::pair<CAddressIndexKey, CAmount> >& vAddressIndex, int nStart = 0, int nEnd = 0);
+/** Read the confirmed unspent outputs of an address (-addressindex) */
+bool GetAddressUnspent(const uint160& hashBytes, int nType, std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> >& vUnspent);
+/** Read the total an address received over the whole chain (-addressindex) */
+bool GetAddressReceived(const uint160& hashBytes, int nType, CAmount& nReceived);
+/** Find the input that spent an output (-spentindex) */
+bool GetSpentIndex(const CSpentIndexKey& key, CSpentIndexValue& value);
 /** Find the best known block, and make it the tip of the block chain */
 
 bool DisconnectBlocksAndReprocess(int blocks);
@@ -609,9 +639,37 @@ bool ReconsiderBlock(CValidationState& state, CBlockIndex* pindex);
 /** The currently-connected chain of blocks. */
 extern CChain chainActive;
 
+/**
+ * Immutable copy of what is most often read of chainActive's tip. Callers
+ * that only need to know where the chain is read it without cs_main; it is
+ * replaced as a whole whenever the tip changes, so its fields always
+ * describe the same block.
+ */
+class CChainTipSnapshot
+{
+public:
+    //! NULL while no chain is loaded. Block index entries, and so the chain below it, stay until shutdown.
+    const CBlockIndex* pindex;
+    int nHeight;
+    uint256 hashBlock;
+    int64_t nTime;
+    int64_t nMedianTimePast;
+    int64_t nMoneySupply;
+
+    explicit CChainTipSnapshot(const CBlockIndex* pindexIn = NULL);
+};
+
+/** The snapshot of chainActive's tip as of its last change. Takes no lock. */
+std::shared_ptr<const CChainTipSnapshot> GetChainTipSnapshot();
+/** Owns every CBlockIndex in mapBlockIndex. Guarded by cs_main. */
+extern CBlockIndexArena blockIndexArena;
+
 /** Global variable that points to the active CCoinsView (protected by cs_main) */
 extern CCoinsViewCache* pcoinsTip;
 
+/** Global variable that points to the coin database under pcoinsTip (protected by cs_main) */
+extern CCoinsViewDB* pcoinsdbview;
+
 /** Global variable that points to the active block tree (protected by cs_main) */
 extern CBlockTreeDB* pblocktree;
 
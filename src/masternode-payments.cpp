@@ -196,20 +196,20 @@ bool IsBlockValueValid(const CBlock& block, int64_t nExpectedValue)
         if (nHeight % GetBudgetPaymentCycleBlocks() < 100) {
             return true;
         } else {
-            if (block.vtx[0].GetValueOut() > nExpectedValue) return false;
+            if (block.vtx[0]->GetValueOut() > nExpectedValue) return false;
         }
     } else { // we're synced and have data so check the budget schedule
 
         //are these blocks even enabled
         if (!IsSporkActive(SPORK_13_ENABLE_SUPERBLOCKS)) {
-            return block.vtx[0].GetValueOut() <= nExpectedValue;
+            return block.vtx[0]->GetValueOut() <= nExpectedValue;
         }
 
         if (budget.IsBudgetPaymentBlock(nHeight)) {
             //the value of the block is evaluated in CheckBlock
             return true;
         } else {
-            if (block.vtx[0].GetValueOut() > nExpectedValue) return false;
+            if (block.vtx[0]->GetValueOut() > nExpectedValue) return false;
         }
     }
 
@@ -223,7 +223,7 @@ bool IsBlockPayeeValid(const CBlock& block, int nBlockHeight)
         return true;
     }
 
-    const CTransaction& txNew = (block.IsProofOfStake() ? block.vtx[1] : block.vtx[0]);
+    const CTransaction& txNew = (block.IsProofOfStake() ? *block.vtx[1] : *block.vtx[0]);
 
     //check if it's a budget block
     if (IsSporkActive(SPORK_13_ENABLE_SUPERBLOCKS)) {
@@ -362,12 +362,9 @@ void CMasternodePayments::ProcessMessageMasternodePayments(CNode* pfrom, std::st
 
         if (pfrom->nVersion < ActiveProtocol()) return;
 
-        int nHeight;
-        {
-            TRY_LOCK(cs_main, locked);
-            if (!locked || chainActive.Tip() == NULL) return;
-            nHeight = chainActive.Tip()->nHeight;
-        }
+        std::shared_ptr<const CChainTipSnapshot> tip = GetChainTipSnapshot();
+        if (!tip->pindex) return;
+        int nHeight = tip->nHeight;
 
         if (masternodePayments.mapMasternodePayeeVotes.count(winner.GetHash())) {
             LogPrint("mnpayments", "mnw - Already seen - %s bestHeight %d\n", winner.GetHash().ToString().c_str(), nHeight);
@@ -450,12 +447,9 @@ bool CMasternodePayments::IsScheduled(CMasternode& mn, int nNotBlockHeight)
 {
     LOCK(cs_mapMasternodeBlocks);
 
-    int nHeight;
-    {
-        TRY_LOCK(cs_main, locked);
-        if (!locked || chainActive.Tip() == NULL) return false;
-        nHeight = chainActive.Tip()->nHeight;
-    }
+    std::shared_ptr<const CChainTipSnapshot> tip = GetChainTipSnapshot();
+    if (!tip->pindex) return false;
+    int nHeight = tip->nHeight;
 
     CScript mnpayee;
     mnpayee = GetScriptForDestination(mn.pubKeyCollateralAddress.GetID());
@@ -601,12 +595,9 @@ void CMasternodePayments::CleanPaymentList()
 {
     LOCK2(cs_mapMasternodePayeeVotes, cs_mapMasternodeBlocks);
 
-    int nHeight;
-    {
-        TRY_LOCK(cs_main, locked);
-        if (!locked || chainActive.Tip() == NULL) return;
-        nHeight = chainActive.Tip()->nHeight;
-    }
+    std::shared_ptr<const CChainTipSnapshot> tip = GetChainTipSnapshot();
+    if (!tip->pindex) return;
+    int nHeight = tip->nHeight;
 
     //keep up to five cycles for historical sake
     int nLimit = std::max(int(mnodeman.size() * 1.25), 1000);
@@ -734,7 +725,9 @@ bool CMasternodePayments::ProcessBlock(int nBlockHeight)
 void CMasternodePaymentWinner::Relay()
 {
     CInv inv(MSG_MASTERNODE_WINNER, GetHash());
-    RelayInv(inv);
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << *this;
+    RelayInv(inv, MakeSerializedNetMsg("mnw", ss));
 }
 
 bool CMasternodePaymentWinner::SignatureValid()
@@ -761,12 +754,9 @@ void CMasternodePayments::Sync(CNode* node, int nCountNeeded)
 {
     LOCK(cs_mapMasternodePayeeVotes);
 
-    int nHeight;
-    {
-        TRY_LOCK(cs_main, locked);
-        if (!locked || chainActive.Tip() == NULL) return;
-        nHeight = chainActive.Tip()->nHeight;
-    }
+    std::shared_ptr<const CChainTipSnapshot> tip = GetChainTipSnapshot();
+    if (!tip->pindex) return;
+    int nHeight = tip->nHeight;
 
     int nCount = (mnodeman.CountEnabled() * 1.25);
     if (nCountNeeded > nCount) nCountNeeded = nCount;
@@ -12,6 +12,7 @@
 #include "main.h"
 #include "masternode-sync.h"
 #include "net.h"
+#include "perfstats.h"
 #include "pow.h"
 #include "primitives/block.h"
 #include "primitives/transaction.h"
@@ -33,27 +34,6 @@ using namespace std;
 // SlingMiner
 //
 
-//
-// Unconfirmed transactions in the memory pool often depend on other
-// transactions in the memory pool. When we select transactions from the
-// pool, we select by highest priority or fee rate, so we might consider
-// transactions that depend on transactions that aren't yet in the block.
-// The COrphan class keeps track of these 'temporary orphans' while
-// CreateBlock is figuring out which transactions to include.
-//
-class COrphan
-{
-public:
-    const CTransaction* ptx;
-    set<uint256> setDependsOn;
-    CFeeRate feeRate;
-    double dPriority;
-
-    COrphan(const CTransaction* ptxIn) : ptx(ptxIn), feeRate(0), dPriority(0)
-    {
-    }
-};
-
 uint64_t nLastBlockTx = 0;
 uint64_t nLastBlockSize = 0;
 int64_t nLastCoinStakeSearchInterval = 0;
@@ -90,58 +70,215 @@ void UpdateTime(CBlockHeader* pblock, const CBlockIndex* pindexPrev, bool fProof
         pblock->nBits = GetNextWorkRequired(pindexPrev, pblock, fProofOfStake);
 }
 
-CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn, CWallet* pwallet, bool fProofOfStake)
+/**
+ * The mempool transactions picked for the last block template. While the
+ * tip and the mempool stay the same the pick would come out the same, so
+ * the next template reuses it instead of walking the mempool and checking
+ * every input again. Transactions whose lock time passes meanwhile are
+ * picked up once the entry is TX_SELECTION_MAX_AGE seconds old.
+ * Guarded by cs_main.
+ */
+class CBlockTxSelection
 {
-    CReserveKey reservekey(pwallet);
+public:
+    CBlockTxSelection() : nHeight(-1), nTransactionsUpdated(0), nTime(0), nFees(0), nBlockSize(0), nBlockTx(0) {}
 
-    // Create new block
-    std::unique_ptr<CBlockTemplate> pblocktemplate(new CBlockTemplate());
-    if (!pblocktemplate.get())
-        return NULL;
-    CBlock* pblock = &pblocktemplate->block; // pointer for convenience
+    //! Append the stored pick to blocktemplate if it is still good for pindexPrev
+    bool AddTo(CBlockTemplate& blocktemplate, const CBlockIndex* pindexPrev, CAmount& nFeesRet, uint64_t& nBlockSizeRet, uint64_t& nBlockTxRet) const
+    {
+        AssertLockHeld(cs_main);
+        if (hashPrevBlock != pindexPrev->GetBlockHash() || nHeight != pindexPrev->nHeight ||
+            nTransactionsUpdated != mempool.GetTransactionsUpdated() || GetTime() - nTime > TX_SELECTION_MAX_AGE)
+            return false;
+        blocktemplate.block.vtx.insert(blocktemplate.block.vtx.end(), vtx.begin(), vtx.end());
+        blocktemplate.vTxFees.insert(blocktemplate.vTxFees.end(), vTxFees.begin(), vTxFees.end());
+        blocktemplate.vTxSigOps.insert(blocktemplate.vTxSigOps.end(), vTxSigOps.begin(), vTxSigOps.end());
+        nFeesRet = nFees;
+        nBlockSizeRet = nBlockSize;
+        nBlockTxRet = nBlockTx;
+        return true;
+    }
 
-    // -regtest only: allow overriding block.nVersion with
-    // -blockversion=N to test forking scenarios
-    if (Params().MineBlocksOnDemand())
-        pblock->nVersion = GetArg("-blockversion", pblock->nVersion);
+    //! Remember the transactions from nFirstTx on as the pick for pindexPrev
+    void Store(const CBlockTemplate& blocktemplate, size_t nFirstTx, const CBlockIndex* pindexPrev, CAmount nFeesIn, uint64_t nBlockSizeIn, uint64_t nBlockTxIn)
+    {
+        AssertLockHeld(cs_main);
+        hashPrevBlock = pindexPrev->GetBlockHash();
+        nHeight = pindexPrev->nHeight;
+        nTransactionsUpdated = mempool.GetTransactionsUpdated();
+        nTime = GetTime();
+        vtx.assign(blocktemplate.block.vtx.begin() + nFirstTx, blocktemplate.block.vtx.end());
+        vTxFees.assign(blocktemplate.vTxFees.begin() + nFirstTx, blocktemplate.vTxFees.end());
+        vTxSigOps.assign(blocktemplate.vTxSigOps.begin() + nFirstTx, blocktemplate.vTxSigOps.end());
+        nFees = nFeesIn;
+        nBlockSize = nBlockSizeIn;
+        nBlockTx = nBlockTxIn;
+    }
 
-    // Create coinbase tx
-    CMutableTransaction txNew;
-    txNew.vin.resize(1);
-    txNew.vin[0].prevout.SetNull();
-    txNew.vout.resize(1);
-    txNew.vout[0].scriptPubKey = scriptPubKeyIn;
-    pblock->vtx.push_back(txNew);
-    pblocktemplate->vTxFees.push_back(-1);   // updated at end
-    pblocktemplate->vTxSigOps.push_back(-1); // updated at end
+private:
+    static const int64_t TX_SELECTION_MAX_AGE = 30;
+
+    uint256 hashPrevBlock;
+    int nHeight;
+    unsigned int nTransactionsUpdated;
+    int64_t nTime;
+    std::vector<CTransactionRef> vtx;
+    std::vector<CAmount> vTxFees;
+    std::vector<int64_t> vTxSigOps;
+    CAmount nFees;
+    uint64_t nBlockSize;
+    uint64_t nBlockTx;
+};
 
-    // ppcoin: if coinstake available add coinstake tx
-    static int64_t nLastCoinStakeSearchTime = GetAdjustedTime(); // only initialized at startup
+static CBlockTxSelection blockTxSelection;
 
-    if (fProofOfStake) {
-        boost::this_thread::interruption_point();
-        pblock->nTime = GetAdjustedTime();
-        CBlockIndex* pindexPrev = chainActive.Tip();
-        pblock->nBits = GetNextWorkRequired(pindexPrev, pblock, fProofOfStake);
-        CMutableTransaction txCoinStake;
-        int64_t nSearchTime = pblock->nTime; // search to current time
-        bool fStakeFound = false;
-        if (nSearchTime >= nLastCoinStakeSearchTime) {
-            unsigned int nTxNewTime = 0;
-            if (pwallet->CreateCoinStake(*pwallet, pblock->nBits, nSearchTime - nLastCoinStakeSearchTime, txCoinStake, nTxNewTime)) {
-                pblock->nTime = nTxNewTime;
-                pblock->vtx[0].vout[0].SetEmpty();
-                pblock->vtx.push_back(CTransaction(txCoinStake));
-                fStakeFound = true;
+static CPerfCounter counterSelectionReused("miner.selection_reused", "Block templates that reused the previous pick of mempool transactions");
+static CPerfHistogram histKernelSearch("miner.kernel_search", "Time to search the stake coins for a kernel");
+
+/**
+ * Fills a block template with mempool transactions. A transaction goes in
+ * together with the unconfirmed ancestors it needs that the block doesn't
+ * hold yet, parents first, and only if the whole package passes.
+ */
+class CBlockTxAssembler
+{
+public:
+    uint64_t nBlockSize;
+    uint64_t nBlockTx;
+    CAmount nFees;
+
+    CBlockTxAssembler(CBlockTemplate& blocktemplateIn, const CBlockIndex* pindexPrev, unsigned int nBlockMaxSizeIn, uint64_t nBlockSizeIn)
+        : nBlockSize(nBlockSizeIn), nBlockTx(0), nFees(0), blocktemplate(blocktemplateIn), nHeight(pindexPrev->nHeight + 1),
+          nBlockMaxSize(nBlockMaxSizeIn), nBlockSigOps(100), view(pcoinsTip), fPrintPriority(GetBoolArg("-printpriority", false))
+    {
+    }
+
+    //! Whether hash went in earlier or failed a check, so that trying it again is pointless
+    bool IsDone(const uint256& hash) const
+    {
+        return setInBlock.count(hash) || setFailed.count(hash);
+    }
+
+    //! Add the mempool transaction hash and the ancestors it needs. Returns false if it didn't fit or failed.
+    bool AddPackage(const uint256& hash)
+    {
+        if (IsDone(hash))
+            return false;
+
+        // Collect the ancestors that aren't in the block yet
+        std::vector<const CTxMemPoolEntry*> vPackage;
+        std::set<uint256> setPackage;
+        std::deque<uint256> vToVisit;
+        vToVisit.push_back(hash);
+        uint64_t nPackageSize = 0;
+        while (!vToVisit.empty()) {
+            uint256 hashVisit = vToVisit.front();
+            vToVisit.pop_front();
+            if (setInBlock.count(hashVisit) || !setPackage.insert(hashVisit).second)
+                continue;
+            if (setFailed.count(hashVisit))
+                return Fail(hash);
+            const CTxMemPoolEntry& entry = mempool.mapTx.find(hashVisit)->second;
+            vPackage.push_back(&entry);
+            nPackageSize += entry.GetTxSize();
+            BOOST_FOREACH (const CTxIn& txin, entry.GetTx().vin) {
+                if (mempool.mapTx.count(txin.prevout.hash))
+                    vToVisit.push_back(txin.prevout.hash);
             }
-            nLastCoinStakeSearchInterval = nSearchTime - nLastCoinStakeSearchTime;
-            nLastCoinStakeSearchTime = nSearchTime;
         }
+        if (nBlockSize + nPackageSize >= nBlockMaxSize)
+            return false;
+
+        // An ancestor has fewer ancestors than its descendants, so this puts parents first
+        std::sort(vPackage.begin(), vPackage.end(), CompareByAncestorCount());
+
+        CCoinsViewCache viewPackage(&view);
+        std::vector<CAmount> vTxFees;
+        std::vector<int64_t> vTxSigOps;
+        int nPackageSigOps = 0;
+        BOOST_FOREACH (const CTxMemPoolEntry* pentry, vPackage) {
+            const CTransaction& tx = pentry->GetTx();
+            if (tx.IsCoinBase() || tx.IsCoinStake() || !IsFinalTx(tx, nHeight) || !viewPackage.HaveInputs(tx)) {
+                Fail(tx.GetHash());
+                return Fail(hash);
+            }
 
-        if (!fStakeFound)
-            return NULL;
+            unsigned int nTxSigOps = GetLegacySigOpCount(tx) + GetP2SHSigOpCount(tx, viewPackage);
+            if (nBlockSigOps + nPackageSigOps + nTxSigOps >= MAX_BLOCK_SIGOPS)
+                return false;
+
+            // Note that flags: we don't want to set mempool/IsStandard()
+            // policy here, but we still have to ensure that the block we
+            // create only contains transactions that are valid in new blocks.
+            CValidationState state;
+            if (!CheckInputs(tx, state, viewPackage, true, MANDATORY_SCRIPT_VERIFY_FLAGS, true)) {
+                Fail(tx.GetHash());
+                return Fail(hash);
+            }
+
+            vTxFees.push_back(viewPackage.GetValueIn(tx) - tx.GetValueOut());
+            vTxSigOps.push_back(nTxSigOps);
+            nPackageSigOps += nTxSigOps;
+            CTxUndo txundo;
+            UpdateCoins(tx, state, viewPackage, txundo, nHeight);
+        }
+
+        // Added
+        viewPackage.Flush();
+        for (unsigned int i = 0; i < vPackage.size(); i++) {
+            const CTransaction& tx = vPackage[i]->GetTx();
+            blocktemplate.block.vtx.push_back(vPackage[i]->GetSharedTx());
+            blocktemplate.vTxFees.push_back(vTxFees[i]);
+            blocktemplate.vTxSigOps.push_back(vTxSigOps[i]);
+            setInBlock.insert(tx.GetHash());
+            nBlockSize += vPackage[i]->GetTxSize();
+            ++nBlockTx;
+            nFees += vTxFees[i];
+            if (fPrintPriority) {
+                LogPrintf("priority %.1f fee %s txid %s\n",
+                    vPackage[i]->GetPriority(nHeight), CFeeRate(vTxFees[i], vPackage[i]->GetTxSize()).ToString(), tx.GetHash().ToString());
+            }
+        }
+        nBlockSigOps += nPackageSigOps;
+        return true;
     }
 
+private:
+    struct CompareByAncestorCount {
+        bool operator()(const CTxMemPoolEntry* a, const CTxMemPoolEntry* b) const
+        {
+            return a->GetCountWithAncestors() < b->GetCountWithAncestors();
+        }
+    };
+
+    CBlockTemplate& blocktemplate;
+    const int nHeight;
+    const unsigned int nBlockMaxSize;
+    int nBlockSigOps;
+    CCoinsViewCache view;
+    std::set<uint256> setInBlock;
+    std::set<uint256> setFailed;
+    bool fPrintPriority;
+
+    bool Fail(const uint256& hash)
+    {
+        setFailed.insert(hash);
+        return false;
+    }
+};
+
+/**
+ * Add the best mempool transactions that fit to the block: first by
+ * priority, for the space set aside for high-priority transactions, then by
+ * the fee rate they pay together with their unconfirmed ancestors. The
+ * mempool keeps transactions in that order, so only the top of it is walked.
+ */
+static void SelectMempoolTransactions(CBlockTemplate& blocktemplate, const CBlockIndex* pindexPrev, CAmount& nFees, uint64_t& nBlockSize, uint64_t& nBlockTx)
+{
+    AssertLockHeld(cs_main);
+    AssertLockHeld(mempool.cs);
+    const int nHeight = pindexPrev->nHeight + 1;
+
     // Largest block you're willing to create:
     unsigned int nBlockMaxSize = GetArg("-blockmaxsize", DEFAULT_BLOCK_MAX_SIZE);
     // Limit to betweeen 1K and MAX_BLOCK_SIZE-1K for sanity:
@@ -157,180 +294,134 @@ CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn, CWallet* pwallet,
     unsigned int nBlockMinSize = GetArg("-blockminsize", DEFAULT_BLOCK_MIN_SIZE);
     nBlockMinSize = std::min(nBlockMaxSize, nBlockMinSize);
 
-    // Collect memory pool transactions into the block
-    CAmount nFees = 0;
-
-    {
-        LOCK2(cs_main, mempool.cs);
-
-        CBlockIndex* pindexPrev = chainActive.Tip();
-        const int nHeight = pindexPrev->nHeight + 1;
-        CCoinsViewCache view(pcoinsTip);
-
-        // Priority order to process transactions
-        list<COrphan> vOrphan; // list memory doesn't move
-        map<uint256, vector<COrphan*> > mapDependers;
-        bool fPrintPriority = GetBoolArg("-printpriority", false);
+    CBlockTxAssembler assembler(blocktemplate, pindexPrev, nBlockMaxSize, nBlockSize);
 
-        // This vector will be sorted into a priority queue:
+    if (nBlockPrioritySize > 0) {
+        // Priority changes with every block, so it can't be indexed; build the heap here
         vector<TxPriority> vecPriority;
         vecPriority.reserve(mempool.mapTx.size());
-        for (map<uint256, CTxMemPoolEntry>::iterator mi = mempool.mapTx.begin();
-             mi != mempool.mapTx.end(); ++mi) {
-            const CTransaction& tx = mi->second.GetTx();
-            if (tx.IsCoinBase() || tx.IsCoinStake() || !IsFinalTx(tx, nHeight))
-                continue;
-
-            COrphan* porphan = NULL;
-            double dPriority = 0;
-            CAmount nTotalIn = 0;
-            bool fMissingInputs = false;
-            BOOST_FOREACH (const CTxIn& txin, tx.vin) {
-                // Read prev transaction
-                if (!view.HaveCoins(txin.prevout.hash)) {
-                    // This should never happen; all transactions in the memory
-                    // pool should connect to either transactions in the chain
-                    // or other transactions in the memory pool.
-                    if (!mempool.mapTx.count(txin.prevout.hash)) {
-                        LogPrintf("ERROR: mempool transaction missing input\n");
-                        if (fDebug) assert("mempool transaction missing input" == 0);
-                        fMissingInputs = true;
-                        if (porphan)
-                            vOrphan.pop_back();
-                        break;
-                    }
-
-                    // Has to wait for dependencies
-                    if (!porphan) {
-                        // Use list for automatic deletion
-                        vOrphan.push_back(COrphan(&tx));
-                        porphan = &vOrphan.back();
-                    }
-                    mapDependers[txin.prevout.hash].push_back(porphan);
-                    porphan->setDependsOn.insert(txin.prevout.hash);
-                    nTotalIn += mempool.mapTx[txin.prevout.hash].GetTx().vout[txin.prevout.n].nValue;
-                    continue;
-                }
-                const CCoins* coins = view.AccessCoins(txin.prevout.hash);
-                assert(coins);
-
-                CAmount nValueIn = coins->vout[txin.prevout.n].nValue;
-                nTotalIn += nValueIn;
-
-                int nConf = nHeight - coins->nHeight;
-
-                dPriority += (double)nValueIn * nConf;
-            }
-            if (fMissingInputs) continue;
-
-            // Priority is sum(valuein * age) / modified_txsize
-            unsigned int nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
-            dPriority = tx.ComputePriority(dPriority, nTxSize);
-
-            uint256 hash = tx.GetHash();
-            mempool.ApplyDeltas(hash, dPriority, nTotalIn);
-
-            CFeeRate feeRate(nTotalIn - tx.GetValueOut(), nTxSize);
-
-            if (porphan) {
-                porphan->dPriority = dPriority;
-                porphan->feeRate = feeRate;
-            } else
-                vecPriority.push_back(TxPriority(dPriority, feeRate, &mi->second.GetTx()));
+        for (map<uint256, CTxMemPoolEntry>::const_iterator mi = mempool.mapTx.begin(); mi != mempool.mapTx.end(); ++mi) {
+            double dPriority = mi->second.GetPriority(nHeight);
+            CAmount dummy = 0;
+            mempool.ApplyDeltas(mi->first, dPriority, dummy);
+            vecPriority.push_back(TxPriority(dPriority, CFeeRate(mi->second.GetModifiedFee(), mi->second.GetTxSize()), &mi->second.GetTx()));
         }
 
-        // Collect transactions into block
-        uint64_t nBlockSize = 1000;
-        uint64_t nBlockTx = 0;
-        int nBlockSigOps = 100;
-        bool fSortedByFee = (nBlockPrioritySize <= 0);
-
-        TxPriorityCompare comparer(fSortedByFee);
+        TxPriorityCompare comparer(false);
         std::make_heap(vecPriority.begin(), vecPriority.end(), comparer);
-
         while (!vecPriority.empty()) {
-            // Take highest priority transaction off the priority queue:
             double dPriority = vecPriority.front().get<0>();
-            CFeeRate feeRate = vecPriority.front().get<1>();
             const CTransaction& tx = *(vecPriority.front().get<2>());
-
             std::pop_heap(vecPriority.begin(), vecPriority.end(), comparer);
             vecPriority.pop_back();
 
-            // Size limits
-            unsigned int nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
-            if (nBlockSize + nTxSize >= nBlockMaxSize)
-                continue;
-
-            // Legacy limits on sigOps:
-            unsigned int nTxSigOps = GetLegacySigOpCount(tx);
-            if (nBlockSigOps + nTxSigOps >= MAX_BLOCK_SIGOPS)
-                continue;
-
-            // Skip free transactions if we're past the minimum block size:
-            const uint256& hash = tx.GetHash();
-            double dPriorityDelta = 0;
-            CAmount nFeeDelta = 0;
-            mempool.ApplyDeltas(hash, dPriorityDelta, nFeeDelta);
-            if (fSortedByFee && (dPriorityDelta <= 0) && (nFeeDelta <= 0) && (feeRate < ::minRelayTxFee) && (nBlockSize + nTxSize >= nBlockMinSize))
-                continue;
-
             // Prioritise by fee once past the priority size or we run out of high-priority
             // transactions:
-            if (!fSortedByFee &&
-                ((nBlockSize + nTxSize >= nBlockPrioritySize) || !AllowFree(dPriority))) {
-                fSortedByFee = true;
-                comparer = TxPriorityCompare(fSortedByFee);
-                std::make_heap(vecPriority.begin(), vecPriority.end(), comparer);
-            }
+            if (assembler.nBlockSize + ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION) >= nBlockPrioritySize || !AllowFree(dPriority))
+                break;
+            assembler.AddPackage(tx.GetHash());
+        }
+    }
 
-            if (!view.HaveInputs(tx))
-                continue;
+    int nConsecutiveFailed = 0;
+    for (std::set<CAncestorFeeRateKey>::const_iterator it = mempool.setAncestorFeeRate.begin(); it != mempool.setAncestorFeeRate.end(); ++it) {
+        // Everything from here on pays less than the relay fee, which only fills up to the minimum block size
+        if (it->GetFeeRate() < ::minRelayTxFee && assembler.nBlockSize >= nBlockMinSize)
+            break;
+        if (assembler.IsDone(it->hash))
+            continue;
+        if (it->GetFeeRate() < ::minRelayTxFee && assembler.nBlockSize + it->nSizeWithAncestors >= nBlockMinSize)
+            continue;
+        if (assembler.AddPackage(it->hash)) {
+            nConsecutiveFailed = 0;
+        } else if (++nConsecutiveFailed > 1000 && assembler.nBlockSize + 4000 > nBlockMaxSize) {
+            // The block is close to full and nothing fits any more
+            break;
+        }
+    }
 
-            CAmount nTxFees = view.GetValueIn(tx) - tx.GetValueOut();
+    nFees = assembler.nFees;
+    nBlockSize = assembler.nBlockSize;
+    nBlockTx = assembler.nBlockTx;
+}
 
-            nTxSigOps += GetP2SHSigOpCount(tx, view);
-            if (nBlockSigOps + nTxSigOps >= MAX_BLOCK_SIGOPS)
-                continue;
+bool SearchForCoinStake(CWallet* pwallet, CMutableTransaction& txCoinStake, unsigned int& nTxNewTime)
+{
+    static int64_t nLastCoinStakeSearchTime = GetAdjustedTime(); // only initialized at startup
 
-            // Note that flags: we don't want to set mempool/IsStandard()
-            // policy here, but we still have to ensure that the block we
-            // create only contains transactions that are valid in new blocks.
-            CValidationState state;
-            if (!CheckInputs(tx, state, view, true, MANDATORY_SCRIPT_VERIFY_FLAGS, true))
-                continue;
+    boost::this_thread::interruption_point();
+    CBlockHeader header;
+    header.nTime = GetAdjustedTime();
+    unsigned int nBits = GetNextWorkRequired(chainActive.Tip(), &header, true);
+    int64_t nSearchTime = header.nTime; // search to current time
+    if (nSearchTime < nLastCoinStakeSearchTime)
+        return false;
+
+    CPerfTimer timer(histKernelSearch);
+    bool fStakeFound = pwallet->CreateCoinStake(*pwallet, nBits, nSearchTime - nLastCoinStakeSearchTime, txCoinStake, nTxNewTime);
+    nLastCoinStakeSearchInterval = nSearchTime - nLastCoinStakeSearchTime;
+    nLastCoinStakeSearchTime = nSearchTime;
+    return fStakeFound;
+}
 
-            CTxUndo txundo;
-            UpdateCoins(tx, state, view, txundo, nHeight);
+CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn, CWallet* pwallet, bool fProofOfStake, const CMutableTransaction* ptxCoinStake, unsigned int nCoinStakeTime)
+{
+    CReserveKey reservekey(pwallet);
 
-            // Added
-            pblock->vtx.push_back(tx);
-            pblocktemplate->vTxFees.push_back(nTxFees);
-            pblocktemplate->vTxSigOps.push_back(nTxSigOps);
-            nBlockSize += nTxSize;
-            ++nBlockTx;
-            nBlockSigOps += nTxSigOps;
-            nFees += nTxFees;
+    // Create new block
+    std::unique_ptr<CBlockTemplate> pblocktemplate(new CBlockTemplate());
+    if (!pblocktemplate.get())
+        return NULL;
+    CBlock* pblock = &pblocktemplate->block; // pointer for convenience
 
-            if (fPrintPriority) {
-                LogPrintf("priority %.1f fee %s txid %s\n",
-                    dPriority, feeRate.ToString(), tx.GetHash().ToString());
-            }
+    // -regtest only: allow overriding block.nVersion with
+    // -blockversion=N to test forking scenarios
+    if (Params().MineBlocksOnDemand())
+        pblock->nVersion = GetArg("-blockversion", pblock->nVersion);
 
-            // Add transactions that depend on this one to the priority queue
-            if (mapDependers.count(hash)) {
-                BOOST_FOREACH (COrphan* porphan, mapDependers[hash]) {
-                    if (!porphan->setDependsOn.empty()) {
-                        porphan->setDependsOn.erase(hash);
-                        if (porphan->setDependsOn.empty()) {
-                            vecPriority.push_back(TxPriority(porphan->dPriority, porphan->feeRate, porphan->ptx));
-                            std::push_heap(vecPriority.begin(), vecPriority.end(), comparer);
-                        }
-                    }
-                }
-            }
+    // Create coinbase tx
+    CMutableTransaction txNew;
+    txNew.vin.resize(1);
+    txNew.vin[0].prevout.SetNull();
+    txNew.vout.resize(1);
+    txNew.vout[0].scriptPubKey = scriptPubKeyIn;
+    pblock->vtx.push_back(MakeTransactionRef(txNew));
+    pblocktemplate->vTxFees.push_back(-1);   // updated at end
+    pblocktemplate->vTxSigOps.push_back(-1); // updated at end
+
+    // ppcoin: if coinstake available add coinstake tx
+    if (fProofOfStake) {
+        CMutableTransaction txCoinStake;
+        unsigned int nTxNewTime = 0;
+        if (ptxCoinStake) {
+            txCoinStake = *ptxCoinStake;
+            nTxNewTime = nCoinStakeTime;
+        } else if (!SearchForCoinStake(pwallet, txCoinStake, nTxNewTime)) {
+            return NULL;
         }
+        pblock->nTime = nTxNewTime;
+        txNew.vout[0].SetEmpty();
+        pblock->vtx[0] = MakeTransactionRef(txNew);
+        pblock->vtx.push_back(MakeTransactionRef(txCoinStake));
+    }
+
+    // Collect memory pool transactions into the block
+    CAmount nFees = 0;
+
+    {
+        LOCK2(cs_main, mempool.cs);
 
+        CBlockIndex* pindexPrev = chainActive.Tip();
+        const int nHeight = pindexPrev->nHeight + 1;
+        uint64_t nBlockSize = 1000;
+        uint64_t nBlockTx = 0;
+        if (blockTxSelection.AddTo(*pblocktemplate, pindexPrev, nFees, nBlockSize, nBlockTx)) {
+            counterSelectionReused.Inc();
+        } else {
+            size_t nFirstTx = pblock->vtx.size();
+            SelectMempoolTransactions(*pblocktemplate, pindexPrev, nFees, nBlockSize, nBlockTx);
+            blockTxSelection.Store(*pblocktemplate, nFirstTx, pindexPrev, nFees, nBlockSize, nBlockTx);
+        }
 
         //TODO: Update to use PoW, not PoS hashes
         if (!fProofOfStake) {
@@ -357,10 +448,10 @@ CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn, CWallet* pwallet,
         //LogPrintf("CreateNewBlock(): total size %u\n", nBlockSize);
 
         // Compute final coinbase transaction.
-        pblock->vtx[0].vin[0].scriptSig = CScript() << nHeight << OP_0;
+        txNew.vin[0].scriptSig = CScript() << nHeight << OP_0;
+        pblock->vtx[0] = MakeTransactionRef(txNew);
 
         if (!fProofOfStake) {
-            pblock->vtx[0] = txNew;
             pblocktemplate->vTxFees[0] = -nFees;
         }
         else
@@ -375,7 +466,7 @@ CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn, CWallet* pwallet,
         pblock->nBits = GetNextWorkRequired(pindexPrev, pblock, fProofOfStake);
         
         pblock->nNonce = 0;
-        pblocktemplate->vTxSigOps[0] = GetLegacySigOpCount(pblock->vtx[0]);
+        pblocktemplate->vTxSigOps[0] = GetLegacySigOpCount(*pblock->vtx[0]);
 
         CValidationState state;
         if (!TestBlockValidity(state, *pblock, pindexPrev, false, false)) {
@@ -397,11 +488,11 @@ void IncrementExtraNonce(CBlock* pblock, CBlockIndex* pindexPrev, unsigned int&
     }
     ++nExtraNonce;
     unsigned int nHeight = pindexPrev->nHeight + 1; // Height first in coinbase required for block.version=2
-    CMutableTransaction txCoinbase(pblock->vtx[0]);
+    CMutableTransaction txCoinbase(*pblock->vtx[0]);
     txCoinbase.vin[0].scriptSig = (CScript() << nHeight << CScriptNum(nExtraNonce)) + COINBASE_FLAGS;
     assert(txCoinbase.vin[0].scriptSig.size() <= 100);
 
-    pblock->vtx[0] = txCoinbase;
+    pblock->vtx[0] = MakeTransactionRef(txCoinbase);
     pblock->hashMerkleRoot = pblock->BuildMerkleTree();
 }
 
@@ -415,11 +506,11 @@ void IncrementExtraNonce(CBlock* pblock, unsigned int nHeight, unsigned int& nEx
     }
     ++nExtraNonce;
 
-    CMutableTransaction txCoinbase(pblock->vtx[0]);
+    CMutableTransaction txCoinbase(*pblock->vtx[0]);
     txCoinbase.vin[0].scriptSig = (CScript() << nHeight << CScriptNum(nExtraNonce)) + COINBASE_FLAGS;
     assert(txCoinbase.vin[0].scriptSig.size() <= 100);
 
-    pblock->vtx[0] = txCoinbase;
+    pblock->vtx[0] = MakeTransactionRef(txCoinbase);
     pblock->hashMerkleRoot = pblock->BuildMerkleTree();
 }
 
@@ -431,14 +522,14 @@ void IncrementExtraNonce(CBlock* pblock, unsigned int nHeight, unsigned int& nEx
 double dHashesPerSec = 0.0;
 int64_t nHPSTimerStart = 0;
 
-CBlockTemplate* CreateNewBlockWithKey(CReserveKey& reservekey, CWallet* pwallet, bool fProofOfStake)
+CBlockTemplate* CreateNewBlockWithKey(CReserveKey& reservekey, CWallet* pwallet, bool fProofOfStake, const CMutableTransaction* ptxCoinStake, unsigned int nCoinStakeTime)
 {
     CPubKey pubkey;
     if (!reservekey.GetReservedKey(pubkey))
         return NULL;
 
     CScript scriptPubKey = CScript() << ToByteVector(pubkey) << OP_CHECKSIG;
-    return CreateNewBlock(scriptPubKey, pwallet, fProofOfStake);
+    return CreateNewBlock(scriptPubKey, pwallet, fProofOfStake, ptxCoinStake, nCoinStakeTime);
 }
 
 static bool ProcessBlockFound(CBlock* pblock, CWallet& wallet, CReserveKey& reservekey, bool fProofOfStake)
@@ -446,10 +537,10 @@ static bool ProcessBlockFound(CBlock* pblock, CWallet& wallet, CReserveKey& rese
     LogPrintf("%s\n", pblock->ToString());
     if (fProofOfStake)
     {
-        LogPrintf("generated %s\n", FormatMoney(pblock->vtx[1].vout[0].nValue));
+        LogPrintf("generated %s\n", FormatMoney(pblock->vtx[1]->vout[0].nValue));
     }
     else {
-        LogPrintf("generated %s\n", FormatMoney(pblock->vtx[0].vout[0].nValue));
+        LogPrintf("generated %s\n", FormatMoney(pblock->vtx[0]->vout[0].nValue));
     }
 
     // Found a solution
@@ -559,7 +650,18 @@ void BitcoinMiner(CWallet* pwallet, bool fProofOfStake)
             if (!pindexPrev)
                 continue;
 
-            std::unique_ptr<CBlockTemplate> pblocktemplate(CreateNewBlockWithKey(reservekey, pwallet, fProofOfStake));
+            // Look for a stake kernel first and only assemble a block around one
+            CMutableTransaction txCoinStake;
+            unsigned int nCoinStakeTime = 0;
+            if (fProofOfStake && !SearchForCoinStake(pwallet, txCoinStake, nCoinStakeTime)) {
+                // Another search at this tip only pays off once the searched
+                // times have moved on, which the hash interval check waits for
+                if (!mapHashedBlocks.count(pindexPrev->nHeight))
+                    MilliSleep(5000);
+                break;
+            }
+
+            std::unique_ptr<CBlockTemplate> pblocktemplate(CreateNewBlockWithKey(reservekey, pwallet, fProofOfStake, fProofOfStake ? &txCoinStake : NULL, nCoinStakeTime));
             if (!pblocktemplate.get())
                 continue;
 
@@ -14,6 +14,7 @@ class CBlockIndex;
 class CReserveKey;
 class CScript;
 class CWallet;
+struct CMutableTransaction;
 
 static const bool DEFAULT_GENERATE = false;
 static const int DEFAULT_GENERATE_THREADS = 1;
@@ -22,9 +23,17 @@ struct CBlockTemplate;
 
 /** Run the miner threads */
 void GenerateBitcoins(bool fGenerate, CWallet* pwallet, int nThreads);
-/** Generate a new block, without valid proof-of-work */
-CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn, CWallet* pwallet, bool fProofOfStake = false);
-CBlockTemplate* CreateNewBlockWithKey(CReserveKey& reservekey, CWallet* pwallet, bool fProofOfStake = false);
+/**
+ * Look for a stake kernel on the current tip without assembling a block.
+ * On success txCoinStake is the signed coinstake and nTxNewTime the time it was found for.
+ */
+bool SearchForCoinStake(CWallet* pwallet, CMutableTransaction& txCoinStake, unsigned int& nTxNewTime);
+/**
+ * Generate a new block, without valid proof-of-work. A proof-of-stake block
+ * is built around ptxCoinStake if given, otherwise a kernel is searched for first.
+ */
+CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn, CWallet* pwallet, bool fProofOfStake = false, const CMutableTransaction* ptxCoinStake = NULL, unsigned int nCoinStakeTime = 0);
+CBlockTemplate* CreateNewBlockWithKey(CReserveKey& reservekey, CWallet* pwallet, bool fProofOfStake = false, const CMutableTransaction* ptxCoinStake = NULL, unsigned int nCoinStakeTime = 0);
 /** Modify the extranonce in a block */
 void IncrementExtraNonce(CBlock* pblock, CBlockIndex* pindexPrev, unsigned int& nExtraNonce);
 void IncrementExtraNonce(CBlock* pblock, unsigned int nHeight, unsigned int& nExtraNonce);
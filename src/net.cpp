@@ -26,6 +26,10 @@
 #include <fcntl.h>
 #endif
 
+#ifdef HAVE_EPOLL
+#include <sys/epoll.h>
+#endif
+
 #ifdef USE_UPNP
 #include <miniupnpc/miniupnpc.h>
 #include <miniupnpc/miniwget.h>
@@ -61,6 +65,15 @@ namespace
 {
 const int MAX_OUTBOUND_CONNECTIONS = 16;
 
+// Maximum time ThreadSocketHandler waits for socket events
+const int SOCKET_EVENTS_TIMEOUT_MILLISECONDS = 50;
+
+// Maximum number of events fetched by a single epoll_wait call
+const int EPOLL_MAX_EVENTS = 256;
+
+// Maximum number of queued messages handed to the kernel by one sendmsg call
+const int SEND_IOV_MAX = 64;
+
 struct ListenSocket {
     SOCKET socket;
     bool whitelisted;
@@ -85,10 +98,15 @@ static std::vector<ListenSocket> vhListenSocket;
 CAddrMan addrman;
 int nMaxConnections = 125;
 bool fAddressesInitialized = false;
+SocketEventsMode nSocketEventsMode = SOCKETEVENTS_SELECT;
+#ifdef HAVE_EPOLL
+static int epollfd = -1;
+#endif
 
 vector<CNode*> vNodes;
 CCriticalSection cs_vNodes;
-map<CInv, CDataStream> mapRelay;
+map<CInv, CSerializedNetMsgRef> mapRelay;
+CRecvBufferPool recvBufferPool;
 deque<pair<int64_t, CInv> > vRelayExpiration;
 CCriticalSection cs_mapRelay;
 limitedmap<CInv, int64_t> mapAlreadyAskedFor(MAX_INV_SZ);
@@ -106,12 +124,96 @@ NodeId nLastNodeId = 0;
 CCriticalSection cs_nLastNodeId;
 
 static CSemaphore* semOutbound = NULL;
-boost::condition_variable messageHandlerCondition;
+
+// Wakes ThreadMessageHandler as soon as a complete message has been received
+static boost::mutex mutexMsgProc;
+static boost::condition_variable condMsgProc;
+static bool fMsgProcWake = false;
 
 // Signals for message handling
 static CNodeSignals g_signals;
 CNodeSignals& GetNodeSignals() { return g_signals; }
 
+bool SetSocketEventsMode(const std::string& strMode)
+{
+    if (strMode == "select") {
+        nSocketEventsMode = SOCKETEVENTS_SELECT;
+        return true;
+    }
+#ifdef HAVE_EPOLL
+    if (strMode == "epoll") {
+        if (epollfd == -1) {
+            epollfd = epoll_create1(EPOLL_CLOEXEC);
+            if (epollfd == -1) {
+                LogPrintf("%s : epoll_create1 failed: %s\n", __func__, NetworkErrorString(errno));
+                return false;
+            }
+        }
+        nSocketEventsMode = SOCKETEVENTS_EPOLL;
+        return true;
+    }
+#endif
+    return false;
+}
+
+std::string GetSocketEventsModeName()
+{
+    switch (nSocketEventsMode) {
+    case SOCKETEVENTS_EPOLL:
+        return "epoll";
+    case SOCKETEVENTS_SELECT:
+    default:
+        return "select";
+    }
+}
+
+bool IsSocketEventsSelectable(SOCKET hSocket)
+{
+    // epoll has no FD_SETSIZE limit
+    if (nSocketEventsMode == SOCKETEVENTS_EPOLL)
+        return true;
+    return IsSelectableSocket(hSocket);
+}
+
+// Add a peer socket to the epoll set. Readiness is edge-triggered and is
+// tracked in CNode::fHasRecvData / CNode::fCanSendData.
+static bool RegisterNodeEvents(CNode* pnode)
+{
+#ifdef HAVE_EPOLL
+    if (nSocketEventsMode != SOCKETEVENTS_EPOLL || pnode->hSocket == INVALID_SOCKET)
+        return true;
+
+    struct epoll_event event;
+    event.data.ptr = pnode;
+    event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    if (epoll_ctl(epollfd, EPOLL_CTL_ADD, pnode->hSocket, &event) != 0) {
+        LogPrintf("%s : epoll_ctl failed for peer=%d: %s\n", __func__, pnode->id, NetworkErrorString(errno));
+        return false;
+    }
+#endif
+    return true;
+}
+
+static void UnregisterNodeEvents(CNode* pnode)
+{
+#ifdef HAVE_EPOLL
+    if (nSocketEventsMode != SOCKETEVENTS_EPOLL || pnode->hSocket == INVALID_SOCKET)
+        return;
+
+    if (epoll_ctl(epollfd, EPOLL_CTL_DEL, pnode->hSocket, NULL) != 0)
+        LogPrint("net", "%s : epoll_ctl failed for peer=%d: %s\n", __func__, pnode->id, NetworkErrorString(errno));
+#endif
+}
+
+void WakeMessageHandler()
+{
+    {
+        boost::lock_guard<boost::mutex> lock(mutexMsgProc);
+        fMsgProcWake = true;
+    }
+    condMsgProc.notify_one();
+}
+
 void AddOneShot(string strDest)
 {
     LOCK(cs_vOneShots);
@@ -404,7 +506,7 @@ CNode* ConnectNode(CAddress addrConnect, const char* pszDest, bool CoinMixMaster
     bool proxyConnectionFailed = false;
     if (pszDest ? ConnectSocketByName(addrConnect, hSocket, pszDest, Params().GetDefaultPort(), nConnectTimeout, &proxyConnectionFailed) :
                   ConnectSocket(addrConnect, hSocket, nConnectTimeout, &proxyConnectionFailed)) {
-        if (!IsSelectableSocket(hSocket)) {
+        if (!IsSocketEventsSelectable(hSocket)) {
             LogPrintf("Cannot create connection: non-selectable socket created (fd >= FD_SETSIZE ?)\n");
             CloseSocket(hSocket);
             return NULL;
@@ -415,6 +517,8 @@ CNode* ConnectNode(CAddress addrConnect, const char* pszDest, bool CoinMixMaster
         // Add node
         CNode* pnode = new CNode(hSocket, addrConnect, pszDest ? pszDest : "", false);
         pnode->AddRef();
+        if (!RegisterNodeEvents(pnode))
+            pnode->CloseSocketDisconnect();
 
         {
             LOCK(cs_vNodes);
@@ -439,13 +543,16 @@ void CNode::CloseSocketDisconnect()
     fDisconnect = true;
     if (hSocket != INVALID_SOCKET) {
         LogPrint("net", "disconnecting peer=%d\n", id);
+        UnregisterNodeEvents(this);
         CloseSocket(hSocket);
     }
 
     // in case this fails, we'll empty the recv buffer when the CNode is deleted
     TRY_LOCK(cs_vRecvMsg, lockRecv);
-    if (lockRecv)
+    if (lockRecv) {
         vRecvMsg.clear();
+        nRecvSize = 0;
+    }
 }
 
 void CNode::PushVersion()
@@ -536,6 +643,7 @@ void CNode::copyStats(CNodeStats& stats)
     X(nStartingHeight);
     X(nSendBytes);
     X(nRecvBytes);
+    X(nRecvSize);
     X(fWhitelisted);
 
     // It is common for nodes with good ping times to suddenly become lagged,
@@ -559,37 +667,43 @@ void CNode::copyStats(CNodeStats& stats)
 #undef X
 
 // requires LOCK(cs_vRecvMsg)
-bool CNode::ReceiveMsgBytes(const char* pch, unsigned int nBytes)
+bool CNode::ReceiveMsgBytes(const char* pch, unsigned int nBytes, bool& complete)
 {
+    complete = false;
     while (nBytes > 0) {
         // get current incomplete message, or create a new one
         if (vRecvMsg.empty() ||
             vRecvMsg.back().complete())
-            vRecvMsg.push_back(CNetMessage(SER_NETWORK, nRecvVersion));
+            vRecvMsg.emplace_back(SER_NETWORK, nRecvVersion);
 
         CNetMessage& msg = vRecvMsg.back();
 
         // absorb network data
         int handled;
-        if (!msg.in_data)
+        if (!msg.in_data) {
             handled = msg.readHeader(pch, nBytes);
-        else
+            if (handled < 0)
+                return false;
+
+            if (msg.in_data) {
+                if (msg.hdr.nMessageSize > MAX_PROTOCOL_MESSAGE_LENGTH) {
+                    LogPrint("net", "Oversized message from peer=%i, disconnecting", GetId());
+                    return false;
+                }
+                nRecvSize += msg.hdr.nMessageSize + CMessageHeader::HEADER_SIZE;
+            }
+        } else
             handled = msg.readData(pch, nBytes);
 
         if (handled < 0)
             return false;
 
-        if (msg.in_data && msg.hdr.nMessageSize > MAX_PROTOCOL_MESSAGE_LENGTH) {
-            LogPrint("net", "Oversized message from peer=%i, disconnecting", GetId());
-            return false;
-        }
-
         pch += handled;
         nBytes -= handled;
 
         if (msg.complete()) {
             msg.nTime = GetTimeMicros();
-            messageHandlerCondition.notify_one();
+            complete = true;
         }
     }
 
@@ -632,8 +746,16 @@ int CNetMessage::readData(const char* pch, unsigned int nBytes)
     unsigned int nCopy = std::min(nRemaining, nBytes);
 
     if (vRecv.size() < nDataPos + nCopy) {
-        // Allocate up to 256 KiB ahead, but never more than the total message size.
-        vRecv.resize(std::min(hdr.nMessageSize, nDataPos + nCopy + 256 * 1024));
+        // Don't trust the declared size for more than a chunk ahead of the
+        // data, a peer could announce large payloads and never send them
+        unsigned int nSize = std::min(hdr.nMessageSize, nDataPos + nCopy + RECV_BUFFER_CHUNK_SIZE);
+        if (vRecv.empty()) {
+            CSerializeData vch;
+            recvBufferPool.Acquire(vch, nSize);
+            vRecv.swap(vch);
+        } else {
+            vRecv.resize(nSize);
+        }
     }
 
     memcpy(&vRecv[nDataPos], pch, nCopy);
@@ -643,26 +765,110 @@ int CNetMessage::readData(const char* pch, unsigned int nBytes)
 }
 
 
+void CRecvBufferPool::Acquire(CSerializeData& vch, unsigned int nSize)
+{
+    int nClass = 0;
+    while (nClass < NUM_CLASSES && (MIN_CLASS_SIZE << nClass) < nSize)
+        nClass++;
+
+    if (nClass < NUM_CLASSES) {
+        LOCK(cs);
+        if (!vFree[nClass].empty()) {
+            vch.swap(vFree[nClass].back());
+            vFree[nClass].pop_back();
+            nPooledBytes -= vch.capacity();
+            nHits++;
+        } else {
+            nMisses++;
+        }
+    }
+
+    if (nClass < NUM_CLASSES && vch.capacity() < (MIN_CLASS_SIZE << nClass))
+        vch.reserve(MIN_CLASS_SIZE << nClass);
+    vch.resize(nSize);
+}
+
+void CRecvBufferPool::Release(CSerializeData& vch)
+{
+    if (vch.capacity() < MIN_CLASS_SIZE)
+        return;
+
+    // File the buffer under the largest class it can serve
+    int nClass = 0;
+    while (nClass + 1 < NUM_CLASSES && (MIN_CLASS_SIZE << (nClass + 1)) <= vch.capacity())
+        nClass++;
+
+    LOCK(cs);
+    if (nPooledBytes + vch.capacity() > MAX_POOLED_BYTES)
+        return;
+    nPooledBytes += vch.capacity();
+    vch.clear();
+    vFree[nClass].push_back(CSerializeData());
+    vFree[nClass].back().swap(vch);
+}
+
+void CRecvBufferPool::GetStats(size_t& nPooledBytesOut, uint64_t& nHitsOut, uint64_t& nMissesOut)
+{
+    LOCK(cs);
+    nPooledBytesOut = nPooledBytes;
+    nHitsOut = nHits;
+    nMissesOut = nMisses;
+}
+
+
 // requires LOCK(cs_vSend)
 void SocketSendData(CNode* pnode)
 {
-    std::deque<CSerializeData>::iterator it = pnode->vSendMsg.begin();
+    std::deque<CSerializedNetMsgRef>::iterator it = pnode->vSendMsg.begin();
 
     while (it != pnode->vSendMsg.end()) {
-        const CSerializeData& data = *it;
-        assert(data.size() > pnode->nSendOffset);
-        int nBytes = send(pnode->hSocket, &data[pnode->nSendOffset], data.size() - pnode->nSendOffset, MSG_NOSIGNAL | MSG_DONTWAIT);
+        assert((*it)->size() > pnode->nSendOffset);
+#ifndef WIN32
+        // Gather as many queued messages as possible into one system call. The
+        // buffers may be shared with other peers and are sent without copying.
+        struct iovec iov[SEND_IOV_MAX];
+        int nIov = 0;
+        size_t nRequested = 0;
+        size_t nOffset = pnode->nSendOffset;
+        for (std::deque<CSerializedNetMsgRef>::iterator jt = it; jt != pnode->vSendMsg.end() && nIov < SEND_IOV_MAX; jt++, nIov++) {
+            const CSerializeData& data = **jt;
+            iov[nIov].iov_base = (void*)&data[nOffset];
+            iov[nIov].iov_len = data.size() - nOffset;
+            nRequested += iov[nIov].iov_len;
+            nOffset = 0;
+        }
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = nIov;
+        int nBytes = sendmsg(pnode->hSocket, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+#else
+        const CSerializeData& data = **it;
+        size_t nRequested = data.size() - pnode->nSendOffset;
+        int nBytes = send(pnode->hSocket, &data[pnode->nSendOffset], nRequested, MSG_NOSIGNAL | MSG_DONTWAIT);
+#endif
         if (nBytes > 0) {
             pnode->nLastSend = GetTime();
             pnode->nSendBytes += nBytes;
-            pnode->nSendOffset += nBytes;
             pnode->RecordBytesSent(nBytes);
-            if (pnode->nSendOffset == data.size()) {
+
+            // Drop the messages that went out completely
+            size_t nSent = nBytes;
+            while (nSent > 0) {
+                const CSerializeData& data = **it;
+                size_t nLeft = data.size() - pnode->nSendOffset;
+                if (nSent < nLeft) {
+                    pnode->nSendOffset += nSent;
+                    break;
+                }
+                nSent -= nLeft;
                 pnode->nSendOffset = 0;
                 pnode->nSendSize -= data.size();
                 it++;
-            } else {
-                // could not send full message; stop sending more
+            }
+
+            if ((size_t)nBytes < nRequested) {
+                // could not send everything; stop sending more
                 break;
             }
         } else {
@@ -688,9 +894,212 @@ void SocketSendData(CNode* pnode)
 
 static list<CNode*> vNodesDisconnected;
 
+// Implement the following logic:
+// * If there is data to send, wait for sending data. As this only
+//   happens when optimistic write failed, we choose to first drain the
+//   write buffer in this case before receiving more. This avoids
+//   needlessly queueing received data, if the remote peer is not themselves
+//   receiving data. This means properly utilizing TCP flow control signalling.
+// * Otherwise, if there is no (complete) message in the receive buffer,
+//   or there is space left in the buffer, wait for receiving data.
+// * (if neither of the above applies, there is certainly one message
+//   in the receiver buffer ready to be processed).
+// Together, that means that at least one of the following is always possible,
+// so we don't deadlock:
+// * We send some data.
+// * We wait for data to be received (and disconnect after timeout).
+// * We process a message in the buffer (message handler thread).
+static void GetNodeSocketInterest(CNode* pnode, bool& fWantRecv, bool& fWantSend)
+{
+    fWantRecv = false;
+    fWantSend = false;
+    {
+        TRY_LOCK(pnode->cs_vSend, lockSend);
+        if (lockSend && !pnode->vSendMsg.empty()) {
+            fWantSend = true;
+            return;
+        }
+    }
+    {
+        TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
+        if (lockRecv && (pnode->vRecvMsg.empty() || !pnode->vRecvMsg.front().complete() ||
+                            pnode->GetTotalRecvSize() <= ReceiveFloodSize()))
+            fWantRecv = true;
+    }
+}
+
+// Wait for socket readiness with select(). Rebuilds the fd sets from vNodes
+// on every call and stores the result in the per-node readiness flags.
+// Returns true if a listening socket is ready to accept.
+static bool SocketEventsSelect()
+{
+    struct timeval timeout;
+    timeout.tv_sec = 0;
+    timeout.tv_usec = SOCKET_EVENTS_TIMEOUT_MILLISECONDS * 1000; // frequency to poll pnode->vSend
+
+    fd_set fdsetRecv;
+    fd_set fdsetSend;
+    fd_set fdsetError;
+    FD_ZERO(&fdsetRecv);
+    FD_ZERO(&fdsetSend);
+    FD_ZERO(&fdsetError);
+    SOCKET hSocketMax = 0;
+    bool have_fds = false;
+
+    BOOST_FOREACH (const ListenSocket& hListenSocket, vhListenSocket) {
+        FD_SET(hListenSocket.socket, &fdsetRecv);
+        hSocketMax = max(hSocketMax, hListenSocket.socket);
+        have_fds = true;
+    }
+
+    {
+        LOCK(cs_vNodes);
+        BOOST_FOREACH (CNode* pnode, vNodes) {
+            if (pnode->hSocket == INVALID_SOCKET)
+                continue;
+            FD_SET(pnode->hSocket, &fdsetError);
+            hSocketMax = max(hSocketMax, pnode->hSocket);
+            have_fds = true;
+
+            bool fWantRecv, fWantSend;
+            GetNodeSocketInterest(pnode, fWantRecv, fWantSend);
+            if (fWantSend)
+                FD_SET(pnode->hSocket, &fdsetSend);
+            else if (fWantRecv)
+                FD_SET(pnode->hSocket, &fdsetRecv);
+        }
+    }
+
+    int nSelect = select(have_fds ? hSocketMax + 1 : 0,
+        &fdsetRecv, &fdsetSend, &fdsetError, &timeout);
+    boost::this_thread::interruption_point();
+
+    if (nSelect == SOCKET_ERROR) {
+        if (have_fds) {
+            int nErr = WSAGetLastError();
+            LogPrintf("socket select error %s\n", NetworkErrorString(nErr));
+            for (unsigned int i = 0; i <= hSocketMax; i++)
+                FD_SET(i, &fdsetRecv);
+        }
+        FD_ZERO(&fdsetSend);
+        FD_ZERO(&fdsetError);
+        MilliSleep(timeout.tv_usec / 1000);
+    }
+
+    bool fListenReady = false;
+    BOOST_FOREACH (const ListenSocket& hListenSocket, vhListenSocket) {
+        if (hListenSocket.socket != INVALID_SOCKET && FD_ISSET(hListenSocket.socket, &fdsetRecv))
+            fListenReady = true;
+    }
+
+    {
+        LOCK(cs_vNodes);
+        BOOST_FOREACH (CNode* pnode, vNodes) {
+            if (pnode->hSocket == INVALID_SOCKET) {
+                pnode->fHasRecvData = false;
+                pnode->fCanSendData = false;
+                continue;
+            }
+            pnode->fHasRecvData = FD_ISSET(pnode->hSocket, &fdsetRecv) || FD_ISSET(pnode->hSocket, &fdsetError);
+            pnode->fCanSendData = FD_ISSET(pnode->hSocket, &fdsetSend);
+        }
+    }
+
+    return fListenReady;
+}
+
+#ifdef HAVE_EPOLL
+// Wait for socket readiness with epoll. Peer sockets are registered once on
+// connect (see RegisterNodeEvents) so the cost of a wakeup only depends on the
+// number of sockets that actually became ready. If fOnlyPoll is set a peer
+// still has buffered data from the last round and we must not block.
+// Returns true if a listening socket is ready to accept.
+static bool SocketEventsEpoll(bool fOnlyPoll)
+{
+    struct epoll_event events[EPOLL_MAX_EVENTS];
+    int nEvents = epoll_wait(epollfd, events, EPOLL_MAX_EVENTS, fOnlyPoll ? 0 : SOCKET_EVENTS_TIMEOUT_MILLISECONDS);
+    boost::this_thread::interruption_point();
+
+    if (nEvents < 0) {
+        int nErr = WSAGetLastError();
+        if (nErr != WSAEINTR) {
+            LogPrintf("socket epoll_wait error %s\n", NetworkErrorString(nErr));
+            MilliSleep(SOCKET_EVENTS_TIMEOUT_MILLISECONDS);
+        }
+        return false;
+    }
+
+    bool fListenReady = false;
+    for (int i = 0; i < nEvents; i++) {
+        // Listening sockets are registered without a node pointer. Nodes are
+        // only deleted by this thread, so the pointer stays valid here even if
+        // another thread closed the socket in the meantime.
+        CNode* pnode = (CNode*)events[i].data.ptr;
+        if (pnode == NULL) {
+            fListenReady = true;
+            continue;
+        }
+        if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+            pnode->fHasRecvData = true;
+        if (events[i].events & EPOLLOUT)
+            pnode->fCanSendData = true;
+    }
+
+    return fListenReady;
+}
+#endif
+
+static void AcceptConnection(const ListenSocket& hListenSocket)
+{
+    struct sockaddr_storage sockaddr;
+    socklen_t len = sizeof(sockaddr);
+    SOCKET hSocket = accept(hListenSocket.socket, (struct sockaddr*)&sockaddr, &len);
+    CAddress addr;
+    int nInbound = 0;
+
+    if (hSocket != INVALID_SOCKET)
+        if (!addr.SetSockAddr((const struct sockaddr*)&sockaddr))
+            LogPrintf("Warning: Unknown socket family\n");
+
+    bool whitelisted = hListenSocket.whitelisted || CNode::IsWhitelistedRange(addr);
+    {
+        LOCK(cs_vNodes);
+        BOOST_FOREACH (CNode* pnode, vNodes)
+            if (pnode->fInbound)
+                nInbound++;
+    }
+
+    if (hSocket == INVALID_SOCKET) {
+        int nErr = WSAGetLastError();
+        if (nErr != WSAEWOULDBLOCK)
+            LogPrintf("socket error accept failed: %s\n", NetworkErrorString(nErr));
+    } else if (!IsSocketEventsSelectable(hSocket)) {
+        LogPrintf("connection from %s dropped: non-selectable socket\n", addr.ToString());
+        CloseSocket(hSocket);
+    } else if (nInbound >= nMaxConnections - MAX_OUTBOUND_CONNECTIONS) {
+        LogPrint("net", "connection from %s dropped (full)\n", addr.ToString());
+        CloseSocket(hSocket);
+    } else if (CNode::IsBanned(addr) && !whitelisted) {
+        LogPrintf("connection from %s dropped (banned)\n", addr.ToString());
+        CloseSocket(hSocket);
+    } else {
+        CNode* pnode = new CNode(hSocket, addr, "", true);
+        pnode->AddRef();
+        pnode->fWhitelisted = whitelisted;
+        if (!RegisterNodeEvents(pnode))
+            pnode->CloseSocketDisconnect();
+
+        {
+            LOCK(cs_vNodes);
+            vNodes.push_back(pnode);
+        }
+    }
+}
+
 void ThreadSocketHandler()
 {
     unsigned int nPrevNodeCount = 0;
+    bool fMoreWork = false;
     while (true) {
         //
         // Disconnect nodes
@@ -749,135 +1158,30 @@ void ThreadSocketHandler()
         }
 
         //
-        // Find which sockets have data to receive
+        // Wait for socket events
         //
-        struct timeval timeout;
-        timeout.tv_sec = 0;
-        timeout.tv_usec = 50000; // frequency to poll pnode->vSend
-
-        fd_set fdsetRecv;
-        fd_set fdsetSend;
-        fd_set fdsetError;
-        FD_ZERO(&fdsetRecv);
-        FD_ZERO(&fdsetSend);
-        FD_ZERO(&fdsetError);
-        SOCKET hSocketMax = 0;
-        bool have_fds = false;
-
-        BOOST_FOREACH (const ListenSocket& hListenSocket, vhListenSocket) {
-            FD_SET(hListenSocket.socket, &fdsetRecv);
-            hSocketMax = max(hSocketMax, hListenSocket.socket);
-            have_fds = true;
-        }
-
-        {
-            LOCK(cs_vNodes);
-            BOOST_FOREACH (CNode* pnode, vNodes) {
-                if (pnode->hSocket == INVALID_SOCKET)
-                    continue;
-                FD_SET(pnode->hSocket, &fdsetError);
-                hSocketMax = max(hSocketMax, pnode->hSocket);
-                have_fds = true;
-
-                // Implement the following logic:
-                // * If there is data to send, select() for sending data. As this only
-                //   happens when optimistic write failed, we choose to first drain the
-                //   write buffer in this case before receiving more. This avoids
-                //   needlessly queueing received data, if the remote peer is not themselves
-                //   receiving data. This means properly utilizing TCP flow control signalling.
-                // * Otherwise, if there is no (complete) message in the receive buffer,
-                //   or there is space left in the buffer, select() for receiving data.
-                // * (if neither of the above applies, there is certainly one message
-                //   in the receiver buffer ready to be processed).
-                // Together, that means that at least one of the following is always possible,
-                // so we don't deadlock:
-                // * We send some data.
-                // * We wait for data to be received (and disconnect after timeout).
-                // * We process a message in the buffer (message handler thread).
-                {
-                    TRY_LOCK(pnode->cs_vSend, lockSend);
-                    if (lockSend && !pnode->vSendMsg.empty()) {
-                        FD_SET(pnode->hSocket, &fdsetSend);
-                        continue;
-                    }
-                }
-                {
-                    TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
-                    if (lockRecv && (pnode->vRecvMsg.empty() || !pnode->vRecvMsg.front().complete() ||
-                                        pnode->GetTotalRecvSize() <= ReceiveFloodSize()))
-                        FD_SET(pnode->hSocket, &fdsetRecv);
-                }
-            }
-        }
-
-        int nSelect = select(have_fds ? hSocketMax + 1 : 0,
-            &fdsetRecv, &fdsetSend, &fdsetError, &timeout);
-        boost::this_thread::interruption_point();
-
-        if (nSelect == SOCKET_ERROR) {
-            if (have_fds) {
-                int nErr = WSAGetLastError();
-                LogPrintf("socket select error %s\n", NetworkErrorString(nErr));
-                for (unsigned int i = 0; i <= hSocketMax; i++)
-                    FD_SET(i, &fdsetRecv);
-            }
-            FD_ZERO(&fdsetSend);
-            FD_ZERO(&fdsetError);
-            MilliSleep(timeout.tv_usec / 1000);
-        }
+        bool fListenReady;
+#ifdef HAVE_EPOLL
+        if (nSocketEventsMode == SOCKETEVENTS_EPOLL)
+            fListenReady = SocketEventsEpoll(fMoreWork);
+        else
+#endif
+            fListenReady = SocketEventsSelect();
 
         //
         // Accept new connections
         //
-        BOOST_FOREACH (const ListenSocket& hListenSocket, vhListenSocket) {
-            if (hListenSocket.socket != INVALID_SOCKET && FD_ISSET(hListenSocket.socket, &fdsetRecv)) {
-                struct sockaddr_storage sockaddr;
-                socklen_t len = sizeof(sockaddr);
-                SOCKET hSocket = accept(hListenSocket.socket, (struct sockaddr*)&sockaddr, &len);
-                CAddress addr;
-                int nInbound = 0;
-
-                if (hSocket != INVALID_SOCKET)
-                    if (!addr.SetSockAddr((const struct sockaddr*)&sockaddr))
-                        LogPrintf("Warning: Unknown socket family\n");
-
-                bool whitelisted = hListenSocket.whitelisted || CNode::IsWhitelistedRange(addr);
-                {
-                    LOCK(cs_vNodes);
-                    BOOST_FOREACH (CNode* pnode, vNodes)
-                        if (pnode->fInbound)
-                            nInbound++;
-                }
-
-                if (hSocket == INVALID_SOCKET) {
-                    int nErr = WSAGetLastError();
-                    if (nErr != WSAEWOULDBLOCK)
-                        LogPrintf("socket error accept failed: %s\n", NetworkErrorString(nErr));
-                } else if (!IsSelectableSocket(hSocket)) {
-                    LogPrintf("connection from %s dropped: non-selectable socket\n", addr.ToString());
-                    CloseSocket(hSocket);
-                } else if (nInbound >= nMaxConnections - MAX_OUTBOUND_CONNECTIONS) {
-                    LogPrint("net", "connection from %s dropped (full)\n", addr.ToString());
-                    CloseSocket(hSocket);
-                } else if (CNode::IsBanned(addr) && !whitelisted) {
-                    LogPrintf("connection from %s dropped (banned)\n", addr.ToString());
-                    CloseSocket(hSocket);
-                } else {
-                    CNode* pnode = new CNode(hSocket, addr, "", true);
-                    pnode->AddRef();
-                    pnode->fWhitelisted = whitelisted;
-
-                    {
-                        LOCK(cs_vNodes);
-                        vNodes.push_back(pnode);
-                    }
-                }
+        if (fListenReady) {
+            BOOST_FOREACH (const ListenSocket& hListenSocket, vhListenSocket) {
+                if (hListenSocket.socket != INVALID_SOCKET)
+                    AcceptConnection(hListenSocket);
             }
         }
 
         //
         // Service each socket
         //
+        fMoreWork = false;
         vector<CNode*> vNodesCopy;
         {
             LOCK(cs_vNodes);
@@ -893,19 +1197,33 @@ void ThreadSocketHandler()
             //
             if (pnode->hSocket == INVALID_SOCKET)
                 continue;
-            if (FD_ISSET(pnode->hSocket, &fdsetRecv) || FD_ISSET(pnode->hSocket, &fdsetError)) {
-                TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
-                if (lockRecv) {
-                    {
+            bool fWantRecv = pnode->fHasRecvData;
+            if (fWantRecv && nSocketEventsMode == SOCKETEVENTS_EPOLL) {
+                // select() only reported readiness for sockets we asked for,
+                // epoll reports everything, so apply the same policy here
+                bool fWantSend;
+                GetNodeSocketInterest(pnode, fWantRecv, fWantSend);
+            }
+            if (fWantRecv) {
+                bool fComplete = false;
+                {
+                    TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
+                    if (lockRecv) {
                         // typical socket buffer is 8K-64K
                         char pchBuf[0x10000];
                         int nBytes = recv(pnode->hSocket, pchBuf, sizeof(pchBuf), MSG_DONTWAIT);
                         if (nBytes > 0) {
-                            if (!pnode->ReceiveMsgBytes(pchBuf, nBytes))
+                            if (!pnode->ReceiveMsgBytes(pchBuf, nBytes, fComplete))
                                 pnode->CloseSocketDisconnect();
                             pnode->nLastRecv = GetTime();
                             pnode->nRecvBytes += nBytes;
                             pnode->RecordBytesRecv(nBytes);
+                            // A short read drained the socket. Otherwise more data may be
+                            // pending, for which edge-triggered epoll won't report again.
+                            if ((unsigned int)nBytes < sizeof(pchBuf))
+                                pnode->fHasRecvData = false;
+                            else
+                                fMoreWork = true;
                         } else if (nBytes == 0) {
                             // socket closed gracefully
                             if (!pnode->fDisconnect)
@@ -914,7 +1232,9 @@ void ThreadSocketHandler()
                         } else if (nBytes < 0) {
                             // error
                             int nErr = WSAGetLastError();
-                            if (nErr != WSAEWOULDBLOCK && nErr != WSAEMSGSIZE && nErr != WSAEINTR && nErr != WSAEINPROGRESS) {
+                            if (nErr == WSAEWOULDBLOCK) {
+                                pnode->fHasRecvData = false;
+                            } else if (nErr != WSAEMSGSIZE && nErr != WSAEINTR && nErr != WSAEINPROGRESS) {
                                 if (!pnode->fDisconnect)
                                     LogPrintf("socket recv error %s\n", NetworkErrorString(nErr));
                                 pnode->CloseSocketDisconnect();
@@ -922,6 +1242,8 @@ void ThreadSocketHandler()
                         }
                     }
                 }
+                if (fComplete)
+                    WakeMessageHandler();
             }
 
             //
@@ -929,10 +1251,14 @@ void ThreadSocketHandler()
             //
             if (pnode->hSocket == INVALID_SOCKET)
                 continue;
-            if (FD_ISSET(pnode->hSocket, &fdsetSend)) {
+            if (pnode->fCanSendData) {
                 TRY_LOCK(pnode->cs_vSend, lockSend);
-                if (lockSend)
+                if (lockSend && !pnode->vSendMsg.empty()) {
                     SocketSendData(pnode);
+                    // Socket buffer is full, wait for the next writable event
+                    if (!pnode->vSendMsg.empty())
+                        pnode->fCanSendData = false;
+                }
             }
 
             //
@@ -1336,11 +1662,13 @@ bool OpenNetworkConnection(const CAddress& addrConnect, CSemaphoreGrant* grantOu
 
 void ThreadMessageHandler()
 {
-    boost::mutex condition_mutex;
-    boost::unique_lock<boost::mutex> lock(condition_mutex);
-
     SetThreadPriority(THREAD_PRIORITY_BELOW_NORMAL);
     while (true) {
+        {
+            boost::lock_guard<boost::mutex> lock(mutexMsgProc);
+            fMsgProcWake = false;
+        }
+
         vector<CNode*> vNodesCopy;
         {
             LOCK(cs_vNodes);
@@ -1393,8 +1721,16 @@ void ThreadMessageHandler()
                 pnode->Release();
         }
 
-        if (fSleep)
-            messageHandlerCondition.timed_wait(lock, boost::posix_time::microsec_clock::universal_time() + boost::posix_time::milliseconds(100));
+        if (fSleep) {
+            // Sleep until ThreadSocketHandler hands us a complete message (a wakeup
+            // that arrived while we were processing is not lost) or 100ms passed.
+            boost::unique_lock<boost::mutex> lock(mutexMsgProc);
+            boost::system_time deadline = boost::get_system_time() + boost::posix_time::milliseconds(100);
+            while (!fMsgProcWake) {
+                if (!condMsgProc.timed_wait(lock, deadline))
+                    break;
+            }
+        }
     }
 }
 
@@ -1452,7 +1788,7 @@ bool BindListenPort(const CService& addrBind, string& strError, bool fWhiteliste
         LogPrintf("%s\n", strError);
         return false;
     }
-    if (!IsSelectableSocket(hListenSocket)) {
+    if (!IsSocketEventsSelectable(hListenSocket)) {
         strError = "Error: Couldn't create a listenable socket for incoming connections";
         LogPrintf("%s\n", strError);
         return false;
@@ -1514,6 +1850,22 @@ bool BindListenPort(const CService& addrBind, string& strError, bool fWhiteliste
 
     vhListenSocket.push_back(ListenSocket(hListenSocket, fWhitelisted));
 
+#ifdef HAVE_EPOLL
+    if (nSocketEventsMode == SOCKETEVENTS_EPOLL) {
+        // Level-triggered, and without a node pointer, see SocketEventsEpoll
+        struct epoll_event event;
+        event.data.ptr = NULL;
+        event.events = EPOLLIN;
+        if (epoll_ctl(epollfd, EPOLL_CTL_ADD, hListenSocket, &event) != 0) {
+            strError = strprintf("Error: epoll_ctl for listening socket failed (error %s)", NetworkErrorString(WSAGetLastError()));
+            LogPrintf("%s\n", strError);
+            vhListenSocket.pop_back();
+            CloseSocket(hListenSocket);
+            return false;
+        }
+    }
+#endif
+
     if (addrBind.IsRoutable() && fDiscover && !fWhitelisted)
         AddLocal(addrBind, LOCAL_BIND);
 
@@ -1667,6 +2019,12 @@ public:
         vNodes.clear();
         vNodesDisconnected.clear();
         vhListenSocket.clear();
+#ifdef HAVE_EPOLL
+        if (epollfd != -1) {
+            close(epollfd);
+            epollfd = -1;
+        }
+#endif
         delete semOutbound;
         semOutbound = NULL;
         delete pnodeLocalHost;
@@ -1695,21 +2053,26 @@ void RelayTransaction(const CTransaction& tx)
     RelayTransaction(tx, ss);
 }
 
+// Keep a framed message in relay memory, ProcessGetData serves it from there
+static void AddRelayMessage(const CInv& inv, const CSerializedNetMsgRef& msg)
+{
+    LOCK(cs_mapRelay);
+    // Expire old relay messages
+    while (!vRelayExpiration.empty() && vRelayExpiration.front().first < GetTime()) {
+        mapRelay.erase(vRelayExpiration.front().second);
+        vRelayExpiration.pop_front();
+    }
+
+    // Save original serialized message so newer versions are preserved
+    if (mapRelay.insert(std::make_pair(inv, msg)).second)
+        vRelayExpiration.push_back(std::make_pair(GetTime() + 15 * 60, inv));
+}
+
 void RelayTransaction(const CTransaction& tx, const CDataStream& ss)
 {
     CInv inv(MSG_TX, tx.GetHash());
-    {
-        LOCK(cs_mapRelay);
-        // Expire old relay messages
-        while (!vRelayExpiration.empty() && vRelayExpiration.front().first < GetTime()) {
-            mapRelay.erase(vRelayExpiration.front().second);
-            vRelayExpiration.pop_front();
-        }
+    AddRelayMessage(inv, MakeSerializedNetMsg("tx", ss));
 
-        // Save original serialized message so newer versions are preserved
-        mapRelay.insert(std::make_pair(inv, ss));
-        vRelayExpiration.push_back(std::make_pair(GetTime() + 15 * 60, inv));
-    }
     LOCK(cs_vNodes);
     BOOST_FOREACH (CNode* pnode, vNodes) {
         if (!pnode->fRelayTxes)
@@ -1725,7 +2088,10 @@ void RelayTransaction(const CTransaction& tx, const CDataStream& ss)
 
 void RelayTransactionLockReq(const CTransaction& tx, bool relayToAll)
 {
-    CInv inv(MSG_TXLOCK_REQUEST, tx.GetHash());
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss.reserve(1000);
+    ss << tx;
+    CSerializedNetMsgRef msg = MakeSerializedNetMsg("ix", ss);
 
     //broadcast the new lock
     LOCK(cs_vNodes);
@@ -1733,10 +2099,16 @@ void RelayTransactionLockReq(const CTransaction& tx, bool relayToAll)
         if (!relayToAll && !pnode->fRelayTxes)
             continue;
 
-        pnode->PushMessage("ix", tx);
+        pnode->PushSerializedMessage(msg);
     }
 }
 
+void RelayInv(CInv& inv, const CSerializedNetMsgRef& msg)
+{
+    AddRelayMessage(inv, msg);
+    RelayInv(inv);
+}
+
 void RelayInv(CInv& inv)
 {
     LOCK(cs_vNodes);
@@ -1926,10 +2298,13 @@ CNode::CNode(SOCKET hSocketIn, CAddress addrIn, std::string addrNameIn, bool fIn
     nRefCount = 0;
     nSendSize = 0;
     nSendOffset = 0;
+    nRecvSize = 0;
     hashContinue = 0;
     nStartingHeight = -1;
     fGetAddr = false;
     fRelayTxes = false;
+    fHasRecvData = false;
+    fCanSendData = false;
     setInventoryKnown.max_size(SendBufferSize() / 1000);
     pfilter = new CBloomFilter();
     nPingNonceSent = 0;
@@ -1995,6 +2370,37 @@ void CNode::AskFor(const CInv& inv)
     mapAskFor.insert(std::make_pair(nRequestTime, inv));
 }
 
+// Fill in the payload size and checksum of the message header at the start
+// of ss. Returns the payload size.
+static unsigned int SetMessageSizeAndChecksum(CDataStream& ss)
+{
+    // Set the size
+    unsigned int nSize = ss.size() - CMessageHeader::HEADER_SIZE;
+    memcpy((char*)&ss[CMessageHeader::MESSAGE_SIZE_OFFSET], &nSize, sizeof(nSize));
+
+    // Set the checksum
+    uint256 hash = Hash(ss.begin() + CMessageHeader::HEADER_SIZE, ss.end());
+    unsigned int nChecksum = 0;
+    memcpy(&nChecksum, &hash, sizeof(nChecksum));
+    assert(ss.size() >= CMessageHeader::CHECKSUM_OFFSET + sizeof(nChecksum));
+    memcpy((char*)&ss[CMessageHeader::CHECKSUM_OFFSET], &nChecksum, sizeof(nChecksum));
+
+    return nSize;
+}
+
+CSerializedNetMsgRef MakeSerializedNetMsg(const char* pszCommand, const CDataStream& ssPayload)
+{
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss.reserve(CMessageHeader::HEADER_SIZE + ssPayload.size());
+    ss << CMessageHeader(pszCommand, 0);
+    ss += ssPayload;
+    SetMessageSizeAndChecksum(ss);
+
+    std::shared_ptr<CSerializeData> msg = std::make_shared<CSerializeData>();
+    ss.GetAndClear(*msg);
+    return msg;
+}
+
 void CNode::BeginMessage(const char* pszCommand) EXCLUSIVE_LOCK_FUNCTION(cs_vSend)
 {
     ENTER_CRITICAL_SECTION(cs_vSend);
@@ -2028,26 +2434,33 @@ void CNode::EndMessage() UNLOCK_FUNCTION(cs_vSend)
     if (ssSend.size() == 0)
         return;
 
-    // Set the size
-    unsigned int nSize = ssSend.size() - CMessageHeader::HEADER_SIZE;
-    memcpy((char*)&ssSend[CMessageHeader::MESSAGE_SIZE_OFFSET], &nSize, sizeof(nSize));
-
-    // Set the checksum
-    uint256 hash = Hash(ssSend.begin() + CMessageHeader::HEADER_SIZE, ssSend.end());
-    unsigned int nChecksum = 0;
-    memcpy(&nChecksum, &hash, sizeof(nChecksum));
-    assert(ssSend.size() >= CMessageHeader::CHECKSUM_OFFSET + sizeof(nChecksum));
-    memcpy((char*)&ssSend[CMessageHeader::CHECKSUM_OFFSET], &nChecksum, sizeof(nChecksum));
+    unsigned int nSize = SetMessageSizeAndChecksum(ssSend);
 
     LogPrint("net", "(%d bytes) peer=%d\n", nSize, id);
 
-    std::deque<CSerializeData>::iterator it = vSendMsg.insert(vSendMsg.end(), CSerializeData());
-    ssSend.GetAndClear(*it);
-    nSendSize += (*it).size();
+    std::shared_ptr<CSerializeData> msg = std::make_shared<CSerializeData>();
+    ssSend.GetAndClear(*msg);
+    QueueSendMsg(msg);
+
+    LEAVE_CRITICAL_SECTION(cs_vSend);
+}
+
+// requires LOCK(cs_vSend)
+void CNode::QueueSendMsg(const CSerializedNetMsgRef& msg)
+{
+    vSendMsg.push_back(msg);
+    nSendSize += msg->size();
 
     // If write queue empty, attempt "optimistic write"
-    if (it == vSendMsg.begin())
+    if (vSendMsg.size() == 1)
         SocketSendData(this);
+}
 
-    LEAVE_CRITICAL_SECTION(cs_vSend);
+void CNode::PushSerializedMessage(const CSerializedNetMsgRef& msg)
+{
+    LOCK(cs_vSend);
+    const char* pszCommand = &(*msg)[MESSAGE_START_SIZE];
+    LogPrint("net", "sending: %s (%d bytes) peer=%d\n", SanitizeString(std::string(pszCommand, strnlen(pszCommand, CMessageHeader::COMMAND_SIZE))),
+        msg->size() - CMessageHeader::HEADER_SIZE, id);
+    QueueSendMsg(msg);
 }
@@ -21,6 +21,7 @@
 #include "utilstrencodings.h"
 
 #include <deque>
+#include <memory>
 #include <stdint.h>
 
 #ifndef WIN32
@@ -50,6 +51,8 @@ static const unsigned int MAX_INV_SZ = 50000;
 static const unsigned int MAX_ADDR_TO_SEND = 1000;
 /** Maximum length of incoming protocol messages (no message over 2 MiB is currently acceptable). */
 static const unsigned int MAX_PROTOCOL_MESSAGE_LENGTH = 2 * 1024 * 1024;
+/** How far ahead of the payload received so far a message's buffer is allocated */
+static const unsigned int RECV_BUFFER_CHUNK_SIZE = 256 * 1024;
 /** -listen default */
 static const bool DEFAULT_LISTEN = true;
 /** -upnp default */
@@ -61,6 +64,20 @@ static const bool DEFAULT_UPNP = false;
 /** The maximum number of entries in mapAskFor */
 static const size_t MAPASKFOR_MAX_SZ = MAX_INV_SZ;
 
+/** Mechanism used by ThreadSocketHandler to wait for socket readiness */
+enum SocketEventsMode {
+    SOCKETEVENTS_SELECT,
+    SOCKETEVENTS_EPOLL,
+};
+/** -socketevents default */
+#ifdef HAVE_EPOLL
+static const char* const DEFAULT_SOCKETEVENTS = "epoll";
+static const char* const SUPPORTED_SOCKETEVENTS = "select, epoll";
+#else
+static const char* const DEFAULT_SOCKETEVENTS = "select";
+static const char* const SUPPORTED_SOCKETEVENTS = "select";
+#endif
+
 unsigned int ReceiveFloodSize();
 unsigned int SendBufferSize();
 
@@ -78,9 +95,27 @@ bool BindListenPort(const CService& bindAddr, std::string& strError, bool fWhite
 void StartNode(boost::thread_group& threadGroup);
 bool StopNode();
 void SocketSendData(CNode* pnode);
+bool SetSocketEventsMode(const std::string& strMode);
+std::string GetSocketEventsModeName();
+bool IsSocketEventsSelectable(SOCKET hSocket);
+void WakeMessageHandler();
 
 typedef int NodeId;
 
+/** A fully framed network message (header, payload and checksum). It is
+ *  immutable once built, so one buffer can be queued on any number of peers
+ *  without serializing or hashing the payload again.
+ *
+ *  The payload is serialized with PROTOCOL_VERSION rather than the version
+ *  negotiated with each peer. Only share objects whose encoding doesn't
+ *  depend on the stream version: transactions, blocks, pings, votes and the
+ *  like do not, while CAddress and CBlockLocator do and must go through
+ *  PushMessage. */
+typedef std::shared_ptr<const CSerializeData> CSerializedNetMsgRef;
+
+/** Frame an already serialized payload as message pszCommand */
+CSerializedNetMsgRef MakeSerializedNetMsg(const char* pszCommand, const CDataStream& ssPayload);
+
 // Signals for message handling
 struct CNodeSignals {
     boost::signals2::signal<int()> GetHeight;
@@ -126,10 +161,11 @@ extern uint64_t nLocalServices;
 extern uint64_t nLocalHostNonce;
 extern CAddrMan addrman;
 extern int nMaxConnections;
+extern SocketEventsMode nSocketEventsMode;
 
 extern std::vector<CNode*> vNodes;
 extern CCriticalSection cs_vNodes;
-extern std::map<CInv, CDataStream> mapRelay;
+extern std::map<CInv, CSerializedNetMsgRef> mapRelay;
 extern std::deque<std::pair<int64_t, CInv> > vRelayExpiration;
 extern CCriticalSection cs_mapRelay;
 extern limitedmap<CInv, int64_t> mapAlreadyAskedFor;
@@ -163,6 +199,7 @@ public:
     int nStartingHeight;
     uint64_t nSendBytes;
     uint64_t nRecvBytes;
+    size_t nRecvSize;
     bool fWhitelisted;
     double dPingTime;
     double dPingWait;
@@ -170,6 +207,42 @@ public:
 };
 
 
+/**
+ * Recycles receive payload buffers between messages.
+ *
+ * Buffers are kept in power-of-two size classes from 1 KiB up to
+ * MAX_PROTOCOL_MESSAGE_LENGTH. A message takes a buffer for the data that
+ * has arrived plus RECV_BUFFER_CHUNK_SIZE, capped at its declared size, and
+ * grows it the same way as more data arrives. The buffer is returned to the
+ * pool once the message has been processed.
+ */
+class CRecvBufferPool
+{
+public:
+    static const unsigned int MIN_CLASS_SIZE = 1024;
+    static const int NUM_CLASSES = 12;
+    //! Upper bound on the memory kept in the free lists
+    static const size_t MAX_POOLED_BYTES = 32 * 1024 * 1024;
+
+    CRecvBufferPool() : nPooledBytes(0), nHits(0), nMisses(0) {}
+
+    //! Fill vch with a buffer of nSize bytes, reusing a pooled one if possible
+    void Acquire(CSerializeData& vch, unsigned int nSize);
+    //! Hand a buffer back to the pool; vch is left empty
+    void Release(CSerializeData& vch);
+
+    void GetStats(size_t& nPooledBytesOut, uint64_t& nHitsOut, uint64_t& nMissesOut);
+
+private:
+    CCriticalSection cs;
+    std::vector<CSerializeData> vFree[NUM_CLASSES];
+    size_t nPooledBytes;
+    uint64_t nHits;
+    uint64_t nMisses;
+};
+
+extern CRecvBufferPool recvBufferPool;
+
 class CNetMessage
 {
 public:
@@ -193,6 +266,13 @@ public:
         nTime = 0;
     }
 
+    ~CNetMessage()
+    {
+        CSerializeData vch;
+        vRecv.swap(vch);
+        recvBufferPool.Release(vch);
+    }
+
     bool complete() const
     {
         if (!in_data)
@@ -222,11 +302,17 @@ public:
     size_t nSendSize;   // total size of all vSendMsg entries
     size_t nSendOffset; // offset inside the first vSendMsg already sent
     uint64_t nSendBytes;
-    std::deque<CSerializeData> vSendMsg;
+    std::deque<CSerializedNetMsgRef> vSendMsg;
     CCriticalSection cs_vSend;
+    // Readiness as last reported by the socket events backend. Only touched
+    // by ThreadSocketHandler; with edge-triggered epoll these stay set until
+    // a recv/send on the socket would block.
+    bool fHasRecvData;
+    bool fCanSendData;
 
     std::deque<CInv> vRecvGetData;
     std::deque<CNetMessage> vRecvMsg;
+    size_t nRecvSize; // total size of all vRecvMsg entries
     CCriticalSection cs_vRecvMsg;
     uint64_t nRecvBytes;
     int nRecvVersion;
@@ -283,6 +369,9 @@ protected:
     // Basic fuzz-testing
     void Fuzz(int nChance); // modifies ssSend
 
+    // requires LOCK(cs_vSend)
+    void QueueSendMsg(const CSerializedNetMsgRef& msg);
+
 public:
     uint256 hashContinue;
     int nStartingHeight;
@@ -338,14 +427,11 @@ public:
     // requires LOCK(cs_vRecvMsg)
     unsigned int GetTotalRecvSize()
     {
-        unsigned int total = 0;
-        BOOST_FOREACH (const CNetMessage& msg, vRecvMsg)
-            total += msg.vRecv.size() + 24;
-        return total;
+        return nRecvSize;
     }
 
     // requires LOCK(cs_vRecvMsg)
-    bool ReceiveMsgBytes(const char* pch, unsigned int nBytes);
+    bool ReceiveMsgBytes(const char* pch, unsigned int nBytes, bool& complete);
 
     // requires LOCK(cs_vRecvMsg)
     void SetRecvVersion(int nVersionIn)
@@ -417,6 +503,10 @@ public:
 
     void PushVersion();
 
+    // Queue a message that was built once with MakeSerializedNetMsg, e.g. when
+    // relaying the same object to many peers.
+    void PushSerializedMessage(const CSerializedNetMsgRef& msg);
+
 
     void PushMessage(const char* pszCommand)
     {
@@ -657,6 +747,7 @@ void RelayTransaction(const CTransaction& tx);
 void RelayTransaction(const CTransaction& tx, const CDataStream& ss);
 void RelayTransactionLockReq(const CTransaction& tx, bool relayToAll = false);
 void RelayInv(CInv& inv);
+void RelayInv(CInv& inv, const CSerializedNetMsgRef& msg);
 
 /** Access to the (IP) address database (peers.dat) */
 class CAddrDB
@@ -0,0 +1,158 @@
+// Copyright (c) 2017 The Sling core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "perfstats.h"
+
+#include "utiltime.h"
+
+#include <algorithm>
+#include <limits>
+
+// The registries only change while static objects are constructed and
+// destroyed, when no other thread runs, so walking them needs no lock.
+static std::vector<CPerfHistogram*>& HistogramRegistry()
+{
+    static std::vector<CPerfHistogram*> vHistograms;
+    return vHistograms;
+}
+
+static std::vector<CPerfCounter*>& CounterRegistry()
+{
+    static std::vector<CPerfCounter*> vCounters;
+    return vCounters;
+}
+
+uint64_t CPerfHistogramSnapshot::Percentile(double dFraction) const
+{
+    if (nCount == 0)
+        return 0;
+
+    uint64_t nTarget = (uint64_t)(dFraction * nCount + 0.5);
+    if (nTarget < 1)
+        nTarget = 1;
+    uint64_t nSeen = 0;
+    for (size_t i = 0; i < vBuckets.size(); i++) {
+        nSeen += vBuckets[i];
+        if (nSeen >= nTarget) {
+            // Report the top of the bucket, but never beyond what was recorded
+            uint64_t nValue = i + 1 < vBuckets.size() ? CPerfHistogram::BucketLowerBound(i + 1) - 1 : nMax;
+            return std::max(nMin, std::min(nValue, nMax));
+        }
+    }
+    return nMax;
+}
+
+CPerfHistogram::CPerfHistogram(const char* pszNameIn, const char* pszDescriptionIn) : pszName(pszNameIn), pszDescription(pszDescriptionIn), fRegistered(true), nSum(0), nMin(std::numeric_limits<uint64_t>::max()), nMax(0)
+{
+    for (int i = 0; i < NUM_BUCKETS; i++)
+        vBuckets[i].store(0, std::memory_order_relaxed);
+    HistogramRegistry().push_back(this);
+}
+
+CPerfHistogram::CPerfHistogram() : pszName(""), pszDescription(""), fRegistered(false), nSum(0), nMin(std::numeric_limits<uint64_t>::max()), nMax(0)
+{
+    for (int i = 0; i < NUM_BUCKETS; i++)
+        vBuckets[i].store(0, std::memory_order_relaxed);
+}
+
+CPerfHistogram::~CPerfHistogram()
+{
+    // The registry may already be gone when an unregistered static histogram is destroyed
+    if (!fRegistered)
+        return;
+    std::vector<CPerfHistogram*>& vHistograms = HistogramRegistry();
+    vHistograms.erase(std::remove(vHistograms.begin(), vHistograms.end(), this), vHistograms.end());
+}
+
+int CPerfHistogram::BucketIndex(uint64_t nValue)
+{
+    if (nValue < (uint64_t)SUB_BUCKETS)
+        return nValue;
+
+    int nExponent = 63;
+    while (!(nValue >> nExponent))
+        nExponent--;
+    if (nExponent >= MAX_EXPONENT)
+        return NUM_BUCKETS - 1;
+
+    int nShift = nExponent - SUB_BUCKET_BITS;
+    return (nShift + 1) * SUB_BUCKETS + (int)((nValue >> nShift) - SUB_BUCKETS);
+}
+
+uint64_t CPerfHistogram::BucketLowerBound(int nBucket)
+{
+    if (nBucket < SUB_BUCKETS)
+        return nBucket;
+
+    int nShift = nBucket / SUB_BUCKETS - 1;
+    return (uint64_t)(SUB_BUCKETS + nBucket % SUB_BUCKETS) << nShift;
+}
+
+void CPerfHistogram::Add(int64_t nMicros)
+{
+    uint64_t nValue = nMicros > 0 ? nMicros : 0;
+    vBuckets[BucketIndex(nValue)].fetch_add(1, std::memory_order_relaxed);
+    nSum.fetch_add(nValue, std::memory_order_relaxed);
+
+    uint64_t nOld = nMin.load(std::memory_order_relaxed);
+    while (nValue < nOld && !nMin.compare_exchange_weak(nOld, nValue, std::memory_order_relaxed)) {
+    }
+    nOld = nMax.load(std::memory_order_relaxed);
+    while (nValue > nOld && !nMax.compare_exchange_weak(nOld, nValue, std::memory_order_relaxed)) {
+    }
+}
+
+void CPerfHistogram::Reset()
+{
+    for (int i = 0; i < NUM_BUCKETS; i++)
+        vBuckets[i].store(0, std::memory_order_relaxed);
+    nSum.store(0, std::memory_order_relaxed);
+    nMin.store(std::numeric_limits<uint64_t>::max(), std::memory_order_relaxed);
+    nMax.store(0, std::memory_order_relaxed);
+}
+
+void CPerfHistogram::GetSnapshot(CPerfHistogramSnapshot& snapshot) const
+{
+    // The fields are read one at a time, so a snapshot taken while samples
+    // are added can be off by the samples in flight.
+    snapshot.vBuckets.resize(NUM_BUCKETS);
+    snapshot.nCount = 0;
+    for (int i = 0; i < NUM_BUCKETS; i++) {
+        snapshot.vBuckets[i] = vBuckets[i].load(std::memory_order_relaxed);
+        snapshot.nCount += snapshot.vBuckets[i];
+    }
+    snapshot.nSum = nSum.load(std::memory_order_relaxed);
+    snapshot.nMax = nMax.load(std::memory_order_relaxed);
+    snapshot.nMin = snapshot.nCount ? nMin.load(std::memory_order_relaxed) : 0;
+}
+
+const std::vector<CPerfHistogram*>& CPerfHistogram::GetAll()
+{
+    return HistogramRegistry();
+}
+
+CPerfCounter::CPerfCounter(const char* pszNameIn, const char* pszDescriptionIn) : pszName(pszNameIn), pszDescription(pszDescriptionIn), nValue(0)
+{
+    CounterRegistry().push_back(this);
+}
+
+CPerfCounter::~CPerfCounter()
+{
+    std::vector<CPerfCounter*>& vCounters = CounterRegistry();
+    vCounters.erase(std::remove(vCounters.begin(), vCounters.end(), this), vCounters.end());
+}
+
+const std::vector<CPerfCounter*>& CPerfCounter::GetAll()
+{
+    return CounterRegistry();
+}
+
+CPerfTimer::CPerfTimer(CPerfHistogram& histIn) : hist(histIn), nStart(GetTimeMicros())
+{
+}
+
+CPerfTimer::~CPerfTimer()
+{
+    hist.Add(GetTimeMicros() - nStart);
+}
@@ -0,0 +1,121 @@
+// Copyright (c) 2017 The Sling core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_PERFSTATS_H
+#define BITCOIN_PERFSTATS_H
+
+#include <atomic>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/** Point-in-time copy of a CPerfHistogram */
+class CPerfHistogramSnapshot
+{
+public:
+    uint64_t nCount;
+    uint64_t nSum;
+    uint64_t nMin;
+    uint64_t nMax;
+    std::vector<uint64_t> vBuckets;
+
+    CPerfHistogramSnapshot() : nCount(0), nSum(0), nMin(0), nMax(0) {}
+
+    //! Value at or below which the given fraction (0..1) of the samples fall
+    uint64_t Percentile(double dFraction) const;
+};
+
+/**
+ * Latency histogram with lock-free recording.
+ *
+ * Samples (in microseconds) go into log-linear buckets: every power of two is
+ * split into 2^SUB_BUCKET_BITS buckets, so a percentile read back from the
+ * histogram is within 1/2^SUB_BUCKET_BITS of the recorded value whatever its
+ * magnitude.
+ *
+ * Histograms are created as static objects and add themselves to a registry
+ * that getperfstats and the perfstats ZMQ topic walk.
+ */
+class CPerfHistogram
+{
+public:
+    static const int SUB_BUCKET_BITS = 3;
+    static const int SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+    //! Samples of 2^MAX_EXPONENT microseconds (about 12 days) or more share the last bucket
+    static const int MAX_EXPONENT = 40;
+    static const int NUM_BUCKETS = (MAX_EXPONENT - SUB_BUCKET_BITS + 1) * SUB_BUCKETS;
+
+    CPerfHistogram(const char* pszNameIn, const char* pszDescriptionIn);
+    //! A histogram left out of the registry, for statistics reported elsewhere
+    CPerfHistogram();
+    ~CPerfHistogram();
+
+    void Add(int64_t nMicros);
+    //! Forget all samples; samples added meanwhile may partly survive
+    void Reset();
+    void GetSnapshot(CPerfHistogramSnapshot& snapshot) const;
+    uint64_t GetSum() const { return nSum.load(std::memory_order_relaxed); }
+
+    const char* GetName() const { return pszName; }
+    const char* GetDescription() const { return pszDescription; }
+
+    static int BucketIndex(uint64_t nValue);
+    //! Smallest value recorded in the given bucket
+    static uint64_t BucketLowerBound(int nBucket);
+
+    //! All histograms, in order of construction
+    static const std::vector<CPerfHistogram*>& GetAll();
+
+private:
+    const char* pszName;
+    const char* pszDescription;
+    bool fRegistered;
+    std::atomic<uint64_t> nSum;
+    std::atomic<uint64_t> nMin;
+    std::atomic<uint64_t> nMax;
+    std::atomic<uint64_t> vBuckets[NUM_BUCKETS];
+
+    CPerfHistogram(const CPerfHistogram&);
+    CPerfHistogram& operator=(const CPerfHistogram&);
+};
+
+/** Lock-free event counter, registered like CPerfHistogram */
+class CPerfCounter
+{
+public:
+    CPerfCounter(const char* pszNameIn, const char* pszDescriptionIn);
+    ~CPerfCounter();
+
+    void Inc(uint64_t n = 1) { nValue.fetch_add(n, std::memory_order_relaxed); }
+    //! For counters that report a current level, such as a queue length
+    void Set(uint64_t n) { nValue.store(n, std::memory_order_relaxed); }
+    uint64_t Get() const { return nValue.load(std::memory_order_relaxed); }
+
+    const char* GetName() const { return pszName; }
+    const char* GetDescription() const { return pszDescription; }
+
+    static const std::vector<CPerfCounter*>& GetAll();
+
+private:
+    const char* pszName;
+    const char* pszDescription;
+    std::atomic<uint64_t> nValue;
+
+    CPerfCounter(const CPerfCounter&);
+    CPerfCounter& operator=(const CPerfCounter&);
+};
+
+/** Records the time from construction to destruction in a histogram */
+class CPerfTimer
+{
+public:
+    explicit CPerfTimer(CPerfHistogram& histIn);
+    ~CPerfTimer();
+
+private:
+    CPerfHistogram& hist;
+    int64_t nStart;
+};
+
+#endif // BITCOIN_PERFSTATS_H
@@ -79,8 +79,9 @@ public:
 class CBlock : public CBlockHeader
 {
 public:
-    // network and disk
-    std::vector<CTransaction> vtx;
+    // network and disk; the transactions are shared with the mempool and
+    // whoever else holds them, so they are replaced rather than modified
+    std::vector<CTransactionRef> vtx;
 
     // ppcoin: block signature - signed by one of the coin base txout[N]'s owner
     std::vector<unsigned char> vchBlockSig;
@@ -88,6 +89,8 @@ public:
     // memory only
     mutable CScript payee;
     mutable std::vector<uint256> vMerkleTree;
+    // the context-free merkle root and transaction checks already passed
+    mutable bool fPrechecked;
 
     CBlock()
     {
@@ -106,7 +109,7 @@ public:
     inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
         READWRITE(*(CBlockHeader*)this);
         READWRITE(vtx);
-	if(vtx.size() > 1 && vtx[1].IsCoinStake())
+	if(vtx.size() > 1 && vtx[1]->IsCoinStake())
 		READWRITE(vchBlockSig);
     }
 
@@ -117,6 +120,7 @@ public:
         vMerkleTree.clear();
         payee = CScript();
         vchBlockSig.clear();
+        fPrechecked = false;
     }
 
     CBlockHeader GetBlockHeader() const
@@ -134,7 +138,7 @@ public:
     // ppcoin: two types of block: proof-of-work or proof-of-stake
     bool IsProofOfStake() const
     {
-        return (vtx.size() > 1 && vtx[1].IsCoinStake());
+        return (vtx.size() > 1 && vtx[1]->IsCoinStake());
     }
 
     bool IsProofOfWork() const
@@ -147,7 +151,7 @@ public:
 
     std::pair<COutPoint, unsigned int> GetProofOfStake() const
     {
-        return IsProofOfStake()? std::make_pair(vtx[1].vin[0].prevout, nTime) : std::make_pair(COutPoint(), (unsigned int)0);
+        return IsProofOfStake()? std::make_pair(vtx[1]->vin[0].prevout, nTime) : std::make_pair(COutPoint(), (unsigned int)0);
     }
 
     // Build the in-memory merkle tree for this block and return the merkle root.
@@ -12,6 +12,8 @@
 #include "serialize.h"
 #include "uint256.h"
 
+#include <memory>
+
 class CTransaction;
 
 /** An outpoint - a combination of a transaction hash and an index n into its vout */
@@ -317,4 +319,10 @@ struct CMutableTransaction
 
 };
 
+/** Shared reference to an immutable transaction, so holders don't need their own copy */
+typedef std::shared_ptr<const CTransaction> CTransactionRef;
+static inline CTransactionRef MakeTransactionRef() { return std::make_shared<const CTransaction>(); }
+template <typename Tx>
+static inline CTransactionRef MakeTransactionRef(Tx&& txIn) { return std::make_shared<const CTransaction>(std::forward<Tx>(txIn)); }
+
 #endif // BITCOIN_PRIMITIVES_TRANSACTION_H
@@ -160,10 +160,13 @@ CTxOut getPrevOut(const COutPoint& out)
 
 void getNextIn(const COutPoint& Out, uint256& Hash, unsigned int& n)
 {
-    // Hash = 0;
-    // n = 0;
-    // if (paddressmap)
-    //    paddressmap->ReadNextIn(Out, Hash, n);
+    Hash = 0;
+    n = 0;
+    CSpentIndexValue Spent;
+    if (GetSpentIndex(CSpentIndexKey(Out.hash, Out.n), Spent)) {
+        Hash = Spent.txid;
+        n = Spent.nInputIndex;
+    }
 }
 
 const CBlockIndex* getexplorerBlockIndex(int64_t height)
@@ -204,7 +207,7 @@ std::string BlockToString(CBlockIndex* pBlock)
 
     std::string TxContent = table + makeHTMLTableRow(TxLabels, sizeof(TxLabels) / sizeof(std::string));
     for (unsigned int i = 0; i < block.vtx.size(); i++) {
-        const CTransaction& tx = block.vtx[i];
+        const CTransaction& tx = *block.vtx[i];
         TxContent += TxToRow(tx);
 
         CAmount In = getTxIn(tx);
@@ -324,7 +327,7 @@ std::string TxToString(uint256 BlockHash, const CTransaction& tx)
         const CTxOut& Out = tx.vout[i];
         uint256 HashNext = uint256S("0");
         unsigned int nNext = 0;
-        bool fAddrIndex = false;
+        bool fAddrIndex = fSpentIndex;
         getNextIn(COutPoint(TxHash, i), HashNext, nNext);
         std::string OutputsContentCells[] =
             {
@@ -386,37 +389,34 @@ std::string AddressToString(const CBitcoinAddress& Address)
             _("Balance")};
     std::string TxContent = table + makeHTMLTableRow(TxLabels, sizeof(TxLabels) / sizeof(std::string));
 
-    std::set<COutPoint> PrevOuts;
-    /*
-    CScript AddressScript;
-    AddressScript.SetDestination(Address.Get());
+    int nType;
+    uint160 HashBytes;
+    if (!fAddressIndex || !GetAddressIndexKey(Address.Get(), nType, HashBytes))
+        return ""; // it would take too long to find transactions by address
 
-    int64_t Sum = 0;
-    bool fAddrIndex = false;
+    std::vector<std::pair<CAddressIndexKey, CAmount> > AddressIndex;
+    if (!GetAddressIndex(HashBytes, nType, AddressIndex))
+        return "";
 
-    if (!fAddrIndex)
-        return ""; // it will take too long to find transactions by address
-    else
-    {
-        std::vector<CDiskTxPos> Txs;
-        paddressmap->GetTxs(Txs, AddressScript.GetID());
-        BOOST_FOREACH (const CDiskTxPos& pos, Txs)
-        {
-            CTransaction tx;
-            CBlock block;
-            uint256 bhash = block.GetHash();
-            GetTransaction(pos.nTxOffset, tx, bhash);
-            std::map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(block.GetHash());
-            if (mi == mapBlockIndex.end())
-                continue;
-            CBlockIndex* pindex = (*mi).second;
-            if (!pindex || !chainActive.Contains(pindex))
-                continue;
-            std::string Prepend = "<a href=\"" + itostr(pindex->nHeight) + "\">" + TimeToString(pindex->nTime) + "</a>";
-            TxContent += TxToRow(tx, AddressScript, Prepend, &Sum);
-        }
+    CScript AddressScript = GetScriptForDestination(Address.Get());
+    int64_t Sum = 0;
+    std::set<uint256> TxSeen;
+    for (std::vector<std::pair<CAddressIndexKey, CAmount> >::const_iterator it = AddressIndex.begin(); it != AddressIndex.end(); it++) {
+        if (!TxSeen.insert(it->first.txhash).second)
+            continue;
+        CTransaction tx;
+        uint256 BlockHash;
+        if (!GetTransaction(it->first.txhash, tx, BlockHash, true))
+            continue;
+        BlockMap::iterator mi = mapBlockIndex.find(BlockHash);
+        if (mi == mapBlockIndex.end())
+            continue;
+        CBlockIndex* pindex = mi->second;
+        if (!pindex || !chainActive.Contains(pindex))
+            continue;
+        std::string Prepend = "<a href=\"" + itostr(pindex->nHeight) + "\">" + TimeToString(pindex->nTime) + "</a>";
+        TxContent += TxToRow(tx, AddressScript, Prepend, &Sum);
     }
-    */
     TxContent += "</table>";
 
     std::string Content;
@@ -18,11 +18,17 @@
 #include "util.h"
 #include "wallet.h"
 
+#include <atomic>
+
 #include <QColor>
 #include <QDateTime>
 #include <QDebug>
 #include <QIcon>
 #include <QList>
+#include <QThread>
+
+/** Number of wallet transactions decomposed per lock of the wallet while loading */
+static const int LOAD_BATCH_SIZE = 500;
 
 // Amount column is right-aligned it contains numbers
 static int column_alignments[] = {
@@ -50,6 +56,57 @@ struct TxLessThan {
     }
 };
 
+/* Object for decomposing the wallet into records in a separate thread, so
+   the window is usable while a large wallet is still being loaded. The
+   wallet is walked in hash order and the locks are only held for one batch
+   at a time.
+ */
+class TransactionTableLoader : public QObject
+{
+    Q_OBJECT
+
+public:
+    TransactionTableLoader(CWallet* wallet) : wallet(wallet), fStop(false) {}
+
+    void stop() { fStop = true; }
+
+public slots:
+    void load();
+
+signals:
+    void loaded(const QList<TransactionRecord>& records);
+
+private:
+    CWallet* wallet;
+    std::atomic<bool> fStop;
+};
+
+#include "transactiontablemodel.moc"
+
+void TransactionTableLoader::load()
+{
+    qDebug() << "TransactionTableLoader::load";
+    bool fFirst = true;
+    bool fDone = false;
+    uint256 hashLast;
+    while (!fDone && !fStop) {
+        QList<TransactionRecord> records;
+        {
+            LOCK2(cs_main, wallet->cs_wallet);
+            std::map<uint256, CWalletTx>::iterator it = fFirst ? wallet->mapWallet.begin() : wallet->mapWallet.upper_bound(hashLast);
+            for (int n = 0; it != wallet->mapWallet.end() && n < LOAD_BATCH_SIZE; ++it, ++n) {
+                if (TransactionRecord::showTransaction(it->second))
+                    records.append(TransactionRecord::decomposeTransaction(wallet, it->second));
+                hashLast = it->first;
+                fFirst = false;
+            }
+            fDone = (it == wallet->mapWallet.end());
+        }
+        if (!records.isEmpty())
+            emit loaded(records);
+    }
+}
+
 // Private implementation
 class TransactionTablePriv
 {
@@ -68,18 +125,66 @@ public:
      */
     QList<TransactionRecord> cachedWallet;
 
-    /* Query entire wallet anew from core.
+    /* Merge a batch from TransactionTableLoader into the model. The batch is
+       sorted by hash, so records that land next to each other are inserted
+       with a single beginInsertRows. Transactions that a notification already
+       brought into the model are skipped, and so are those that were erased
+       or hidden after the loader read them: the notification for that may
+       have been handled while they were not in the model yet.
      */
-    void refreshWallet()
+    void insertRecords(const QList<TransactionRecord>& batch)
     {
-        qDebug() << "TransactionTablePriv::refreshWallet";
-        cachedWallet.clear();
+        QList<TransactionRecord> records;
         {
             LOCK2(cs_main, wallet->cs_wallet);
-            for (std::map<uint256, CWalletTx>::iterator it = wallet->mapWallet.begin(); it != wallet->mapWallet.end(); ++it) {
-                if (TransactionRecord::showTransaction(it->second))
-                    cachedWallet.append(TransactionRecord::decomposeTransaction(wallet, it->second));
+            foreach (const TransactionRecord& rec, batch) {
+                std::map<uint256, CWalletTx>::iterator mi = wallet->mapWallet.find(rec.hash);
+                if (mi != wallet->mapWallet.end() && TransactionRecord::showTransaction(mi->second))
+                    records.append(rec);
+            }
+        }
+
+        QList<TransactionRecord> run;
+        int runIndex = 0;
+        int i = 0;
+        while (i <= records.size()) {
+            bool fEnd = (i == records.size());
+            int j = i;
+            int insertIndex = 0;
+            bool inModel = false;
+            if (!fEnd) {
+                // The records of one transaction are next to each other
+                const uint256& hash = records[i].hash;
+                while (j < records.size() && records[j].hash == hash)
+                    j++;
+                QList<TransactionRecord>::iterator lower = qLowerBound(
+                    cachedWallet.begin(), cachedWallet.end(), hash, TxLessThan());
+                insertIndex = lower - cachedWallet.begin();
+                inModel = (lower != cachedWallet.end() && lower->hash == hash);
+            }
+
+            if (!run.isEmpty() && (fEnd || inModel || insertIndex != runIndex)) {
+                parent->beginInsertRows(QModelIndex(), runIndex, runIndex + run.size() - 1);
+                int insert_idx = runIndex;
+                foreach (const TransactionRecord& rec, run) {
+                    cachedWallet.insert(insert_idx, rec);
+                    insert_idx += 1;
+                }
+                parent->endInsertRows();
+                run.clear();
+                if (!fEnd && !inModel)
+                    insertIndex = qLowerBound(cachedWallet.begin(), cachedWallet.end(), records[i].hash, TxLessThan()) - cachedWallet.begin();
+            }
+            if (fEnd)
+                break;
+
+            if (!inModel) {
+                if (run.isEmpty())
+                    runIndex = insertIndex;
+                for (int k = i; k < j; k++)
+                    run.append(records[k]);
             }
+            i = j;
         }
     }
 
@@ -152,8 +257,14 @@ public:
             parent->endRemoveRows();
             break;
         case CT_UPDATED:
-            // Miscellaneous updates -- nothing to do, status update will take care of this, and is only computed for
-            // visible transactions.
+            // Status is only computed for visible transactions. Mark just this
+            // transaction's rows stale, so they are recomputed the next time the
+            // view asks for them without touching the rest of the model.
+            if (inModel) {
+                for (QList<TransactionRecord>::iterator it = lower; it != upper; ++it)
+                    it->status.cur_num_blocks = -1;
+                parent->emitDataChanged(lowerIndex, upperIndex - 1);
+            }
             break;
         }
     }
@@ -211,19 +322,42 @@ TransactionTableModel::TransactionTableModel(CWallet* wallet, WalletModel* paren
                                                                                      fProcessingQueuedTransactions(false)
 {
     columns << QString() << QString() << tr("Date") << tr("Type") << tr("Address") << BitcoinUnits::getAmountColumnTitle(walletModel->getOptionsModel()->getDisplayUnit());
-    priv->refreshWallet();
 
     connect(walletModel->getOptionsModel(), SIGNAL(displayUnitChanged(int)), this, SLOT(updateDisplayUnit()));
 
+    // Subscribe first, so nothing that changes while the loader runs is missed
     subscribeToCoreSignals();
+
+    qRegisterMetaType<QList<TransactionRecord> >("QList<TransactionRecord>");
+    loaderThread = new QThread;
+    loader = new TransactionTableLoader(wallet);
+    loader->moveToThread(loaderThread);
+    connect(loader, SIGNAL(loaded(QList<TransactionRecord>)), this, SLOT(insertRecords(QList<TransactionRecord>)));
+    loaderThread->start();
+    QMetaObject::invokeMethod(loader, "load", Qt::QueuedConnection);
 }
 
 TransactionTableModel::~TransactionTableModel()
 {
     unsubscribeFromCoreSignals();
+    loader->stop();
+    loaderThread->quit();
+    loaderThread->wait();
+    delete loader;
+    delete loaderThread;
     delete priv;
 }
 
+void TransactionTableModel::insertRecords(const QList<TransactionRecord>& records)
+{
+    priv->insertRecords(records);
+}
+
+void TransactionTableModel::emitDataChanged(int first, int last)
+{
+    emit dataChanged(index(first, 0), index(last, columns.length() - 1));
+}
+
 /** Updates the column title to "Amount (DisplayUnit)" and emits headerDataChanged() signal for table headers to react. */
 void TransactionTableModel::updateAmountColumnTitle()
 {
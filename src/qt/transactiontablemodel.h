@@ -6,14 +6,23 @@
 #define BITCOIN_QT_TRANSACTIONTABLEMODEL_H
 
 #include "bitcoinunits.h"
+#include "transactionrecord.h"
 
 #include <QAbstractTableModel>
+#include <QList>
+#include <QMetaType>
 #include <QStringList>
 
-class TransactionRecord;
+class TransactionTableLoader;
 class TransactionTablePriv;
 class WalletModel;
 
+QT_BEGIN_NAMESPACE
+class QThread;
+QT_END_NAMESPACE
+
+Q_DECLARE_METATYPE(QList<TransactionRecord>)
+
 class CWallet;
 
 /** UI model for the transaction table of a wallet.
@@ -79,6 +88,8 @@ private:
     WalletModel* walletModel;
     QStringList columns;
     TransactionTablePriv* priv;
+    TransactionTableLoader* loader;
+    QThread* loaderThread;
     bool fProcessingQueuedTransactions;
 
     void subscribeToCoreSignals();
@@ -95,6 +106,7 @@ private:
     QVariant txStatusDecoration(const TransactionRecord* wtx) const;
     QVariant txWatchonlyDecoration(const TransactionRecord* wtx) const;
     QVariant txAddressDecoration(const TransactionRecord* wtx) const;
+    void emitDataChanged(int first, int last);
 
 public slots:
     /* New transaction, or transaction changed status */
@@ -105,6 +117,8 @@ public slots:
     void updateAmountColumnTitle();
     /* Needed to update fProcessingQueuedTransactions through a QueuedConnection */
     void setProcessingQueuedTransactions(bool value) { fProcessingQueuedTransactions = value; }
+    /* Batch of records from the background wallet loader */
+    void insertRecords(const QList<TransactionRecord>& records);
 
     friend class TransactionTablePriv;
 };
@@ -4,19 +4,29 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "main.h"
+#include "perfstats.h"
 #include "primitives/block.h"
 #include "primitives/transaction.h"
+#include "random.h"
 #include "rpcserver.h"
+#include "serialize.h"
 #include "streams.h"
 #include "sync.h"
+#include "txmempool.h"
 #include "utilstrencodings.h"
 #include "version.h"
 
+#include <limits>
+#include <list>
+
 #include <boost/algorithm/string.hpp>
 
 using namespace std;
 using namespace json_spirit;
 
+//! Most outpoints one /rest/getutxos/ request may ask about
+static const size_t MAX_GETUTXOS_OUTPOINTS = 15;
+
 enum RetFormat {
     RF_UNDEF,
     RF_BINARY,
@@ -34,6 +44,23 @@ static const struct {
     {RF_JSON, "json"},
 };
 
+/** An unspent output as /rest/getutxos/ reports it */
+struct CCoin {
+    uint32_t nTxVer; // Don't call this nVersion, that name has a special meaning inside SerializationOp
+    uint32_t nHeight;
+    CTxOut out;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion)
+    {
+        READWRITE(nTxVer);
+        READWRITE(nHeight);
+        READWRITE(out);
+    }
+};
+
 class RestErr
 {
 public:
@@ -41,8 +68,81 @@ public:
     string message;
 };
 
+/**
+ * Serialized replies about blocks buried deep enough not to change, so
+ * explorers asking for the same old blocks over and over are not served
+ * from disk each time. The least recently used replies go first once the
+ * cache is full.
+ */
+class CRESTResponseCache
+{
+public:
+    CRESTResponseCache() : nMaxSize((size_t)DEFAULT_REST_CACHE_SIZE << 20), nSize(0) {}
+
+    void SetMaxSize(size_t nMaxSizeIn)
+    {
+        LOCK(cs);
+        nMaxSize = nMaxSizeIn;
+        Trim();
+    }
+
+    bool Get(const string& strKey, string& strBody)
+    {
+        LOCK(cs);
+        map<string, EntryList::iterator>::iterator it = mapEntries.find(strKey);
+        if (it == mapEntries.end())
+            return false;
+        listEntries.splice(listEntries.begin(), listEntries, it->second);
+        strBody = it->second->second;
+        return true;
+    }
+
+    void Put(const string& strKey, const string& strBody)
+    {
+        LOCK(cs);
+        if (strBody.size() > nMaxSize || mapEntries.count(strKey))
+            return;
+        listEntries.push_front(make_pair(strKey, strBody));
+        mapEntries[strKey] = listEntries.begin();
+        nSize += strBody.size();
+        Trim();
+    }
+
+private:
+    typedef list<pair<string, string> > EntryList;
+
+    CCriticalSection cs;
+    size_t nMaxSize;
+    size_t nSize;
+    //! Most recently used first
+    EntryList listEntries;
+    map<string, EntryList::iterator> mapEntries;
+
+    void Trim()
+    {
+        while (nSize > nMaxSize) {
+            nSize -= listEntries.back().second.size();
+            mapEntries.erase(listEntries.back().first);
+            listEntries.pop_back();
+        }
+    }
+};
+
+static CRESTResponseCache restCache;
+
+static CPerfCounter restCacheHits("rest.cache_hits", "REST replies served from the response cache");
+static CPerfCounter restCacheMisses("rest.cache_misses", "Cacheable REST replies that had to be built");
+static CPerfCounter restNotModified("rest.not_modified", "REST requests answered with 304 Not Modified");
+
+void SetRESTCacheSize(size_t nBytes)
+{
+    restCache.SetMaxSize(nBytes);
+}
+
 extern void TxToJSON(const CTransaction& tx, const uint256 hashBlock, Object& entry);
-extern Object blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool txDetails = false);
+extern void ScriptPubKeyToJSON(const CScript& scriptPubKey, Object& out, bool fIncludeHex);
+extern Object blockHeaderToJSON(const CBlock& block, const CBlockIndex* blockindex);
+extern void BlockToJSONStream(const CBlock& block, const CBlockIndex* blockindex, bool txDetails, CJSONStreamWriter& writer);
 
 static RestErr RESTERR(enum HTTPStatusCode status, string message)
 {
@@ -52,6 +152,15 @@ static RestErr RESTERR(enum HTTPStatusCode status, string message)
     return re;
 }
 
+// Warmup ends before a -reindex has connected anything, so the handlers that
+// read the tip or the coin database check for them; cs_main must be held.
+static void RESTRequireChainState()
+{
+    AssertLockHeld(cs_main);
+    if (chainActive.Tip() == NULL || pcoinsTip == NULL)
+        throw RESTERR(HTTP_SERVICE_UNAVAILABLE, "Service temporarily unavailable: block chain not loaded");
+}
+
 static enum RetFormat ParseDataFormat(vector<string>& params, const string strReq)
 {
     boost::split(params, strReq, boost::is_any_of("."));
@@ -80,6 +189,14 @@ static string AvailableDataFormatsString()
     return formats;
 }
 
+static const char* DataFormatName(enum RetFormat rf)
+{
+    for (unsigned int i = 0; i < ARRAYLEN(rf_names); i++)
+        if (rf_names[i].rf == rf)
+            return rf_names[i].name;
+    return "";
+}
+
 static bool ParseHashStr(const string& strReq, uint256& v)
 {
     if (!IsHex(strReq) || (strReq.size() != 64))
@@ -89,10 +206,81 @@ static bool ParseHashStr(const string& strReq, uint256& v)
     return true;
 }
 
+/** The body of a bin or hex reply carrying the serialized data */
+static string SerializedReplyBody(const CDataStream& ss, enum RetFormat rf)
+{
+    if (rf == RF_BINARY)
+        return ss.str();
+    return HexStr(ss.begin(), ss.end()) + "\n";
+}
+
+static const char* ReplyContentType(enum RetFormat rf)
+{
+    switch (rf) {
+    case RF_BINARY:
+        return "application/octet-stream";
+    case RF_HEX:
+        return "text/plain";
+    default:
+        return "application/json";
+    }
+}
+
+static string RESTETag(const string& strId)
+{
+    return "\"" + strId + "\"";
+}
+
+/**
+ * Mempool tags name the update count, which starts over when the node
+ * restarts. A random value drawn once per process keeps a tag from before
+ * a restart from matching a different mempool after it.
+ */
+static string MempoolETagId(const string& strWhat)
+{
+    static const uint64_t nProcessNonce = GetRand(std::numeric_limits<uint64_t>::max());
+    return strprintf("mempool.%s.%016x.%u", strWhat, nProcessNonce, mempool.GetTransactionsUpdated());
+}
+
+/**
+ * Answer with 304 Not Modified if the client already has the reply with
+ * the given ETag. Tags name what a reply depends on, such as the chain
+ * tip, so they are known before any of the reply is built.
+ */
+static bool RESTNotModified(AcceptedConnection* conn, map<string, string>& mapHeaders, const string& strETag, bool fRun)
+{
+    map<string, string>::const_iterator it = mapHeaders.find("if-none-match");
+    if (it == mapHeaders.end())
+        return false;
+
+    vector<string> vTags;
+    boost::split(vTags, it->second, boost::is_any_of(","));
+    BOOST_FOREACH (string& strTag, vTags) {
+        boost::trim(strTag);
+        // GET requests compare tags weakly
+        if (boost::starts_with(strTag, "W/"))
+            strTag = strTag.substr(2);
+        if (strTag == strETag || strTag == "*") {
+            restNotModified.Inc();
+            conn->stream() << HTTPReply(HTTP_NOT_MODIFIED, "", fRun, true, "text/plain", "ETag: " + strETag + "\r\n") << std::flush;
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool RESTReply(AcceptedConnection* conn, const string& strBody, bool fRun, enum RetFormat rf, const string& strETag = "")
+{
+    string strHeaders = strETag.empty() ? "" : "ETag: " + strETag + "\r\n";
+    conn->stream() << HTTPReply(HTTP_OK, strBody, fRun, false, ReplyContentType(rf), strHeaders) << std::flush;
+    return true;
+}
+
 static bool rest_block(AcceptedConnection* conn,
     string& strReq,
     map<string, string>& mapHeaders,
     bool fRun,
+    int nProto,
     bool showTxDetails)
 {
     vector<string> params;
@@ -103,38 +291,69 @@ static bool rest_block(AcceptedConnection* conn,
     if (!ParseHashStr(hashStr, hash))
         throw RESTERR(HTTP_BAD_REQUEST, "Invalid hash: " + hashStr);
 
-    CBlock block;
+    if (rf == RF_UNDEF)
+        throw RESTERR(HTTP_NOT_FOUND, "output format not found (available: " + AvailableDataFormatsString() + ")");
+
     CBlockIndex* pblockindex = NULL;
+    int nConfirmations = 0;
     {
         LOCK(cs_main);
         if (mapBlockIndex.count(hash) == 0)
             throw RESTERR(HTTP_NOT_FOUND, hashStr + " not found");
 
         pblockindex = mapBlockIndex[hash];
-        if (!ReadBlockFromDisk(block, pblockindex))
-            throw RESTERR(HTTP_NOT_FOUND, hashStr + " not found");
+        if (chainActive.Contains(pblockindex))
+            nConfirmations = chainActive.Height() - pblockindex->nHeight + 1;
     }
 
-    CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION);
-    ssBlock << block;
-
-    switch (rf) {
-    case RF_BINARY: {
-        string binaryBlock = ssBlock.str();
-        conn->stream() << HTTPReplyHeader(HTTP_OK, fRun, binaryBlock.size(), "application/octet-stream") << binaryBlock << std::flush;
+    // A block's data never changes, but its JSON reports confirmations and
+    // the next block, which follow the tip
+    string strETag;
+    if (rf == RF_JSON)
+        strETag = RESTETag(hashStr + (showTxDetails ? "" : ".notxdetails") + ".json." + GetChainTipSnapshot()->hashBlock.GetHex());
+    else
+        strETag = RESTETag(hashStr + "." + DataFormatName(rf));
+    if (RESTNotModified(conn, mapHeaders, strETag, fRun))
         return true;
+
+    string strCacheKey = string("block/") + hashStr + "." + DataFormatName(rf);
+    bool fCacheable = rf != RF_JSON && nConfirmations >= REST_CACHE_MIN_CONFIRMATIONS;
+    if (fCacheable) {
+        string strBody;
+        if (restCache.Get(strCacheKey, strBody)) {
+            restCacheHits.Inc();
+            return RESTReply(conn, strBody, fRun, rf, strETag);
+        }
+        restCacheMisses.Inc();
+    }
+
+    CBlock block;
+    {
+        LOCK(cs_main);
+        if (!ReadBlockFromDisk(block, pblockindex))
+            throw RESTERR(HTTP_NOT_FOUND, hashStr + " not found");
     }
 
+    switch (rf) {
+    case RF_BINARY:
     case RF_HEX: {
-        string strHex = HexStr(ssBlock.begin(), ssBlock.end()) + "\n";
-        conn->stream() << HTTPReply(HTTP_OK, strHex, fRun, false, "text/plain") << std::flush;
-        return true;
+        CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION);
+        ssBlock << block;
+        string strBody = SerializedReplyBody(ssBlock, rf);
+        if (fCacheable)
+            restCache.Put(strCacheKey, strBody);
+        return RESTReply(conn, strBody, fRun, rf, strETag);
     }
 
     case RF_JSON: {
-        Object objBlock = blockToJSON(block, pblockindex, showTxDetails);
-        string strJSON = write_string(Value(objBlock), false) + "\n";
-        conn->stream() << HTTPReply(HTTP_OK, strJSON, fRun) << std::flush;
+        // Blocks with transaction details are large, so they are sent as they are written
+        CHTTPStreamReply reply(conn->stream(), fRun, nProto >= 1);
+        reply.AddHeader("ETag", strETag);
+        std::ostream os(&reply);
+        CJSONStreamWriter writer(os);
+        BlockToJSONStream(block, pblockindex, showTxDetails, writer);
+        os << "\n";
+        reply.Finish();
         return true;
     }
 
@@ -150,23 +369,123 @@ static bool rest_block(AcceptedConnection* conn,
 static bool rest_block_extended(AcceptedConnection* conn,
     string& strReq,
     map<string, string>& mapHeaders,
-    bool fRun)
+    bool fRun,
+    int nProto)
 {
-    return rest_block(conn, strReq, mapHeaders, fRun, true);
+    return rest_block(conn, strReq, mapHeaders, fRun, nProto, true);
 }
 
 static bool rest_block_notxdetails(AcceptedConnection* conn,
     string& strReq,
     map<string, string>& mapHeaders,
-    bool fRun)
+    bool fRun,
+    int nProto)
 {
-    return rest_block(conn, strReq, mapHeaders, fRun, false);
+    return rest_block(conn, strReq, mapHeaders, fRun, nProto, false);
+}
+
+static bool rest_headers(AcceptedConnection* conn,
+    string& strReq,
+    map<string, string>& mapHeaders,
+    bool fRun,
+    int nProto)
+{
+    vector<string> params;
+    enum RetFormat rf = ParseDataFormat(params, strReq);
+
+    vector<string> path;
+    boost::split(path, params[0], boost::is_any_of("/"));
+    if (path.size() != 2)
+        throw RESTERR(HTTP_BAD_REQUEST, "No header count specified. Use /rest/headers/<count>/<hash>.<ext>.");
+
+    int32_t nCount;
+    if (!ParseInt32(path[0], &nCount) || nCount < 1 || nCount > (int32_t)MAX_HEADERS_RESULTS)
+        throw RESTERR(HTTP_BAD_REQUEST, strprintf("Header count out of range: %s", path[0]));
+
+    string hashStr = path[1];
+    uint256 hash;
+    if (!ParseHashStr(hashStr, hash))
+        throw RESTERR(HTTP_BAD_REQUEST, "Invalid hash: " + hashStr);
+
+    if (rf == RF_UNDEF)
+        throw RESTERR(HTTP_NOT_FOUND, "output format not found (available: " + AvailableDataFormatsString() + ")");
+
+    // The headers of the active chain from the given block on
+    vector<const CBlockIndex*> vHeaders;
+    int nConfirmations = 0;
+    uint256 hashTip;
+    {
+        LOCK(cs_main);
+        RESTRequireChainState();
+        BlockMap::const_iterator it = mapBlockIndex.find(hash);
+        const CBlockIndex* pindex = (it != mapBlockIndex.end()) ? it->second : NULL;
+        while (pindex != NULL && chainActive.Contains(pindex)) {
+            vHeaders.push_back(pindex);
+            if (vHeaders.size() == (size_t)nCount)
+                break;
+            pindex = chainActive.Next(pindex);
+        }
+        if (!vHeaders.empty())
+            nConfirmations = chainActive.Height() - vHeaders.back()->nHeight + 1;
+        hashTip = chainActive.Tip()->GetBlockHash();
+    }
+
+    // A full run of buried headers stays the same; anything else may change with the tip
+    string strCacheKey = strprintf("headers/%d/%s.%s", nCount, hashStr, DataFormatName(rf));
+    bool fCacheable = vHeaders.size() == (size_t)nCount && nConfirmations >= REST_CACHE_MIN_CONFIRMATIONS;
+    string strETag = RESTETag(fCacheable ? strCacheKey : strCacheKey + "." + hashTip.GetHex());
+    if (RESTNotModified(conn, mapHeaders, strETag, fRun))
+        return true;
+
+    if (fCacheable) {
+        string strBody;
+        if (restCache.Get(strCacheKey, strBody)) {
+            restCacheHits.Inc();
+            return RESTReply(conn, strBody, fRun, rf, strETag);
+        }
+        restCacheMisses.Inc();
+    }
+
+    string strBody;
+    switch (rf) {
+    case RF_BINARY:
+    case RF_HEX: {
+        CDataStream ssHeader(SER_NETWORK, PROTOCOL_VERSION);
+        BOOST_FOREACH (const CBlockIndex* pindex, vHeaders)
+            ssHeader << pindex->GetBlockHeader();
+        strBody = SerializedReplyBody(ssHeader, rf);
+        break;
+    }
+
+    case RF_JSON: {
+        Array jsonHeaders;
+        BOOST_FOREACH (const CBlockIndex* pindex, vHeaders) {
+            Object objHeader;
+            objHeader.push_back(Pair("hash", pindex->GetBlockHash().GetHex()));
+            objHeader.push_back(Pair("height", pindex->nHeight));
+            Object objFields = blockHeaderToJSON(CBlock(pindex->GetBlockHeader()), pindex);
+            objHeader.insert(objHeader.end(), objFields.begin(), objFields.end());
+            jsonHeaders.push_back(objHeader);
+        }
+        strBody = write_string(Value(jsonHeaders), false) + "\n";
+        break;
+    }
+
+    default: {
+        throw RESTERR(HTTP_NOT_FOUND, "output format not found (available: " + AvailableDataFormatsString() + ")");
+    }
+    }
+
+    if (fCacheable)
+        restCache.Put(strCacheKey, strBody);
+    return RESTReply(conn, strBody, fRun, rf, strETag);
 }
 
 static bool rest_tx(AcceptedConnection* conn,
     string& strReq,
     map<string, string>& mapHeaders,
-    bool fRun)
+    bool fRun,
+    int nProto)
 {
     vector<string> params;
     enum RetFormat rf = ParseDataFormat(params, strReq);
@@ -176,32 +495,151 @@ static bool rest_tx(AcceptedConnection* conn,
     if (!ParseHashStr(hashStr, hash))
         throw RESTERR(HTTP_BAD_REQUEST, "Invalid hash: " + hashStr);
 
+    if (rf == RF_UNDEF)
+        throw RESTERR(HTTP_NOT_FOUND, "output format not found (available: " + AvailableDataFormatsString() + ")");
+
     CTransaction tx;
     uint256 hashBlock = 0;
     if (!GetTransaction(hash, tx, hashBlock, true))
         throw RESTERR(HTTP_NOT_FOUND, hashStr + " not found");
 
+    // The data of a transaction never changes, but its JSON reports
+    // confirmations, which follow the tip
+    string strETag;
+    if (rf == RF_JSON)
+        strETag = RESTETag(hashStr + ".json." + GetChainTipSnapshot()->hashBlock.GetHex());
+    else
+        strETag = RESTETag(hashStr + "." + DataFormatName(rf));
+    if (RESTNotModified(conn, mapHeaders, strETag, fRun))
+        return true;
+
     CDataStream ssTx(SER_NETWORK, PROTOCOL_VERSION);
     ssTx << tx;
 
     switch (rf) {
-    case RF_BINARY: {
-        string binaryTx = ssTx.str();
-        conn->stream() << HTTPReplyHeader(HTTP_OK, fRun, binaryTx.size(), "application/octet-stream") << binaryTx << std::flush;
-        return true;
-    }
-
+    case RF_BINARY:
     case RF_HEX: {
-        string strHex = HexStr(ssTx.begin(), ssTx.end()) + "\n";
-        conn->stream() << HTTPReply(HTTP_OK, strHex, fRun, false, "text/plain") << std::flush;
-        return true;
+        return RESTReply(conn, SerializedReplyBody(ssTx, rf), fRun, rf, strETag);
     }
 
     case RF_JSON: {
         Object objTx;
         TxToJSON(tx, hashBlock, objTx);
         string strJSON = write_string(Value(objTx), false) + "\n";
-        conn->stream() << HTTPReply(HTTP_OK, strJSON, fRun) << std::flush;
+        return RESTReply(conn, strJSON, fRun, rf, strETag);
+    }
+
+    default: {
+        throw RESTERR(HTTP_NOT_FOUND, "output format not found (available: " + AvailableDataFormatsString() + ")");
+    }
+    }
+
+    // not reached
+    return true; // continue to process further HTTP reqs on this cxn
+}
+
+static bool rest_chaininfo(AcceptedConnection* conn,
+    string& strReq,
+    map<string, string>& mapHeaders,
+    bool fRun,
+    int nProto)
+{
+    vector<string> params;
+    enum RetFormat rf = ParseDataFormat(params, strReq);
+
+    switch (rf) {
+    case RF_JSON: {
+        Array rpcParams;
+        Value chainInfoObject;
+        {
+            LOCK(cs_main);
+            RESTRequireChainState();
+            chainInfoObject = getblockchaininfo(rpcParams, false);
+        }
+        string strJSON = write_string(chainInfoObject, false) + "\n";
+        return RESTReply(conn, strJSON, fRun, rf);
+    }
+
+    default: {
+        throw RESTERR(HTTP_NOT_FOUND, "output format not found (available: json)");
+    }
+    }
+
+    // not reached
+    return true; // continue to process further HTTP reqs on this cxn
+}
+
+static bool rest_mempool_info(AcceptedConnection* conn,
+    string& strReq,
+    map<string, string>& mapHeaders,
+    bool fRun,
+    int nProto)
+{
+    vector<string> params;
+    enum RetFormat rf = ParseDataFormat(params, strReq);
+
+    switch (rf) {
+    case RF_JSON: {
+        string strETag = RESTETag(MempoolETagId("info"));
+        if (RESTNotModified(conn, mapHeaders, strETag, fRun))
+            return true;
+
+        Array rpcParams;
+        Value mempoolInfoObject = getmempoolinfo(rpcParams, false);
+        string strJSON = write_string(mempoolInfoObject, false) + "\n";
+        return RESTReply(conn, strJSON, fRun, rf, strETag);
+    }
+
+    default: {
+        throw RESTERR(HTTP_NOT_FOUND, "output format not found (available: json)");
+    }
+    }
+
+    // not reached
+    return true; // continue to process further HTTP reqs on this cxn
+}
+
+static bool rest_mempool_contents(AcceptedConnection* conn,
+    string& strReq,
+    map<string, string>& mapHeaders,
+    bool fRun,
+    int nProto)
+{
+    vector<string> params;
+    enum RetFormat rf = ParseDataFormat(params, strReq);
+
+    if (rf == RF_UNDEF)
+        throw RESTERR(HTTP_NOT_FOUND, "output format not found (available: " + AvailableDataFormatsString() + ")");
+
+    // The current priorities in the JSON also follow the tip
+    string strETag = MempoolETagId("contents") + "." + DataFormatName(rf);
+    if (rf == RF_JSON)
+        strETag += "." + GetChainTipSnapshot()->hashBlock.GetHex();
+    strETag = RESTETag(strETag);
+    if (RESTNotModified(conn, mapHeaders, strETag, fRun))
+        return true;
+
+    switch (rf) {
+    case RF_BINARY:
+    case RF_HEX: {
+        vector<uint256> vtxid;
+        mempool.queryHashes(vtxid);
+        CDataStream ssTxids(SER_NETWORK, PROTOCOL_VERSION);
+        ssTxids << vtxid;
+        return RESTReply(conn, SerializedReplyBody(ssTxids, rf), fRun, rf, strETag);
+    }
+
+    case RF_JSON: {
+        // What getrawmempool returns with verbose set
+        Array rpcParams;
+        rpcParams.push_back(true);
+        CHTTPStreamReply reply(conn->stream(), fRun, nProto >= 1);
+        reply.AddHeader("ETag", strETag);
+        std::ostream os(&reply);
+        CJSONStreamWriter writer(os);
+        getrawmempool_stream(rpcParams, writer);
+        os << "\n";
+        reply.Finish();
         return true;
     }
 
@@ -214,22 +652,146 @@ static bool rest_tx(AcceptedConnection* conn,
     return true; // continue to process further HTTP reqs on this cxn
 }
 
+static bool rest_getutxos(AcceptedConnection* conn,
+    string& strReq,
+    map<string, string>& mapHeaders,
+    bool fRun,
+    int nProto)
+{
+    vector<string> params;
+    enum RetFormat rf = ParseDataFormat(params, strReq);
+
+    // Outpoints come as <txid>-<n> separated by slashes, after an optional checkmempool/
+    vector<string> uriParts;
+    boost::split(uriParts, params[0], boost::is_any_of("/"));
+    bool fCheckMemPool = false;
+    if (!uriParts.empty() && uriParts[0] == "checkmempool") {
+        fCheckMemPool = true;
+        uriParts.erase(uriParts.begin());
+    }
+
+    vector<COutPoint> vOutPoints;
+    BOOST_FOREACH (const string& strOutPoint, uriParts) {
+        if (strOutPoint.empty())
+            continue;
+        size_t nSep = strOutPoint.find('-');
+        uint256 txid;
+        int32_t nOutput;
+        if (nSep == string::npos || !ParseHashStr(strOutPoint.substr(0, nSep), txid) ||
+            !ParseInt32(strOutPoint.substr(nSep + 1), &nOutput) || nOutput < 0)
+            throw RESTERR(HTTP_BAD_REQUEST, "Parse error");
+        vOutPoints.push_back(COutPoint(txid, (uint32_t)nOutput));
+    }
+
+    if (vOutPoints.empty())
+        throw RESTERR(HTTP_BAD_REQUEST, "Error: empty request");
+
+    if (vOutPoints.size() > MAX_GETUTXOS_OUTPOINTS)
+        throw RESTERR(HTTP_BAD_REQUEST, strprintf("Error: max outpoints exceeded (max: %d, tried: %d)", MAX_GETUTXOS_OUTPOINTS, vOutPoints.size()));
+
+    if (rf == RF_UNDEF)
+        throw RESTERR(HTTP_NOT_FOUND, "output format not found (available: " + AvailableDataFormatsString() + ")");
+
+    // Bit i of the bitmap tells whether outpoint i is unspent
+    vector<unsigned char> bitmap((vOutPoints.size() + 7) / 8, 0);
+    string bitmapStringRepresentation;
+    vector<CCoin> outs;
+    int nHeight;
+    uint256 hashTip;
+    {
+        LOCK2(cs_main, mempool.cs);
+        RESTRequireChainState();
+
+        CCoinsViewMemPool viewMempool(pcoinsTip, mempool);
+        for (size_t i = 0; i < vOutPoints.size(); i++) {
+            const COutPoint& outpoint = vOutPoints[i];
+            CCoins coins;
+            bool fHit = false;
+            if (fCheckMemPool ? viewMempool.GetCoins(outpoint.hash, coins) : pcoinsTip->GetCoins(outpoint.hash, coins)) {
+                if (fCheckMemPool)
+                    mempool.pruneSpent(outpoint.hash, coins);
+                if (coins.IsAvailable(outpoint.n)) {
+                    CCoin coin;
+                    coin.nTxVer = coins.nVersion;
+                    coin.nHeight = coins.nHeight;
+                    coin.out = coins.vout[outpoint.n];
+                    outs.push_back(coin);
+                    fHit = true;
+                }
+            }
+            if (fHit)
+                bitmap[i / 8] |= 1 << (i % 8);
+            bitmapStringRepresentation.append(fHit ? "1" : "0");
+        }
+
+        nHeight = chainActive.Height();
+        hashTip = chainActive.Tip()->GetBlockHash();
+    }
+
+    switch (rf) {
+    case RF_BINARY:
+    case RF_HEX: {
+        CDataStream ssGetUTXOResponse(SER_NETWORK, PROTOCOL_VERSION);
+        ssGetUTXOResponse << nHeight << hashTip << bitmap << outs;
+        return RESTReply(conn, SerializedReplyBody(ssGetUTXOResponse, rf), fRun, rf);
+    }
+
+    case RF_JSON: {
+        Object objGetUTXOResponse;
+        objGetUTXOResponse.push_back(Pair("chainHeight", nHeight));
+        objGetUTXOResponse.push_back(Pair("chaintipHash", hashTip.GetHex()));
+        objGetUTXOResponse.push_back(Pair("bitmap", bitmapStringRepresentation));
+
+        Array utxos;
+        BOOST_FOREACH (const CCoin& coin, outs) {
+            Object utxo;
+            utxo.push_back(Pair("txvers", (int32_t)coin.nTxVer));
+            utxo.push_back(Pair("height", (int32_t)coin.nHeight));
+            utxo.push_back(Pair("value", ValueFromAmount(coin.out.nValue)));
+
+            Object o;
+            ScriptPubKeyToJSON(coin.out.scriptPubKey, o, true);
+            utxo.push_back(Pair("scriptPubKey", o));
+            utxos.push_back(utxo);
+        }
+        objGetUTXOResponse.push_back(Pair("utxos", utxos));
+
+        string strJSON = write_string(Value(objGetUTXOResponse), false) + "\n";
+        return RESTReply(conn, strJSON, fRun, rf);
+    }
+
+    default: {
+        throw RESTERR(HTTP_NOT_FOUND, "output format not found (available: " + AvailableDataFormatsString() + ")");
+    }
+    }
+
+    // not reached
+    return true; // continue to process further HTTP reqs on this cxn
+}
+
 static const struct {
     const char* prefix;
     bool (*handler)(AcceptedConnection* conn,
         string& strURI,
         map<string, string>& mapHeaders,
-        bool fRun);
+        bool fRun,
+        int nProto);
 } uri_prefixes[] = {
     {"/rest/tx/", rest_tx},
     {"/rest/block/notxdetails/", rest_block_notxdetails},
     {"/rest/block/", rest_block_extended},
+    {"/rest/headers/", rest_headers},
+    {"/rest/chaininfo", rest_chaininfo},
+    {"/rest/mempool/info", rest_mempool_info},
+    {"/rest/mempool/contents", rest_mempool_contents},
+    {"/rest/getutxos/", rest_getutxos},
 };
 
 bool HTTPReq_REST(AcceptedConnection* conn,
     string& strURI,
     map<string, string>& mapHeaders,
-    bool fRun)
+    bool fRun,
+    int nProto)
 {
     try {
         std::string statusmessage;
@@ -240,7 +802,7 @@ bool HTTPReq_REST(AcceptedConnection* conn,
             unsigned int plen = strlen(uri_prefixes[i].prefix);
             if (strURI.substr(0, plen) == uri_prefixes[i].prefix) {
                 string strReq = strURI.substr(plen);
-                return uri_prefixes[i].handler(conn, strReq, mapHeaders, fRun);
+                return uri_prefixes[i].handler(conn, strReq, mapHeaders, fRun, nProto);
             }
         }
     } catch (RestErr& re) {
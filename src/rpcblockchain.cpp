@@ -50,43 +50,94 @@ double GetDifficulty(const CBlockIndex* blockindex)
 }
 
 
-Object blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool txDetails = false)
+/**
+ * Emit the members of a block, in order, through the writer calls of
+ * CJSONStreamWriter. blockToJSON and BlockToJSONStream both use it, so the
+ * built and the streamed result can't drift apart.
+ */
+template <typename Writer>
+static void BlockToJSONMembers(const CBlock& block, const CBlockIndex* blockindex, bool txDetails, int confirmations, const CBlockIndex* pnext, Writer& writer)
 {
-    Object result;
-    result.push_back(Pair("hash", block.GetHash().GetHex()));
-    int confirmations = -1;
-    // Only report confirmations if the block is on the main chain
-    if (chainActive.Contains(blockindex))
-        confirmations = chainActive.Height() - blockindex->nHeight + 1;
-    result.push_back(Pair("confirmations", confirmations));
-    result.push_back(Pair("size", (int)::GetSerializeSize(block, SER_NETWORK, PROTOCOL_VERSION)));
-    result.push_back(Pair("height", blockindex->nHeight));
-    result.push_back(Pair("version", block.nVersion));
-    result.push_back(Pair("merkleroot", block.hashMerkleRoot.GetHex()));
-    Array txs;
-    BOOST_FOREACH (const CTransaction& tx, block.vtx) {
+    writer.WritePair("hash", block.GetHash().GetHex());
+    writer.WritePair("confirmations", confirmations);
+    writer.WritePair("size", (int)::GetSerializeSize(block, SER_NETWORK, PROTOCOL_VERSION));
+    writer.WritePair("height", blockindex->nHeight);
+    writer.WritePair("version", block.nVersion);
+    writer.WritePair("merkleroot", block.hashMerkleRoot.GetHex());
+    writer.Key("tx");
+    writer.BeginArray();
+    BOOST_FOREACH (const CTransactionRef& ptx, block.vtx) {
+        const CTransaction& tx = *ptx;
         if (txDetails) {
             Object objTx;
             TxToJSON(tx, uint256(0), objTx);
-            txs.push_back(objTx);
+            writer.Write(objTx);
         } else
-            txs.push_back(tx.GetHash().GetHex());
+            writer.Write(tx.GetHash().GetHex());
     }
-    result.push_back(Pair("tx", txs));
-    result.push_back(Pair("time", block.GetBlockTime()));
-    result.push_back(Pair("nonce", (uint64_t)block.nNonce));
-    result.push_back(Pair("bits", strprintf("%08x", block.nBits)));
-    result.push_back(Pair("difficulty", GetDifficulty(blockindex)));
-    result.push_back(Pair("chainwork", blockindex->nChainWork.GetHex()));
+    writer.EndArray();
+    writer.WritePair("time", block.GetBlockTime());
+    writer.WritePair("nonce", (uint64_t)block.nNonce);
+    writer.WritePair("bits", strprintf("%08x", block.nBits));
+    writer.WritePair("difficulty", GetDifficulty(blockindex));
+    writer.WritePair("chainwork", blockindex->nChainWork.GetHex());
 
     if (blockindex->pprev)
-        result.push_back(Pair("previousblockhash", blockindex->pprev->GetBlockHash().GetHex()));
-    CBlockIndex* pnext = chainActive.Next(blockindex);
+        writer.WritePair("previousblockhash", blockindex->pprev->GetBlockHash().GetHex());
     if (pnext)
-        result.push_back(Pair("nextblockhash", pnext->GetBlockHash().GetHex()));
+        writer.WritePair("nextblockhash", pnext->GetBlockHash().GetHex());
+}
+
+/** Takes the writer calls of BlockToJSONMembers and builds an Object from them; arrays don't nest */
+class CJSONObjectBuilder
+{
+public:
+    explicit CJSONObjectBuilder(Object& objIn) : obj(objIn) {}
+
+    void Key(const std::string& strKeyIn) { strKey = strKeyIn; }
+    void BeginArray() { arr.clear(); }
+    void EndArray() { obj.push_back(Pair(strKey, arr)); }
+    void Write(const Value& value) { arr.push_back(value); }
+    void WritePair(const std::string& strKeyIn, const Value& value) { obj.push_back(Pair(strKeyIn, value)); }
+
+private:
+    Object& obj;
+    std::string strKey;
+    Array arr;
+};
+
+Object blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool txDetails = false)
+{
+    AssertLockHeld(cs_main);
+    int confirmations = -1;
+    // Only report confirmations if the block is on the main chain
+    if (chainActive.Contains(blockindex))
+        confirmations = chainActive.Height() - blockindex->nHeight + 1;
+
+    Object result;
+    CJSONObjectBuilder builder(result);
+    BlockToJSONMembers(block, blockindex, txDetails, confirmations, chainActive.Next(blockindex), builder);
     return result;
 }
 
+/** Write what blockToJSON returns without building it first */
+void BlockToJSONStream(const CBlock& block, const CBlockIndex* blockindex, bool txDetails, CJSONStreamWriter& writer)
+{
+    int confirmations = -1;
+    const CBlockIndex* pnext = NULL;
+    {
+        LOCK(cs_main);
+        // Only report confirmations if the block is on the main chain
+        if (chainActive.Contains(blockindex))
+            confirmations = chainActive.Height() - blockindex->nHeight + 1;
+        pnext = chainActive.Next(blockindex);
+    }
+
+    writer.BeginObject();
+    BlockToJSONMembers(block, blockindex, txDetails, confirmations, pnext, writer);
+    writer.EndObject();
+}
+
 
 Object blockHeaderToJSON(const CBlock& block, const CBlockIndex* blockindex)
 {
@@ -113,7 +164,7 @@ Value getblockcount(const Array& params, bool fHelp)
             "\nExamples:\n" +
             HelpExampleCli("getblockcount", "") + HelpExampleRpc("getblockcount", ""));
 
-    return chainActive.Height();
+    return GetChainTipSnapshot()->nHeight;
 }
 
 Value getbestblockhash(const Array& params, bool fHelp)
@@ -127,7 +178,7 @@ Value getbestblockhash(const Array& params, bool fHelp)
             "\nExamples\n" +
             HelpExampleCli("getbestblockhash", "") + HelpExampleRpc("getbestblockhash", ""));
 
-    return chainActive.Tip()->GetBlockHash().GetHex();
+    return GetChainTipSnapshot()->hashBlock.GetHex();
 }
 
 Value getdifficulty(const Array& params, bool fHelp)
@@ -141,10 +192,61 @@ Value getdifficulty(const Array& params, bool fHelp)
             "\nExamples:\n" +
             HelpExampleCli("getdifficulty", "") + HelpExampleRpc("getdifficulty", ""));
 
-    return GetDifficulty();
+    std::shared_ptr<const CChainTipSnapshot> tip = GetChainTipSnapshot();
+    if (!tip->pindex)
+        return 1.0;
+    return GetDifficulty(tip->pindex);
 }
 
 
+/** What getrawmempool reports about a transaction, copied out of the pool */
+struct CMempoolEntryInfo {
+    uint256 hash;
+    size_t nSize;
+    CAmount nFee;
+    int64_t nTime;
+    unsigned int nHeight;
+    double dStartingPriority;
+    double dCurrentPriority;
+    std::set<std::string> setDepends;
+};
+
+static void GetMempoolEntryInfo(std::vector<CMempoolEntryInfo>& vInfo, unsigned int nChainHeight)
+{
+    LOCK(mempool.cs);
+    vInfo.reserve(mempool.mapTx.size());
+    BOOST_FOREACH (const PAIRTYPE(uint256, CTxMemPoolEntry) & entry, mempool.mapTx) {
+        const CTxMemPoolEntry& e = entry.second;
+        vInfo.push_back(CMempoolEntryInfo());
+        CMempoolEntryInfo& info = vInfo.back();
+        info.hash = entry.first;
+        info.nSize = e.GetTxSize();
+        info.nFee = e.GetFee();
+        info.nTime = e.GetTime();
+        info.nHeight = e.GetHeight();
+        info.dStartingPriority = e.GetPriority(e.GetHeight());
+        info.dCurrentPriority = e.GetPriority(nChainHeight);
+        BOOST_FOREACH (const CTxIn& txin, e.GetTx().vin) {
+            if (mempool.exists(txin.prevout.hash))
+                info.setDepends.insert(txin.prevout.hash.ToString());
+        }
+    }
+}
+
+static Object MempoolEntryInfoToJSON(const CMempoolEntryInfo& e)
+{
+    Object info;
+    info.push_back(Pair("size", (int)e.nSize));
+    info.push_back(Pair("fee", ValueFromAmount(e.nFee)));
+    info.push_back(Pair("time", e.nTime));
+    info.push_back(Pair("height", (int)e.nHeight));
+    info.push_back(Pair("startingpriority", e.dStartingPriority));
+    info.push_back(Pair("currentpriority", e.dCurrentPriority));
+    Array depends(e.setDepends.begin(), e.setDepends.end());
+    info.push_back(Pair("depends", depends));
+    return info;
+}
+
 Value getrawmempool(const Array& params, bool fHelp)
 {
     if (fHelp || params.size() > 1)
@@ -180,28 +282,11 @@ Value getrawmempool(const Array& params, bool fHelp)
         fVerbose = params[0].get_bool();
 
     if (fVerbose) {
-        LOCK(mempool.cs);
+        std::vector<CMempoolEntryInfo> vInfo;
+        GetMempoolEntryInfo(vInfo, chainActive.Height());
         Object o;
-        BOOST_FOREACH (const PAIRTYPE(uint256, CTxMemPoolEntry) & entry, mempool.mapTx) {
-            const uint256& hash = entry.first;
-            const CTxMemPoolEntry& e = entry.second;
-            Object info;
-            info.push_back(Pair("size", (int)e.GetTxSize()));
-            info.push_back(Pair("fee", ValueFromAmount(e.GetFee())));
-            info.push_back(Pair("time", e.GetTime()));
-            info.push_back(Pair("height", (int)e.GetHeight()));
-            info.push_back(Pair("startingpriority", e.GetPriority(e.GetHeight())));
-            info.push_back(Pair("currentpriority", e.GetPriority(chainActive.Height())));
-            const CTransaction& tx = e.GetTx();
-            set<string> setDepends;
-            BOOST_FOREACH (const CTxIn& txin, tx.vin) {
-                if (mempool.exists(txin.prevout.hash))
-                    setDepends.insert(txin.prevout.hash.ToString());
-            }
-            Array depends(setDepends.begin(), setDepends.end());
-            info.push_back(Pair("depends", depends));
-            o.push_back(Pair(hash.ToString(), info));
-        }
+        BOOST_FOREACH (const CMempoolEntryInfo& info, vInfo)
+            o.push_back(Pair(info.hash.ToString(), MempoolEntryInfoToJSON(info)));
         return o;
     } else {
         vector<uint256> vtxid;
@@ -215,6 +300,35 @@ Value getrawmempool(const Array& params, bool fHelp)
     }
 }
 
+bool getrawmempool_stream(const Array& params, CJSONStreamWriter& writer)
+{
+    if (params.size() > 1)
+        return false;
+
+    bool fVerbose = false;
+    if (params.size() > 0)
+        fVerbose = params[0].get_bool();
+
+    // The pool is copied out in compact form so its lock is not held while the reply is sent
+    if (fVerbose) {
+        std::vector<CMempoolEntryInfo> vInfo;
+        GetMempoolEntryInfo(vInfo, GetChainTipSnapshot()->nHeight);
+        writer.BeginObject();
+        BOOST_FOREACH (const CMempoolEntryInfo& info, vInfo)
+            writer.WritePair(info.hash.ToString(), MempoolEntryInfoToJSON(info));
+        writer.EndObject();
+    } else {
+        vector<uint256> vtxid;
+        mempool.queryHashes(vtxid);
+
+        writer.BeginArray();
+        BOOST_FOREACH (const uint256& hash, vtxid)
+            writer.Write(hash.ToString());
+        writer.EndArray();
+    }
+    return true;
+}
+
 Value getblockhash(const Array& params, bool fHelp)
 {
     if (fHelp || params.size() != 1)
@@ -228,11 +342,13 @@ Value getblockhash(const Array& params, bool fHelp)
             "\nExamples:\n" +
             HelpExampleCli("getblockhash", "1000") + HelpExampleRpc("getblockhash", "1000"));
 
+    // The ancestors of the tip are found through pprev and pskip, which never change
+    std::shared_ptr<const CChainTipSnapshot> tip = GetChainTipSnapshot();
     int nHeight = params[0].get_int();
-    if (nHeight < 0 || nHeight > chainActive.Height())
+    if (nHeight < 0 || nHeight > tip->nHeight)
         throw JSONRPCError(RPC_INVALID_PARAMETER, "Block height out of range");
 
-    CBlockIndex* pblockindex = chainActive[nHeight];
+    const CBlockIndex* pblockindex = tip->pindex->GetAncestor(nHeight);
     return pblockindex->GetBlockHash().GetHex();
 }
 
@@ -296,6 +412,33 @@ Value getblock(const Array& params, bool fHelp)
     return blockToJSON(block, pblockindex);
 }
 
+bool getblock_stream(const Array& params, CJSONStreamWriter& writer)
+{
+    if (params.size() < 1 || params.size() > 2)
+        return false;
+
+    // The hex form is a single string, so only the object is streamed
+    if (params.size() > 1 && !params[1].get_bool())
+        return false;
+
+    uint256 hash(params[0].get_str());
+
+    CBlock block;
+    CBlockIndex* pblockindex;
+    {
+        LOCK(cs_main);
+        if (mapBlockIndex.count(hash) == 0)
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
+
+        pblockindex = mapBlockIndex[hash];
+        if (!ReadBlockFromDisk(block, pblockindex))
+            throw JSONRPCError(RPC_INTERNAL_ERROR, "Can't read block from disk");
+    }
+
+    BlockToJSONStream(block, pblockindex, false, writer);
+    return true;
+}
+
 Value getblockheader(const Array& params, bool fHelp)
 {
     if (fHelp || params.size() < 1 || params.size() > 2)
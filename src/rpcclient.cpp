@@ -22,12 +22,18 @@ class CRPCConvertParam
 public:
     std::string methodName; //! method whose params want conversion
     int paramIdx;           //! 0-based idx of param to convert
+    bool fStringIfInvalid;  //! pass a value that isn't JSON on as a string
 };
 // ***TODO***
 static const CRPCConvertParam vRPCConvertParams[] =
     {
         {"stop", 0},
         {"setmocktime", 0},
+        {"getlockstats", 0},
+        {"getlockstats", 1},
+        {"getrpcstats", 0},
+        {"logging", 0},
+        {"logging", 1},
         {"getaddednodeinfo", 0},
         {"setgenerate", 0},
         {"setgenerate", 1},
@@ -103,12 +109,17 @@ static const CRPCConvertParam vRPCConvertParams[] =
         {"reservebalance", 1},
         {"setstakesplitthreshold", 0},
         {"autocombinerewards", 0},
-        {"autocombinerewards", 1}};
+        {"autocombinerewards", 1},
+        {"getaddressbalance", 0, true},
+        {"getaddressutxos", 0, true},
+        {"getaddresstxids", 0, true},
+        {"getspentinfo", 0}};
 
 class CRPCConvertTable
 {
 private:
     std::set<std::pair<std::string, int> > members;
+    std::set<std::pair<std::string, int> > membersStringIfInvalid;
 
 public:
     CRPCConvertTable();
@@ -117,6 +128,11 @@ public:
     {
         return (members.count(std::make_pair(method, idx)) > 0);
     }
+
+    bool stringIfInvalid(const std::string& method, int idx)
+    {
+        return (membersStringIfInvalid.count(std::make_pair(method, idx)) > 0);
+    }
 };
 
 CRPCConvertTable::CRPCConvertTable()
@@ -127,6 +143,9 @@ CRPCConvertTable::CRPCConvertTable()
     for (unsigned int i = 0; i < n_elem; i++) {
         members.insert(std::make_pair(vRPCConvertParams[i].methodName,
             vRPCConvertParams[i].paramIdx));
+        if (vRPCConvertParams[i].fStringIfInvalid)
+            membersStringIfInvalid.insert(std::make_pair(vRPCConvertParams[i].methodName,
+                vRPCConvertParams[i].paramIdx));
     }
 }
 
@@ -148,9 +167,12 @@ Array RPCConvertValues(const std::string& strMethod, const std::vector<std::stri
         // parse string as JSON, insert bool/number/object/etc. value
         else {
             Value jVal;
-            if (!read_string(strVal, jVal))
+            if (read_string(strVal, jVal))
+                params.push_back(jVal);
+            else if (rpcCvtTable.stringIfInvalid(strMethod, idx))
+                params.push_back(strVal); // e.g. a bare address where an object is also accepted
+            else
                 throw runtime_error(string("Error parsing JSON:") + strVal);
-            params.push_back(jVal);
         }
     }
 
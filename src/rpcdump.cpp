@@ -139,6 +139,7 @@ Value importprivkey(const Array& params, bool fHelp)
         if (fRescan) {
             pwalletMain->ScanForWalletTransactions(chainActive.Genesis(), true);
         }
+        pwalletMain->ResetCoinMixRounds();
     }
 
     return Value::null;
@@ -203,6 +204,7 @@ Value importaddress(const Array& params, bool fHelp)
             pwalletMain->ScanForWalletTransactions(chainActive.Genesis(), true);
             pwalletMain->ReacceptWalletTransactions();
         }
+        pwalletMain->ResetCoinMixRounds();
     }
 
     return Value::null;
@@ -297,6 +299,7 @@ Value importwallet(const Array& params, bool fHelp)
     LogPrintf("Rescanning last %i blocks\n", chainActive.Height() - pindex->nHeight + 1);
     pwalletMain->ScanForWalletTransactions(pindex);
     pwalletMain->MarkDirty();
+    pwalletMain->ResetCoinMixRounds();
 
     if (!fGood)
         throw JSONRPCError(RPC_WALLET_ERROR, "Error adding some keys to wallet");
@@ -485,6 +488,7 @@ Value bip38decrypt(const Array& params, bool fHelp)
         // whenever a key is imported, we need to scan the whole chain
         pwalletMain->nTimeFirstKey = 1; // 0 would be considered 'no value'
         pwalletMain->ScanForWalletTransactions(chainActive.Genesis(), true);
+        pwalletMain->ResetCoinMixRounds();
     }
 
     return result;
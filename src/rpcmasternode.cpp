@@ -182,8 +182,9 @@ Value masternode(const Array& params, bool fHelp)
             Object obj;
             int nCount = 0;
 
-            if (chainActive.Tip())
-                mnodeman.GetNextMasternodeInQueueForPayment(chainActive.Tip()->nHeight, true, nCount);
+            std::shared_ptr<const CChainTipSnapshot> tip = GetChainTipSnapshot();
+            if (tip->pindex)
+                mnodeman.GetNextMasternodeInQueueForPayment(tip->nHeight, true, nCount);
 
             obj.push_back(Pair("total", mnodeman.size()));
             //obj.push_back(Pair("stable", mnodeman.stable_size()));
@@ -447,13 +448,9 @@ Value masternode(const Array& params, bool fHelp)
     }
 
     if (strCommand == "winners") {
-        int nHeight;
-        {
-            LOCK(cs_main);
-            CBlockIndex* pindex = chainActive.Tip();
-            if(!pindex) return 0;
-            nHeight = pindex->nHeight;
-        }
+        std::shared_ptr<const CChainTipSnapshot> tip = GetChainTipSnapshot();
+        if (!tip->pindex) return 0;
+        int nHeight = tip->nHeight;
 
         int nLast = 10;
         std::string strFilter = "";
@@ -547,6 +544,33 @@ Value masternode(const Array& params, bool fHelp)
     return Value::null;
 }
 
+/** Describe a ranked masternode for masternodelist, or return false if the filter leaves it out */
+static bool MasternodeToJSON(const pair<int, CMasternode>& s, const std::string& strFilter, Object& obj)
+{
+    std::string strVin = s.second.vin.prevout.ToStringShort();
+    std::string strTxHash = s.second.vin.prevout.hash.ToString();
+    uint32_t oIdx = s.second.vin.prevout.n;
+
+    CMasternode* mn = mnodeman.Find(s.second.vin);
+
+    if (strFilter != "" && strTxHash.find(strFilter) == string::npos &&
+        mn->Status().find(strFilter) == string::npos &&
+        CBitcoinAddress(mn->pubKeyCollateralAddress.GetID()).ToString().find(strFilter) == string::npos) return false;
+
+    std::string strStatus = mn->Status();
+
+    obj.push_back(Pair("rank", (strStatus == "ENABLED" ? s.first : 0)));
+    obj.push_back(Pair("txhash", strTxHash));
+    obj.push_back(Pair("outidx", (uint64_t)oIdx));
+    obj.push_back(Pair("status", strStatus));
+    obj.push_back(Pair("addr", CBitcoinAddress(mn->pubKeyCollateralAddress.GetID()).ToString()));
+    obj.push_back(Pair("version", mn->protocolVersion));
+    obj.push_back(Pair("lastseen", (int64_t)mn->lastPing.sigTime));
+    obj.push_back(Pair("activetime", (int64_t)(mn->lastPing.sigTime - mn->sigTime)));
+    obj.push_back(Pair("lastpaid", (int64_t)mn->GetLastPaid()));
+    return true;
+}
+
 Value masternodelist(const Array& params, bool fHelp)
 {
     std::string strFilter = "";
@@ -581,40 +605,37 @@ Value masternodelist(const Array& params, bool fHelp)
     }
 
     Array ret;
-    int nHeight;
-    {
-        LOCK(cs_main);
-        CBlockIndex* pindex = chainActive.Tip();
-        if(!pindex) return 0;
-        nHeight = pindex->nHeight;
-    }
+    std::shared_ptr<const CChainTipSnapshot> tip = GetChainTipSnapshot();
+    if (!tip->pindex) return 0;
+    int nHeight = tip->nHeight;
     std::vector<pair<int, CMasternode> > vMasternodeRanks = mnodeman.GetMasternodeRanks(nHeight);
     BOOST_FOREACH (PAIRTYPE(int, CMasternode) & s, vMasternodeRanks) {
         Object obj;
-        std::string strVin = s.second.vin.prevout.ToStringShort();
-        std::string strTxHash = s.second.vin.prevout.hash.ToString();
-        uint32_t oIdx = s.second.vin.prevout.n;
+        if (MasternodeToJSON(s, strFilter, obj))
+            ret.push_back(obj);
+    }
 
-        CMasternode* mn = mnodeman.Find(s.second.vin);
+    return ret;
+}
 
-        if (strFilter != "" && strTxHash.find(strFilter) == string::npos &&
-            mn->Status().find(strFilter) == string::npos &&
-            CBitcoinAddress(mn->pubKeyCollateralAddress.GetID()).ToString().find(strFilter) == string::npos) continue;
+bool masternodelist_stream(const Array& params, CJSONStreamWriter& writer)
+{
+    if (params.size() > 1)
+        return false;
 
-        std::string strStatus = mn->Status();
+    std::string strFilter = "";
+    if (params.size() == 1) strFilter = params[0].get_str();
 
-        obj.push_back(Pair("rank", (strStatus == "ENABLED" ? s.first : 0)));
-        obj.push_back(Pair("txhash", strTxHash));
-        obj.push_back(Pair("outidx", (uint64_t)oIdx));
-        obj.push_back(Pair("status", strStatus));
-        obj.push_back(Pair("addr", CBitcoinAddress(mn->pubKeyCollateralAddress.GetID()).ToString()));
-        obj.push_back(Pair("version", mn->protocolVersion));
-        obj.push_back(Pair("lastseen", (int64_t)mn->lastPing.sigTime));
-        obj.push_back(Pair("activetime", (int64_t)(mn->lastPing.sigTime - mn->sigTime)));
-        obj.push_back(Pair("lastpaid", (int64_t)mn->GetLastPaid()));
+    std::shared_ptr<const CChainTipSnapshot> tip = GetChainTipSnapshot();
+    if (!tip->pindex) return false;
+    std::vector<pair<int, CMasternode> > vMasternodeRanks = mnodeman.GetMasternodeRanks(tip->nHeight);
 
-        ret.push_back(obj);
+    writer.BeginArray();
+    BOOST_FOREACH (PAIRTYPE(int, CMasternode) & s, vMasternodeRanks) {
+        Object obj;
+        if (MasternodeToJSON(s, strFilter, obj))
+            writer.Write(obj);
     }
-
-    return ret;
+    writer.EndArray();
+    return true;
 }
@@ -12,6 +12,7 @@
 #include "masternode-sync.h"
 #include "net.h"
 #include "netbase.h"
+#include "perfstats.h"
 #include "rpcserver.h"
 #include "spork.h"
 #include "timedata.h"
@@ -248,6 +249,170 @@ Value spork(const Array& params, bool fHelp)
         HelpRequiringPassphrase());
 }
 
+Object PerfStatsToJSON(const std::string& strPrefix)
+{
+    Object ret;
+    BOOST_FOREACH (const CPerfHistogram* phist, CPerfHistogram::GetAll()) {
+        if (std::string(phist->GetName()).compare(0, strPrefix.size(), strPrefix) != 0)
+            continue;
+        CPerfHistogramSnapshot snapshot;
+        phist->GetSnapshot(snapshot);
+        Object obj;
+        obj.push_back(Pair("count", snapshot.nCount));
+        obj.push_back(Pair("total", snapshot.nSum));
+        obj.push_back(Pair("min", snapshot.nMin));
+        obj.push_back(Pair("max", snapshot.nMax));
+        obj.push_back(Pair("mean", snapshot.nCount ? (double)snapshot.nSum / snapshot.nCount : 0.0));
+        obj.push_back(Pair("p50", snapshot.Percentile(0.5)));
+        obj.push_back(Pair("p90", snapshot.Percentile(0.9)));
+        obj.push_back(Pair("p99", snapshot.Percentile(0.99)));
+        ret.push_back(Pair(phist->GetName(), obj));
+    }
+    BOOST_FOREACH (const CPerfCounter* pcounter, CPerfCounter::GetAll()) {
+        if (std::string(pcounter->GetName()).compare(0, strPrefix.size(), strPrefix) == 0)
+            ret.push_back(Pair(pcounter->GetName(), pcounter->Get()));
+    }
+    return ret;
+}
+
+Value getperfstats(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() > 1)
+        throw runtime_error(
+            "getperfstats ( \"prefix\" )\n"
+            "\nReturns timing histograms and counters for block validation stages.\n"
+            "All times are in microseconds.\n"
+            "\nArguments:\n"
+            "1. \"prefix\"     (string, optional) Only return statistics whose name starts with this\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"name\": {       (json object) A timing histogram, such as block.verify\n"
+            "    \"count\": n,   (numeric) Number of samples\n"
+            "    \"total\": n,   (numeric) Sum of all samples\n"
+            "    \"min\": n,     (numeric) Smallest sample\n"
+            "    \"max\": n,     (numeric) Largest sample\n"
+            "    \"mean\": x.x,  (numeric) Average sample\n"
+            "    \"p50\": n,     (numeric) Median, within 12.5%\n"
+            "    \"p90\": n,     (numeric) 90th percentile, within 12.5%\n"
+            "    \"p99\": n      (numeric) 99th percentile, within 12.5%\n"
+            "  },\n"
+            "  \"name\": n,      (numeric) A counter, such as block.prefetched\n"
+            "  ...\n"
+            "}\n"
+            "\nExamples:\n" +
+            HelpExampleCli("getperfstats", "") + HelpExampleCli("getperfstats", "\"block.\"") + HelpExampleRpc("getperfstats", ""));
+
+    return PerfStatsToJSON(params.size() > 0 ? params[0].get_str() : "");
+}
+
+static Object LockTimesToJSON(uint64_t nTotal, uint64_t nMax, const uint64_t vPercentiles[3])
+{
+    Object obj;
+    obj.push_back(Pair("total", nTotal));
+    obj.push_back(Pair("max", nMax));
+    obj.push_back(Pair("p50", vPercentiles[0]));
+    obj.push_back(Pair("p90", vPercentiles[1]));
+    obj.push_back(Pair("p99", vPercentiles[2]));
+    return obj;
+}
+
+Value getlockstats(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() > 2)
+        throw runtime_error(
+            "getlockstats ( count reset )\n"
+            "\nReturns the lock sites waited on longest, when started with -lockstats.\n"
+            "A lock site is a LOCK or TRY_LOCK in the source. All times are in microseconds.\n"
+            "\nArguments:\n"
+            "1. count          (numeric, optional, default=20) Number of lock sites to return, 0 for all\n"
+            "2. reset          (boolean, optional, default=false) Zero the statistics after returning them\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"enabled\": true|false,  (boolean) Whether locks are being profiled\n"
+            "  \"sites\": [\n"
+            "    {\n"
+            "      \"lock\": \"name\",      (string) The locked expression, such as cs_main\n"
+            "      \"site\": \"file:line\", (string) Where the lock was taken\n"
+            "      \"acquired\": n,        (numeric) Times the lock was taken here\n"
+            "      \"contended\": n,       (numeric) Times it had to wait for another thread\n"
+            "      \"tryfailed\": n,       (numeric) Times a TRY_LOCK here found the lock taken\n"
+            "      \"wait\": {             (json object) Waits that found the lock taken\n"
+            "        \"total\": n, \"max\": n, \"p50\": n, \"p90\": n, \"p99\": n\n"
+            "      },\n"
+            "      \"hold\": {             (json object) How long the lock was held, same fields as wait\n"
+            "      }\n"
+            "    }, ...\n"
+            "  ]\n"
+            "}\n"
+            "\nExamples:\n" +
+            HelpExampleCli("getlockstats", "") + HelpExampleCli("getlockstats", "0 true") + HelpExampleRpc("getlockstats", "10"));
+
+    int nCount = params.size() > 0 ? params[0].get_int() : 20;
+    if (nCount < 0)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Negative count");
+    bool fReset = params.size() > 1 ? params[1].get_bool() : false;
+
+    std::vector<CLockSiteStats> vStats = GetLockStats();
+    if (fReset)
+        ResetLockStats();
+    if (nCount > 0 && vStats.size() > (size_t)nCount)
+        vStats.resize(nCount);
+
+    Array sites;
+    BOOST_FOREACH (const CLockSiteStats& stats, vStats) {
+        Object site;
+        site.push_back(Pair("lock", stats.strName));
+        site.push_back(Pair("site", strprintf("%s:%d", stats.strFile, stats.nLine)));
+        site.push_back(Pair("acquired", stats.nAcquired));
+        site.push_back(Pair("contended", stats.nContended));
+        site.push_back(Pair("tryfailed", stats.nTryFailed));
+        site.push_back(Pair("wait", LockTimesToJSON(stats.nWaitMicros, stats.nMaxWaitMicros, stats.vWaitPercentiles)));
+        site.push_back(Pair("hold", LockTimesToJSON(stats.nHoldMicros, stats.nMaxHoldMicros, stats.vHoldPercentiles)));
+        sites.push_back(site);
+    }
+
+    Object ret;
+    ret.push_back(Pair("enabled", fLockStats.load()));
+    ret.push_back(Pair("sites", sites));
+    return ret;
+}
+
+Value logging(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() > 2)
+        throw runtime_error(
+            "logging ( [\"include_category\",...] [\"exclude_category\",...] )\n"
+            "\nGets and sets the debug log categories.\n"
+            "With no arguments, returns whether each category is logged.\n"
+            "The categories are those of -debug; \"all\" stands for every category and \"sling\" for\n"
+            "coinmix, fastsend, masternode, mnpayments and mnbudget. Exclusions are applied after inclusions.\n"
+            "Lines the log writer had to drop are counted in getperfstats as log.dropped_lines.\n"
+            "\nArguments:\n"
+            "1. \"include\"    (array of strings, optional) Categories to turn on\n"
+            "2. \"exclude\"    (array of strings, optional) Categories to turn off\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"category\": true|false,  (boolean) Whether debug output of this category is logged\n"
+            "  ...\n"
+            "}\n"
+            "\nExamples:\n" +
+            HelpExampleCli("logging", "\"[\\\"all\\\"]\" \"[\\\"net\\\"]\"") + HelpExampleRpc("logging", "[\"all\"], [\"net\"]"));
+
+    for (unsigned int i = 0; i < params.size(); i++) {
+        const Array& categories = params[i].get_array();
+        BOOST_FOREACH (const Value& category, categories) {
+            if (!SetLogCategory(category.get_str(), i == 0))
+                throw JSONRPCError(RPC_INVALID_PARAMETER, "Unknown logging category " + category.get_str());
+        }
+    }
+
+    Object ret;
+    std::vector<std::pair<std::string, bool> > vCategories = GetLogCategories();
+    for (unsigned int i = 0; i < vCategories.size(); i++)
+        ret.push_back(Pair(vCategories[i].first, vCategories[i].second));
+    return ret;
+}
+
 Value validateaddress(const Array& params, bool fHelp)
 {
     if (fHelp || params.size() != 1)
@@ -460,6 +625,231 @@ Value setmocktime(const Array& params, bool fHelp)
     return Value::null;
 }
 
+// The address index RPCs take an address or, like the Insight API, an
+// object with an "addresses" array and an optional height range.
+static void ParseAddressIndexRequest(const Value& request, std::vector<std::pair<uint160, int> >& vAddresses, int* pnStart = NULL, int* pnEnd = NULL)
+{
+    Array addresses;
+    if (request.type() == str_type) {
+        addresses.push_back(request);
+    } else if (request.type() == obj_type) {
+        const Object& obj = request.get_obj();
+        Value value = find_value(obj, "addresses");
+        if (value.type() != array_type)
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Addresses must be an array");
+        addresses = value.get_array();
+        if (pnStart) {
+            Value start = find_value(obj, "start");
+            if (start.type() != null_type)
+                *pnStart = start.get_int();
+        }
+        if (pnEnd) {
+            Value end = find_value(obj, "end");
+            if (end.type() != null_type)
+                *pnEnd = end.get_int();
+        }
+    } else {
+        throw JSONRPCError(RPC_TYPE_ERROR, "Expected an address or an object with an addresses array");
+    }
+
+    BOOST_FOREACH (const Value& value, addresses) {
+        if (value.type() != str_type)
+            throw JSONRPCError(RPC_TYPE_ERROR, "Addresses must be strings");
+        CBitcoinAddress address(value.get_str());
+        int nType;
+        uint160 hashBytes;
+        if (!address.IsValid() || !GetAddressIndexKey(address.Get(), nType, hashBytes))
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid address: " + value.get_str());
+        vAddresses.push_back(make_pair(hashBytes, nType));
+    }
+
+    if (pnStart && pnEnd && *pnEnd > 0 && *pnEnd < *pnStart)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "End height is below start height");
+}
+
+static std::string AddressFromIndexKey(int nType, const uint160& hashBytes)
+{
+    if (nType == ADDRESS_TYPE_P2SH)
+        return CBitcoinAddress(CScriptID(hashBytes)).ToString();
+    return CBitcoinAddress(CKeyID(hashBytes)).ToString();
+}
+
+Value getaddressbalance(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1)
+        throw runtime_error(
+            "getaddressbalance \"address\"|{\"addresses\":[\"address\",...]}\n"
+            "\nReturns the confirmed balance of one or more addresses (requires -addressindex).\n"
+            "\nArguments:\n"
+            "1. \"address\"          (string) The address, or an object with an \"addresses\" array\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"balance\": n,       (numeric) The current balance in SLING\n"
+            "  \"received\": n,      (numeric) The total amount received in SLING, change included\n"
+            "}\n"
+            "\nExamples:\n" +
+            HelpExampleCli("getaddressbalance", "\"SNqQy2GpVfSpYzhq5Y5Lbd3ZLSdHGEmRzW\"") + HelpExampleCli("getaddressbalance", "'{\"addresses\": [\"SNqQy2GpVfSpYzhq5Y5Lbd3ZLSdHGEmRzW\"]}'") + HelpExampleRpc("getaddressbalance", "\"SNqQy2GpVfSpYzhq5Y5Lbd3ZLSdHGEmRzW\""));
+
+    std::vector<std::pair<uint160, int> > vAddresses;
+    ParseAddressIndexRequest(params[0], vAddresses);
+
+    // The unspent index holds exactly the outputs the balance is made of and
+    // the block tree keeps a running total of what each address received, so
+    // neither figure needs the whole history of the address.
+    CAmount nBalance = 0;
+    CAmount nReceived = 0;
+    for (std::vector<std::pair<uint160, int> >::const_iterator it = vAddresses.begin(); it != vAddresses.end(); it++) {
+        std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > vUnspent;
+        if (!GetAddressUnspent(it->first, it->second, vUnspent))
+            throw JSONRPCError(RPC_MISC_ERROR, "No information available for address");
+        for (std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> >::const_iterator u = vUnspent.begin(); u != vUnspent.end(); u++)
+            nBalance += u->second.nSatoshis;
+
+        CAmount nAddressReceived;
+        if (!GetAddressReceived(it->first, it->second, nAddressReceived))
+            throw JSONRPCError(RPC_MISC_ERROR, "No information available for address");
+        nReceived += nAddressReceived;
+    }
+
+    Object result;
+    result.push_back(Pair("balance", ValueFromAmount(nBalance)));
+    result.push_back(Pair("received", ValueFromAmount(nReceived)));
+    return result;
+}
+
+Value getaddressutxos(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1)
+        throw runtime_error(
+            "getaddressutxos \"address\"|{\"addresses\":[\"address\",...]}\n"
+            "\nReturns the confirmed unspent outputs of one or more addresses (requires -addressindex).\n"
+            "\nArguments:\n"
+            "1. \"address\"          (string) The address, or an object with an \"addresses\" array\n"
+            "\nResult:\n"
+            "[\n"
+            "  {\n"
+            "    \"address\": \"address\",  (string) The address the output pays to\n"
+            "    \"txid\": \"hash\",        (string) The transaction id\n"
+            "    \"outputIndex\": n,      (numeric) The output index\n"
+            "    \"script\": \"hex\",       (string) The script hex encoded\n"
+            "    \"satoshis\": n,         (numeric) The value of the output in satoshis\n"
+            "    \"height\": n            (numeric) The height of the block the output was confirmed in\n"
+            "  }\n"
+            "  ,...\n"
+            "]\n"
+            "\nExamples:\n" +
+            HelpExampleCli("getaddressutxos", "\"SNqQy2GpVfSpYzhq5Y5Lbd3ZLSdHGEmRzW\"") + HelpExampleCli("getaddressutxos", "'{\"addresses\": [\"SNqQy2GpVfSpYzhq5Y5Lbd3ZLSdHGEmRzW\"]}'") + HelpExampleRpc("getaddressutxos", "\"SNqQy2GpVfSpYzhq5Y5Lbd3ZLSdHGEmRzW\""));
+
+    std::vector<std::pair<uint160, int> > vAddresses;
+    ParseAddressIndexRequest(params[0], vAddresses);
+
+    Array result;
+    for (std::vector<std::pair<uint160, int> >::const_iterator it = vAddresses.begin(); it != vAddresses.end(); it++) {
+        std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > vUnspent;
+        if (!GetAddressUnspent(it->first, it->second, vUnspent))
+            throw JSONRPCError(RPC_MISC_ERROR, "No information available for address");
+        std::string strAddress = AddressFromIndexKey(it->second, it->first);
+        for (std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> >::const_iterator u = vUnspent.begin(); u != vUnspent.end(); u++) {
+            Object output;
+            output.push_back(Pair("address", strAddress));
+            output.push_back(Pair("txid", u->first.txhash.GetHex()));
+            output.push_back(Pair("outputIndex", (int)u->first.nIndex));
+            output.push_back(Pair("script", HexStr(u->second.script.begin(), u->second.script.end())));
+            output.push_back(Pair("satoshis", u->second.nSatoshis));
+            output.push_back(Pair("height", u->second.nBlockHeight));
+            result.push_back(output);
+        }
+    }
+    return result;
+}
+
+Value getaddresstxids(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1)
+        throw runtime_error(
+            "getaddresstxids \"address\"|{\"addresses\":[\"address\",...],\"start\":n,\"end\":n}\n"
+            "\nReturns the ids of the confirmed transactions paying to or spending from one or more\n"
+            "addresses, in order of height (requires -addressindex).\n"
+            "\nArguments:\n"
+            "1. \"address\"          (string) The address, or an object with:\n"
+            "     \"addresses\"      (array) The addresses\n"
+            "     \"start\"          (numeric, optional) The first height to include\n"
+            "     \"end\"            (numeric, optional) The last height to include, 0 for the tip\n"
+            "\nA range of heights reads only that part of the index, so the history of a busy\n"
+            "address can be paged through without reading it all.\n"
+            "\nResult:\n"
+            "[\n"
+            "  \"transactionid\"     (string) The transaction id\n"
+            "  ,...\n"
+            "]\n"
+            "\nExamples:\n" +
+            HelpExampleCli("getaddresstxids", "\"SNqQy2GpVfSpYzhq5Y5Lbd3ZLSdHGEmRzW\"") + HelpExampleCli("getaddresstxids", "'{\"addresses\": [\"SNqQy2GpVfSpYzhq5Y5Lbd3ZLSdHGEmRzW\"], \"start\": 1000, \"end\": 2000}'") + HelpExampleRpc("getaddresstxids", "\"SNqQy2GpVfSpYzhq5Y5Lbd3ZLSdHGEmRzW\""));
+
+    std::vector<std::pair<uint160, int> > vAddresses;
+    int nStart = 0;
+    int nEnd = 0;
+    ParseAddressIndexRequest(params[0], vAddresses, &nStart, &nEnd);
+
+    // A transaction has a record per input and output it has at an address;
+    // each is listed once, ordered by height and then position in the block.
+    std::set<std::pair<std::pair<int, unsigned int>, uint256> > setTxids;
+    for (std::vector<std::pair<uint160, int> >::const_iterator it = vAddresses.begin(); it != vAddresses.end(); it++) {
+        std::vector<std::pair<CAddressIndexKey, CAmount> > vAddressIndex;
+        if (!GetAddressIndex(it->first, it->second, vAddressIndex, nStart, nEnd))
+            throw JSONRPCError(RPC_MISC_ERROR, "No information available for address");
+        for (std::vector<std::pair<CAddressIndexKey, CAmount> >::const_iterator a = vAddressIndex.begin(); a != vAddressIndex.end(); a++)
+            setTxids.insert(make_pair(make_pair(a->first.nBlockHeight, a->first.nTxIndex), a->first.txhash));
+    }
+
+    Array result;
+    for (std::set<std::pair<std::pair<int, unsigned int>, uint256> >::const_iterator it = setTxids.begin(); it != setTxids.end(); it++)
+        result.push_back(it->second.GetHex());
+    return result;
+}
+
+Value getspentinfo(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1)
+        throw runtime_error(
+            "getspentinfo {\"txid\":\"hash\",\"index\":n}\n"
+            "\nReturns the input that spent an output (requires -spentindex).\n"
+            "\nArguments:\n"
+            "1. {\n"
+            "     \"txid\": \"hash\",   (string, required) The id of the transaction of the output\n"
+            "     \"index\": n        (numeric, required) The output index\n"
+            "   }\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"txid\": \"hash\",      (string) The id of the spending transaction\n"
+            "  \"index\": n,          (numeric) The index of the spending input\n"
+            "  \"height\": n          (numeric) The height of the block the spend was confirmed in\n"
+            "}\n"
+            "\nExamples:\n" +
+            HelpExampleCli("getspentinfo", "'{\"txid\": \"0437cd7f8525ceed2324359c2d0ba26006d92d856a9c20fa0241106ee5a597c9\", \"index\": 0}'") + HelpExampleRpc("getspentinfo", "{\"txid\": \"0437cd7f8525ceed2324359c2d0ba26006d92d856a9c20fa0241106ee5a597c9\", \"index\": 0}"));
+
+    RPCTypeCheck(params, boost::assign::list_of(obj_type));
+    const Object& request = params[0].get_obj();
+    Value txidValue = find_value(request, "txid");
+    Value indexValue = find_value(request, "index");
+    if (txidValue.type() != str_type || indexValue.type() != int_type)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid txid or index");
+    if (indexValue.get_int() < 0)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid txid or index");
+
+    if (!fSpentIndex)
+        throw JSONRPCError(RPC_MISC_ERROR, "Spent index not enabled");
+    CSpentIndexKey key(ParseHashV(txidValue, "txid"), indexValue.get_int());
+    CSpentIndexValue value;
+    if (!GetSpentIndex(key, value))
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Unable to get spent info");
+
+    Object result;
+    result.push_back(Pair("txid", value.txid.GetHex()));
+    result.push_back(Pair("index", (int)value.nInputIndex));
+    result.push_back(Pair("height", value.nBlockHeight));
+    return result;
+}
+
 #ifdef ENABLE_WALLET
 Value getstakingstatus(const Array& params, bool fHelp)
 {
@@ -88,6 +88,7 @@ Value getpeerinfo(const Array& params, bool fHelp)
             "    \"lastrecv\": ttt,           (numeric) The time in seconds since epoch (Jan 1 1970 GMT) of the last receive\n"
             "    \"bytessent\": n,            (numeric) The total bytes sent\n"
             "    \"bytesrecv\": n,            (numeric) The total bytes received\n"
+            "    \"recvbuffer\": n,           (numeric) The bytes held by received messages awaiting processing\n"
             "    \"conntime\": ttt,           (numeric) The connection time in seconds since epoch (Jan 1 1970 GMT)\n"
             "    \"pingtime\": n,             (numeric) ping time\n"
             "    \"pingwait\": n,             (numeric) ping wait\n"
@@ -126,6 +127,7 @@ Value getpeerinfo(const Array& params, bool fHelp)
         obj.push_back(Pair("lastrecv", stats.nLastRecv));
         obj.push_back(Pair("bytessent", stats.nSendBytes));
         obj.push_back(Pair("bytesrecv", stats.nRecvBytes));
+        obj.push_back(Pair("recvbuffer", (uint64_t)stats.nRecvSize));
         obj.push_back(Pair("conntime", stats.nTimeConnected));
         obj.push_back(Pair("pingtime", stats.dPingTime));
         if (stats.dPingWait > 0.0)
@@ -313,7 +315,12 @@ Value getnettotals(const Array& params, bool fHelp)
             "{\n"
             "  \"totalbytesrecv\": n,   (numeric) Total bytes received\n"
             "  \"totalbytessent\": n,   (numeric) Total bytes sent\n"
-            "  \"timemillis\": t        (numeric) Total cpu time\n"
+            "  \"timemillis\": t,       (numeric) Total cpu time\n"
+            "  \"recvbufferpool\": {    (json object) Receive buffer pool\n"
+            "    \"pooledbytes\": n,    (numeric) Bytes held in idle buffers\n"
+            "    \"hits\": n,           (numeric) Messages that reused a pooled buffer\n"
+            "    \"misses\": n          (numeric) Messages that needed a new buffer\n"
+            "  }\n"
             "}\n"
             "\nExamples:\n" +
             HelpExampleCli("getnettotals", "") + HelpExampleRpc("getnettotals", ""));
@@ -322,6 +329,15 @@ Value getnettotals(const Array& params, bool fHelp)
     obj.push_back(Pair("totalbytesrecv", CNode::GetTotalBytesRecv()));
     obj.push_back(Pair("totalbytessent", CNode::GetTotalBytesSent()));
     obj.push_back(Pair("timemillis", GetTimeMillis()));
+
+    size_t nPooledBytes;
+    uint64_t nHits, nMisses;
+    recvBufferPool.GetStats(nPooledBytes, nHits, nMisses);
+    Object pool;
+    pool.push_back(Pair("pooledbytes", (uint64_t)nPooledBytes));
+    pool.push_back(Pair("hits", nHits));
+    pool.push_back(Pair("misses", nMisses));
+    obj.push_back(Pair("recvbufferpool", pool));
     return obj;
 }
 
@@ -358,6 +374,7 @@ Value getnetworkinfo(const Array& params, bool fHelp)
             "  \"localservices\": \"xxxxxxxxxxxxxxxx\", (string) the services we offer to the network\n"
             "  \"timeoffset\": xxxxx,                   (numeric) the time offset\n"
             "  \"connections\": xxxxx,                  (numeric) the number of connections\n"
+            "  \"socketevents\": \"xxx\",               (string) the socket events mode, either select or epoll\n"
             "  \"networks\": [                          (array) information per network\n"
             "  {\n"
             "    \"name\": \"xxx\",                     (string) network (ipv4, ipv6 or onion)\n"
@@ -388,6 +405,7 @@ Value getnetworkinfo(const Array& params, bool fHelp)
     obj.push_back(Pair("localservices", strprintf("%016x", nLocalServices)));
     obj.push_back(Pair("timeoffset", GetTimeOffset()));
     obj.push_back(Pair("connections", (int)vNodes.size()));
+    obj.push_back(Pair("socketevents", GetSocketEventsModeName()));
     obj.push_back(Pair("networks", GetNetworksInfo()));
     obj.push_back(Pair("relayfee", ValueFromAmount(::minRelayTxFee.GetFeePerK())));
     Array localAddresses;
@@ -70,6 +70,8 @@ static const char* httpStatusDescription(int nStatus)
     switch (nStatus) {
     case HTTP_OK:
         return "OK";
+    case HTTP_NOT_MODIFIED:
+        return "Not Modified";
     case HTTP_BAD_REQUEST:
         return "Bad Request";
     case HTTP_FORBIDDEN:
@@ -78,6 +80,8 @@ static const char* httpStatusDescription(int nStatus)
         return "Not Found";
     case HTTP_INTERNAL_SERVER_ERROR:
         return "Internal Server Error";
+    case HTTP_SERVICE_UNAVAILABLE:
+        return "Service Unavailable";
     default:
         return "";
     }
@@ -108,7 +112,7 @@ string HTTPError(int nStatus, bool keepalive, bool headersOnly)
         headersOnly, "text/plain");
 }
 
-string HTTPReplyHeader(int nStatus, bool keepalive, size_t contentLength, const char* contentType)
+string HTTPReplyHeader(int nStatus, bool keepalive, size_t contentLength, const char* contentType, const string& strHeaders)
 {
     return strprintf(
         "HTTP/1.1 %d %s\r\n"
@@ -116,6 +120,7 @@ string HTTPReplyHeader(int nStatus, bool keepalive, size_t contentLength, const
         "Connection: %s\r\n"
         "Content-Length: %u\r\n"
         "Content-Type: %s\r\n"
+        "%s"
         "Server: sling-json-rpc/%s\r\n"
         "\r\n",
         nStatus,
@@ -124,15 +129,144 @@ string HTTPReplyHeader(int nStatus, bool keepalive, size_t contentLength, const
         keepalive ? "keep-alive" : "close",
         contentLength,
         contentType,
+        strHeaders,
         FormatFullVersion());
 }
 
-string HTTPReply(int nStatus, const string& strMsg, bool keepalive, bool headersOnly, const char* contentType)
+CHTTPStreamReply::CHTTPStreamReply(std::ostream& streamIn, bool fKeepAliveIn, bool fChunkedIn, const char* pszContentTypeIn) : stream(streamIn), fKeepAlive(fKeepAliveIn), fChunked(fChunkedIn), fStarted(false), pszContentType(pszContentTypeIn), vBuffer(CHUNK_SIZE)
+{
+    setp(&vBuffer[0], &vBuffer[0] + vBuffer.size());
+}
+
+void CHTTPStreamReply::AddHeader(const std::string& strName, const std::string& strValue)
+{
+    assert(!fStarted);
+    strHeaders += strName + ": " + strValue + "\r\n";
+}
+
+int CHTTPStreamReply::overflow(int c)
+{
+    if (fChunked) {
+        SendChunk();
+    } else {
+        // Keep the whole body for Finish()
+        size_t nSize = pptr() - pbase();
+        vBuffer.resize(vBuffer.size() * 2);
+        setp(&vBuffer[0], &vBuffer[0] + vBuffer.size());
+        pbump(nSize);
+    }
+    if (c != traits_type::eof()) {
+        *pptr() = c;
+        pbump(1);
+    }
+    return traits_type::not_eof(c);
+}
+
+void CHTTPStreamReply::SendChunk()
+{
+    size_t nSize = pptr() - pbase();
+    if (nSize == 0)
+        return;
+    if (!fStarted) {
+        stream << strprintf(
+            "HTTP/1.1 %d %s\r\n"
+            "Date: %s\r\n"
+            "Connection: %s\r\n"
+            "Transfer-Encoding: chunked\r\n"
+            "Content-Type: %s\r\n"
+            "%s"
+            "Server: sling-json-rpc/%s\r\n"
+            "\r\n",
+            HTTP_OK,
+            httpStatusDescription(HTTP_OK),
+            rfc1123Time(),
+            fKeepAlive ? "keep-alive" : "close",
+            pszContentType,
+            strHeaders,
+            FormatFullVersion());
+        fStarted = true;
+    }
+    stream << strprintf("%x\r\n", nSize);
+    stream.write(pbase(), nSize);
+    stream << "\r\n" << std::flush;
+    setp(&vBuffer[0], &vBuffer[0] + vBuffer.size());
+}
+
+void CHTTPStreamReply::Finish()
+{
+    if (!fStarted) {
+        size_t nSize = pptr() - pbase();
+        stream << HTTPReplyHeader(HTTP_OK, fKeepAlive, nSize, pszContentType, strHeaders);
+        stream.write(pbase(), nSize);
+        stream << std::flush;
+        fStarted = true;
+    } else {
+        SendChunk();
+        stream << "0\r\n\r\n" << std::flush;
+    }
+    setp(&vBuffer[0], &vBuffer[0] + vBuffer.size());
+}
+
+void CJSONStreamWriter::Separate()
+{
+    if (fAfterKey) {
+        fAfterKey = false;
+        return;
+    }
+    if (!vHasMember.empty()) {
+        if (vHasMember.back())
+            os << ',';
+        vHasMember.back() = true;
+    }
+}
+
+void CJSONStreamWriter::BeginObject()
+{
+    Separate();
+    os << '{';
+    vHasMember.push_back(false);
+}
+
+void CJSONStreamWriter::EndObject()
+{
+    assert(!vHasMember.empty() && !fAfterKey);
+    vHasMember.pop_back();
+    os << '}';
+}
+
+void CJSONStreamWriter::BeginArray()
+{
+    Separate();
+    os << '[';
+    vHasMember.push_back(false);
+}
+
+void CJSONStreamWriter::EndArray()
+{
+    assert(!vHasMember.empty() && !fAfterKey);
+    vHasMember.pop_back();
+    os << ']';
+}
+
+void CJSONStreamWriter::Key(const string& strKey)
+{
+    Separate();
+    os << '"' << add_esc_chars(strKey) << "\":";
+    fAfterKey = true;
+}
+
+void CJSONStreamWriter::Write(const Value& value)
+{
+    Separate();
+    write_stream(value, os, false);
+}
+
+string HTTPReply(int nStatus, const string& strMsg, bool keepalive, bool headersOnly, const char* contentType, const string& strHeaders)
 {
     if (headersOnly) {
-        return HTTPReplyHeader(nStatus, keepalive, 0, contentType);
+        return HTTPReplyHeader(nStatus, keepalive, 0, contentType, strHeaders);
     } else {
-        return HTTPReplyHeader(nStatus, keepalive, strMsg.size(), contentType) + strMsg;
+        return HTTPReplyHeader(nStatus, keepalive, strMsg.size(), contentType, strHeaders) + strMsg;
     }
 }
 
@@ -221,7 +355,30 @@ int ReadHTTPMessage(std::basic_istream<char>& stream, map<string, string>& mapHe
         return HTTP_INTERNAL_SERVER_ERROR;
 
     // Read message
-    if (nLen > 0) {
+    std::string strEncoding = mapHeadersRet["transfer-encoding"];
+    if (boost::to_lower_copy(strEncoding) == "chunked") {
+        while (true) {
+            string strSize;
+            std::getline(stream, strSize);
+            if (!stream)
+                return HTTP_INTERNAL_SERVER_ERROR;
+            // Chunk extensions follow the size after a semicolon
+            size_t nChunk = strtoul(strSize.c_str(), NULL, 16);
+            if (nChunk == 0)
+                break;
+            if (nChunk > max_size - strMessageRet.size())
+                return HTTP_INTERNAL_SERVER_ERROR;
+            size_t nOld = strMessageRet.size();
+            strMessageRet.resize(nOld + nChunk);
+            stream.read(&strMessageRet[nOld], nChunk);
+            std::getline(stream, strSize);
+            if (!stream)
+                return HTTP_INTERNAL_SERVER_ERROR;
+        }
+        // Trailer headers
+        map<string, string> mapTrailers;
+        ReadHTTPHeaders(stream, mapTrailers);
+    } else if (nLen > 0) {
         vector<char> vch;
         size_t ptr = 0;
         while (ptr < (size_t)nLen) {
@@ -12,8 +12,11 @@
 #include <boost/iostreams/stream.hpp>
 #include <list>
 #include <map>
+#include <ostream>
 #include <stdint.h>
+#include <streambuf>
 #include <string>
+#include <vector>
 
 #include "json/json_spirit_reader_template.h"
 #include "json/json_spirit_utils.h"
@@ -22,6 +25,7 @@
 //! HTTP status codes
 enum HTTPStatusCode {
     HTTP_OK = 200,
+    HTTP_NOT_MODIFIED = 304,
     HTTP_BAD_REQUEST = 400,
     HTTP_UNAUTHORIZED = 401,
     HTTP_FORBIDDEN = 403,
@@ -146,12 +150,84 @@ private:
 
 std::string HTTPPost(const std::string& strMsg, const std::map<std::string, std::string>& mapRequestHeaders);
 std::string HTTPError(int nStatus, bool keepalive, bool headerOnly = false);
-std::string HTTPReplyHeader(int nStatus, bool keepalive, size_t contentLength, const char* contentType = "application/json");
-std::string HTTPReply(int nStatus, const std::string& strMsg, bool keepalive, bool headerOnly = false, const char* contentType = "application/json");
+/** strHeaders holds further header lines, each ending in "\r\n" */
+std::string HTTPReplyHeader(int nStatus, bool keepalive, size_t contentLength, const char* contentType = "application/json", const std::string& strHeaders = "");
+std::string HTTPReply(int nStatus, const std::string& strMsg, bool keepalive, bool headerOnly = false, const char* contentType = "application/json", const std::string& strHeaders = "");
 bool ReadHTTPRequestLine(std::basic_istream<char>& stream, int& proto, std::string& http_method, std::string& http_uri);
 int ReadHTTPStatus(std::basic_istream<char>& stream, int& proto);
 int ReadHTTPHeaders(std::basic_istream<char>& stream, std::map<std::string, std::string>& mapHeadersRet);
 int ReadHTTPMessage(std::basic_istream<char>& stream, std::map<std::string, std::string>& mapHeadersRet, std::string& strMessageRet, int nProto, size_t max_size);
+/**
+ * Sends a 200 reply written to it piece by piece. HTTP/1.1 clients get the
+ * body in chunks as it is written, so the whole body is never held; others
+ * get it in one piece from Finish(). A reply that fits in one chunk is sent
+ * with a Content-Length either way.
+ */
+class CHTTPStreamReply : public std::streambuf
+{
+public:
+    static const size_t CHUNK_SIZE = 64 * 1024;
+
+    CHTTPStreamReply(std::ostream& streamIn, bool fKeepAliveIn, bool fChunkedIn, const char* pszContentTypeIn = "application/json");
+
+    //! Add a header line to the reply; only before anything is written
+    void AddHeader(const std::string& strName, const std::string& strValue);
+    //! Whether anything was sent. Until then the reply can be dropped for another one.
+    bool Started() const { return fStarted; }
+    //! Send the rest of the body and end the reply
+    void Finish();
+
+protected:
+    int overflow(int c);
+
+private:
+    std::ostream& stream;
+    bool fKeepAlive;
+    bool fChunked;
+    bool fStarted;
+    const char* pszContentType;
+    std::string strHeaders;
+    std::vector<char> vBuffer;
+
+    void SendChunk();
+
+    CHTTPStreamReply(const CHTTPStreamReply&);
+    CHTTPStreamReply& operator=(const CHTTPStreamReply&);
+};
+
+/**
+ * Writes JSON to a stream as it is produced, for results too large to build
+ * as a json_spirit tree first. Values passed in are written exactly as
+ * write_string(value, false) writes them, so a streamed result reads the
+ * same as a built one.
+ */
+class CJSONStreamWriter
+{
+public:
+    explicit CJSONStreamWriter(std::ostream& osIn) : os(osIn), fAfterKey(false) {}
+
+    void BeginObject();
+    void EndObject();
+    void BeginArray();
+    void EndArray();
+    //! Name the next member of the current object
+    void Key(const std::string& strKey);
+    void Write(const json_spirit::Value& value);
+    void WritePair(const std::string& strKey, const json_spirit::Value& value)
+    {
+        Key(strKey);
+        Write(value);
+    }
+
+private:
+    std::ostream& os;
+    //! For each open object or array, whether it has a member yet
+    std::vector<bool> vHasMember;
+    bool fAfterKey;
+
+    void Separate();
+};
+
 std::string JSONRPCRequest(const std::string& strMethod, const json_spirit::Array& params, const json_spirit::Value& id);
 json_spirit::Object JSONRPCReplyObj(const json_spirit::Value& result, const json_spirit::Value& error, const json_spirit::Value& id);
 std::string JSONRPCReply(const json_spirit::Value& result, const json_spirit::Value& error, const json_spirit::Value& id);
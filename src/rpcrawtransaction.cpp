@@ -192,41 +192,24 @@ Value getrawtransaction(const Array& params, bool fHelp)
 }
 
 #ifdef ENABLE_WALLET
-Value listunspent(const Array& params, bool fHelp)
+/** What listunspent reports about an output, copied out of the wallet */
+struct CUnspentInfo {
+    uint256 txid;
+    int nOut;
+    bool fHaveAddress;
+    std::string strAddress;
+    bool fHaveAccount;
+    std::string strAccount;
+    CScript scriptPubKey;
+    bool fHaveRedeemScript;
+    CScript redeemScript;
+    CAmount nValue;
+    int nDepth;
+    bool fSpendable;
+};
+
+static void GetUnspentInfo(const Array& params, std::vector<CUnspentInfo>& vInfo)
 {
-    if (fHelp || params.size() > 3)
-        throw runtime_error(
-            "listunspent ( minconf maxconf  [\"address\",...] )\n"
-            "\nReturns array of unspent transaction outputs\n"
-            "with between minconf and maxconf (inclusive) confirmations.\n"
-            "Optionally filter to only include txouts paid to specified addresses.\n"
-            "Results are an array of Objects, each of which has:\n"
-            "{txid, vout, scriptPubKey, amount, confirmations}\n"
-            "\nArguments:\n"
-            "1. minconf          (numeric, optional, default=1) The minimum confirmations to filter\n"
-            "2. maxconf          (numeric, optional, default=9999999) The maximum confirmations to filter\n"
-            "3. \"addresses\"    (string) A json array of sling addresses to filter\n"
-            "    [\n"
-            "      \"address\"   (string) sling address\n"
-            "      ,...\n"
-            "    ]\n"
-            "\nResult\n"
-            "[                   (array of json object)\n"
-            "  {\n"
-            "    \"txid\" : \"txid\",        (string) the transaction id \n"
-            "    \"vout\" : n,               (numeric) the vout value\n"
-            "    \"address\" : \"address\",  (string) the sling address\n"
-            "    \"account\" : \"account\",  (string) The associated account, or \"\" for the default account\n"
-            "    \"scriptPubKey\" : \"key\", (string) the script key\n"
-            "    \"amount\" : x.xxx,         (numeric) the transaction amount in btc\n"
-            "    \"confirmations\" : n       (numeric) The number of confirmations\n"
-            "  }\n"
-            "  ,...\n"
-            "]\n"
-
-            "\nExamples\n" +
-            HelpExampleCli("listunspent", "") + HelpExampleCli("listunspent", "6 9999999 \"[\\\"1PGFqEzfmQch1gKD3ra4k18PNj3tTUUSqg\\\",\\\"1LtvqCaApEdUGFkpKMM4MstjcaL4dKg8SP\\\"]\"") + HelpExampleRpc("listunspent", "6, 9999999 \"[\\\"1PGFqEzfmQch1gKD3ra4k18PNj3tTUUSqg\\\",\\\"1LtvqCaApEdUGFkpKMM4MstjcaL4dKg8SP\\\"]\""));
-
     RPCTypeCheck(params, list_of(int_type)(int_type)(array_type));
 
     int nMinDepth = 1;
@@ -250,10 +233,11 @@ Value listunspent(const Array& params, bool fHelp)
         }
     }
 
-    Array results;
-    vector<COutput> vecOutputs;
     assert(pwalletMain != NULL);
+    LOCK2(cs_main, pwalletMain->cs_wallet);
+    vector<COutput> vecOutputs;
     pwalletMain->AvailableCoins(vecOutputs, false);
+    vInfo.reserve(vecOutputs.size());
     BOOST_FOREACH (const COutput& out, vecOutputs) {
         if (out.nDepth < nMinDepth || out.nDepth > nMaxDepth)
             continue;
@@ -267,35 +251,116 @@ Value listunspent(const Array& params, bool fHelp)
                 continue;
         }
 
-        CAmount nValue = out.tx->vout[out.i].nValue;
+        vInfo.push_back(CUnspentInfo());
+        CUnspentInfo& info = vInfo.back();
         const CScript& pk = out.tx->vout[out.i].scriptPubKey;
-        Object entry;
-        entry.push_back(Pair("txid", out.tx->GetHash().GetHex()));
-        entry.push_back(Pair("vout", out.i));
+        info.txid = out.tx->GetHash();
+        info.nOut = out.i;
         CTxDestination address;
-        if (ExtractDestination(out.tx->vout[out.i].scriptPubKey, address)) {
-            entry.push_back(Pair("address", CBitcoinAddress(address).ToString()));
-            if (pwalletMain->mapAddressBook.count(address))
-                entry.push_back(Pair("account", pwalletMain->mapAddressBook[address].name));
+        info.fHaveAddress = ExtractDestination(pk, address);
+        info.fHaveAccount = false;
+        if (info.fHaveAddress) {
+            info.strAddress = CBitcoinAddress(address).ToString();
+            std::map<CTxDestination, CAddressBookData>::const_iterator mi = pwalletMain->mapAddressBook.find(address);
+            if (mi != pwalletMain->mapAddressBook.end()) {
+                info.fHaveAccount = true;
+                info.strAccount = mi->second.name;
+            }
         }
-        entry.push_back(Pair("scriptPubKey", HexStr(pk.begin(), pk.end())));
+        info.scriptPubKey = pk;
+        info.fHaveRedeemScript = false;
         if (pk.IsPayToScriptHash()) {
             CTxDestination address;
             if (ExtractDestination(pk, address)) {
                 const CScriptID& hash = boost::get<CScriptID>(address);
-                CScript redeemScript;
-                if (pwalletMain->GetCScript(hash, redeemScript))
-                    entry.push_back(Pair("redeemScript", HexStr(redeemScript.begin(), redeemScript.end())));
+                info.fHaveRedeemScript = pwalletMain->GetCScript(hash, info.redeemScript);
             }
         }
-        entry.push_back(Pair("amount", ValueFromAmount(nValue)));
-        entry.push_back(Pair("confirmations", out.nDepth));
-        entry.push_back(Pair("spendable", out.fSpendable));
-        results.push_back(entry);
+        info.nValue = out.tx->vout[out.i].nValue;
+        info.nDepth = out.nDepth;
+        info.fSpendable = out.fSpendable;
+    }
+}
+
+static Object UnspentInfoToJSON(const CUnspentInfo& u)
+{
+    Object entry;
+    entry.push_back(Pair("txid", u.txid.GetHex()));
+    entry.push_back(Pair("vout", u.nOut));
+    if (u.fHaveAddress) {
+        entry.push_back(Pair("address", u.strAddress));
+        if (u.fHaveAccount)
+            entry.push_back(Pair("account", u.strAccount));
     }
+    entry.push_back(Pair("scriptPubKey", HexStr(u.scriptPubKey.begin(), u.scriptPubKey.end())));
+    if (u.fHaveRedeemScript)
+        entry.push_back(Pair("redeemScript", HexStr(u.redeemScript.begin(), u.redeemScript.end())));
+    entry.push_back(Pair("amount", ValueFromAmount(u.nValue)));
+    entry.push_back(Pair("confirmations", u.nDepth));
+    entry.push_back(Pair("spendable", u.fSpendable));
+    return entry;
+}
+
+Value listunspent(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() > 3)
+        throw runtime_error(
+            "listunspent ( minconf maxconf  [\"address\",...] )\n"
+            "\nReturns array of unspent transaction outputs\n"
+            "with between minconf and maxconf (inclusive) confirmations.\n"
+            "Optionally filter to only include txouts paid to specified addresses.\n"
+            "Results are an array of Objects, each of which has:\n"
+            "{txid, vout, scriptPubKey, amount, confirmations}\n"
+            "\nArguments:\n"
+            "1. minconf          (numeric, optional, default=1) The minimum confirmations to filter\n"
+            "2. maxconf          (numeric, optional, default=9999999) The maximum confirmations to filter\n"
+            "3. \"addresses\"    (string) A json array of sling addresses to filter\n"
+            "    [\n"
+            "      \"address\"   (string) sling address\n"
+            "      ,...\n"
+            "    ]\n"
+            "\nResult\n"
+            "[                   (array of json object)\n"
+            "  {\n"
+            "    \"txid\" : \"txid\",        (string) the transaction id \n"
+            "    \"vout\" : n,               (numeric) the vout value\n"
+            "    \"address\" : \"address\",  (string) the sling address\n"
+            "    \"account\" : \"account\",  (string) The associated account, or \"\" for the default account\n"
+            "    \"scriptPubKey\" : \"key\", (string) the script key\n"
+            "    \"amount\" : x.xxx,         (numeric) the transaction amount in btc\n"
+            "    \"confirmations\" : n       (numeric) The number of confirmations\n"
+            "  }\n"
+            "  ,...\n"
+            "]\n"
+
+            "\nExamples\n" +
+            HelpExampleCli("listunspent", "") + HelpExampleCli("listunspent", "6 9999999 \"[\\\"1PGFqEzfmQch1gKD3ra4k18PNj3tTUUSqg\\\",\\\"1LtvqCaApEdUGFkpKMM4MstjcaL4dKg8SP\\\"]\"") + HelpExampleRpc("listunspent", "6, 9999999 \"[\\\"1PGFqEzfmQch1gKD3ra4k18PNj3tTUUSqg\\\",\\\"1LtvqCaApEdUGFkpKMM4MstjcaL4dKg8SP\\\"]\""));
+
+    std::vector<CUnspentInfo> vInfo;
+    GetUnspentInfo(params, vInfo);
+
+    Array results;
+    BOOST_FOREACH (const CUnspentInfo& u, vInfo)
+        results.push_back(UnspentInfoToJSON(u));
 
     return results;
 }
+
+bool listunspent_stream(const Array& params, CJSONStreamWriter& writer)
+{
+    if (params.size() > 3 || !pwalletMain)
+        return false;
+
+    // The outputs are copied out in compact form so the wallet lock is not held while the reply is sent
+    std::vector<CUnspentInfo> vInfo;
+    GetUnspentInfo(params, vInfo);
+
+    writer.BeginArray();
+    BOOST_FOREACH (const CUnspentInfo& u, vInfo)
+        writer.Write(UnspentInfoToJSON(u));
+    writer.EndArray();
+    return true;
+}
 #endif
 
 Value createrawtransaction(const Array& params, bool fHelp)
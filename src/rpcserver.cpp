@@ -10,6 +10,7 @@
 #include "base58.h"
 #include "init.h"
 #include "main.h"
+#include "perfstats.h"
 #include "ui_interface.h"
 #include "util.h"
 #ifdef ENABLE_WALLET
@@ -28,6 +29,11 @@
 #include <boost/shared_ptr.hpp>
 #include <boost/thread.hpp>
 
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <set>
+
 using namespace boost;
 using namespace boost::asio;
 using namespace json_spirit;
@@ -49,6 +55,28 @@ static boost::asio::io_service::work* rpc_dummy_work = NULL;
 static std::vector<CSubNet> rpc_allow_subnets; //!< List of subnets to allow RPC connections from
 static std::vector<boost::shared_ptr<ip::tcp::acceptor> > rpc_acceptors;
 
+/**
+ * A connection waits on the I/O service until its next request arrives, then
+ * in rpc_queue for one of the rpc_connection_group threads, which serves the
+ * request and hands the connection back to the I/O service. A thread is only
+ * held while a request is read and executed, so idle keep-alive connections
+ * hold up no one else. They are closed after -rpcservertimeout silent seconds.
+ */
+static CWaitableCriticalSection cs_rpcQueue;
+static CConditionVariable cvRPCQueue;
+static std::deque<std::pair<boost::shared_ptr<AcceptedConnection>, int64_t> > rpc_queue;
+static std::set<AcceptedConnection*> rpc_active_connections;
+static size_t nRPCQueueMax = DEFAULT_RPC_WORK_QUEUE;
+static bool fRPCQueueStopping = false;
+static int nRPCServerTimeout = DEFAULT_RPC_SERVER_TIMEOUT;
+static boost::thread_group* rpc_connection_group = NULL;
+
+static CPerfCounter rpcQueueDepth("rpc.queue_depth", "Accepted RPC connections waiting for a thread");
+static CPerfCounter rpcActiveConnections("rpc.active_connections", "RPC connections being served");
+static CPerfCounter rpcRejectedConnections("rpc.rejected_connections", "RPC connections turned away because the queue was full");
+static CPerfCounter rpcParallelRequests("rpc.parallel_requests", "Batch requests executed alongside others of their batch");
+static CPerfHistogram rpcQueueWait("rpc.queue_wait", "Time an accepted RPC connection waited for a thread");
+
 void RPCTypeCheck(const Array& params,
     const list<Value_type>& typesExpected,
     bool fAllowNull)
@@ -225,139 +253,213 @@ Value stop(const Array& params, bool fHelp)
     return "Sling server stopping";
 }
 
+Value getrpcstats(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() > 1)
+        throw runtime_error(
+            "getrpcstats ( count )\n"
+            "\nReturns how long RPC methods took and the state of the RPC work queue.\n"
+            "Times are in microseconds and include waiting for locks.\n"
+            "\nArguments:\n"
+            "1. count          (numeric, optional, default=0) Number of methods to return, slowest in total first, 0 for all\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"queue\": n,             (numeric) Accepted connections waiting for a thread\n"
+            "  \"queuelimit\": n,        (numeric) Queued connections at which new ones are turned away (-rpcworkqueue)\n"
+            "  \"active\": n,            (numeric) Connections being served\n"
+            "  \"methods\": {            (json object) Methods called since startup\n"
+            "    \"name\": {\n"
+            "      \"count\": n, \"total\": n, \"max\": n, \"p50\": n, \"p90\": n, \"p99\": n\n"
+            "    }, ...\n"
+            "  }\n"
+            "}\n"
+            "\nExamples:\n" +
+            HelpExampleCli("getrpcstats", "") + HelpExampleCli("getrpcstats", "10") + HelpExampleRpc("getrpcstats", ""));
+
+    int nCount = params.size() > 0 ? params[0].get_int() : 0;
+    if (nCount < 0)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Negative count");
+
+    Object ret;
+    {
+        boost::unique_lock<boost::mutex> lock(cs_rpcQueue);
+        ret.push_back(Pair("queue", (uint64_t)rpc_queue.size()));
+        ret.push_back(Pair("queuelimit", (uint64_t)nRPCQueueMax));
+        ret.push_back(Pair("active", (uint64_t)rpc_active_connections.size()));
+    }
+
+    std::vector<CRPCMethodStats> vStats = tableRPC.GetMethodStats();
+    if (nCount > 0 && vStats.size() > (size_t)nCount)
+        vStats.resize(nCount);
+    Object methods;
+    BOOST_FOREACH (const CRPCMethodStats& stats, vStats) {
+        Object obj;
+        obj.push_back(Pair("count", stats.nCount));
+        obj.push_back(Pair("total", stats.nMicros));
+        obj.push_back(Pair("max", stats.nMaxMicros));
+        obj.push_back(Pair("p50", stats.vPercentiles[0]));
+        obj.push_back(Pair("p90", stats.vPercentiles[1]));
+        obj.push_back(Pair("p99", stats.vPercentiles[2]));
+        methods.push_back(Pair(stats.strName, obj));
+    }
+    ret.push_back(Pair("methods", methods));
+    return ret;
+}
+
 
 /**
  * Call Table
  */
 static const CRPCCommand vRPCCommands[] =
     {
-        //  category              name                      actor (function)         okSafeMode threadSafe reqWallet
-        //  --------------------- ------------------------  -----------------------  ---------- ---------- ---------
+        //  category              name                      actor (function)         okSafeMode threadSafe reqWallet readOnly
+        //  --------------------- ------------------------  -----------------------  ---------- ---------- --------- --------
         /* Overall control/query calls */
-        {"control", "getinfo", &getinfo, true, false, false}, /* uses wallet if enabled */
-        {"control", "help", &help, true, true, false},
-        {"control", "stop", &stop, true, true, false},
+        {"control", "getinfo", &getinfo, true, false, false, true}, /* uses wallet if enabled */
+        {"control", "help", &help, true, true, false, true},
+        {"control", "getperfstats", &getperfstats, true, true, false, true},
+        {"control", "getlockstats", &getlockstats, true, true, false, true},
+        {"control", "getrpcstats", &getrpcstats, true, true, false, true},
+        {"control", "logging", &logging, true, true, false, false},
+        {"control", "stop", &stop, true, true, false, false},
 
         /* P2P networking */
-        {"network", "getnetworkinfo", &getnetworkinfo, true, false, false},
-        {"network", "addnode", &addnode, true, true, false},
-        {"network", "getaddednodeinfo", &getaddednodeinfo, true, true, false},
-        {"network", "getconnectioncount", &getconnectioncount, true, false, false},
-        {"network", "getnettotals", &getnettotals, true, true, false},
-        {"network", "getpeerinfo", &getpeerinfo, true, false, false},
-        {"network", "ping", &ping, true, false, false},
+        {"network", "getnetworkinfo", &getnetworkinfo, true, false, false, true},
+        {"network", "addnode", &addnode, true, true, false, false},
+        {"network", "getaddednodeinfo", &getaddednodeinfo, true, true, false, true},
+        {"network", "getconnectioncount", &getconnectioncount, true, false, false, true},
+        {"network", "getnettotals", &getnettotals, true, true, false, true},
+        {"network", "getpeerinfo", &getpeerinfo, true, false, false, true},
+        {"network", "ping", &ping, true, false, false, false},
 
         /* Block chain and UTXO */
-        {"blockchain", "getblockchaininfo", &getblockchaininfo, true, false, false},
-        {"blockchain", "getbestblockhash", &getbestblockhash, true, false, false},
-        {"blockchain", "getblockcount", &getblockcount, true, false, false},
-        {"blockchain", "getblock", &getblock, true, false, false},
-        {"blockchain", "getblockhash", &getblockhash, true, false, false},
-        {"blockchain", "getblockheader", &getblockheader, false, false, false},
-        {"blockchain", "getchaintips", &getchaintips, true, false, false},
-        {"blockchain", "getdifficulty", &getdifficulty, true, false, false},
-        {"blockchain", "getmempoolinfo", &getmempoolinfo, true, true, false},
-        {"blockchain", "getrawmempool", &getrawmempool, true, false, false},
-        {"blockchain", "gettxout", &gettxout, true, false, false},
-        {"blockchain", "gettxoutsetinfo", &gettxoutsetinfo, true, false, false},
-        {"blockchain", "verifychain", &verifychain, true, false, false},
-        {"blockchain", "invalidateblock", &invalidateblock, true, true, false},
-        {"blockchain", "reconsiderblock", &reconsiderblock, true, true, false},
+        {"blockchain", "getblockchaininfo", &getblockchaininfo, true, false, false, true},
+        {"blockchain", "getbestblockhash", &getbestblockhash, true, true, false, true},
+        {"blockchain", "getblockcount", &getblockcount, true, true, false, true},
+        {"blockchain", "getblock", &getblock, true, false, false, true},
+        {"blockchain", "getblockhash", &getblockhash, true, true, false, true},
+        {"blockchain", "getblockheader", &getblockheader, false, false, false, true},
+        {"blockchain", "getchaintips", &getchaintips, true, false, false, true},
+        {"blockchain", "getdifficulty", &getdifficulty, true, true, false, true},
+        {"blockchain", "getmempoolinfo", &getmempoolinfo, true, true, false, true},
+        {"blockchain", "getrawmempool", &getrawmempool, true, false, false, true},
+        {"blockchain", "gettxout", &gettxout, true, false, false, true},
+        {"blockchain", "gettxoutsetinfo", &gettxoutsetinfo, true, false, false, false},
+        {"blockchain", "verifychain", &verifychain, true, false, false, false},
+        {"blockchain", "invalidateblock", &invalidateblock, true, true, false, false},
+        {"blockchain", "reconsiderblock", &reconsiderblock, true, true, false, false},
 
         /* Mining */
-        {"mining", "getblocktemplate", &getblocktemplate, true, false, false},
-        {"mining", "getmininginfo", &getmininginfo, true, false, false},
-        {"mining", "getnetworkhashps", &getnetworkhashps, true, false, false},
-        {"mining", "prioritisetransaction", &prioritisetransaction, true, false, false},
-        {"mining", "submitblock", &submitblock, true, true, false},
-        {"mining", "reservebalance", &reservebalance, true, true, false},
+        {"mining", "getblocktemplate", &getblocktemplate, true, false, false, false},
+        {"mining", "getmininginfo", &getmininginfo, true, false, false, true},
+        {"mining", "getnetworkhashps", &getnetworkhashps, true, false, false, true},
+        {"mining", "prioritisetransaction", &prioritisetransaction, true, false, false, false},
+        {"mining", "submitblock", &submitblock, true, true, false, false},
+        {"mining", "reservebalance", &reservebalance, true, true, false, false},
 
 #ifdef ENABLE_WALLET
         /* Coin generation */
-        {"generating", "getgenerate", &getgenerate, true, false, false},
-        {"generating", "gethashespersec", &gethashespersec, true, false, false},
-        {"generating", "setgenerate", &setgenerate, true, true, false},
+        {"generating", "getgenerate", &getgenerate, true, false, false, true},
+        {"generating", "gethashespersec", &gethashespersec, true, false, false, true},
+        {"generating", "setgenerate", &setgenerate, true, true, false, false},
 #endif
 
         /* Raw transactions */
-        {"rawtransactions", "createrawtransaction", &createrawtransaction, true, false, false},
-        {"rawtransactions", "decoderawtransaction", &decoderawtransaction, true, false, false},
-        {"rawtransactions", "decodescript", &decodescript, true, false, false},
-        {"rawtransactions", "getrawtransaction", &getrawtransaction, true, false, false},
-        {"rawtransactions", "sendrawtransaction", &sendrawtransaction, false, false, false},
-        {"rawtransactions", "signrawtransaction", &signrawtransaction, false, false, false}, /* uses wallet if enabled */
+        {"rawtransactions", "createrawtransaction", &createrawtransaction, true, false, false, true},
+        {"rawtransactions", "decoderawtransaction", &decoderawtransaction, true, false, false, true},
+        {"rawtransactions", "decodescript", &decodescript, true, false, false, true},
+        {"rawtransactions", "getrawtransaction", &getrawtransaction, true, false, false, true},
+        {"rawtransactions", "sendrawtransaction", &sendrawtransaction, false, false, false, false},
+        {"rawtransactions", "signrawtransaction", &signrawtransaction, false, false, false, false}, /* uses wallet if enabled */
 
         /* Utility functions */
-        {"util", "createmultisig", &createmultisig, true, true, false},
-        {"util", "validateaddress", &validateaddress, true, false, false}, /* uses wallet if enabled */
-        {"util", "verifymessage", &verifymessage, true, false, false},
-        {"util", "estimatefee", &estimatefee, true, true, false},
-        {"util", "estimatepriority", &estimatepriority, true, true, false},
+        {"util", "createmultisig", &createmultisig, true, true, false, true},
+        {"util", "validateaddress", &validateaddress, true, false, false, true}, /* uses wallet if enabled */
+        {"util", "verifymessage", &verifymessage, true, false, false, true},
+        {"util", "estimatefee", &estimatefee, true, true, false, true},
+        {"util", "estimatepriority", &estimatepriority, true, true, false, true},
+
+        /* Address index */
+        {"addressindex", "getaddressbalance", &getaddressbalance, true, true, false, true},
+        {"addressindex", "getaddressutxos", &getaddressutxos, true, true, false, true},
+        {"addressindex", "getaddresstxids", &getaddresstxids, true, true, false, true},
+        {"addressindex", "getspentinfo", &getspentinfo, true, true, false, true},
 
         /* Not shown in help */
-        {"hidden", "invalidateblock", &invalidateblock, true, true, false},
-        {"hidden", "reconsiderblock", &reconsiderblock, true, true, false},
-        {"hidden", "setmocktime", &setmocktime, true, false, false},
+        {"hidden", "invalidateblock", &invalidateblock, true, true, false, false},
+        {"hidden", "reconsiderblock", &reconsiderblock, true, true, false, false},
+        {"hidden", "setmocktime", &setmocktime, true, false, false, false},
 
         /* Sling features */
-        {"sling", "masternode", &masternode, true, true, false},
-        {"sling", "masternodelist", &masternodelist, true, true, false},
-        {"sling", "mnbudget", &mnbudget, true, true, false},
-        {"sling", "mnbudgetvoteraw", &mnbudgetvoteraw, true, true, false},
-        {"sling", "mnfinalbudget", &mnfinalbudget, true, true, false},
-        {"sling", "mnsync", &mnsync, true, true, false},
-        {"sling", "spork", &spork, true, true, false},
+        {"sling", "masternode", &masternode, true, true, false, false},
+        {"sling", "masternodelist", &masternodelist, true, true, false, true},
+        {"sling", "mnbudget", &mnbudget, true, true, false, false},
+        {"sling", "mnbudgetvoteraw", &mnbudgetvoteraw, true, true, false, false},
+        {"sling", "mnfinalbudget", &mnfinalbudget, true, true, false, false},
+        {"sling", "mnsync", &mnsync, true, true, false, false},
+        {"sling", "spork", &spork, true, true, false, false},
 #ifdef ENABLE_WALLET
-        {"sling", "coinmix", &coinmix, false, false, true}, /* not threadSafe because of SendMoney */
+        {"sling", "coinmix", &coinmix, false, false, true, false}, /* not threadSafe because of SendMoney */
 
         /* Wallet */
-        {"wallet", "addmultisigaddress", &addmultisigaddress, true, false, true},
-        {"wallet", "autocombinerewards", &autocombinerewards, false, false, true},
-        {"wallet", "backupwallet", &backupwallet, true, false, true},
-        {"wallet", "dumpprivkey", &dumpprivkey, true, false, true},
-        {"wallet", "dumpwallet", &dumpwallet, true, false, true},
-        {"wallet", "bip38encrypt", &bip38encrypt, true, false, true},
-        {"wallet", "bip38decrypt", &bip38decrypt, true, false, true},
-        {"wallet", "encryptwallet", &encryptwallet, true, false, true},
-        {"wallet", "getaccountaddress", &getaccountaddress, true, false, true},
-        {"wallet", "getaccount", &getaccount, true, false, true},
-        {"wallet", "getaddressesbyaccount", &getaddressesbyaccount, true, false, true},
-        {"wallet", "getbalance", &getbalance, false, false, true},
-        {"wallet", "getnewaddress", &getnewaddress, true, false, true},
-        {"wallet", "getrawchangeaddress", &getrawchangeaddress, true, false, true},
-        {"wallet", "getreceivedbyaccount", &getreceivedbyaccount, false, false, true},
-        {"wallet", "getreceivedbyaddress", &getreceivedbyaddress, false, false, true},
-        {"wallet", "getstakingstatus", &getstakingstatus, false, false, true},
-        {"wallet", "getstakesplitthreshold", &getstakesplitthreshold, false, false, true},
-        {"wallet", "gettransaction", &gettransaction, false, false, true},
-        {"wallet", "getunconfirmedbalance", &getunconfirmedbalance, false, false, true},
-        {"wallet", "getwalletinfo", &getwalletinfo, false, false, true},
-        {"wallet", "importprivkey", &importprivkey, true, false, true},
-        {"wallet", "importwallet", &importwallet, true, false, true},
-        {"wallet", "importaddress", &importaddress, true, false, true},
-        {"wallet", "keypoolrefill", &keypoolrefill, true, false, true},
-        {"wallet", "listaccounts", &listaccounts, false, false, true},
-        {"wallet", "listaddressgroupings", &listaddressgroupings, false, false, true},
-        {"wallet", "listlockunspent", &listlockunspent, false, false, true},
-        {"wallet", "listreceivedbyaccount", &listreceivedbyaccount, false, false, true},
-        {"wallet", "listreceivedbyaddress", &listreceivedbyaddress, false, false, true},
-        {"wallet", "listsinceblock", &listsinceblock, false, false, true},
-        {"wallet", "listtransactions", &listtransactions, false, false, true},
-        {"wallet", "listunspent", &listunspent, false, false, true},
-        {"wallet", "lockunspent", &lockunspent, true, false, true},
-        {"wallet", "move", &movecmd, false, false, true},
-        {"wallet", "multisend", &multisend, false, false, true},
-        {"wallet", "sendfrom", &sendfrom, false, false, true},
-        {"wallet", "sendmany", &sendmany, false, false, true},
-        {"wallet", "sendtoaddress", &sendtoaddress, false, false, true},
-        {"wallet", "sendtoaddressix", &sendtoaddressix, false, false, true},
-        {"wallet", "setaccount", &setaccount, true, false, true},
-        {"wallet", "setstakesplitthreshold", &setstakesplitthreshold, false, false, true},
-        {"wallet", "settxfee", &settxfee, true, false, true},
-        {"wallet", "signmessage", &signmessage, true, false, true},
-        {"wallet", "walletlock", &walletlock, true, false, true},
-        {"wallet", "walletpassphrasechange", &walletpassphrasechange, true, false, true},
-        {"wallet", "walletpassphrase", &walletpassphrase, true, false, true},
+        {"wallet", "addmultisigaddress", &addmultisigaddress, true, false, true, false},
+        {"wallet", "autocombinerewards", &autocombinerewards, false, false, true, false},
+        {"wallet", "backupwallet", &backupwallet, true, false, true, false},
+        {"wallet", "dumpprivkey", &dumpprivkey, true, false, true, false},
+        {"wallet", "dumpwallet", &dumpwallet, true, false, true, false},
+        {"wallet", "bip38encrypt", &bip38encrypt, true, false, true, false},
+        {"wallet", "bip38decrypt", &bip38decrypt, true, false, true, false},
+        {"wallet", "encryptwallet", &encryptwallet, true, false, true, false},
+        {"wallet", "getaccountaddress", &getaccountaddress, true, false, true, false},
+        {"wallet", "getaccount", &getaccount, true, false, true, true},
+        {"wallet", "getaddressesbyaccount", &getaddressesbyaccount, true, false, true, true},
+        {"wallet", "getbalance", &getbalance, false, false, true, true},
+        {"wallet", "getnewaddress", &getnewaddress, true, false, true, false},
+        {"wallet", "getrawchangeaddress", &getrawchangeaddress, true, false, true, false},
+        {"wallet", "getreceivedbyaccount", &getreceivedbyaccount, false, false, true, true},
+        {"wallet", "getreceivedbyaddress", &getreceivedbyaddress, false, false, true, true},
+        {"wallet", "getstakingstatus", &getstakingstatus, false, false, true, true},
+        {"wallet", "getstakesplitthreshold", &getstakesplitthreshold, false, false, true, true},
+        {"wallet", "gettransaction", &gettransaction, false, false, true, true},
+        {"wallet", "getunconfirmedbalance", &getunconfirmedbalance, false, false, true, true},
+        {"wallet", "getwalletinfo", &getwalletinfo, false, false, true, true},
+        {"wallet", "importprivkey", &importprivkey, true, false, true, false},
+        {"wallet", "importwallet", &importwallet, true, false, true, false},
+        {"wallet", "importaddress", &importaddress, true, false, true, false},
+        {"wallet", "keypoolrefill", &keypoolrefill, true, false, true, false},
+        {"wallet", "listaccounts", &listaccounts, false, false, true, true},
+        {"wallet", "listaddressgroupings", &listaddressgroupings, false, false, true, true},
+        {"wallet", "listlockunspent", &listlockunspent, false, false, true, true},
+        {"wallet", "listreceivedbyaccount", &listreceivedbyaccount, false, false, true, true},
+        {"wallet", "listreceivedbyaddress", &listreceivedbyaddress, false, false, true, true},
+        {"wallet", "listsinceblock", &listsinceblock, false, false, true, true},
+        {"wallet", "listtransactions", &listtransactions, false, false, true, true},
+        {"wallet", "listunspent", &listunspent, false, false, true, true},
+        {"wallet", "lockunspent", &lockunspent, true, false, true, false},
+        {"wallet", "move", &movecmd, false, false, true, false},
+        {"wallet", "multisend", &multisend, false, false, true, false},
+        {"wallet", "sendfrom", &sendfrom, false, false, true, false},
+        {"wallet", "sendmany", &sendmany, false, false, true, false},
+        {"wallet", "sendtoaddress", &sendtoaddress, false, false, true, false},
+        {"wallet", "sendtoaddressix", &sendtoaddressix, false, false, true, false},
+        {"wallet", "setaccount", &setaccount, true, false, true, false},
+        {"wallet", "setstakesplitthreshold", &setstakesplitthreshold, false, false, true, false},
+        {"wallet", "settxfee", &settxfee, true, false, true, false},
+        {"wallet", "signmessage", &signmessage, true, false, true, false},
+        {"wallet", "walletlock", &walletlock, true, false, true, false},
+        {"wallet", "walletpassphrasechange", &walletpassphrasechange, true, false, true, false},
+        {"wallet", "walletpassphrase", &walletpassphrase, true, false, true, false},
+#endif // ENABLE_WALLET
+};
+
+/** Methods whose results can be too large to build before sending */
+static const CRPCStreamCommand vRPCStreamCommands[] =
+    {
+        {"getblock", &getblock_stream},
+        {"getrawmempool", &getrawmempool_stream},
+        {"masternodelist", &masternodelist_stream},
+#ifdef ENABLE_WALLET
+        {"listunspent", &listunspent_stream},
 #endif // ENABLE_WALLET
 };
 
@@ -369,7 +471,16 @@ CRPCTable::CRPCTable()
 
         pcmd = &vRPCCommands[vcidx];
         mapCommands[pcmd->name] = pcmd;
+        mapLatency[pcmd->name] = new CPerfHistogram();
     }
+    for (vcidx = 0; vcidx < (sizeof(vRPCStreamCommands) / sizeof(vRPCStreamCommands[0])); vcidx++)
+        mapStreamActors[vRPCStreamCommands[vcidx].name] = vRPCStreamCommands[vcidx].actor;
+}
+
+CRPCTable::~CRPCTable()
+{
+    for (map<string, CPerfHistogram*>::iterator it = mapLatency.begin(); it != mapLatency.end(); ++it)
+        delete it->second;
 }
 
 const CRPCCommand* CRPCTable::operator[](string name) const
@@ -439,6 +550,8 @@ public:
         asio::io_service& io_service,
         ssl::context& context,
         bool fUseSSL) : sslStream(io_service, context),
+                        ioService(io_service),
+                        fSSL(fUseSSL),
                         _d(sslStream, fUseSSL),
                         _stream(_d)
     {
@@ -459,15 +572,75 @@ public:
         _stream.close();
     }
 
+    virtual void shutdown()
+    {
+        boost::system::error_code ec;
+        sslStream.lowest_layer().shutdown(ip::tcp::socket::shutdown_both, ec);
+    }
+
+    virtual bool HasBufferedInput()
+    {
+        if (_stream.rdbuf()->in_avail() > 0)
+            return true;
+        if (!fSSL)
+            return false;
+        // Decrypted data, or encrypted records OpenSSL read but didn't decrypt yet
+        SSL* ssl = sslStream.native_handle();
+        return SSL_pending(ssl) > 0 || BIO_pending(SSL_get_rbio(ssl)) > 0;
+    }
+
+    virtual void AsyncWaitForInput(const boost::function<void(bool)>& handler, int nTimeout)
+    {
+        // Both handlers hold the wait, and with it the caller's handler
+        boost::shared_ptr<CInputWait> wait(new CInputWait(ioService, handler));
+        wait->timer.expires_from_now(posix_time::seconds(nTimeout));
+        wait->timer.async_wait(boost::bind(&AcceptedConnectionImpl::InputTimeout, this, wait, _1));
+        sslStream.lowest_layer().async_read_some(asio::null_buffers(), boost::bind(&AcceptedConnectionImpl::InputReady, wait, _1));
+    }
+
+    virtual bool IsSSL() const
+    {
+        return fSSL;
+    }
+
     typename Protocol::endpoint peer;
     asio::ssl::stream<typename Protocol::socket> sslStream;
 
 private:
+    struct CInputWait {
+        CInputWait(asio::io_service& io_service, const boost::function<void(bool)>& handlerIn) : timer(io_service), handler(handlerIn), fReady(false), fTimedOut(false) {}
+        deadline_timer timer;
+        boost::function<void(bool)> handler;
+        std::atomic<bool> fReady;
+        std::atomic<bool> fTimedOut;
+    };
+
+    static void InputReady(boost::shared_ptr<CInputWait> wait, const boost::system::error_code& error)
+    {
+        wait->fReady = true;
+        boost::system::error_code ec;
+        wait->timer.cancel(ec);
+        wait->handler(!error && !wait->fTimedOut);
+    }
+
+    void InputTimeout(boost::shared_ptr<CInputWait> wait, const boost::system::error_code& error)
+    {
+        // Cancelled, or the peer got in first; the handler holds the connection, so this is still valid
+        if (error || wait->fReady)
+            return;
+        wait->fTimedOut = true;
+        boost::system::error_code ec;
+        sslStream.lowest_layer().cancel(ec);
+    }
+
+    asio::io_service& ioService;
+    const bool fSSL;
     SSLIOStreamDevice<Protocol> _d;
     iostreams::stream<SSLIOStreamDevice<Protocol> > _stream;
 };
 
-void ServiceConnection(AcceptedConnection* conn);
+bool ServiceConnection(AcceptedConnection* conn);
+static void WaitForRPCRequest(const boost::shared_ptr<AcceptedConnection>& conn);
 
 //! Forward declaration required for RPCListen
 template <typename Protocol, typename SocketAcceptorService>
@@ -529,8 +702,85 @@ static void RPCAcceptHandler(boost::shared_ptr<basic_socket_acceptor<Protocol, S
             conn->stream() << HTTPError(HTTP_FORBIDDEN, false) << std::flush;
         conn->close();
     } else {
-        ServiceConnection(conn.get());
+        WaitForRPCRequest(conn);
+    }
+}
+
+bool QueueRPCConnection(const boost::shared_ptr<AcceptedConnection>& conn)
+{
+    boost::unique_lock<boost::mutex> lock(cs_rpcQueue);
+    if (fRPCQueueStopping) {
+        lock.unlock();
+        conn->close();
+        return false;
+    }
+    if (rpc_queue.size() >= nRPCQueueMax) {
+        lock.unlock();
+        LogPrint("rpc", "RPC work queue full, turning away %s\n", conn->peer_address_to_string());
+        rpcRejectedConnections.Inc();
+        if (!conn->IsSSL())
+            conn->stream() << HTTPError(HTTP_SERVICE_UNAVAILABLE, false) << std::flush;
         conn->close();
+        return false;
+    }
+    rpc_queue.push_back(std::make_pair(conn, GetTimeMicros()));
+    rpcQueueDepth.Set(rpc_queue.size());
+    cvRPCQueue.notify_one();
+    return true;
+}
+
+static void RPCInputHandler(boost::shared_ptr<AcceptedConnection> conn, bool fReady)
+{
+    if (fReady)
+        QueueRPCConnection(conn);
+    else
+        conn->close();
+}
+
+// Wait for the next request on the I/O service, without holding a connection thread
+static void WaitForRPCRequest(const boost::shared_ptr<AcceptedConnection>& conn)
+{
+    conn->AsyncWaitForInput(boost::bind(&RPCInputHandler, conn, _1), nRPCServerTimeout);
+}
+
+static void ThreadRPCConnections()
+{
+    RenameThread("sling-rpcconn");
+    while (true) {
+        boost::shared_ptr<AcceptedConnection> conn;
+        {
+            boost::unique_lock<boost::mutex> lock(cs_rpcQueue);
+            while (rpc_queue.empty() && !fRPCQueueStopping)
+                cvRPCQueue.wait(lock);
+            if (fRPCQueueStopping)
+                break;
+            conn = rpc_queue.front().first;
+            rpcQueueWait.Add(GetTimeMicros() - rpc_queue.front().second);
+            rpc_queue.pop_front();
+            rpcQueueDepth.Set(rpc_queue.size());
+            rpc_active_connections.insert(conn.get());
+            rpcActiveConnections.Set(rpc_active_connections.size());
+        }
+
+        bool fKeepAlive = false;
+        try {
+            fKeepAlive = ServiceConnection(conn.get());
+        } catch (const std::exception& e) {
+            LogPrint("rpc", "%s: %s\n", __func__, e.what());
+        } catch (...) {
+            LogPrint("rpc", "%s: unknown exception\n", __func__);
+        }
+
+        {
+            boost::unique_lock<boost::mutex> lock(cs_rpcQueue);
+            rpc_active_connections.erase(conn.get());
+            rpcActiveConnections.Set(rpc_active_connections.size());
+            fKeepAlive = fKeepAlive && !fRPCQueueStopping;
+        }
+        if (fKeepAlive)
+            WaitForRPCRequest(conn);
+        else
+            conn->close();
     }
 }
 
@@ -690,8 +940,19 @@ void StartRPCThreads()
         return;
     }
 
+    int nThreads = std::max((int)GetArg("-rpcthreads", DEFAULT_RPC_THREADS), 1);
+    {
+        boost::unique_lock<boost::mutex> lock(cs_rpcQueue);
+        nRPCQueueMax = std::max((int)GetArg("-rpcworkqueue", DEFAULT_RPC_WORK_QUEUE), 1);
+        nRPCServerTimeout = std::max((int)GetArg("-rpcservertimeout", DEFAULT_RPC_SERVER_TIMEOUT), 1);
+        fRPCQueueStopping = false;
+    }
+    SetRESTCacheSize((size_t)std::max(GetArg("-restcachesize", DEFAULT_REST_CACHE_SIZE), (int64_t)0) << 20);
+    rpc_connection_group = new boost::thread_group();
+    for (int i = 0; i < nThreads; i++)
+        rpc_connection_group->create_thread(&ThreadRPCConnections);
     rpc_worker_group = new boost::thread_group();
-    for (int i = 0; i < GetArg("-rpcthreads", 4); i++)
+    for (int i = 0; i < nThreads; i++)
         rpc_worker_group->create_thread(boost::bind(&asio::io_service::run, rpc_io_service));
     fRPCRunning = true;
 }
@@ -732,8 +993,23 @@ void StopRPCThreads()
     }
     deadlineTimers.clear();
 
+    // Wake the connection threads, including those waiting for a request on a kept-alive connection
+    {
+        boost::unique_lock<boost::mutex> lock(cs_rpcQueue);
+        fRPCQueueStopping = true;
+        rpc_queue.clear();
+        rpcQueueDepth.Set(0);
+        BOOST_FOREACH (AcceptedConnection* conn, rpc_active_connections)
+            conn->shutdown();
+        cvRPCQueue.notify_all();
+    }
+
     rpc_io_service->stop();
     cvBlockChange.notify_all();
+    if (rpc_connection_group != NULL)
+        rpc_connection_group->join_all();
+    delete rpc_connection_group;
+    rpc_connection_group = NULL;
     if (rpc_worker_group != NULL)
         rpc_worker_group->join_all();
     delete rpc_dummy_work;
@@ -852,19 +1128,142 @@ static Object JSONRPCExecOne(const Value& req)
     return rpc_result;
 }
 
-static string JSONRPCExecBatch(const Array& vReq)
+static bool IsReadOnlyRequest(const Value& req)
+{
+    if (req.type() != obj_type)
+        return false;
+    const Value& valMethod = find_value(req.get_obj(), "method");
+    if (valMethod.type() != str_type)
+        return false;
+    const CRPCCommand* pcmd = tableRPC[valMethod.get_str()];
+    return pcmd && pcmd->readOnly;
+}
+
+/**
+ * A run of read-only requests of a batch. The connection's thread and the
+ * I/O threads take requests from it until none are left, so the run
+ * finishes even if the I/O threads are busy or already stopped.
+ */
+class CRPCParallelRun
+{
+public:
+    CRPCParallelRun(const Array& vReqIn, size_t nBeginIn, size_t nEndIn) : vReq(vReqIn), nBegin(nBeginIn), nEnd(nEndIn), nNext(nBeginIn), nDone(0), vReply(nEndIn - nBeginIn) {}
+
+    //! Execute a request nobody took yet; false once all are taken
+    bool RunOne()
+    {
+        size_t i = nNext.fetch_add(1);
+        if (i >= nEnd)
+            return false;
+        Object reply;
+        try {
+            reply = JSONRPCExecOne(vReq[i]);
+        } catch (...) {
+            // Nobody would be left to count the request done
+            reply = JSONRPCReplyObj(Value::null, JSONRPCError(RPC_MISC_ERROR, "Unknown error"), Value::null);
+        }
+        boost::unique_lock<boost::mutex> lock(cs);
+        vReply[i - nBegin] = reply;
+        if (++nDone == nEnd - nBegin)
+            cond.notify_all();
+        return true;
+    }
+
+    void Wait(Array& ret)
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        while (nDone < nEnd - nBegin)
+            cond.wait(lock);
+        for (size_t i = 0; i < vReply.size(); i++)
+            ret.push_back(vReply[i]);
+    }
+
+private:
+    //! Only read by whoever takes a request, which the caller waits for
+    const Array& vReq;
+    const size_t nBegin;
+    const size_t nEnd;
+    std::atomic<size_t> nNext;
+    CWaitableCriticalSection cs;
+    CConditionVariable cond;
+    size_t nDone;
+    std::vector<Object> vReply;
+};
+
+static void RPCParallelRunHandler(boost::shared_ptr<CRPCParallelRun> run)
+{
+    run->RunOne();
+}
+
+/**
+ * Requests that change nothing are executed in parallel with the read-only
+ * requests next to them; any other request waits for the ones before it
+ * and holds up the ones after it. Replies stay in request order.
+ */
+string JSONRPCExecBatch(const Array& vReq)
 {
     Array ret;
-    for (unsigned int reqIdx = 0; reqIdx < vReq.size(); reqIdx++)
-        ret.push_back(JSONRPCExecOne(vReq[reqIdx]));
+    size_t reqIdx = 0;
+    while (reqIdx < vReq.size()) {
+        size_t nEnd = reqIdx;
+        while (nEnd < vReq.size() && IsReadOnlyRequest(vReq[nEnd]))
+            nEnd++;
+        if (nEnd - reqIdx < 2 || rpc_io_service == NULL) {
+            ret.push_back(JSONRPCExecOne(vReq[reqIdx]));
+            reqIdx++;
+            continue;
+        }
+
+        // Held by the posted handlers too, which may run after the run is done
+        boost::shared_ptr<CRPCParallelRun> run(new CRPCParallelRun(vReq, reqIdx, nEnd));
+        for (size_t i = reqIdx + 1; i < nEnd; i++)
+            rpc_io_service->post(boost::bind(&RPCParallelRunHandler, run));
+        rpcParallelRequests.Inc(nEnd - reqIdx);
+        while (run->RunOne()) {
+        }
+        run->Wait(ret);
+        reqIdx = nEnd;
+    }
 
     return write_string(Value(ret), false) + "\n";
 }
 
+/**
+ * Stream the reply to a request whose method can stream its result. Returns
+ * whether the reply was sent. An error once part of the reply is out can no
+ * longer be reported, so then fAbort is set and the connection must be dropped.
+ */
+static bool StreamJSONRPCReply(AcceptedConnection* conn, const JSONRequest& jreq, bool fRun, int nProto, bool& fAbort)
+{
+    // HTTP/1.0 clients cannot take chunks, so theirs is sent in one piece
+    CHTTPStreamReply reply(conn->stream(), fRun, nProto >= 1);
+    std::ostream os(&reply);
+    CJSONStreamWriter writer(os);
+    try {
+        writer.BeginObject();
+        writer.Key("result");
+        if (!tableRPC.executeStream(jreq.strMethod, jreq.params, writer))
+            return false;
+        writer.WritePair("error", Value::null);
+        writer.WritePair("id", jreq.id);
+        writer.EndObject();
+        os << "\n";
+        reply.Finish();
+    } catch (...) {
+        if (!reply.Started())
+            throw;
+        LogPrintf("ThreadRPCServer %s failed while streaming its reply\n", jreq.strMethod);
+        fAbort = true;
+        return false;
+    }
+    return true;
+}
+
 static bool HTTPReq_JSONRPC(AcceptedConnection* conn,
     string& strRequest,
     map<string, string>& mapHeaders,
-    bool fRun)
+    bool fRun,
+    int nProto)
 {
     // Check authorization
     if (mapHeaders.count("authorization") == 0) {
@@ -903,6 +1302,14 @@ static bool HTTPReq_JSONRPC(AcceptedConnection* conn,
         if (valRequest.type() == obj_type) {
             jreq.parse(valRequest);
 
+            if (tableRPC.canStream(jreq.strMethod)) {
+                bool fAbort = false;
+                if (StreamJSONRPCReply(conn, jreq, fRun, nProto, fAbort))
+                    return true;
+                if (fAbort)
+                    return false;
+            }
+
             Value result = tableRPC.execute(jreq.strMethod, jreq.params);
 
             // Send reply
@@ -925,7 +1332,11 @@ static bool HTTPReq_JSONRPC(AcceptedConnection* conn,
     return true;
 }
 
-void ServiceConnection(AcceptedConnection* conn)
+/**
+ * Serve the requests that have arrived on a connection. Returns whether the
+ * connection is kept alive, to wait for its next request.
+ */
+bool ServiceConnection(AcceptedConnection* conn)
 {
     bool fRun = true;
     while (fRun && !ShutdownRequested()) {
@@ -935,7 +1346,7 @@ void ServiceConnection(AcceptedConnection* conn)
 
         // Read HTTP request line
         if (!ReadHTTPRequestLine(conn->stream(), nProto, strMethod, strURI))
-            break;
+            return false;
 
         // Read HTTP message headers and body
         ReadHTTPMessage(conn->stream(), mapHeaders, strRequest, nProto, MAX_SIZE);
@@ -946,22 +1357,27 @@ void ServiceConnection(AcceptedConnection* conn)
 
         // Process via JSON-RPC API
         if (strURI == "/") {
-            if (!HTTPReq_JSONRPC(conn, strRequest, mapHeaders, fRun))
-                break;
+            if (!HTTPReq_JSONRPC(conn, strRequest, mapHeaders, fRun, nProto))
+                return false;
 
             // Process via HTTP REST API
         } else if (strURI.substr(0, 6) == "/rest/" && GetBoolArg("-rest", false)) {
-            if (!HTTPReq_REST(conn, strURI, mapHeaders, fRun))
-                break;
+            if (!HTTPReq_REST(conn, strURI, mapHeaders, fRun, nProto))
+                return false;
 
         } else {
             conn->stream() << HTTPError(HTTP_NOT_FOUND, false) << std::flush;
-            break;
+            return false;
         }
+
+        // A pipelined request is served at once, otherwise the thread is let go
+        if (!conn->HasBufferedInput())
+            break;
     }
+    return fRun && !ShutdownRequested();
 }
 
-json_spirit::Value CRPCTable::execute(const std::string& strMethod, const json_spirit::Array& params) const
+const CRPCCommand* CRPCTable::FindCommand(const std::string& strMethod) const
 {
     // Find method
     const CRPCCommand* pcmd = tableRPC[strMethod];
@@ -978,10 +1394,19 @@ json_spirit::Value CRPCTable::execute(const std::string& strMethod, const json_s
         !pcmd->okSafeMode)
         throw JSONRPCError(RPC_FORBIDDEN_BY_SAFE_MODE, string("Safe mode: ") + strWarning);
 
+    return pcmd;
+}
+
+json_spirit::Value CRPCTable::execute(const std::string& strMethod, const json_spirit::Array& params) const
+{
+    const CRPCCommand* pcmd = FindCommand(strMethod);
+
     try {
         // Execute
         Value result;
         {
+            // Includes waiting for cs_main and the wallet
+            CPerfTimer timer(*mapLatency.find(strMethod)->second);
             if (pcmd->threadSafe)
                 result = pcmd->actor(params, false);
 #ifdef ENABLE_WALLET
@@ -997,7 +1422,7 @@ json_spirit::Value CRPCTable::execute(const std::string& strMethod, const json_s
                     }
                     while (true) {
                         TRY_LOCK(pwalletMain->cs_wallet, lockWallet);
-                        if (!lockMain) {
+                        if (!lockWallet) {
                             MilliSleep(50);
                             continue;
                         }
@@ -1020,6 +1445,30 @@ json_spirit::Value CRPCTable::execute(const std::string& strMethod, const json_s
     }
 }
 
+bool CRPCTable::executeStream(const std::string& strMethod, const json_spirit::Array& params, CJSONStreamWriter& writer) const
+{
+    FindCommand(strMethod);
+    map<string, rpcstreamfn_type>::const_iterator it = mapStreamActors.find(strMethod);
+    if (it == mapStreamActors.end())
+        return false;
+
+    // The actor takes its own locks. A call it hands back to execute() is timed there.
+    CPerfHistogram& hist = *mapLatency.find(strMethod)->second;
+    int64_t nStart = GetTimeMicros();
+    try {
+        if (!it->second(params, writer))
+            return false;
+    } catch (std::exception& e) {
+        hist.Add(GetTimeMicros() - nStart);
+        throw JSONRPCError(RPC_MISC_ERROR, e.what());
+    } catch (...) {
+        hist.Add(GetTimeMicros() - nStart);
+        throw;
+    }
+    hist.Add(GetTimeMicros() - nStart);
+    return true;
+}
+
 std::vector<std::string> CRPCTable::listCommands() const
 {
     std::vector<std::string> commandList;
@@ -1031,6 +1480,33 @@ std::vector<std::string> CRPCTable::listCommands() const
     return commandList;
 }
 
+static bool CompareMethodStatsTime(const CRPCMethodStats& a, const CRPCMethodStats& b)
+{
+    return a.nMicros > b.nMicros;
+}
+
+std::vector<CRPCMethodStats> CRPCTable::GetMethodStats() const
+{
+    std::vector<CRPCMethodStats> vStats;
+    for (map<string, CPerfHistogram*>::const_iterator it = mapLatency.begin(); it != mapLatency.end(); ++it) {
+        CPerfHistogramSnapshot snapshot;
+        it->second->GetSnapshot(snapshot);
+        if (snapshot.nCount == 0)
+            continue;
+        CRPCMethodStats stats;
+        stats.strName = it->first;
+        stats.nCount = snapshot.nCount;
+        stats.nMicros = snapshot.nSum;
+        stats.nMaxMicros = snapshot.nMax;
+        stats.vPercentiles[0] = snapshot.Percentile(0.5);
+        stats.vPercentiles[1] = snapshot.Percentile(0.9);
+        stats.vPercentiles[2] = snapshot.Percentile(0.99);
+        vStats.push_back(stats);
+    }
+    std::sort(vStats.begin(), vStats.end(), CompareMethodStatsTime);
+    return vStats;
+}
+
 std::string HelpExampleCli(string methodname, string args)
 {
     return "> sling-cli " + methodname + " " + args + "\n";
@@ -12,15 +12,31 @@
 
 #include <list>
 #include <map>
+#include <vector>
 #include <stdint.h>
 #include <string>
 
+#include <boost/function.hpp>
+#include <boost/shared_ptr.hpp>
+
 #include "json/json_spirit_reader_template.h"
 #include "json/json_spirit_utils.h"
 #include "json/json_spirit_writer_template.h"
 
 class CBlockIndex;
 class CNetAddr;
+class CPerfHistogram;
+
+//! Threads serving RPC connections, and as many I/O threads
+static const int DEFAULT_RPC_THREADS = 4;
+//! Accepted RPC connections that may wait for a thread before new ones are turned away
+static const int DEFAULT_RPC_WORK_QUEUE = 16;
+//! Seconds an RPC connection may stay silent before its next request
+static const int DEFAULT_RPC_SERVER_TIMEOUT = 30;
+//! Megabytes of REST replies about buried blocks kept in memory
+static const int DEFAULT_REST_CACHE_SIZE = 32;
+//! Confirmations after which a block is taken not to change for the REST cache
+static const int REST_CACHE_MIN_CONFIRMATIONS = 6;
 
 class AcceptedConnection
 {
@@ -30,8 +46,24 @@ public:
     virtual std::iostream& stream() = 0;
     virtual std::string peer_address_to_string() const = 0;
     virtual void close() = 0;
+    //! Make a read blocked on the connection return, from another thread
+    virtual void shutdown() = 0;
+    //! Whether more of the peer's data was already taken from the socket
+    virtual bool HasBufferedInput() = 0;
+    //! Call handler(true) on an I/O thread once the peer sends more, or handler(false) after
+    //! nTimeout silent seconds. The handler must hold a reference to the connection.
+    virtual void AsyncWaitForInput(const boost::function<void(bool)>& handler, int nTimeout) = 0;
+    //! Whether the connection is encrypted, so a plain HTTP error can't be written to it
+    virtual bool IsSSL() const = 0;
 };
 
+/**
+ * Hand a connection whose next request has arrived to the RPC connection
+ * threads. If -rpcworkqueue connections are waiting already it is turned
+ * away with a 503 and closed, and false is returned.
+ */
+bool QueueRPCConnection(const boost::shared_ptr<AcceptedConnection>& conn);
+
 /** Start RPC threads */
 void StartRPCThreads();
 /**
@@ -80,8 +112,16 @@ void RPCRunLater(const std::string& name, boost::function<void(void)> func, int6
 
 //! Convert boost::asio address to CNetAddr
 extern CNetAddr BoostAsioToCNetAddr(boost::asio::ip::address address);
+/** Execute a JSON-RPC batch; read-only requests may run in parallel, replies are in request order */
+extern std::string JSONRPCExecBatch(const json_spirit::Array& vReq);
 
 typedef json_spirit::Value (*rpcfn_type)(const json_spirit::Array& params, bool fHelp);
+/**
+ * Writes the result of a method to the writer as it is produced, taking
+ * whatever locks it needs itself. Returns false, having written nothing,
+ * when the call is better served by the method's actor.
+ */
+typedef bool (*rpcstreamfn_type)(const json_spirit::Array& params, CJSONStreamWriter& writer);
 
 class CRPCCommand
 {
@@ -92,6 +132,24 @@ public:
     bool okSafeMode;
     bool threadSafe;
     bool reqWallet;
+    //! Changes nothing, so may run at the same time as other requests of its batch
+    bool readOnly;
+};
+
+/** A method that can also stream its result */
+struct CRPCStreamCommand {
+    std::string name;
+    rpcstreamfn_type actor;
+};
+
+/** Latency totals of one RPC method, copied out for reporting */
+struct CRPCMethodStats {
+    std::string strName;
+    uint64_t nCount;
+    uint64_t nMicros;
+    uint64_t nMaxMicros;
+    //! 50th, 90th and 99th percentile
+    uint64_t vPercentiles[3];
 };
 
 /**
@@ -101,9 +159,19 @@ class CRPCTable
 {
 private:
     std::map<std::string, const CRPCCommand*> mapCommands;
+    //! Execution time of each method, kept out of the getperfstats registry
+    std::map<std::string, CPerfHistogram*> mapLatency;
+    std::map<std::string, rpcstreamfn_type> mapStreamActors;
+
+    //! Find a method, throwing if it may not be called now
+    const CRPCCommand* FindCommand(const std::string& strMethod) const;
+
+    CRPCTable(const CRPCTable&);
+    CRPCTable& operator=(const CRPCTable&);
 
 public:
     CRPCTable();
+    ~CRPCTable();
     const CRPCCommand* operator[](std::string name) const;
     std::string help(std::string name) const;
 
@@ -116,11 +184,24 @@ public:
      */
     json_spirit::Value execute(const std::string& method, const json_spirit::Array& params) const;
 
+    //! Whether the method can stream its result through executeStream()
+    bool canStream(const std::string& method) const { return mapStreamActors.count(method) > 0; }
+
+    /**
+     * Execute a method, writing its result to the writer as it is produced.
+     * @returns false, having written nothing, when the result has to come from execute() instead.
+     * @throws an exception (json_spirit::Value) when an error happens.
+     */
+    bool executeStream(const std::string& method, const json_spirit::Array& params, CJSONStreamWriter& writer) const;
+
     /**
     * Returns a list of registered commands
     * @returns List of registered commands.
     */
     std::vector<std::string> listCommands() const;
+
+    /** Latency of the methods called at least once, slowest in total first */
+    std::vector<CRPCMethodStats> GetMethodStats() const;
 };
 
 extern const CRPCTable tableRPC;
@@ -144,6 +225,7 @@ extern double GetDifficulty(const CBlockIndex* blockindex = NULL);
 extern std::string HelpRequiringPassphrase();
 extern std::string HelpExampleCli(std::string methodname, std::string args);
 extern std::string HelpExampleRpc(std::string methodname, std::string args);
+extern json_spirit::Object PerfStatsToJSON(const std::string& strPrefix = "");
 
 extern void EnsureWalletIsUnlocked();
 
@@ -213,13 +295,22 @@ extern json_spirit::Value getwalletinfo(const json_spirit::Array& params, bool f
 extern json_spirit::Value getblockchaininfo(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value getnetworkinfo(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value setmocktime(const json_spirit::Array& params, bool fHelp);
+extern json_spirit::Value getperfstats(const json_spirit::Array& params, bool fHelp);
+extern json_spirit::Value getlockstats(const json_spirit::Array& params, bool fHelp);
+extern json_spirit::Value getrpcstats(const json_spirit::Array& params, bool fHelp);
+extern json_spirit::Value logging(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value reservebalance(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value multisend(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value autocombinerewards(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value getstakingstatus(const json_spirit::Array& params, bool fHelp);
+extern json_spirit::Value getaddressbalance(const json_spirit::Array& params, bool fHelp);
+extern json_spirit::Value getaddressutxos(const json_spirit::Array& params, bool fHelp);
+extern json_spirit::Value getaddresstxids(const json_spirit::Array& params, bool fHelp);
+extern json_spirit::Value getspentinfo(const json_spirit::Array& params, bool fHelp);
 
 extern json_spirit::Value getrawtransaction(const json_spirit::Array& params, bool fHelp); // in rcprawtransaction.cpp
 extern json_spirit::Value listunspent(const json_spirit::Array& params, bool fHelp);
+extern bool listunspent_stream(const json_spirit::Array& params, CJSONStreamWriter& writer);
 extern json_spirit::Value lockunspent(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value listlockunspent(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value createrawtransaction(const json_spirit::Array& params, bool fHelp);
@@ -234,8 +325,10 @@ extern json_spirit::Value getdifficulty(const json_spirit::Array& params, bool f
 extern json_spirit::Value settxfee(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value getmempoolinfo(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value getrawmempool(const json_spirit::Array& params, bool fHelp);
+extern bool getrawmempool_stream(const json_spirit::Array& params, CJSONStreamWriter& writer);
 extern json_spirit::Value getblockhash(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value getblock(const json_spirit::Array& params, bool fHelp);
+extern bool getblock_stream(const json_spirit::Array& params, CJSONStreamWriter& writer);
 extern json_spirit::Value getblockheader(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value gettxoutsetinfo(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value gettxout(const json_spirit::Array& params, bool fHelp);
@@ -247,6 +340,7 @@ extern json_spirit::Value coinmix(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value spork(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value masternode(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value masternodelist(const json_spirit::Array& params, bool fHelp);
+extern bool masternodelist_stream(const json_spirit::Array& params, CJSONStreamWriter& writer);
 extern json_spirit::Value mnbudget(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value mnbudgetvoteraw(const json_spirit::Array& params, bool fHelp);
 extern json_spirit::Value mnfinalbudget(const json_spirit::Array& params, bool fHelp);
@@ -256,6 +350,8 @@ extern json_spirit::Value mnsync(const json_spirit::Array& params, bool fHelp);
 extern bool HTTPReq_REST(AcceptedConnection* conn,
     std::string& strURI,
     std::map<std::string, std::string>& mapHeaders,
-    bool fRun);
+    bool fRun,
+    int nProto);
+extern void SetRESTCacheSize(size_t nBytes);
 
 #endif // BITCOIN_RPCSERVER_H
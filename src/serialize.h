@@ -11,6 +11,7 @@
 #include <ios>
 #include <limits>
 #include <map>
+#include <memory>
 #include <set>
 #include <stdint.h>
 #include <string.h>
@@ -615,6 +616,16 @@ void Serialize(Stream& os, const std::set<K, Pred, A>& m, int nType, int nVersio
 template <typename Stream, typename K, typename Pred, typename A>
 void Unserialize(Stream& is, std::set<K, Pred, A>& m, int nType, int nVersion);
 
+/**
+ * shared_ptr to an immutable object
+ */
+template <typename T>
+unsigned int GetSerializeSize(const std::shared_ptr<const T>& p, int nType, int nVersion);
+template <typename Stream, typename T>
+void Serialize(Stream& os, const std::shared_ptr<const T>& p, int nType, int nVersion);
+template <typename Stream, typename T>
+void Unserialize(Stream& is, std::shared_ptr<const T>& p, int nType, int nVersion);
+
 
 /**
  * If none of the specialized versions above matched, default to calling member function.
@@ -868,6 +879,31 @@ void Unserialize(Stream& is, std::set<K, Pred, A>& m, int nType, int nVersion)
 }
 
 
+/**
+ * shared_ptr to an immutable object: the object is serialized in place, and
+ * a fresh one is allocated for every read
+ */
+template <typename T>
+unsigned int GetSerializeSize(const std::shared_ptr<const T>& p, int nType, int nVersion)
+{
+    return GetSerializeSize(*p, nType, nVersion);
+}
+
+template <typename Stream, typename T>
+void Serialize(Stream& os, const std::shared_ptr<const T>& p, int nType, int nVersion)
+{
+    Serialize(os, *p, nType, nVersion);
+}
+
+template <typename Stream, typename T>
+void Unserialize(Stream& is, std::shared_ptr<const T>& p, int nType, int nVersion)
+{
+    std::shared_ptr<T> pNew = std::make_shared<T>();
+    Unserialize(is, *pNew, nType, nVersion);
+    p = pNew;
+}
+
+
 /**
  * Support for ADD_SERIALIZE_METHODS and READWRITE macro
  */
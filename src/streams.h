@@ -286,6 +286,14 @@ public:
         data.insert(data.end(), begin(), end());
         clear();
     }
+
+    // Exchange the underlying buffer without copying it. The read position
+    // is reset to the start of the new contents.
+    void swap(CSerializeData& data)
+    {
+        vch.swap(data);
+        nReadPos = 0;
+    }
 };
 
 
@@ -4,9 +4,12 @@
 
 #include "sync.h"
 
+#include "perfstats.h"
 #include "util.h"
 #include "utilstrencodings.h"
 
+#include <algorithm>
+#include <chrono>
 #include <stdio.h>
 
 #include <boost/foreach.hpp>
@@ -20,6 +23,131 @@ void PrintLockContention(const char* pszName, const char* pszFile, int nLine)
 }
 #endif /* DEBUG_LOCKCONTENTION */
 
+std::atomic<bool> fLockStats(false);
+
+class CLockSite
+{
+public:
+    const char* pszName;
+    const char* pszFile;
+    int nLine;
+    std::atomic<uint64_t> nAcquired;
+    std::atomic<uint64_t> nContended;
+    std::atomic<uint64_t> nTryFailed;
+    //! Only waits that found the lock taken
+    CPerfHistogram histWait;
+    CPerfHistogram histHold;
+
+    CLockSite(const char* pszNameIn, const char* pszFileIn, int nLineIn) : pszName(pszNameIn), pszFile(pszFileIn), nLine(nLineIn), nAcquired(0), nContended(0), nTryFailed(0) {}
+};
+
+/**
+ * Open addressing table of lock sites, filled in with compare-and-swap so
+ * that finding a site takes no lock. Sites are never removed. Once the
+ * table is full, further sites share one overflow entry.
+ */
+static const unsigned int LOCK_SITE_SLOTS = 4096;
+static std::atomic<CLockSite*> vLockSites[LOCK_SITE_SLOTS];
+static CLockSite lockSiteOverflow("(other)", "(other)", 0);
+
+CLockSite* GetLockSite(const char* pszName, const char* pszFile, int nLine)
+{
+    // The name and file are string literals of the LOCK macro, so the pointers identify the site
+    size_t nHash = (size_t)pszFile * 31 + (size_t)pszName * 17 + nLine;
+    for (unsigned int i = 0; i < LOCK_SITE_SLOTS; i++) {
+        std::atomic<CLockSite*>& slot = vLockSites[(nHash + i) % LOCK_SITE_SLOTS];
+        CLockSite* psite = slot.load(std::memory_order_acquire);
+        if (psite == NULL) {
+            CLockSite* psiteNew = new CLockSite(pszName, pszFile, nLine);
+            if (slot.compare_exchange_strong(psite, psiteNew, std::memory_order_acq_rel))
+                return psiteNew;
+            // Another thread took the slot meanwhile; psite is its site now
+            delete psiteNew;
+        }
+        if (psite->pszFile == pszFile && psite->nLine == nLine && psite->pszName == pszName)
+            return psite;
+    }
+    return &lockSiteOverflow;
+}
+
+int64_t LockStatsMicros()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void RecordLockAcquired(CLockSite* psite, bool fContended, int64_t nWaitMicros)
+{
+    psite->nAcquired.fetch_add(1, std::memory_order_relaxed);
+    if (fContended) {
+        psite->nContended.fetch_add(1, std::memory_order_relaxed);
+        psite->histWait.Add(nWaitMicros);
+    }
+}
+
+void RecordLockTryFailed(CLockSite* psite)
+{
+    psite->nTryFailed.fetch_add(1, std::memory_order_relaxed);
+}
+
+void RecordLockHeld(CLockSite* psite, int64_t nHoldMicros)
+{
+    psite->histHold.Add(nHoldMicros);
+}
+
+static bool CompareLockSiteWait(const CLockSiteStats& a, const CLockSiteStats& b)
+{
+    if (a.nWaitMicros != b.nWaitMicros)
+        return a.nWaitMicros > b.nWaitMicros;
+    return a.nTryFailed > b.nTryFailed;
+}
+
+std::vector<CLockSiteStats> GetLockStats()
+{
+    std::vector<CLockSiteStats> vStats;
+    for (unsigned int i = 0; i <= LOCK_SITE_SLOTS; i++) {
+        const CLockSite* psite = i < LOCK_SITE_SLOTS ? vLockSites[i].load(std::memory_order_acquire) : &lockSiteOverflow;
+        if (psite == NULL || psite->nAcquired.load(std::memory_order_relaxed) + psite->nTryFailed.load(std::memory_order_relaxed) == 0)
+            continue;
+        CPerfHistogramSnapshot wait, hold;
+        psite->histWait.GetSnapshot(wait);
+        psite->histHold.GetSnapshot(hold);
+
+        CLockSiteStats stats;
+        stats.strName = psite->pszName;
+        stats.strFile = psite->pszFile;
+        stats.nLine = psite->nLine;
+        stats.nAcquired = psite->nAcquired.load(std::memory_order_relaxed);
+        stats.nContended = psite->nContended.load(std::memory_order_relaxed);
+        stats.nTryFailed = psite->nTryFailed.load(std::memory_order_relaxed);
+        stats.nWaitMicros = wait.nSum;
+        stats.nMaxWaitMicros = wait.nMax;
+        stats.nHoldMicros = hold.nSum;
+        stats.nMaxHoldMicros = hold.nMax;
+        const double vFractions[3] = {0.5, 0.9, 0.99};
+        for (int j = 0; j < 3; j++) {
+            stats.vWaitPercentiles[j] = wait.Percentile(vFractions[j]);
+            stats.vHoldPercentiles[j] = hold.Percentile(vFractions[j]);
+        }
+        vStats.push_back(stats);
+    }
+    std::sort(vStats.begin(), vStats.end(), CompareLockSiteWait);
+    return vStats;
+}
+
+void ResetLockStats()
+{
+    for (unsigned int i = 0; i <= LOCK_SITE_SLOTS; i++) {
+        CLockSite* psite = i < LOCK_SITE_SLOTS ? vLockSites[i].load(std::memory_order_acquire) : &lockSiteOverflow;
+        if (psite == NULL)
+            continue;
+        psite->nAcquired.store(0, std::memory_order_relaxed);
+        psite->nContended.store(0, std::memory_order_relaxed);
+        psite->nTryFailed.store(0, std::memory_order_relaxed);
+        psite->histWait.Reset();
+        psite->histHold.Reset();
+    }
+}
+
 #ifdef DEBUG_LOCKORDER
 //
 // Early deadlock detection.
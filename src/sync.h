@@ -8,6 +8,11 @@
 
 #include "threadsafety.h"
 
+#include <atomic>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
 #include <boost/thread/condition_variable.hpp>
 #include <boost/thread/locks.hpp>
 #include <boost/thread/mutex.hpp>
@@ -104,16 +109,66 @@ void static inline AssertLockHeldInternal(const char* pszName, const char* pszFi
 void PrintLockContention(const char* pszName, const char* pszFile, int nLine);
 #endif
 
+/**
+ * Lock contention profiling, turned on by -lockstats. While on, every
+ * LOCK and TRY_LOCK records, for the place in the source it was taken at,
+ * how long it waited for the lock (if it had to), how long it held it,
+ * and whether a TRY_LOCK failed. getlockstats reports the results.
+ */
+extern std::atomic<bool> fLockStats;
+
+class CLockSite;
+CLockSite* GetLockSite(const char* pszName, const char* pszFile, int nLine);
+int64_t LockStatsMicros();
+void RecordLockAcquired(CLockSite* psite, bool fContended, int64_t nWaitMicros);
+void RecordLockTryFailed(CLockSite* psite);
+void RecordLockHeld(CLockSite* psite, int64_t nHoldMicros);
+
+/** Totals of one lock site, copied out for reporting */
+struct CLockSiteStats {
+    std::string strName;
+    std::string strFile;
+    int nLine;
+    uint64_t nAcquired;
+    uint64_t nContended;
+    uint64_t nTryFailed;
+    uint64_t nWaitMicros;
+    uint64_t nMaxWaitMicros;
+    uint64_t nHoldMicros;
+    uint64_t nMaxHoldMicros;
+    //! Wait and hold time percentiles: 50th, 90th, 99th
+    uint64_t vWaitPercentiles[3];
+    uint64_t vHoldPercentiles[3];
+};
+
+/** All lock sites seen while profiling, those waited on longest in total first */
+std::vector<CLockSiteStats> GetLockStats();
+/** Zero the totals of all lock sites */
+void ResetLockStats();
+
 /** Wrapper around boost::unique_lock<Mutex> */
 template <typename Mutex>
 class CMutexLock
 {
 private:
     boost::unique_lock<Mutex> lock;
+    //! Set while profiling
+    CLockSite* psite;
+    int64_t nLockedAt;
 
     void Enter(const char* pszName, const char* pszFile, int nLine)
     {
         EnterCritical(pszName, pszFile, nLine, (void*)(lock.mutex()));
+        if (fLockStats.load(std::memory_order_relaxed)) {
+            psite = GetLockSite(pszName, pszFile, nLine);
+            int64_t nWaitStart = LockStatsMicros();
+            bool fContended = !lock.try_lock();
+            if (fContended)
+                lock.lock();
+            nLockedAt = LockStatsMicros();
+            RecordLockAcquired(psite, fContended, nLockedAt - nWaitStart);
+            return;
+        }
 #ifdef DEBUG_LOCKCONTENTION
         if (!lock.try_lock()) {
             PrintLockContention(pszName, pszFile, nLine);
@@ -130,11 +185,21 @@ private:
         lock.try_lock();
         if (!lock.owns_lock())
             LeaveCritical();
+        if (fLockStats.load(std::memory_order_relaxed)) {
+            CLockSite* psiteTry = GetLockSite(pszName, pszFile, nLine);
+            if (lock.owns_lock()) {
+                psite = psiteTry;
+                nLockedAt = LockStatsMicros();
+                RecordLockAcquired(psite, false, 0);
+            } else {
+                RecordLockTryFailed(psiteTry);
+            }
+        }
         return lock.owns_lock();
     }
 
 public:
-    CMutexLock(Mutex& mutexIn, const char* pszName, const char* pszFile, int nLine, bool fTry = false) : lock(mutexIn, boost::defer_lock)
+    CMutexLock(Mutex& mutexIn, const char* pszName, const char* pszFile, int nLine, bool fTry = false) : lock(mutexIn, boost::defer_lock), psite(NULL), nLockedAt(0)
     {
         if (fTry)
             TryEnter(pszName, pszFile, nLine);
@@ -144,6 +209,8 @@ public:
 
     ~CMutexLock()
     {
+        if (psite && lock.owns_lock())
+            RecordLockHeld(psite, LockStatsMicros() - nLockedAt);
         if (lock.owns_lock())
             LeaveCritical();
     }
@@ -5,6 +5,7 @@
 #include "wallet.h"
 #include "walletdb.h"
 
+#include <algorithm>
 #include <stdint.h>
 
 #include <boost/foreach.hpp>
@@ -136,4 +137,65 @@ BOOST_AUTO_TEST_CASE(acc_orderupgrade)
     BOOST_CHECK(6 == vpwtx[1]->nOrderPos);
 }
 
+static std::vector<std::pair<int64_t, std::string> >
+DescribeOrder(const CWallet::TxItems& txOrdered)
+{
+    std::vector<std::pair<int64_t, std::string> > vOrder;
+    BOOST_FOREACH(const PAIRTYPE(int64_t, CWallet::TxPair)& item, txOrdered)
+    {
+        if (item.second.first)
+            vOrder.push_back(std::make_pair(item.first, item.second.first->GetHash().ToString()));
+        else
+            vOrder.push_back(std::make_pair(item.first, item.second.second->strAccount + " " + i64tostr(item.second.second->nTime)));
+    }
+    // Entries sharing a position may come in any order
+    std::sort(vOrder.begin(), vOrder.end());
+    return vOrder;
+}
+
+BOOST_AUTO_TEST_CASE(acc_orderedindex)
+{
+    CWalletDB walletdb(pwalletMain->strWalletFile);
+    CAccountingEntry ae;
+    CWalletTx wtx;
+
+    LOCK(pwalletMain->cs_wallet);
+
+    // Entries added after load go straight into the order index
+    ae.strAccount = "idx";
+    ae.nCreditDebit = 2;
+    ae.nTime = 1333333340;
+    ae.strOtherAccount = "f";
+    ae.nOrderPos = pwalletMain->IncOrderPosNext(&walletdb);
+    BOOST_CHECK(pwalletMain->AddAccountingEntry(ae, walletdb));
+
+    wtx.mapValue["comment"] = "w";
+    {
+        CMutableTransaction tx(wtx);
+        tx.nLockTime = 1234;
+        *static_cast<CTransaction*>(&wtx) = CTransaction(tx);
+    }
+    pwalletMain->AddToWallet(wtx);
+    CWalletTx* pwtx = &pwalletMain->mapWallet[wtx.GetHash()];
+
+    CWallet::TxItems::reverse_iterator it = pwalletMain->wtxOrdered.rbegin();
+    BOOST_REQUIRE(it != pwalletMain->wtxOrdered.rend());
+    BOOST_CHECK(it->second.first == pwtx);
+    BOOST_CHECK_EQUAL(it->first, pwtx->nOrderPos);
+    ++it;
+    BOOST_REQUIRE(it != pwalletMain->wtxOrdered.rend());
+    BOOST_REQUIRE(it->second.second != NULL);
+    BOOST_CHECK(it->second.second->strAccount == "idx");
+    BOOST_CHECK_EQUAL(it->first, ae.nOrderPos);
+
+    // ... and agree with an index built from scratch
+    std::vector<std::pair<int64_t, std::string> > vBefore = DescribeOrder(pwalletMain->wtxOrdered);
+    pwalletMain->BuildOrderedTxItems(walletdb);
+    BOOST_CHECK(vBefore == DescribeOrder(pwalletMain->wtxOrdered));
+
+    // Erased transactions leave the index
+    pwalletMain->EraseFromWallet(wtx.GetHash());
+    BOOST_CHECK_EQUAL(pwalletMain->wtxOrdered.size(), vBefore.size() - 1);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,129 @@
+// Copyright (c) 2017 The Sling core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "addressindex.h"
+#include "clientversion.h"
+#include "streams.h"
+#include "txdb.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_AUTO_TEST_SUITE(addressindex_tests)
+
+static std::string SerializeKey(const CAddressIndexKey& key)
+{
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << std::make_pair('a', key);
+    return ss.str();
+}
+
+BOOST_AUTO_TEST_CASE(addressindex_key_order)
+{
+    // Records of an address must sort by height in the database, or a range
+    // read would miss entries; the heights straddle the VARINT size steps.
+    uint160 hashBytes(12345);
+    int heights[] = {0, 1, 127, 128, 255, 256, 16511, 16512, 65536, 2000000};
+    for (unsigned int i = 1; i < sizeof(heights) / sizeof(heights[0]); i++) {
+        CAddressIndexKey prev(ADDRESS_TYPE_P2PKH, hashBytes, heights[i - 1], 7, uint256(1), 0, false);
+        CAddressIndexKey next(ADDRESS_TYPE_P2PKH, hashBytes, heights[i], 0, uint256(0), 0, false);
+        BOOST_CHECK(SerializeKey(prev) < SerializeKey(next));
+    }
+
+    // Within a block, by position of the transaction
+    CAddressIndexKey first(ADDRESS_TYPE_P2PKH, hashBytes, 500, 255, uint256(9), 3, true);
+    CAddressIndexKey second(ADDRESS_TYPE_P2PKH, hashBytes, 500, 256, uint256(1), 0, false);
+    BOOST_CHECK(SerializeKey(first) < SerializeKey(second));
+
+    // Round trip
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << first;
+    BOOST_CHECK_EQUAL(ss.size(), first.GetSerializeSize(SER_DISK, CLIENT_VERSION));
+    CAddressIndexKey read;
+    ss >> read;
+    BOOST_CHECK_EQUAL(read.nAddressType, ADDRESS_TYPE_P2PKH);
+    BOOST_CHECK(read.hashBytes == hashBytes);
+    BOOST_CHECK_EQUAL(read.nBlockHeight, 500);
+    BOOST_CHECK_EQUAL(read.nTxIndex, 255U);
+    BOOST_CHECK(read.txhash == uint256(9));
+    BOOST_CHECK_EQUAL(read.nIndex, 3U);
+    BOOST_CHECK(read.fSpending);
+}
+
+BOOST_AUTO_TEST_CASE(addressindex_db_ranges)
+{
+    CBlockTreeDB db(1 << 20, true);
+    uint160 hashA(1);
+    uint160 hashB(2);
+
+    CAddressIndexUpdate update;
+    for (int nHeight = 100; nHeight <= 1000; nHeight += 100)
+        update.vAddressIndex.push_back(std::make_pair(CAddressIndexKey(ADDRESS_TYPE_P2PKH, hashA, nHeight, 1, uint256(nHeight), 0, false), nHeight));
+    // Same hash as another type, and a neighbouring hash: neither may leak into reads of A
+    update.vAddressIndex.push_back(std::make_pair(CAddressIndexKey(ADDRESS_TYPE_P2SH, hashA, 300, 1, uint256(1), 0, false), 1));
+    update.vAddressIndex.push_back(std::make_pair(CAddressIndexKey(ADDRESS_TYPE_P2PKH, hashB, 0, 0, uint256(2), 0, false), 1));
+    BOOST_CHECK(db.WriteAddressIndexUpdate(update));
+
+    std::vector<std::pair<CAddressIndexKey, CAmount> > vAll;
+    BOOST_CHECK(db.ReadAddressIndex(hashA, ADDRESS_TYPE_P2PKH, vAll));
+    BOOST_CHECK_EQUAL(vAll.size(), 10U);
+    for (unsigned int i = 0; i < vAll.size(); i++)
+        BOOST_CHECK_EQUAL(vAll[i].first.nBlockHeight, (int)(i + 1) * 100);
+
+    std::vector<std::pair<CAddressIndexKey, CAmount> > vRange;
+    BOOST_CHECK(db.ReadAddressIndex(hashA, ADDRESS_TYPE_P2PKH, vRange, 250, 600));
+    BOOST_CHECK_EQUAL(vRange.size(), 4U);
+    BOOST_CHECK_EQUAL(vRange.front().first.nBlockHeight, 300);
+    BOOST_CHECK_EQUAL(vRange.back().first.nBlockHeight, 600);
+    BOOST_CHECK_EQUAL(vRange.back().second, 600);
+
+    std::vector<std::pair<CAddressIndexKey, CAmount> > vTail;
+    BOOST_CHECK(db.ReadAddressIndex(hashA, ADDRESS_TYPE_P2PKH, vTail, 900));
+    BOOST_CHECK_EQUAL(vTail.size(), 2U);
+
+    // Disconnecting erases the records again
+    CAddressIndexUpdate undo;
+    undo.vAddressIndexErase.push_back(vAll.back().first);
+    BOOST_CHECK(db.WriteAddressIndexUpdate(undo));
+    vAll.clear();
+    BOOST_CHECK(db.ReadAddressIndex(hashA, ADDRESS_TYPE_P2PKH, vAll));
+    BOOST_CHECK_EQUAL(vAll.size(), 9U);
+}
+
+BOOST_AUTO_TEST_CASE(addressindex_db_unspent_and_spent)
+{
+    CBlockTreeDB db(1 << 20, true);
+    uint160 hashBytes(3);
+    CScript script = CScript() << OP_TRUE;
+
+    CAddressIndexUpdate update;
+    update.vAddressUnspent.push_back(std::make_pair(CAddressUnspentKey(ADDRESS_TYPE_P2SH, hashBytes, uint256(10), 0), CAddressUnspentValue(50, script, 10)));
+    update.vAddressUnspent.push_back(std::make_pair(CAddressUnspentKey(ADDRESS_TYPE_P2SH, hashBytes, uint256(11), 1), CAddressUnspentValue(70, script, 11)));
+    update.vSpent.push_back(std::make_pair(CSpentIndexKey(uint256(10), 1), CSpentIndexValue(uint256(12), 2, 12, 30, ADDRESS_TYPE_P2SH, hashBytes)));
+    BOOST_CHECK(db.WriteAddressIndexUpdate(update));
+
+    std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > vUnspent;
+    BOOST_CHECK(db.ReadAddressUnspentIndex(hashBytes, ADDRESS_TYPE_P2SH, vUnspent));
+    BOOST_CHECK_EQUAL(vUnspent.size(), 2U);
+    BOOST_CHECK_EQUAL(vUnspent[0].second.nSatoshis + vUnspent[1].second.nSatoshis, 120);
+
+    CSpentIndexValue spent;
+    BOOST_CHECK(db.ReadSpentIndex(CSpentIndexKey(uint256(10), 1), spent));
+    BOOST_CHECK(spent.txid == uint256(12));
+    BOOST_CHECK_EQUAL(spent.nInputIndex, 2U);
+    BOOST_CHECK_EQUAL(spent.nBlockHeight, 12);
+    BOOST_CHECK(!db.ReadSpentIndex(CSpentIndexKey(uint256(10), 0), spent));
+
+    // Null values erase
+    CAddressIndexUpdate undo;
+    undo.vAddressUnspent.push_back(std::make_pair(CAddressUnspentKey(ADDRESS_TYPE_P2SH, hashBytes, uint256(10), 0), CAddressUnspentValue()));
+    undo.vSpent.push_back(std::make_pair(CSpentIndexKey(uint256(10), 1), CSpentIndexValue()));
+    BOOST_CHECK(db.WriteAddressIndexUpdate(undo));
+    vUnspent.clear();
+    BOOST_CHECK(db.ReadAddressUnspentIndex(hashBytes, ADDRESS_TYPE_P2SH, vUnspent));
+    BOOST_CHECK_EQUAL(vUnspent.size(), 1U);
+    BOOST_CHECK(vUnspent[0].first.txhash == uint256(11));
+    BOOST_CHECK(!db.ReadSpentIndex(CSpentIndexKey(uint256(10), 1), spent));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
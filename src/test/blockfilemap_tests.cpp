@@ -0,0 +1,92 @@
+// Copyright (c) 2017 The Sling core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockfilemap.h"
+#include "chainparams.h"
+#include "clientversion.h"
+#include "main.h"
+#include "streams.h"
+
+#include <boost/filesystem.hpp>
+#include <boost/test/unit_test.hpp>
+
+BOOST_AUTO_TEST_SUITE(blockfilemap_tests)
+
+// Lay out blocks the way WriteBlockToDisk does and return their positions
+static std::vector<CDiskBlockPos> WriteTestBlockFile(int nFile, const CBlock& block, int nBlocks, unsigned int& nSize)
+{
+    std::vector<CDiskBlockPos> vPos;
+    CAutoFile fileout(OpenBlockFile(CDiskBlockPos(nFile, 0)), SER_DISK, CLIENT_VERSION);
+    BOOST_REQUIRE(!fileout.IsNull());
+    for (int i = 0; i < nBlocks; i++) {
+        unsigned int nBlockSize = fileout.GetSerializeSize(block);
+        fileout << FLATDATA(Params().MessageStart()) << nBlockSize;
+        vPos.push_back(CDiskBlockPos(nFile, ftell(fileout.Get())));
+        fileout << block;
+    }
+    nSize = ftell(fileout.Get());
+    return vPos;
+}
+
+BOOST_AUTO_TEST_CASE(blockfilemap_read)
+{
+    const CBlock& genesis = Params().GenesisBlock();
+    unsigned int nSize0, nSize1;
+    std::vector<CDiskBlockPos> vPos0 = WriteTestBlockFile(90000, genesis, 3, nSize0);
+    std::vector<CDiskBlockPos> vPos1 = WriteTestBlockFile(90001, genesis, 1, nSize1);
+
+    CBlockFileMapper mapper(1);
+    for (unsigned int i = 0; i < vPos0.size(); i++) {
+        CMappedFileReader reader(SER_DISK, CLIENT_VERSION);
+        mapper.Open(vPos0[i], "blk", nSize0, reader);
+        BOOST_REQUIRE(!reader.IsNull());
+        CBlock block;
+        reader >> block;
+        BOOST_CHECK(block.GetHash() == genesis.GetHash());
+    }
+
+    // Only one mapping is kept, but a reader holds on to its own
+    CMappedFileReader reader0(SER_DISK, CLIENT_VERSION);
+    mapper.Open(vPos0[0], "blk", nSize0, reader0);
+    CMappedFileReader reader1(SER_DISK, CLIENT_VERSION);
+    mapper.Open(vPos1[0], "blk", nSize1, reader1);
+    BOOST_REQUIRE(!reader0.IsNull() && !reader1.IsNull());
+    CBlock block0, block1;
+    reader0 >> block0;
+    reader1 >> block1;
+    BOOST_CHECK(block0.GetHash() == block1.GetHash());
+
+    // Reads stop at the end of the valid part of the file
+    CMappedFileReader readerShort(SER_DISK, CLIENT_VERSION);
+    mapper.Open(vPos0[2], "blk", vPos0[2].nPos + 10, readerShort);
+    BOOST_REQUIRE(!readerShort.IsNull());
+    CBlock blockShort;
+    BOOST_CHECK_THROW(readerShort >> blockShort, std::ios_base::failure);
+
+    // Positions past the valid part and files that are too short aren't mapped
+    CMappedFileReader readerPast(SER_DISK, CLIENT_VERSION);
+    mapper.Open(CDiskBlockPos(90000, nSize0), "blk", nSize0, readerPast);
+    BOOST_CHECK(readerPast.IsNull());
+    CMappedFileReader readerBig(SER_DISK, CLIENT_VERSION);
+    mapper.Open(vPos1[0], "blk", nSize1 + 1, readerBig);
+    BOOST_CHECK(readerBig.IsNull());
+
+    // Clearing drops the mappings but not the readers still using them
+    CMappedFileReader readerKept(SER_DISK, CLIENT_VERSION);
+    mapper.Open(vPos0[1], "blk", nSize0, readerKept);
+    mapper.Clear();
+    CMappedFileReader readerAfter(SER_DISK, CLIENT_VERSION);
+    mapper.Open(vPos0[1], "blk", nSize0, readerAfter);
+    BOOST_REQUIRE(!readerKept.IsNull() && !readerAfter.IsNull());
+    CBlock blockKept, blockAfter;
+    readerKept >> blockKept;
+    readerAfter >> blockAfter;
+    BOOST_CHECK(blockKept.GetHash() == genesis.GetHash());
+    BOOST_CHECK(blockAfter.GetHash() == genesis.GetHash());
+
+    boost::filesystem::remove(GetBlockPosFilename(CDiskBlockPos(90000, 0), "blk"));
+    boost::filesystem::remove(GetBlockPosFilename(CDiskBlockPos(90001, 0), "blk"));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
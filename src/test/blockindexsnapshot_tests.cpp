@@ -0,0 +1,103 @@
+// Copyright (c) 2017 The Sling core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockindexsnapshot.h"
+#include "main.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_AUTO_TEST_SUITE(blockindexsnapshot_tests)
+
+BOOST_AUTO_TEST_CASE(blockindexsnapshot_roundtrip)
+{
+    LOCK(cs_main);
+
+    // Work on an index of our own and put the global one back at the end
+    BlockMap mapSaved;
+    mapSaved.swap(mapBlockIndex);
+    std::set<std::pair<COutPoint, unsigned int> > setStakeSeenSaved;
+    setStakeSeenSaved.swap(setStakeSeen);
+
+    // A short chain with a fork off its first block, and a placeholder
+    // for a block that was never stored
+    CBlockIndex* pindex0 = InsertBlockIndex(uint256(1));
+    CBlockIndex* pindex1 = InsertBlockIndex(uint256(2));
+    CBlockIndex* pindexFork = InsertBlockIndex(uint256(3));
+    InsertBlockIndex(uint256(4));
+    pindex1->pprev = pindex0;
+    pindexFork->pprev = pindex0;
+    pindex0->pnext = pindex1;
+    CBlockIndex* vEntries[] = {pindex0, pindex1, pindexFork};
+    for (int i = 0; i < 3; i++) {
+        CBlockIndex* pindex = vEntries[i];
+        pindex->nHeight = pindex->pprev ? pindex->pprev->nHeight + 1 : 0;
+        pindex->nFile = i;
+        pindex->nDataPos = 1000 + i;
+        pindex->nUndoPos = 2000 + i;
+        pindex->nVersion = 3;
+        pindex->hashMerkleRoot = uint256(100 + i);
+        pindex->nTime = 1500000000 + i;
+        pindex->nBits = 0x1e0ffff0;
+        pindex->nNonce = i;
+        pindex->nStatus = BLOCK_VALID_SCRIPTS | BLOCK_HAVE_DATA;
+        pindex->nTx = 2 + i;
+        pindex->nFlags = CBlockIndex::BLOCK_PROOF_OF_STAKE;
+        pindex->nMint = 5 * COIN;
+        pindex->nMoneySupply = (i + 1) * 5 * COIN;
+        pindex->nStakeModifier = 0x1234567890ULL + i;
+        pindex->prevoutStake = COutPoint(uint256(200 + i), i);
+        pindex->nStakeTime = 1500000000 + i;
+        pindex->hashProofOfStake = uint256(300 + i);
+    }
+
+    // A snapshot written for another tip is not used, and is gone afterwards
+    const uint256 hashTip(42);
+    BlockMap mapWritten;
+    BOOST_CHECK(WriteBlockIndexSnapshot(hashTip));
+    mapWritten.swap(mapBlockIndex);
+    BOOST_CHECK(!LoadBlockIndexSnapshot(uint256(43)));
+    BOOST_CHECK(mapBlockIndex.empty());
+    BOOST_CHECK(!LoadBlockIndexSnapshot(hashTip));
+
+    mapWritten.swap(mapBlockIndex);
+    BOOST_CHECK(WriteBlockIndexSnapshot(hashTip));
+    mapWritten.swap(mapBlockIndex);
+    setStakeSeen.clear();
+    BOOST_CHECK(LoadBlockIndexSnapshot(hashTip));
+    BOOST_CHECK_EQUAL(mapBlockIndex.size(), mapWritten.size());
+    BOOST_CHECK_EQUAL(setStakeSeen.size(), 3U);
+
+    BOOST_FOREACH (const PAIRTYPE(uint256, CBlockIndex*) & item, mapWritten) {
+        const CBlockIndex* pindexOld = item.second;
+        BOOST_REQUIRE(mapBlockIndex.count(item.first));
+        const CBlockIndex* pindexNew = mapBlockIndex[item.first];
+        BOOST_CHECK(pindexNew != pindexOld);
+        BOOST_CHECK(*pindexNew->phashBlock == item.first);
+        BOOST_CHECK((pindexNew->pprev ? pindexNew->pprev->GetBlockHash() : 0) == (pindexOld->pprev ? pindexOld->pprev->GetBlockHash() : 0));
+        BOOST_CHECK((pindexNew->pnext ? pindexNew->pnext->GetBlockHash() : 0) == (pindexOld->pnext ? pindexOld->pnext->GetBlockHash() : 0));
+        BOOST_CHECK_EQUAL(pindexNew->nHeight, pindexOld->nHeight);
+        BOOST_CHECK_EQUAL(pindexNew->nFile, pindexOld->nFile);
+        BOOST_CHECK_EQUAL(pindexNew->nDataPos, pindexOld->nDataPos);
+        BOOST_CHECK_EQUAL(pindexNew->nUndoPos, pindexOld->nUndoPos);
+        BOOST_CHECK_EQUAL(pindexNew->nVersion, pindexOld->nVersion);
+        BOOST_CHECK(pindexNew->hashMerkleRoot == pindexOld->hashMerkleRoot);
+        BOOST_CHECK_EQUAL(pindexNew->nTime, pindexOld->nTime);
+        BOOST_CHECK_EQUAL(pindexNew->nBits, pindexOld->nBits);
+        BOOST_CHECK_EQUAL(pindexNew->nNonce, pindexOld->nNonce);
+        BOOST_CHECK_EQUAL(pindexNew->nStatus, pindexOld->nStatus);
+        BOOST_CHECK_EQUAL(pindexNew->nTx, pindexOld->nTx);
+        BOOST_CHECK_EQUAL(pindexNew->nFlags, pindexOld->nFlags);
+        BOOST_CHECK_EQUAL(pindexNew->nMint, pindexOld->nMint);
+        BOOST_CHECK_EQUAL(pindexNew->nMoneySupply, pindexOld->nMoneySupply);
+        BOOST_CHECK_EQUAL(pindexNew->nStakeModifier, pindexOld->nStakeModifier);
+        BOOST_CHECK(pindexNew->prevoutStake == pindexOld->prevoutStake);
+        BOOST_CHECK_EQUAL(pindexNew->nStakeTime, pindexOld->nStakeTime);
+        BOOST_CHECK(pindexNew->hashProofOfStake == pindexOld->hashProofOfStake);
+    }
+
+    mapBlockIndex.swap(mapSaved);
+    setStakeSeen.swap(setStakeSeenSaved);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
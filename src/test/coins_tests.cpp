@@ -4,6 +4,7 @@
 
 #include "coins.h"
 #include "random.h"
+#include "txdb.h"
 #include "uint256.h"
 
 #include <vector>
@@ -175,4 +176,153 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
     BOOST_CHECK(missed_an_entry);
 }
 
+// Random spends, restores and replacements on a stack of caches on top of the
+// per-output coin database. The database only sees the outputs each flushed
+// entry marks as changed, so compare it against the reference after every
+// full flush.
+BOOST_AUTO_TEST_CASE(coins_db_output_simulation_test)
+{
+    CCoinsViewDB db(1 << 20, true, true);
+    std::map<uint256, CCoins> result;
+    std::vector<CCoinsViewCache*> stack;
+    stack.push_back(new CCoinsViewCache(&db));
+
+    std::vector<uint256> txids;
+    txids.resize(200);
+    for (unsigned int i = 0; i < txids.size(); i++) {
+        txids[i] = GetRandHash();
+    }
+
+    bool spent_an_output = false;
+    bool restored_an_output = false;
+    bool checked_database = false;
+
+    for (unsigned int i = 0; i < 20000; i++) {
+        {
+            uint256 txid = txids[insecure_rand() % txids.size()];
+            CCoins& coins = result[txid];
+            CCoinsModifier entry = stack.back()->ModifyCoins(txid);
+            BOOST_CHECK(coins == *entry);
+            unsigned int nAction = insecure_rand() % 10;
+            if (coins.IsPruned()) {
+                coins.Clear();
+                coins.nVersion = 1;
+                coins.nHeight = 1 + insecure_rand() % 100000;
+                coins.fCoinStake = insecure_rand() % 2;
+                coins.vout.resize(1 + insecure_rand() % 20);
+                for (unsigned int j = 0; j < coins.vout.size(); j++) {
+                    coins.vout[j].nValue = 1 + insecure_rand();
+                    coins.vout[j].scriptPubKey = CScript() << OP_TRUE;
+                }
+                *entry = coins;
+            } else if (nAction < 7) {
+                unsigned int n = insecure_rand() % coins.vout.size();
+                BOOST_CHECK(coins.Spend(n) == entry->Spend(n));
+                spent_an_output = true;
+            } else if (nAction < 9) {
+                unsigned int n = insecure_rand() % (coins.vout.size() + 2);
+                if (!coins.IsAvailable(n)) {
+                    if (coins.vout.size() < n + 1)
+                        coins.vout.resize(n + 1);
+                    coins.vout[n].nValue = 1 + insecure_rand();
+                    coins.vout[n].scriptPubKey = CScript() << OP_TRUE;
+                    if (entry->vout.size() < n + 1)
+                        entry->vout.resize(n + 1);
+                    entry->vout[n] = coins.vout[n];
+                    restored_an_output = true;
+                }
+            } else {
+                coins.Clear();
+                entry->Clear();
+            }
+        }
+
+        if (insecure_rand() % 100 == 0) {
+            if (stack.size() > 1 && insecure_rand() % 2 == 0) {
+                stack.back()->Flush();
+                delete stack.back();
+                stack.pop_back();
+            } else if (stack.size() < 4) {
+                stack.push_back(new CCoinsViewCache(stack.back()));
+            }
+        }
+
+        if (insecure_rand() % 1000 == 0 || i == 19999) {
+            while (stack.size() > 1) {
+                stack.back()->Flush();
+                delete stack.back();
+                stack.pop_back();
+            }
+            stack.back()->Flush();
+            for (std::map<uint256, CCoins>::iterator it = result.begin(); it != result.end(); it++) {
+                CCoins coins;
+                if (db.GetCoins(it->first, coins)) {
+                    BOOST_CHECK(coins == it->second);
+                    BOOST_CHECK(!coins.IsPruned());
+                } else {
+                    BOOST_CHECK(it->second.IsPruned());
+                }
+                BOOST_CHECK(db.HaveCoins(it->first) == !it->second.IsPruned());
+            }
+            checked_database = true;
+        }
+    }
+
+    while (stack.size() > 0) {
+        delete stack.back();
+        stack.pop_back();
+    }
+
+    BOOST_CHECK(spent_an_output);
+    BOOST_CHECK(restored_an_output);
+    BOOST_CHECK(checked_database);
+}
+
+// A background flush keeps serving the flushed entries until they are on disk
+// and moves the best block only once everything is written.
+BOOST_AUTO_TEST_CASE(coins_db_background_flush)
+{
+    CCoinsViewDB db(1 << 20, true, true);
+    std::map<uint256, CCoins> result;
+    uint256 hashBlock = GetRandHash();
+    {
+        CCoinsViewCache cache(&db);
+        for (unsigned int i = 0; i < 30000; i++) {
+            uint256 txid = GetRandHash();
+            CCoins& coins = result[txid];
+            coins.nVersion = 1;
+            coins.nHeight = 1 + i;
+            coins.vout.resize(1 + insecure_rand() % 3);
+            for (unsigned int j = 0; j < coins.vout.size(); j++) {
+                coins.vout[j].nValue = 1 + insecure_rand();
+                coins.vout[j].scriptPubKey = CScript() << OP_TRUE;
+            }
+            *cache.ModifyCoins(txid) = coins;
+        }
+        cache.SetBestBlock(hashBlock);
+        db.WriteNextBatchInBackground();
+        BOOST_CHECK(cache.Flush());
+    }
+
+    // Readers see the flushed state whether or not the thread got to it yet
+    BOOST_CHECK(db.GetBestBlock() == hashBlock);
+    for (std::map<uint256, CCoins>::iterator it = result.begin(); it != result.end(); it++) {
+        CCoins coins;
+        BOOST_CHECK(db.GetCoins(it->first, coins));
+        BOOST_CHECK(coins == it->second);
+    }
+
+    BOOST_CHECK(db.WaitForBackgroundWrite());
+    BOOST_CHECK_EQUAL(db.GetBackgroundBacklog(), 0U);
+    BOOST_CHECK(db.GetBestBlock() == hashBlock);
+    // The marker is gone, so there is nothing to replay
+    BOOST_CHECK(db.ReplayInterruptedFlush());
+    BOOST_CHECK(db.GetBestBlock() == hashBlock);
+    for (std::map<uint256, CCoins>::iterator it = result.begin(); it != result.end(); it++) {
+        CCoins coins;
+        BOOST_CHECK(db.GetCoins(it->first, coins));
+        BOOST_CHECK(coins == it->second);
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -48,4 +48,19 @@ BOOST_AUTO_TEST_CASE(subsidy_limit_test)
     BOOST_CHECK(nSum == 4109975100000000ULL);
 }
 
+BOOST_AUTO_TEST_CASE(chain_tip_snapshot)
+{
+    std::shared_ptr<const CChainTipSnapshot> tip = GetChainTipSnapshot();
+    LOCK(cs_main);
+    BOOST_REQUIRE(chainActive.Tip() != NULL);
+    BOOST_CHECK(tip->pindex == chainActive.Tip());
+    BOOST_CHECK_EQUAL(tip->nHeight, chainActive.Height());
+    BOOST_CHECK(tip->hashBlock == chainActive.Tip()->GetBlockHash());
+    BOOST_CHECK_EQUAL(tip->nMedianTimePast, chainActive.Tip()->GetMedianTimePast());
+
+    CChainTipSnapshot empty;
+    BOOST_CHECK(empty.pindex == NULL);
+    BOOST_CHECK_EQUAL(empty.nHeight, -1);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -51,7 +51,7 @@ BOOST_AUTO_TEST_CASE(MempoolRemoveTest)
 
 
     CTxMemPool testPool(CFeeRate(0));
-    std::list<CTransaction> removed;
+    std::list<CTransactionRef> removed;
 
     // Nothing in pool, remove should do nothing:
     testPool.remove(txParent, removed, true);
@@ -99,4 +99,63 @@ BOOST_AUTO_TEST_CASE(MempoolRemoveTest)
     removed.clear();
 }
 
+BOOST_AUTO_TEST_CASE(MempoolAncestorIndexTest)
+{
+    // Parent A with child C, and an unrelated B
+    CMutableTransaction txA, txB, txC;
+    txA.vin.resize(1);
+    txA.vin[0].scriptSig = CScript() << OP_11;
+    txA.vout.resize(1);
+    txA.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    txA.vout[0].nValue = 33000LL;
+    txB = txA;
+    txB.vin[0].scriptSig = CScript() << OP_12;
+    txC = txA;
+    txC.vin[0].prevout.hash = txA.GetHash();
+    txC.vin[0].prevout.n = 0;
+
+    CTxMemPool testPool(CFeeRate(0));
+    CTxMemPoolEntry entryA(txA, 1000, 0, 0.0, 1);
+    CTxMemPoolEntry entryC(txC, 20000, 0, 0.0, 1);
+    testPool.addUnchecked(txA.GetHash(), entryA);
+    testPool.addUnchecked(txB.GetHash(), CTxMemPoolEntry(txB, 5000, 0, 0.0, 1));
+    testPool.addUnchecked(txC.GetHash(), entryC);
+    BOOST_CHECK_EQUAL(testPool.setAncestorFeeRate.size(), 3);
+
+    const CTxMemPoolEntry& pooledC = testPool.mapTx[txC.GetHash()];
+    BOOST_CHECK_EQUAL(pooledC.GetCountWithAncestors(), 2);
+    BOOST_CHECK_EQUAL(pooledC.GetSizeWithAncestors(), entryA.GetTxSize() + entryC.GetTxSize());
+    BOOST_CHECK_EQUAL(pooledC.GetModFeesWithAncestors(), 21000);
+
+    // The child pays for its parent: C, then B, then A
+    std::set<CAncestorFeeRateKey>::const_iterator it = testPool.setAncestorFeeRate.begin();
+    BOOST_CHECK(it->hash == txC.GetHash());
+    BOOST_CHECK((++it)->hash == txB.GetHash());
+    BOOST_CHECK((++it)->hash == txA.GetHash());
+
+    // A fee delta on the parent counts for the child too
+    testPool.PrioritiseTransaction(txA.GetHash(), txA.GetHash().ToString(), 0.0, 10000);
+    BOOST_CHECK_EQUAL(testPool.mapTx[txA.GetHash()].GetModFeesWithAncestors(), 11000);
+    BOOST_CHECK_EQUAL(pooledC.GetModFeesWithAncestors(), 31000);
+    BOOST_CHECK(testPool.setAncestorFeeRate.rbegin()->hash == txB.GetHash());
+
+    // The parent is mined; C stands on its own
+    std::list<CTransactionRef> removed;
+    testPool.remove(txA, removed, false);
+    BOOST_CHECK_EQUAL(pooledC.GetCountWithAncestors(), 1);
+    BOOST_CHECK_EQUAL(pooledC.GetSizeWithAncestors(), entryC.GetTxSize());
+    BOOST_CHECK_EQUAL(pooledC.GetModFeesWithAncestors(), 20000);
+
+    // ... and put back by a reorg, with its delta
+    testPool.addUnchecked(txA.GetHash(), entryA);
+    BOOST_CHECK_EQUAL(pooledC.GetCountWithAncestors(), 2);
+    BOOST_CHECK_EQUAL(pooledC.GetModFeesWithAncestors(), 31000);
+    BOOST_CHECK_EQUAL(testPool.setAncestorFeeRate.size(), 3);
+
+    testPool.remove(txA, removed, true);
+    BOOST_CHECK_EQUAL(testPool.setAncestorFeeRate.size(), 1);
+    testPool.clear();
+    BOOST_CHECK(testPool.setAncestorFeeRate.empty());
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -8,6 +8,7 @@
 #include "pubkey.h"
 #include "uint256.h"
 #include "util.h"
+#include "perfstats_util.h"
 
 #include <boost/test/unit_test.hpp>
 
@@ -71,14 +72,14 @@ BOOST_AUTO_TEST_CASE(CreateNewBlock_validity)
         CBlock *pblock = &pblocktemplate->block; // pointer for convenience
         pblock->nVersion = 1;
         pblock->nTime = chainActive.Tip()->GetMedianTimePast()+1;
-        CMutableTransaction txCoinbase(pblock->vtx[0]);
+        CMutableTransaction txCoinbase(*pblock->vtx[0]);
         txCoinbase.vin[0].scriptSig = CScript();
         txCoinbase.vin[0].scriptSig.push_back(blockinfo[i].extranonce);
         txCoinbase.vin[0].scriptSig.push_back(chainActive.Height());
         txCoinbase.vout[0].scriptPubKey = CScript();
-        pblock->vtx[0] = CTransaction(txCoinbase);
+        pblock->vtx[0] = MakeTransactionRef(txCoinbase);
         if (txFirst.size() < 2)
-            txFirst.push_back(new CTransaction(pblock->vtx[0]));
+            txFirst.push_back(new CTransaction(*pblock->vtx[0]));
         pblock->hashMerkleRoot = pblock->BuildMerkleTree();
         pblock->nNonce = blockinfo[i].nonce;
         CValidationState state;
@@ -254,6 +255,13 @@ BOOST_AUTO_TEST_CASE(CreateNewBlock_validity)
     BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 3);
     delete pblocktemplate;
 
+    // Nothing changed, so the next template reuses the same pick
+    uint64_t nReusedBefore = GetPerfCounter("miner.selection_reused");
+    BOOST_CHECK(pblocktemplate = CreateNewBlock(scriptPubKey, pwalletMain, false));
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 3);
+    BOOST_CHECK_EQUAL(GetPerfCounter("miner.selection_reused"), nReusedBefore + 1);
+    delete pblocktemplate;
+
     chainActive.Tip()->nHeight--;
     SetMockTime(0);
     mempool.clear();
@@ -0,0 +1,73 @@
+// Copyright (c) 2017 The Sling core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "perfstats.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_AUTO_TEST_SUITE(perfstats_tests)
+
+BOOST_AUTO_TEST_CASE(perfstats_buckets)
+{
+    // Small values get a bucket each
+    for (uint64_t n = 0; n < (uint64_t)CPerfHistogram::SUB_BUCKETS; n++)
+        BOOST_CHECK_EQUAL(CPerfHistogram::BucketIndex(n), (int)n);
+
+    // Every bucket starts where the previous one ended
+    for (int i = 1; i < CPerfHistogram::NUM_BUCKETS; i++) {
+        uint64_t nLower = CPerfHistogram::BucketLowerBound(i);
+        BOOST_CHECK_EQUAL(CPerfHistogram::BucketIndex(nLower), i);
+        BOOST_CHECK_EQUAL(CPerfHistogram::BucketIndex(nLower - 1), i - 1);
+    }
+
+    // Huge values share the last bucket
+    BOOST_CHECK_EQUAL(CPerfHistogram::BucketIndex((uint64_t)1 << 50), CPerfHistogram::NUM_BUCKETS - 1);
+}
+
+BOOST_AUTO_TEST_CASE(perfstats_histogram)
+{
+    CPerfHistogram hist("test.histogram", "");
+    CPerfHistogramSnapshot snapshot;
+    hist.GetSnapshot(snapshot);
+    BOOST_CHECK_EQUAL(snapshot.nCount, 0U);
+    BOOST_CHECK_EQUAL(snapshot.Percentile(0.5), 0U);
+
+    for (int i = 1; i <= 1000; i++)
+        hist.Add(i * 100);
+    hist.Add(-5); // clock went backwards, recorded as 0
+    hist.GetSnapshot(snapshot);
+
+    BOOST_CHECK_EQUAL(snapshot.nCount, 1001U);
+    BOOST_CHECK_EQUAL(snapshot.nSum, 50050000U);
+    BOOST_CHECK_EQUAL(snapshot.nMin, 0U);
+    BOOST_CHECK_EQUAL(snapshot.nMax, 100000U);
+
+    // Percentiles are within one sub-bucket of the exact value
+    uint64_t nMedian = snapshot.Percentile(0.5);
+    BOOST_CHECK(nMedian >= 50000 && nMedian <= 50000 + 50000 / 8 * 2);
+    uint64_t nP99 = snapshot.Percentile(0.99);
+    BOOST_CHECK(nP99 >= 99000 && nP99 <= 100000);
+    BOOST_CHECK_EQUAL(snapshot.Percentile(1.0), 100000U);
+}
+
+BOOST_AUTO_TEST_CASE(perfstats_registry)
+{
+    size_t nHistograms = CPerfHistogram::GetAll().size();
+    size_t nCounters = CPerfCounter::GetAll().size();
+    {
+        CPerfHistogram hist("test.registered", "");
+        CPerfCounter counter("test.counter", "");
+        BOOST_CHECK_EQUAL(CPerfHistogram::GetAll().size(), nHistograms + 1);
+        BOOST_CHECK_EQUAL(CPerfHistogram::GetAll().back(), &hist);
+        BOOST_CHECK_EQUAL(CPerfCounter::GetAll().size(), nCounters + 1);
+
+        counter.Inc();
+        counter.Inc(2);
+        BOOST_CHECK_EQUAL(counter.Get(), 3U);
+    }
+    BOOST_CHECK_EQUAL(CPerfHistogram::GetAll().size(), nHistograms);
+    BOOST_CHECK_EQUAL(CPerfCounter::GetAll().size(), nCounters);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
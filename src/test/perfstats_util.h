@@ -0,0 +1,24 @@
+// Copyright (c) 2017 The Sling core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_TEST_PERFSTATS_UTIL_H
+#define BITCOIN_TEST_PERFSTATS_UTIL_H
+
+#include "perfstats.h"
+
+#include <string>
+
+#include <boost/foreach.hpp>
+
+/** Current value of the performance counter named strName, 0 if there is none */
+static inline uint64_t GetPerfCounter(const std::string& strName)
+{
+    BOOST_FOREACH (const CPerfCounter* pcounter, CPerfCounter::GetAll()) {
+        if (strName == pcounter->GetName())
+            return pcounter->Get();
+    }
+    return 0;
+}
+
+#endif // BITCOIN_TEST_PERFSTATS_UTIL_H
@@ -6,7 +6,9 @@
 #include "rpcclient.h"
 
 #include "base58.h"
+#include "chainparams.h"
 #include "netbase.h"
+#include "perfstats_util.h"
 
 #include <boost/algorithm/string.hpp>
 #include <boost/test/unit_test.hpp>
@@ -108,6 +110,23 @@ BOOST_AUTO_TEST_CASE(rpc_rawsign)
     BOOST_CHECK(find_value(r.get_obj(), "complete").get_bool() == true);
 }
 
+BOOST_AUTO_TEST_CASE(rpc_convertvalues)
+{
+    vector<string> vArgs;
+    vArgs.push_back("SNqQy2GpVfSpYzhq5Y5Lbd3ZLSdHGEmRzW");
+    Array params = RPCConvertValues("getaddressbalance", vArgs);
+    BOOST_CHECK_EQUAL(params[0].get_str(), "SNqQy2GpVfSpYzhq5Y5Lbd3ZLSdHGEmRzW");
+
+    vArgs[0] = "{\"addresses\": [\"SNqQy2GpVfSpYzhq5Y5Lbd3ZLSdHGEmRzW\"]}";
+    params = RPCConvertValues("getaddressbalance", vArgs);
+    BOOST_CHECK(params[0].type() == obj_type);
+
+    // Parameters without the fallback still have to be JSON
+    vArgs[0] = "not_json";
+    BOOST_CHECK_THROW(RPCConvertValues("getspentinfo", vArgs), runtime_error);
+    BOOST_CHECK_THROW(RPCConvertValues("stop", vArgs), runtime_error);
+}
+
 BOOST_AUTO_TEST_CASE(rpc_format_monetary_values)
 {
     BOOST_CHECK_EQUAL(write_string(ValueFromAmount(0LL), false), "0.00000000");
@@ -172,4 +191,165 @@ BOOST_AUTO_TEST_CASE(rpc_boostasiotocnetaddr)
     BOOST_CHECK_EQUAL(BoostAsioToCNetAddr(boost::asio::ip::address::from_string("::ffff:127.0.0.1")).ToString(), "127.0.0.1");
 }
 
+BOOST_AUTO_TEST_CASE(rpc_methodstats)
+{
+    // Only requests that change nothing may run alongside the rest of their batch
+    BOOST_CHECK(tableRPC["getblockcount"]->readOnly);
+    BOOST_CHECK(tableRPC["decoderawtransaction"]->readOnly);
+    BOOST_CHECK(!tableRPC["stop"]->readOnly);
+    BOOST_CHECK(!tableRPC["sendrawtransaction"]->readOnly);
+
+    // CallRPC skips the table's dispatch, which does the timing
+    BOOST_CHECK_NO_THROW(tableRPC.execute("getblockcount", Array()));
+    BOOST_CHECK_NO_THROW(tableRPC.execute("getblockcount", Array()));
+    Value r;
+    BOOST_CHECK_NO_THROW(r = CallRPC("getrpcstats"));
+    const Value& stats = find_value(find_value(r.get_obj(), "methods").get_obj(), "getblockcount");
+    BOOST_REQUIRE(stats.type() == obj_type);
+    BOOST_CHECK(find_value(stats.get_obj(), "count").get_int64() >= 2);
+    BOOST_CHECK_THROW(CallRPC("getrpcstats -1"), runtime_error);
+}
+
+BOOST_AUTO_TEST_CASE(rpc_jsonstream)
+{
+    // Streamed JSON must read exactly as the same value written at once
+    Object obj;
+    obj.push_back(Pair("a \"quoted\" key", 1));
+    Array arr;
+    arr.push_back(Object());
+    arr.push_back(Array());
+    arr.push_back(Value::null);
+    arr.push_back(2.5);
+    obj.push_back(Pair("arr", arr));
+
+    std::ostringstream os;
+    CJSONStreamWriter writer(os);
+    writer.BeginObject();
+    writer.WritePair("a \"quoted\" key", 1);
+    writer.Key("arr");
+    writer.BeginArray();
+    writer.BeginObject();
+    writer.EndObject();
+    writer.BeginArray();
+    writer.EndArray();
+    writer.Write(Value::null);
+    writer.Write(2.5);
+    writer.EndArray();
+    writer.EndObject();
+    BOOST_CHECK_EQUAL(os.str(), write_string(Value(obj), false));
+
+    // A streamed block matches the built one
+    Array params;
+    params.push_back(Params().HashGenesisBlock().GetHex());
+    std::ostringstream osBlock;
+    CJSONStreamWriter writerBlock(osBlock);
+    BOOST_CHECK(tableRPC.executeStream("getblock", params, writerBlock));
+    BOOST_CHECK_EQUAL(osBlock.str(), write_string(tableRPC.execute("getblock", params), false));
+
+    // The hex form is left to the actor
+    params.push_back(false);
+    std::ostringstream osHex;
+    CJSONStreamWriter writerHex(osHex);
+    BOOST_CHECK(!tableRPC.executeStream("getblock", params, writerHex));
+    BOOST_CHECK(osHex.str().empty());
+}
+
+BOOST_AUTO_TEST_CASE(rpc_httpstreamreply)
+{
+    // A reply that fits in one chunk gets a Content-Length
+    std::ostringstream osShort;
+    {
+        CHTTPStreamReply reply(osShort, true, true);
+        std::ostream os(&reply);
+        os << "{}";
+        BOOST_CHECK(!reply.Started());
+        reply.Finish();
+    }
+    BOOST_CHECK(osShort.str().find("Content-Length: 2\r\n") != string::npos);
+
+    // Longer ones are chunked and read back whole
+    std::string strBody(CHTTPStreamReply::CHUNK_SIZE * 2 + 10, 'x');
+    std::stringstream ss;
+    {
+        CHTTPStreamReply reply(ss, true, true);
+        std::ostream os(&reply);
+        os << strBody;
+        BOOST_CHECK(reply.Started());
+        reply.Finish();
+    }
+    int nProto = 0;
+    BOOST_CHECK_EQUAL(ReadHTTPStatus(ss, nProto), HTTP_OK);
+    map<string, string> mapHeaders;
+    std::string strMessage;
+    ReadHTTPMessage(ss, mapHeaders, strMessage, nProto, MAX_SIZE);
+    BOOST_CHECK_EQUAL(mapHeaders["transfer-encoding"], "chunked");
+    BOOST_CHECK(strMessage == strBody);
+}
+
+BOOST_AUTO_TEST_CASE(rpc_workqueue)
+{
+    // Stands in for a connection whose next request has arrived
+    class CTestConnection : public AcceptedConnection
+    {
+    public:
+        std::stringstream ss;
+        std::iostream& stream() { return ss; }
+        std::string peer_address_to_string() const { return "127.0.0.1"; }
+        void close() {}
+        void shutdown() {}
+        bool HasBufferedInput() { return false; }
+        void AsyncWaitForInput(const boost::function<void(bool)>& handler, int nTimeout) {}
+        bool IsSSL() const { return false; }
+    };
+
+    uint64_t nRejected = GetPerfCounter("rpc.rejected_connections");
+    for (int i = 0; i < DEFAULT_RPC_WORK_QUEUE; i++)
+        BOOST_CHECK(QueueRPCConnection(boost::shared_ptr<AcceptedConnection>(new CTestConnection())));
+
+    // With no thread to take them, the next one is turned away
+    boost::shared_ptr<CTestConnection> conn(new CTestConnection());
+    BOOST_CHECK(!QueueRPCConnection(conn));
+    BOOST_CHECK(conn->ss.str().find(" 503 ") != string::npos);
+    BOOST_CHECK_EQUAL(GetPerfCounter("rpc.rejected_connections"), nRejected + 1);
+
+    // Stopping drops the waiting connections
+    StartDummyRPCThread();
+    StopRPCThreads();
+    BOOST_CHECK_EQUAL(GetPerfCounter("rpc.queue_depth"), 0);
+}
+
+BOOST_AUTO_TEST_CASE(rpc_batch)
+{
+    // Read-only requests run in parallel, the rest in order; replies keep request order
+    const char* methods[] = {"getblockcount", "getbestblockhash", "getdifficulty", "setmocktime", "getblockcount", "getbestblockhash"};
+    Array vReq;
+    for (int i = 0; i < 6; i++) {
+        Object req;
+        req.push_back(Pair("method", methods[i]));
+        Array params;
+        if (string(methods[i]) == "setmocktime")
+            params.push_back(0);
+        req.push_back(Pair("params", params));
+        req.push_back(Pair("id", i));
+        vReq.push_back(req);
+    }
+
+    StartDummyRPCThread();
+    uint64_t nParallel = GetPerfCounter("rpc.parallel_requests");
+    std::string strReply = JSONRPCExecBatch(vReq);
+    uint64_t nParallelAfter = GetPerfCounter("rpc.parallel_requests");
+    StopRPCThreads();
+
+    Value valReply;
+    BOOST_REQUIRE(read_string(strReply, valReply));
+    BOOST_REQUIRE(valReply.type() == array_type);
+    const Array& vReply = valReply.get_array();
+    BOOST_REQUIRE_EQUAL(vReply.size(), 6U);
+    for (int i = 0; i < 6; i++) {
+        BOOST_CHECK_EQUAL(find_value(vReply[i].get_obj(), "id").get_int(), i);
+        BOOST_CHECK(find_value(vReply[i].get_obj(), "error").type() == null_type);
+    }
+    BOOST_CHECK(nParallelAfter > nParallel);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
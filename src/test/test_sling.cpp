@@ -25,7 +25,6 @@ extern bool fPrintToConsole;
 extern void noui_connect();
 
 struct TestingSetup {
-    CCoinsViewDB *pcoinsdbview;
     boost::filesystem::path pathTemp;
     boost::thread_group threadGroup;
 
@@ -67,6 +66,7 @@ struct TestingSetup {
 #endif
         delete pcoinsTip;
         delete pcoinsdbview;
+        pcoinsdbview = NULL;
         delete pblocktree;
 #ifdef ENABLE_WALLET
         bitdb.Flush(true);
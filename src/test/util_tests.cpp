@@ -10,11 +10,14 @@
 #include "sync.h"
 #include "utilstrencodings.h"
 #include "utilmoneystr.h"
+#include "perfstats_util.h"
 
 #include <stdint.h>
 #include <vector>
 
+#include <boost/foreach.hpp>
 #include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
 
 using namespace std;
 
@@ -424,4 +427,111 @@ BOOST_AUTO_TEST_CASE(test_FormatSubVersion)
     BOOST_CHECK_EQUAL(FormatSubVersion("Test", 99900, comments),std::string("/Test:0.9.99(comment1)/"));
     BOOST_CHECK_EQUAL(FormatSubVersion("Test", 99900, comments2),std::string("/Test:0.9.99(comment1; comment2)/"));
 }
+
+BOOST_AUTO_TEST_CASE(util_LogCategories)
+{
+    bool fDebugOld = fDebug;
+    BOOST_CHECK(LogAcceptCategory(NULL));
+
+    // fDebug follows -debug only
+    fDebug = false;
+    BOOST_CHECK(SetLogCategory("net", true));
+    BOOST_CHECK(!fDebug);
+    BOOST_CHECK(LogAcceptCategory("net"));
+    BOOST_CHECK(!LogAcceptCategory("mempool"));
+    BOOST_CHECK(!LogAcceptCategory("nosuchcategory"));
+
+    // Composite and catch-all names
+    BOOST_CHECK(SetLogCategory("sling", true));
+    BOOST_CHECK(LogAcceptCategory("coinmix"));
+    BOOST_CHECK(LogAcceptCategory("mnbudget"));
+    BOOST_CHECK(SetLogCategory("all", true));
+    BOOST_CHECK(LogAcceptCategory("mempool"));
+    BOOST_CHECK(LogAcceptCategory("nosuchcategory"));
+    BOOST_CHECK(SetLogCategory("all", false));
+    BOOST_CHECK(!LogAcceptCategory("net"));
+
+    BOOST_CHECK(!SetLogCategory("nosuchcategory", true));
+    std::vector<std::pair<std::string, bool> > vCategories = GetLogCategories();
+    BOOST_CHECK(!vCategories.empty());
+    for (unsigned int i = 0; i < vCategories.size(); i++) {
+        BOOST_CHECK(!vCategories[i].second);
+        if (i > 0)
+            BOOST_CHECK(vCategories[i - 1].first < vCategories[i].first);
+    }
+    fDebug = fDebugOld;
+    InitLogCategories();
+}
+
+BOOST_AUTO_TEST_CASE(util_LogWriter)
+{
+    uint64_t nWrittenOld = GetPerfCounter("log.written_lines");
+    StartLogWriter();
+    for (int i = 0; i < 100; i++)
+        LogPrintf("util_LogWriter line %d\n", i);
+    // Stopping writes out everything that is queued
+    StopLogWriter();
+    BOOST_CHECK_EQUAL(GetPerfCounter("log.written_lines") - nWrittenOld, 100U);
+
+    // Without the thread lines are written by the caller
+    LogPrintf("util_LogWriter after stop\n");
+    BOOST_CHECK_EQUAL(GetPerfCounter("log.written_lines") - nWrittenOld, 100U);
+}
+
+static CCriticalSection csLockStatsTest;
+
+static void LockStatsTestThread()
+{
+    {
+        TRY_LOCK(csLockStatsTest, lockTry);
+        BOOST_CHECK(!lockTry);
+    }
+    LOCK(csLockStatsTest);
+}
+
+static bool FindLockStats(CLockSiteStats& stats, bool fTry)
+{
+    BOOST_FOREACH (const CLockSiteStats& site, GetLockStats()) {
+        if (site.strName == "csLockStatsTest" && (site.nTryFailed > 0) == fTry) {
+            stats = site;
+            return true;
+        }
+    }
+    return false;
+}
+
+BOOST_AUTO_TEST_CASE(util_LockStats)
+{
+    fLockStats = true;
+    boost::thread t;
+    {
+        LOCK(csLockStatsTest);
+        t = boost::thread(LockStatsTestThread);
+        MilliSleep(20);
+    }
+    t.join();
+    fLockStats = false;
+
+    CLockSiteStats stats;
+    BOOST_REQUIRE(FindLockStats(stats, true));
+    BOOST_CHECK_EQUAL(stats.nTryFailed, 1U);
+    BOOST_CHECK_EQUAL(stats.nAcquired, 0U);
+
+    // Both LOCKs were taken once; one of them waited for the other
+    uint64_t nAcquired = 0, nContended = 0, nHoldMicros = 0;
+    BOOST_FOREACH (const CLockSiteStats& site, GetLockStats()) {
+        if (site.strName == "csLockStatsTest") {
+            nAcquired += site.nAcquired;
+            nContended += site.nContended;
+            nHoldMicros += site.nHoldMicros;
+        }
+    }
+    BOOST_CHECK_EQUAL(nAcquired, 2U);
+    BOOST_CHECK_EQUAL(nContended, 1U);
+    BOOST_CHECK(nHoldMicros >= 10000);
+
+    ResetLockStats();
+    BOOST_CHECK(!FindLockStats(stats, true));
+    BOOST_CHECK(!FindLockStats(stats, false));
+}
 BOOST_AUTO_TEST_SUITE_END()
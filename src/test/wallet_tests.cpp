@@ -4,6 +4,8 @@
 
 #include "wallet.h"
 
+#include "init.h"
+
 #include <set>
 #include <stdint.h>
 #include <utility>
@@ -305,4 +307,157 @@ BOOST_AUTO_TEST_CASE(coin_selection_tests)
     empty_wallet();
 }
 
+class CWalletDBTxReader : public CWalletDB
+{
+public:
+    CWalletDBTxReader(const std::string& strFilename) : CWalletDB(strFilename, "r") {}
+    bool HaveTx(const uint256& hash) { return Exists(std::make_pair(std::string("tx"), hash)); }
+};
+
+BOOST_AUTO_TEST_CASE(wallet_journal)
+{
+    int64_t nDelayOld = nWalletWriteDelay;
+    nWalletWriteDelay = 60 * 60 * 1000;
+    LOCK(pwalletMain->cs_wallet);
+    BOOST_CHECK(pwalletMain->FlushWalletJournal());
+
+    vector<uint256> vHash;
+    for (int i = 0; i < 3; i++) {
+        CMutableTransaction tx;
+        tx.nLockTime = 7000000 + i;
+        tx.vout.resize(1);
+        tx.vout[0].nValue = (i + 1) * CENT;
+        CWalletTx wtx(pwalletMain, tx);
+        BOOST_CHECK(pwalletMain->AddToWallet(wtx));
+        vHash.push_back(wtx.GetHash());
+    }
+    // Updating a queued transaction doesn't queue a second write
+    CWalletTx wtxUpdate(pwalletMain, pwalletMain->mapWallet[vHash[0]]);
+    wtxUpdate.fFromMe = true;
+    BOOST_CHECK(pwalletMain->AddToWallet(wtxUpdate));
+    BOOST_CHECK_EQUAL(pwalletMain->GetJournalSize(), 3U);
+    BOOST_CHECK(!CWalletDBTxReader(pwalletMain->strWalletFile).HaveTx(vHash[0]));
+
+    // Erased transactions are dropped from the journal
+    pwalletMain->EraseFromWallet(vHash[2]);
+    BOOST_CHECK_EQUAL(pwalletMain->GetJournalSize(), 2U);
+
+    BOOST_CHECK(pwalletMain->FlushWalletJournal());
+    BOOST_CHECK_EQUAL(pwalletMain->GetJournalSize(), 0U);
+    {
+        CWalletDBTxReader walletdb(pwalletMain->strWalletFile);
+        BOOST_CHECK(walletdb.HaveTx(vHash[0]));
+        BOOST_CHECK(walletdb.HaveTx(vHash[1]));
+        BOOST_CHECK(!walletdb.HaveTx(vHash[2]));
+    }
+
+    // Without a delay every change is written at once
+    nWalletWriteDelay = 0;
+    CWalletTx wtxUpdate2(pwalletMain, pwalletMain->mapWallet[vHash[1]]);
+    wtxUpdate2.fFromMe = true;
+    BOOST_CHECK(pwalletMain->AddToWallet(wtxUpdate2));
+    BOOST_CHECK_EQUAL(pwalletMain->GetJournalSize(), 0U);
+
+    pwalletMain->EraseFromWallet(vHash[0]);
+    pwalletMain->EraseFromWallet(vHash[1]);
+    nWalletWriteDelay = nDelayOld;
+}
+
+BOOST_AUTO_TEST_CASE(wallet_coinmix_rounds)
+{
+    const CAmount nDenom = COIN + 1000;
+    bool fAddedDenom = find(CoinMixDenominations.begin(), CoinMixDenominations.end(), nDenom) == CoinMixDenominations.end();
+    if (fAddedDenom)
+        CoinMixDenominations.push_back(nDenom);
+
+    LOCK(pwalletMain->cs_wallet);
+    CKey key;
+    key.MakeNewKey(true);
+    BOOST_CHECK(pwalletMain->AddKeyPubKey(key, key.GetPubKey()));
+    CScript scriptMine = GetScriptForDestination(key.GetPubKey().GetID());
+
+    // Three mixing transactions, each spending the one before it
+    vector<CMutableTransaction> vTx(3);
+    uint256 hashPrev = GetRandHash();
+    for (int i = 0; i < 3; i++) {
+        vTx[i].vin.resize(1);
+        vTx[i].vin[0].prevout = COutPoint(hashPrev, 0);
+        vTx[i].vout.resize(2);
+        vTx[i].vout[0].nValue = nDenom;
+        vTx[i].vout[0].scriptPubKey = scriptMine;
+        vTx[i].vout[1] = vTx[i].vout[0];
+        hashPrev = vTx[i].GetHash();
+    }
+
+    // The last one arrives before the one it spends
+    BOOST_CHECK(pwalletMain->AddToWallet(CWalletTx(pwalletMain, vTx[0])));
+    BOOST_CHECK(pwalletMain->AddToWallet(CWalletTx(pwalletMain, vTx[2])));
+    BOOST_CHECK_EQUAL(pwalletMain->GetRealInputCoinMixRounds(CTxIn(vTx[0].GetHash(), 0), 0), 0);
+    BOOST_CHECK_EQUAL(pwalletMain->GetRealInputCoinMixRounds(CTxIn(vTx[2].GetHash(), 1), 0), 0);
+
+    BOOST_CHECK(pwalletMain->AddToWallet(CWalletTx(pwalletMain, vTx[1])));
+    BOOST_CHECK_EQUAL(pwalletMain->GetRealInputCoinMixRounds(CTxIn(vTx[1].GetHash(), 0), 0), 1);
+    BOOST_CHECK_EQUAL(pwalletMain->GetRealInputCoinMixRounds(CTxIn(vTx[2].GetHash(), 0), 0), 2);
+    BOOST_CHECK_EQUAL(pwalletMain->GetRealInputCoinMixRounds(CTxIn(vTx[2].GetHash(), 1), 0), 2);
+
+    // Outputs the wallet doesn't have
+    BOOST_CHECK_EQUAL(pwalletMain->GetRealInputCoinMixRounds(CTxIn(vTx[2].GetHash(), 2), 0), -4);
+    BOOST_CHECK_EQUAL(pwalletMain->GetRealInputCoinMixRounds(CTxIn(GetRandHash(), 0), 0), -1);
+
+    // Erasing the first one starts the chain over at the second
+    pwalletMain->EraseFromWallet(vTx[0].GetHash());
+    BOOST_CHECK_EQUAL(pwalletMain->GetRealInputCoinMixRounds(CTxIn(vTx[1].GetHash(), 0), 0), 0);
+    BOOST_CHECK_EQUAL(pwalletMain->GetRealInputCoinMixRounds(CTxIn(vTx[2].GetHash(), 1), 0), 1);
+
+    for (int i = 0; i < 3; i++)
+        pwalletMain->EraseFromWallet(vTx[i].GetHash());
+    if (fAddedDenom)
+        CoinMixDenominations.pop_back();
+}
+
+BOOST_AUTO_TEST_CASE(wallet_parallel_load)
+{
+    // Enough transactions and keys to decode them on several threads
+    const int nTx = 1500;
+    vector<uint256> vHash;
+    vector<CPubKey> vPubKey;
+    {
+        CWalletDB walletdb("wallet_load_test.dat", "cr+");
+        uint256 hashPrev = GetRandHash();
+        for (int i = 0; i < nTx; i++) {
+            CMutableTransaction tx;
+            tx.vin.resize(1);
+            tx.vin[0].prevout = COutPoint(hashPrev, 0);
+            tx.vout.resize(1);
+            tx.vout[0].nValue = COIN;
+            CWalletTx wtx(NULL, tx);
+            wtx.nOrderPos = i;
+            hashPrev = wtx.GetHash();
+            BOOST_CHECK(walletdb.WriteTx(hashPrev, wtx));
+            vHash.push_back(hashPrev);
+        }
+        for (int i = 0; i < 100; i++) {
+            CKey key;
+            key.MakeNewKey(true);
+            vPubKey.push_back(key.GetPubKey());
+            BOOST_CHECK(walletdb.WriteKey(vPubKey.back(), key.GetPrivKey(), CKeyMetadata(GetTime())));
+        }
+        BOOST_CHECK(walletdb.WriteOrderPosNext(nTx));
+    }
+
+    CWallet wallet("wallet_load_test.dat");
+    bool fFirstRun;
+    BOOST_CHECK_EQUAL(wallet.LoadWallet(fFirstRun), DB_LOAD_OK);
+    LOCK(wallet.cs_wallet);
+    BOOST_CHECK_EQUAL(wallet.mapWallet.size(), (size_t)nTx);
+    BOOST_CHECK_EQUAL(wallet.wtxOrdered.size(), (size_t)nTx);
+    BOOST_CHECK_EQUAL(wallet.nOrderPosNext, nTx);
+    BOOST_FOREACH (const CPubKey& pubkey, vPubKey)
+        BOOST_CHECK(wallet.HaveKey(pubkey.GetID()));
+
+    // Every transaction spends the one before it
+    for (int i = 0; i < nTx; i++)
+        BOOST_CHECK_EQUAL(wallet.IsSpent(vHash[i], 0), i + 1 < nTx);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -6,58 +6,338 @@
 #include "txdb.h"
 
 #include "main.h"
+#include "perfstats.h"
 #include "pow.h"
+#include "ui_interface.h"
 #include "uint256.h"
 
+#include <algorithm>
 #include <stdint.h>
 
+#include <boost/bind.hpp>
+#include <boost/scoped_ptr.hpp>
 #include <boost/thread.hpp>
 
 using namespace std;
 
-void static BatchWriteCoins(CLevelDBBatch& batch, const uint256& hash, const CCoins& coins)
+namespace
+{
+/**
+ * Key of one unspent output in the coin database: 'C', the txid and the
+ * output index.
+ */
+class CCoinsOutputKey
+{
+public:
+    char chType;
+    uint256 txid;
+    uint32_t n;
+
+    CCoinsOutputKey() : chType('C'), n(0) {}
+    CCoinsOutputKey(const uint256& txidIn, uint32_t nIn) : chType('C'), txid(txidIn), n(nIn) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion)
+    {
+        READWRITE(chType);
+        READWRITE(txid);
+        READWRITE(VARINT(n));
+    }
+};
+
+/**
+ * Record of a transaction with unspent outputs, stored under ('T', txid):
+ * its metadata and which of its outputs are unspent. The outputs are
+ * records of their own (the compressed CTxOut under a CCoinsOutputKey), so
+ * every lookup is a point read and a spend rewrites only this small record.
+ *
+ * Serialized format:
+ * - VARINT(nVersion)
+ * - VARINT(nCode), with nCode = nHeight * 4 + fCoinStake * 2 + fCoinBase
+ * - the availability bitvector, bit i set when output i is unspent
+ */
+class CCoinsTxRecord
+{
+public:
+    int nVersion;
+    unsigned int nCode;
+    std::vector<unsigned char> vAvail;
+
+    CCoinsTxRecord() : nVersion(0), nCode(0) {}
+    CCoinsTxRecord(const CCoins& coins) : nVersion(coins.nVersion), nCode(coins.nHeight * 4 + (coins.fCoinStake ? 2 : 0) + (coins.fCoinBase ? 1 : 0))
+    {
+        for (unsigned int i = 0; i < coins.vout.size(); i++) {
+            if (coins.IsAvailable(i)) {
+                if (vAvail.size() <= i / 8)
+                    vAvail.resize(i / 8 + 1, 0);
+                vAvail[i / 8] |= 1 << (i % 8);
+            }
+        }
+    }
+
+    bool IsAvailable(unsigned int nPos) const
+    {
+        return nPos / 8 < vAvail.size() && (vAvail[nPos / 8] & (1 << (nPos % 8))) != 0;
+    }
+
+    unsigned int GetOutputCount() const
+    {
+        return vAvail.size() * 8;
+    }
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion)
+    {
+        READWRITE(VARINT(this->nVersion));
+        READWRITE(VARINT(nCode));
+        READWRITE(vAvail);
+    }
+};
+
+void WriteCoinsOutput(CLevelDBBatch& batch, const uint256& txid, const CCoins& coins, unsigned int nPos)
+{
+    batch.Write(CCoinsOutputKey(txid, nPos), CTxOutCompressor(REF(coins.vout[nPos])));
+}
+
+void WriteCoinsRecord(CLevelDBBatch& batch, const uint256& txid, const CCoins& coins)
 {
     if (coins.IsPruned())
-        batch.Erase(make_pair('c', hash));
+        batch.Erase(make_pair('T', txid));
     else
-        batch.Write(make_pair('c', hash), coins);
+        batch.Write(make_pair('T', txid), CCoinsTxRecord(coins));
+}
+
+//! Outputs up to which a transaction is read with a point read per output
+static const unsigned int COINS_POINT_READS_MAX = 4;
+
+//! Fill coins from a transaction record and the output records it lists
+void ReadCoins(const CLevelDBWrapper& db, const uint256& txid, const CCoinsTxRecord& record, CCoins& coins)
+{
+    coins.Clear();
+    coins.nVersion = record.nVersion;
+    coins.nHeight = record.nCode / 4;
+    coins.fCoinStake = (record.nCode & 2) != 0;
+    coins.fCoinBase = (record.nCode & 1) != 0;
+    unsigned int nAvailable = 0;
+    for (unsigned int i = 0; i < record.GetOutputCount(); i++) {
+        if (record.IsAvailable(i)) {
+            coins.vout.resize(i + 1);
+            nAvailable++;
+        }
+    }
+
+    if (nAvailable <= COINS_POINT_READS_MAX) {
+        for (unsigned int i = 0; i < coins.vout.size(); i++) {
+            if (!record.IsAvailable(i))
+                continue;
+            CTxOutCompressor txout(coins.vout[i]);
+            if (!db.Read(CCoinsOutputKey(txid, i), txout))
+                throw leveldb_error("Database corrupted");
+        }
+        return;
+    }
+
+    // Opening an iterator costs as much as a few reads, then every further
+    // output is cheap. The scan stops at the last listed output, so it never
+    // walks into the records after the transaction.
+    boost::scoped_ptr<leveldb::Iterator> pcursor(const_cast<CLevelDBWrapper&>(db).NewIterator());
+    CDataStream ssPrefix(SER_DISK, CLIENT_VERSION);
+    ssPrefix << 'C' << txid;
+    pcursor->Seek(leveldb::Slice(&ssPrefix[0], ssPrefix.size()));
+    for (unsigned int nRead = 0; nRead < nAvailable; nRead++, pcursor->Next()) {
+        if (!pcursor->Valid())
+            throw leveldb_error("Database corrupted");
+        try {
+            leveldb::Slice slKey = pcursor->key();
+            CDataStream ssKey(slKey.data(), slKey.data() + slKey.size(), SER_DISK, CLIENT_VERSION);
+            CCoinsOutputKey key;
+            ssKey >> key;
+            if (key.chType != 'C' || key.txid != txid || !record.IsAvailable(key.n))
+                throw leveldb_error("Database corrupted");
+            leveldb::Slice slValue = pcursor->value();
+            CDataStream ssValue(slValue.data(), slValue.data() + slValue.size(), SER_DISK, CLIENT_VERSION);
+            CTxOutCompressor txout(coins.vout[key.n]);
+            ssValue >> txout;
+        } catch (const std::ios_base::failure&) {
+            throw leveldb_error("Database corrupted");
+        }
+    }
 }
+} // anonymous namespace
 
 void static BatchWriteHashBestChain(CLevelDBBatch& batch, const uint256& hash)
 {
     batch.Write('B', hash);
 }
 
-CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe) : db(GetDataDir() / "chainstate", nCacheSize, fMemory, fWipe)
+static CPerfHistogram perfFlushBackground("coindb.flush", "Writing a frozen coins cache to disk in the background");
+static CPerfHistogram perfFlushChunk("coindb.flush_chunk", "Writing one chunk of a background flush");
+static CPerfHistogram perfFlushWait("coindb.flush_wait", "Waiting for the previous background flush before the next flush");
+static CPerfCounter perfFlushBacklog("coindb.flush_backlog", "Coins cache entries the background flush has yet to write");
+
+//! Cache entries written per chunk by the flush thread
+static const size_t FLUSH_CHUNK_ENTRIES = 10000;
+
+CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe) : db(GetDataDir() / "chainstate", nCacheSize, fMemory, fWipe), hashFlushing(0), fFlushFailed(false), fStopFlush(false), fNextInBackground(false)
 {
 }
 
+CCoinsViewDB::~CCoinsViewDB()
+{
+    if (threadFlush) {
+        {
+            boost::unique_lock<boost::mutex> lock(mutexFlush);
+            fStopFlush = true;
+        }
+        condFlush.notify_all();
+        // The thread finishes a running flush before it exits
+        threadFlush->join();
+    }
+}
+
 bool CCoinsViewDB::GetCoins(const uint256& txid, CCoins& coins) const
 {
-    return db.Read(make_pair('c', txid), coins);
+    {
+        boost::unique_lock<boost::mutex> lock(mutexFlush);
+        CCoinsMap::const_iterator it = mapFlushing.find(txid);
+        if (it != mapFlushing.end()) {
+            if (it->second.coins.IsPruned())
+                return false;
+            coins = it->second.coins;
+            return true;
+        }
+    }
+
+    CCoinsTxRecord record;
+    if (!db.Read(make_pair('T', txid), record))
+        return false;
+    ReadCoins(db, txid, record, coins);
+    return true;
 }
 
 bool CCoinsViewDB::HaveCoins(const uint256& txid) const
 {
-    return db.Exists(make_pair('c', txid));
+    {
+        boost::unique_lock<boost::mutex> lock(mutexFlush);
+        CCoinsMap::const_iterator it = mapFlushing.find(txid);
+        if (it != mapFlushing.end())
+            return !it->second.coins.IsPruned();
+    }
+    return db.Exists(make_pair('T', txid));
 }
 
 uint256 CCoinsViewDB::GetBestBlock() const
 {
+    {
+        boost::unique_lock<boost::mutex> lock(mutexFlush);
+        if (hashFlushing != 0)
+            return hashFlushing;
+    }
     uint256 hashBestChain;
     if (!db.Read('B', hashBestChain))
         return uint256(0);
     return hashBestChain;
 }
 
+/**
+ * Write the records of a modified cache entry. Only the outputs the entry
+ * marks as changed are touched: a spend of one output of a large transaction
+ * rewrites the transaction record and deletes one output record, instead of
+ * rewriting every remaining output.
+ */
+void CCoinsViewDB::BatchWriteCoins(CLevelDBBatch& batch, const uint256& txid, const CCoinsCacheEntry& entry, size_t& nWritten, size_t& nErased)
+{
+    const CCoins& coins = entry.coins;
+    if ((entry.flags & CCoinsCacheEntry::PARTIAL) && !(entry.flags & CCoinsCacheEntry::FRESH)) {
+        bool fChanged = false;
+        for (unsigned int i = 0; i < entry.vChanged.size(); i++) {
+            if (!entry.vChanged[i])
+                continue;
+            fChanged = true;
+            if (coins.IsAvailable(i)) {
+                WriteCoinsOutput(batch, txid, coins, i);
+                nWritten++;
+            } else {
+                batch.Erase(CCoinsOutputKey(txid, i));
+                nErased++;
+            }
+        }
+        if (fChanged)
+            WriteCoinsRecord(batch, txid, coins);
+        return;
+    }
+
+    // Without per-output tracking the stored record tells which outputs to
+    // erase, unless the database had none to begin with.
+    CCoinsTxRecord recordOld;
+    if (!(entry.flags & CCoinsCacheEntry::FRESH) && db.Read(make_pair('T', txid), recordOld)) {
+        for (unsigned int i = 0; i < recordOld.GetOutputCount(); i++) {
+            if (recordOld.IsAvailable(i) && !coins.IsAvailable(i)) {
+                batch.Erase(CCoinsOutputKey(txid, i));
+                nErased++;
+            }
+        }
+    }
+    for (unsigned int i = 0; i < coins.vout.size(); i++) {
+        if (coins.IsAvailable(i)) {
+            WriteCoinsOutput(batch, txid, coins, i);
+            nWritten++;
+        }
+    }
+    WriteCoinsRecord(batch, txid, coins);
+}
+
 bool CCoinsViewDB::BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock)
+{
+    bool fBackground = fNextInBackground;
+    fNextInBackground = false;
+    {
+        CPerfTimer timer(perfFlushWait);
+        if (!WaitForBackgroundWrite())
+            return false;
+    }
+    if (!fBackground || hashBlock == 0)
+        return BatchWriteNow(mapCoins, hashBlock);
+
+    uint256 hashPrev;
+    if (!db.Read('B', hashPrev))
+        hashPrev = 0;
+    {
+        boost::unique_lock<boost::mutex> lock(mutexFlush);
+        mapFlushing.swap(mapCoins);
+        hashFlushing = hashBlock;
+        perfFlushBacklog.Set(mapFlushing.size());
+        // The marker goes to disk before any entry does
+        CLevelDBBatch batch;
+        batch.Write('H', make_pair(hashBlock, hashPrev));
+        if (!db.WriteBatch(batch)) {
+            mapCoins.swap(mapFlushing);
+            hashFlushing = 0;
+            return false;
+        }
+        if (!threadFlush)
+            threadFlush.reset(new boost::thread(boost::bind(&CCoinsViewDB::ThreadFlush, this)));
+    }
+    condFlush.notify_all();
+    mapCoins.clear();
+    LogPrint("coindb", "Handed %u entries for block %s to the flush thread\n", (unsigned int)mapFlushing.size(), hashBlock.ToString());
+    return true;
+}
+
+bool CCoinsViewDB::BatchWriteNow(CCoinsMap& mapCoins, const uint256& hashBlock)
 {
     CLevelDBBatch batch;
     size_t count = 0;
     size_t changed = 0;
+    size_t nWritten = 0;
+    size_t nErased = 0;
     for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end();) {
         if (it->second.flags & CCoinsCacheEntry::DIRTY) {
-            BatchWriteCoins(batch, it->first, it->second.coins);
+            BatchWriteCoins(batch, it->first, it->second, nWritten, nErased);
             changed++;
         }
         count++;
@@ -67,10 +347,207 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock)
     if (hashBlock != uint256(0))
         BatchWriteHashBestChain(batch, hashBlock);
 
-    LogPrint("coindb", "Committing %u changed transactions (out of %u) to coin database...\n", (unsigned int)changed, (unsigned int)count);
+    LogPrint("coindb", "Committing %u changed transactions (out of %u) to coin database: %u outputs written, %u erased...\n", (unsigned int)changed, (unsigned int)count, (unsigned int)nWritten, (unsigned int)nErased);
     return db.WriteBatch(batch);
 }
 
+void CCoinsViewDB::WriteNextBatchInBackground()
+{
+    fNextInBackground = true;
+}
+
+bool CCoinsViewDB::WaitForBackgroundWrite() const
+{
+    boost::unique_lock<boost::mutex> lock(mutexFlush);
+    while (hashFlushing != 0 && !fFlushFailed)
+        condFlush.wait(lock);
+    return !fFlushFailed;
+}
+
+size_t CCoinsViewDB::GetBackgroundBacklog() const
+{
+    boost::unique_lock<boost::mutex> lock(mutexFlush);
+    return mapFlushing.size();
+}
+
+/**
+ * Only the flush thread changes mapFlushing while a flush runs, so it reads
+ * the entries without the lock and takes it only to drop written entries,
+ * which readers then find on disk.
+ */
+void CCoinsViewDB::ThreadFlush()
+{
+    RenameThread("sling-coinsflush");
+    while (true) {
+        uint256 hashBlock;
+        {
+            boost::unique_lock<boost::mutex> lock(mutexFlush);
+            while (!fStopFlush && (hashFlushing == 0 || fFlushFailed))
+                condFlush.wait(lock);
+            if (hashFlushing == 0 || fFlushFailed)
+                return;
+            hashBlock = hashFlushing;
+        }
+
+        int64_t nStart = GetTimeMicros();
+        size_t nEntries = mapFlushing.size();
+        size_t nWritten = 0;
+        size_t nErased = 0;
+        try {
+            while (!mapFlushing.empty()) {
+                CPerfTimer timer(perfFlushChunk);
+                CLevelDBBatch batch;
+                std::vector<uint256> vChunk;
+                vChunk.reserve(FLUSH_CHUNK_ENTRIES);
+                for (CCoinsMap::const_iterator it = mapFlushing.begin(); it != mapFlushing.end() && vChunk.size() < FLUSH_CHUNK_ENTRIES; it++) {
+                    if (it->second.flags & CCoinsCacheEntry::DIRTY)
+                        BatchWriteCoins(batch, it->first, it->second, nWritten, nErased);
+                    vChunk.push_back(it->first);
+                }
+                if (!db.WriteBatch(batch))
+                    throw leveldb_error("Failed to write coin database");
+
+                boost::unique_lock<boost::mutex> lock(mutexFlush);
+                BOOST_FOREACH (const uint256& txid, vChunk)
+                    mapFlushing.erase(txid);
+                perfFlushBacklog.Set(mapFlushing.size());
+            }
+
+            // Everything is on disk: the database now holds hashBlock
+            CLevelDBBatch batch;
+            BatchWriteHashBestChain(batch, hashBlock);
+            batch.Erase('H');
+            if (!db.WriteBatch(batch))
+                throw leveldb_error("Failed to write coin database");
+        } catch (const std::exception& e) {
+            LogPrintf("%s : background flush of block %s failed: %s\n", __func__, hashBlock.ToString(), e.what());
+            boost::unique_lock<boost::mutex> lock(mutexFlush);
+            fFlushFailed = true;
+            condFlush.notify_all();
+            continue;
+        }
+
+        int64_t nTime = GetTimeMicros() - nStart;
+        perfFlushBackground.Add(nTime);
+        LogPrint("coindb", "Background flush of %u entries for block %s: %u outputs written, %u erased in %.2fms\n",
+            (unsigned int)nEntries, hashBlock.ToString(), (unsigned int)nWritten, (unsigned int)nErased, nTime * 0.001);
+        {
+            boost::unique_lock<boost::mutex> lock(mutexFlush);
+            hashFlushing = 0;
+        }
+        condFlush.notify_all();
+    }
+}
+
+/**
+ * The blocks between the database's best block and the block in the marker
+ * only ever add and spend outputs. Applying them in order on top of the
+ * database recreates their outputs and spends their inputs again, which
+ * gives the same records whichever chunks made it to disk before the flush
+ * was interrupted: the records of one transaction are always written in the
+ * same chunk.
+ */
+bool CCoinsViewDB::ReplayInterruptedFlush()
+{
+    pair<uint256, uint256> hashes;
+    if (!db.Read('H', hashes))
+        return true;
+
+    const uint256& hashBlock = hashes.first;
+    const uint256& hashPrev = hashes.second;
+    LogPrintf("Coin database flush to block %s was interrupted, replaying from %s\n", hashBlock.ToString(), hashPrev.ToString());
+    BlockMap::const_iterator itBlock = mapBlockIndex.find(hashBlock);
+    if (itBlock == mapBlockIndex.end())
+        return error("%s : block %s of the interrupted flush is unknown", __func__, hashBlock.ToString());
+    CBlockIndex* pindexPrev = NULL;
+    if (hashPrev != 0) {
+        BlockMap::const_iterator itPrev = mapBlockIndex.find(hashPrev);
+        if (itPrev == mapBlockIndex.end() || itBlock->second->GetAncestor(itPrev->second->nHeight) != itPrev->second)
+            return error("%s : block %s is not an ancestor of %s", __func__, hashPrev.ToString(), hashBlock.ToString());
+        pindexPrev = itPrev->second;
+    }
+
+    std::vector<CBlockIndex*> vReplay;
+    for (CBlockIndex* pindex = itBlock->second; pindex != pindexPrev; pindex = pindex->pprev)
+        vReplay.push_back(pindex);
+    uiInterface.InitMessage(_("Replaying blocks..."));
+    CCoinsViewCache view(this);
+    for (std::vector<CBlockIndex*>::reverse_iterator it = vReplay.rbegin(); it != vReplay.rend(); it++) {
+        CBlockIndex* pindex = *it;
+        CBlock block;
+        if (!ReadBlockFromDisk(block, pindex))
+            return error("%s : failed to read block %s", __func__, pindex->GetBlockHash().ToString());
+        BOOST_FOREACH (const CTransactionRef& ptx, block.vtx) {
+            const CTransaction& tx = *ptx;
+            if (!tx.IsCoinBase()) {
+                BOOST_FOREACH (const CTxIn& txin, tx.vin)
+                    view.ModifyCoins(txin.prevout.hash)->Spend(txin.prevout.n);
+            }
+            view.ModifyCoins(tx.GetHash())->FromTx(tx, pindex->nHeight);
+        }
+    }
+
+    view.SetBestBlock(hashBlock);
+    if (!view.Flush())
+        return error("%s : failed to write coin database", __func__);
+    CLevelDBBatch batch;
+    batch.Erase('H');
+    if (!db.WriteBatch(batch))
+        return error("%s : failed to write coin database", __func__);
+    LogPrintf("Replayed %u blocks into the coin database\n", (unsigned int)vReplay.size());
+    return true;
+}
+
+bool CCoinsViewDB::Upgrade()
+{
+    boost::scoped_ptr<leveldb::Iterator> pcursor(db.NewIterator());
+    CDataStream ssKeySet(SER_DISK, CLIENT_VERSION);
+    ssKeySet << 'c';
+    pcursor->Seek(leveldb::Slice(&ssKeySet[0], ssKeySet.size()));
+    if (!pcursor->Valid() || pcursor->key()[0] != 'c')
+        return true;
+
+    LogPrintf("Upgrading coin database to per-output records...\n");
+    uiInterface.InitMessage(_("Upgrading coin database..."));
+    int64_t nStart = GetTimeMillis();
+    size_t nTransactions = 0;
+    size_t nOutputs = 0;
+    // Every batch converts whole transactions and removes their old records,
+    // so an interrupted upgrade resumes where it stopped.
+    while (pcursor->Valid() && pcursor->key()[0] == 'c') {
+        CLevelDBBatch batch;
+        for (size_t nBatch = 0; nBatch < 10000 && pcursor->Valid() && pcursor->key()[0] == 'c'; nBatch++, pcursor->Next()) {
+            uint256 txid;
+            CCoins coins;
+            try {
+                leveldb::Slice slKey = pcursor->key();
+                CDataStream ssKey(slKey.data(), slKey.data() + slKey.size(), SER_DISK, CLIENT_VERSION);
+                char chType;
+                ssKey >> chType >> txid;
+                leveldb::Slice slValue = pcursor->value();
+                CDataStream ssValue(slValue.data(), slValue.data() + slValue.size(), SER_DISK, CLIENT_VERSION);
+                ssValue >> coins;
+            } catch (std::exception& e) {
+                return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+            }
+            for (unsigned int i = 0; i < coins.vout.size(); i++) {
+                if (coins.IsAvailable(i)) {
+                    WriteCoinsOutput(batch, txid, coins, i);
+                    nOutputs++;
+                }
+            }
+            WriteCoinsRecord(batch, txid, coins);
+            batch.Erase(make_pair('c', txid));
+            nTransactions++;
+        }
+        if (!db.WriteBatch(batch))
+            return error("%s : failed to write coin database", __func__);
+        LogPrint("coindb", "Upgraded %u transactions to %u output records\n", (unsigned int)nTransactions, (unsigned int)nOutputs);
+    }
+    LogPrintf("Upgraded %u transactions to %u output records in %dms\n", (unsigned int)nTransactions, (unsigned int)nOutputs, GetTimeMillis() - nStart);
+    return true;
+}
+
 CBlockTreeDB::CBlockTreeDB(size_t nCacheSize, bool fMemory, bool fWipe) : CLevelDBWrapper(GetDataDir() / "blocks" / "index", nCacheSize, fMemory, fWipe)
 {
 }
@@ -119,44 +596,48 @@ bool CCoinsViewDB::GetStats(CCoinsStats& stats) const
     /* It seems that there are no "const iterators" for LevelDB.  Since we
        only need read operations on it, use a const-cast to get around
        that restriction.  */
+    if (!WaitForBackgroundWrite())
+        return false;
     boost::scoped_ptr<leveldb::Iterator> pcursor(const_cast<CLevelDBWrapper*>(&db)->NewIterator());
-    pcursor->SeekToFirst();
+    CDataStream ssKeySet(SER_DISK, CLIENT_VERSION);
+    ssKeySet << 'T';
+    pcursor->Seek(leveldb::Slice(&ssKeySet[0], ssKeySet.size()));
 
     CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
     stats.hashBlock = GetBestBlock();
     ss << stats.hashBlock;
     CAmount nTotalAmount = 0;
-    while (pcursor->Valid()) {
+    while (pcursor->Valid() && pcursor->key()[0] == 'T') {
         boost::this_thread::interruption_point();
         try {
             leveldb::Slice slKey = pcursor->key();
             CDataStream ssKey(slKey.data(), slKey.data() + slKey.size(), SER_DISK, CLIENT_VERSION);
             char chType;
-            ssKey >> chType;
-            if (chType == 'c') {
-                leveldb::Slice slValue = pcursor->value();
-                CDataStream ssValue(slValue.data(), slValue.data() + slValue.size(), SER_DISK, CLIENT_VERSION);
-                CCoins coins;
-                ssValue >> coins;
-                uint256 txhash;
-                ssKey >> txhash;
-                ss << txhash;
-                ss << VARINT(coins.nVersion);
-                ss << (coins.fCoinBase ? 'c' : 'n');
-                ss << VARINT(coins.nHeight);
-                stats.nTransactions++;
-                for (unsigned int i = 0; i < coins.vout.size(); i++) {
-                    const CTxOut& out = coins.vout[i];
-                    if (!out.IsNull()) {
-                        stats.nTransactionOutputs++;
-                        ss << VARINT(i + 1);
-                        ss << out;
-                        nTotalAmount += out.nValue;
-                    }
+            uint256 txhash;
+            ssKey >> chType >> txhash;
+            leveldb::Slice slValue = pcursor->value();
+            CDataStream ssValue(slValue.data(), slValue.data() + slValue.size(), SER_DISK, CLIENT_VERSION);
+            CCoinsTxRecord record;
+            ssValue >> record;
+            CCoins coins;
+            ReadCoins(db, txhash, record, coins);
+            ss << txhash;
+            ss << VARINT(coins.nVersion);
+            ss << (coins.fCoinBase ? 'c' : 'n');
+            ss << VARINT(coins.nHeight);
+            stats.nTransactions++;
+            stats.nSerializedSize += 32 + slValue.size();
+            for (unsigned int i = 0; i < coins.vout.size(); i++) {
+                const CTxOut& out = coins.vout[i];
+                if (!out.IsNull()) {
+                    stats.nTransactionOutputs++;
+                    ss << VARINT(i + 1);
+                    ss << out;
+                    nTotalAmount += out.nValue;
+                    stats.nSerializedSize += 32 + GetSizeOfVarInt(i) + ::GetSerializeSize(CTxOutCompressor(coins.vout[i]), SER_DISK, CLIENT_VERSION);
                 }
-                stats.nSerializedSize += 32 + slValue.size();
-                ss << VARINT(0);
             }
+            ss << VARINT(0);
             pcursor->Next();
         } catch (std::exception& e) {
             return error("%s : Deserialize or I/O error - %s", __func__, e.what());
@@ -195,15 +676,68 @@ bool CBlockTreeDB::ReadFlag(const std::string& name, bool& fValue)
     return true;
 }
 
-bool CBlockTreeDB::LoadBlockIndexGuts()
+// Key of the running total an address received
+static std::pair<char, std::pair<unsigned char, uint160> > AddressReceivedKey(unsigned char nType, const uint160& hashBytes)
+{
+    return make_pair('r', make_pair(nType, hashBytes));
+}
+
+// Applies the changes of one connected or disconnected block to the address
+// and spent indexes in a single batch, so the indexes never describe half a
+// block. Null unspent and spent values erase their records. The total each
+// address received moves with its output records; a record that is already
+// on disk, or already gone, is not counted again, so connecting a block a
+// second time after an unclean shutdown leaves the totals alone.
+bool CBlockTreeDB::WriteAddressIndexUpdate(const CAddressIndexUpdate& update)
+{
+    CLevelDBBatch batch;
+    std::map<std::pair<unsigned char, uint160>, CAmount> mapReceived;
+    for (std::vector<std::pair<CAddressIndexKey, CAmount> >::const_iterator it = update.vAddressIndex.begin(); it != update.vAddressIndex.end(); it++) {
+        if (!it->first.fSpending && !Exists(make_pair('a', it->first)))
+            mapReceived[make_pair(it->first.nAddressType, it->first.hashBytes)] += it->second;
+        batch.Write(make_pair('a', it->first), it->second);
+    }
+    for (std::vector<CAddressIndexKey>::const_iterator it = update.vAddressIndexErase.begin(); it != update.vAddressIndexErase.end(); it++) {
+        CAmount nValue;
+        if (!it->fSpending && Read(make_pair('a', *it), nValue))
+            mapReceived[make_pair(it->nAddressType, it->hashBytes)] -= nValue;
+        batch.Erase(make_pair('a', *it));
+    }
+    for (std::map<std::pair<unsigned char, uint160>, CAmount>::const_iterator it = mapReceived.begin(); it != mapReceived.end(); it++) {
+        CAmount nReceived = 0;
+        Read(AddressReceivedKey(it->first.first, it->first.second), nReceived);
+        nReceived += it->second;
+        if (nReceived == 0)
+            batch.Erase(AddressReceivedKey(it->first.first, it->first.second));
+        else
+            batch.Write(AddressReceivedKey(it->first.first, it->first.second), nReceived);
+    }
+    for (std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> >::const_iterator it = update.vAddressUnspent.begin(); it != update.vAddressUnspent.end(); it++) {
+        if (it->second.IsNull())
+            batch.Erase(make_pair('u', it->first));
+        else
+            batch.Write(make_pair('u', it->first), it->second);
+    }
+    for (std::vector<std::pair<CSpentIndexKey, CSpentIndexValue> >::const_iterator it = update.vSpent.begin(); it != update.vSpent.end(); it++) {
+        if (it->second.IsNull())
+            batch.Erase(make_pair('p', it->first));
+        else
+            batch.Write(make_pair('p', it->first), it->second);
+    }
+    return WriteBatch(batch);
+}
+
+// Reads the history of an address between two heights, both inclusive; an
+// end of 0 reads to the tip. Records are keyed by height, so this is one
+// seek and a scan of exactly the requested range.
+bool CBlockTreeDB::ReadAddressIndex(const uint160& hashBytes, int nType, std::vector<std::pair<CAddressIndexKey, CAmount> >& vAddressIndex, int nStart, int nEnd)
 {
     boost::scoped_ptr<leveldb::Iterator> pcursor(NewIterator());
 
     CDataStream ssKeySet(SER_DISK, CLIENT_VERSION);
-    ssKeySet << make_pair('b', uint256(0));
+    ssKeySet << make_pair('a', CAddressIndexKey(nType, hashBytes, std::max(nStart, 0), 0, uint256(0), 0, false));
     pcursor->Seek(ssKeySet.str());
 
-    // Load mapBlockIndex
     while (pcursor->Valid()) {
         boost::this_thread::interruption_point();
         try {
@@ -211,57 +745,190 @@ bool CBlockTreeDB::LoadBlockIndexGuts()
             CDataStream ssKey(slKey.data(), slKey.data() + slKey.size(), SER_DISK, CLIENT_VERSION);
             char chType;
             ssKey >> chType;
-            if (chType == 'b') {
-                leveldb::Slice slValue = pcursor->value();
-                CDataStream ssValue(slValue.data(), slValue.data() + slValue.size(), SER_DISK, CLIENT_VERSION);
-                CDiskBlockIndex diskindex;
-                ssValue >> diskindex;
-
-                // Construct block index object
-                CBlockIndex* pindexNew = InsertBlockIndex(diskindex.GetBlockHash());
-                pindexNew->pprev = InsertBlockIndex(diskindex.hashPrev);
-                pindexNew->pnext = InsertBlockIndex(diskindex.hashNext);
-                pindexNew->nHeight = diskindex.nHeight;
-                pindexNew->nFile = diskindex.nFile;
-                pindexNew->nDataPos = diskindex.nDataPos;
-                pindexNew->nUndoPos = diskindex.nUndoPos;
-                pindexNew->nVersion = diskindex.nVersion;
-                pindexNew->hashMerkleRoot = diskindex.hashMerkleRoot;
-                pindexNew->nTime = diskindex.nTime;
-                pindexNew->nBits = diskindex.nBits;
-                pindexNew->nNonce = diskindex.nNonce;
-                pindexNew->nStatus = diskindex.nStatus;
-                pindexNew->nTx = diskindex.nTx;
-
-                //Proof Of Stake
-                pindexNew->nMint = diskindex.nMint;
-                pindexNew->nMoneySupply = diskindex.nMoneySupply;
-                pindexNew->nFlags = diskindex.nFlags;
-                pindexNew->nStakeModifier = diskindex.nStakeModifier;
-                pindexNew->prevoutStake = diskindex.prevoutStake;
-                pindexNew->nStakeTime = diskindex.nStakeTime;
-                pindexNew->hashProofOfStake = diskindex.hashProofOfStake;
-
-                if (pindexNew->IsProofOfStake()) {
-                    // This is a PoS Block
-                    // ppcoin: build setStakeSeen
-                    setStakeSeen.insert(make_pair(pindexNew->prevoutStake, pindexNew->nStakeTime));
-                }
-                else if (!pindexNew->IsProofOfStake()) {
-                    // This is a PoW Block
-                    if (!CheckProofOfWork(pindexNew->GetBlockHash(), pindexNew->nBits)) {
-                        return error("LoadBlockIndex() : CheckProofOfWork failed: %s", pindexNew->ToString());
-                    }
-                }
+            if (chType != 'a')
+                break;
+            CAddressIndexKey key;
+            ssKey >> key;
+            if (key.nAddressType != nType || key.hashBytes != hashBytes)
+                break;
+            if (nEnd > 0 && key.nBlockHeight > nEnd)
+                break;
+
+            leveldb::Slice slValue = pcursor->value();
+            CDataStream ssValue(slValue.data(), slValue.data() + slValue.size(), SER_DISK, CLIENT_VERSION);
+            CAmount nValue;
+            ssValue >> nValue;
+            vAddressIndex.push_back(make_pair(key, nValue));
+            pcursor->Next();
+        } catch (std::exception& e) {
+            return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+        }
+    }
+    return true;
+}
 
-                pcursor->Next();
-            } else {
-                break; // if shutdown requested or finished loading block index
-            }
+bool CBlockTreeDB::ReadAddressUnspentIndex(const uint160& hashBytes, int nType, std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> >& vUnspent)
+{
+    boost::scoped_ptr<leveldb::Iterator> pcursor(NewIterator());
+
+    CDataStream ssKeySet(SER_DISK, CLIENT_VERSION);
+    ssKeySet << make_pair('u', CAddressUnspentKey(nType, hashBytes, uint256(0), 0));
+    pcursor->Seek(ssKeySet.str());
+
+    while (pcursor->Valid()) {
+        boost::this_thread::interruption_point();
+        try {
+            leveldb::Slice slKey = pcursor->key();
+            CDataStream ssKey(slKey.data(), slKey.data() + slKey.size(), SER_DISK, CLIENT_VERSION);
+            char chType;
+            ssKey >> chType;
+            if (chType != 'u')
+                break;
+            CAddressUnspentKey key;
+            ssKey >> key;
+            if (key.nAddressType != nType || key.hashBytes != hashBytes)
+                break;
+
+            leveldb::Slice slValue = pcursor->value();
+            CDataStream ssValue(slValue.data(), slValue.data() + slValue.size(), SER_DISK, CLIENT_VERSION);
+            CAddressUnspentValue value;
+            ssValue >> value;
+            vUnspent.push_back(make_pair(key, value));
+            pcursor->Next();
         } catch (std::exception& e) {
             return error("%s : Deserialize or I/O error - %s", __func__, e.what());
         }
     }
+    return true;
+}
+
+bool CBlockTreeDB::ReadAddressReceived(const uint160& hashBytes, int nType, CAmount& nReceived)
+{
+    nReceived = 0;
+    Read(AddressReceivedKey(nType, hashBytes), nReceived);
+    return true;
+}
+
+bool CBlockTreeDB::ReadSpentIndex(const CSpentIndexKey& key, CSpentIndexValue& value)
+{
+    return Read(make_pair('p', key), value);
+}
+
+// Reads the 'b' records whose hash starts with a byte in [nBegin, nEnd).
+// The hash is taken from the key, so no header is rehashed here; the
+// background sweep in ThreadVerifyBlockIndexHashes checks them later.
+void CBlockTreeDB::ReadBlockIndexRange(int nBegin, int nEnd, std::vector<std::pair<uint256, CDiskBlockIndex> >& vIndex, std::string& strError)
+{
+    try {
+        boost::scoped_ptr<leveldb::Iterator> pcursor(NewIterator());
+
+        uint256 hashStart(0);
+        *hashStart.begin() = nBegin;
+        CDataStream ssKeySet(SER_DISK, CLIENT_VERSION);
+        ssKeySet << make_pair('b', hashStart);
+        pcursor->Seek(ssKeySet.str());
+
+        while (pcursor->Valid()) {
+            boost::this_thread::interruption_point();
+            leveldb::Slice slKey = pcursor->key();
+            CDataStream ssKey(slKey.data(), slKey.data() + slKey.size(), SER_DISK, CLIENT_VERSION);
+            char chType;
+            ssKey >> chType;
+            if (chType != 'b')
+                break;
+            uint256 hash;
+            ssKey >> hash;
+            if (*hash.begin() >= nEnd)
+                break;
+
+            leveldb::Slice slValue = pcursor->value();
+            CDataStream ssValue(slValue.data(), slValue.data() + slValue.size(), SER_DISK, CLIENT_VERSION);
+            vIndex.push_back(make_pair(hash, CDiskBlockIndex()));
+            ssValue >> vIndex.back().second;
+
+            pcursor->Next();
+        }
+    } catch (boost::thread_interrupted&) {
+        strError = "interrupted";
+    } catch (std::exception& e) {
+        strError = strprintf("Deserialize or I/O error - %s", e.what());
+    }
+}
+
+bool CBlockTreeDB::LoadBlockIndexGuts()
+{
+    int64_t nStart = GetTimeMillis();
+
+    // The records are split by the first byte of their hash and every range
+    // is read and deserialized by its own iterator. Linking them into
+    // mapBlockIndex stays on this thread.
+    int nThreads = std::max(1, std::min(8, (int)boost::thread::hardware_concurrency()));
+    std::vector<std::vector<std::pair<uint256, CDiskBlockIndex> > > vRanges(nThreads);
+    std::vector<std::string> vErrors(nThreads);
+    if (nThreads == 1) {
+        ReadBlockIndexRange(0, 256, vRanges[0], vErrors[0]);
+    } else {
+        boost::thread_group readers;
+        for (int i = 0; i < nThreads; i++)
+            readers.create_thread(boost::bind(&CBlockTreeDB::ReadBlockIndexRange, this, 256 * i / nThreads, 256 * (i + 1) / nThreads, boost::ref(vRanges[i]), boost::ref(vErrors[i])));
+        readers.join_all();
+    }
+    boost::this_thread::interruption_point();
+    for (int i = 0; i < nThreads; i++) {
+        if (!vErrors[i].empty())
+            return error("%s : %s", __func__, vErrors[i]);
+    }
+
+    int64_t nRead = GetTimeMillis();
+    size_t nRecords = 0;
+
+    // Load mapBlockIndex
+    for (int i = 0; i < nThreads; i++) {
+        BOOST_FOREACH (const PAIRTYPE(uint256, CDiskBlockIndex)& item, vRanges[i]) {
+            const CDiskBlockIndex& diskindex = item.second;
+
+            // Construct block index object
+            CBlockIndex* pindexNew = InsertBlockIndex(item.first);
+            pindexNew->pprev = InsertBlockIndex(diskindex.hashPrev);
+            pindexNew->pnext = InsertBlockIndex(diskindex.hashNext);
+            pindexNew->nHeight = diskindex.nHeight;
+            pindexNew->nFile = diskindex.nFile;
+            pindexNew->nDataPos = diskindex.nDataPos;
+            pindexNew->nUndoPos = diskindex.nUndoPos;
+            pindexNew->nVersion = diskindex.nVersion;
+            pindexNew->hashMerkleRoot = diskindex.hashMerkleRoot;
+            pindexNew->nTime = diskindex.nTime;
+            pindexNew->nBits = diskindex.nBits;
+            pindexNew->nNonce = diskindex.nNonce;
+            pindexNew->nStatus = diskindex.nStatus;
+            pindexNew->nTx = diskindex.nTx;
+
+            //Proof Of Stake
+            pindexNew->nMint = diskindex.nMint;
+            pindexNew->nMoneySupply = diskindex.nMoneySupply;
+            pindexNew->nFlags = diskindex.nFlags;
+            pindexNew->nStakeModifier = diskindex.nStakeModifier;
+            pindexNew->prevoutStake = diskindex.prevoutStake;
+            pindexNew->nStakeTime = diskindex.nStakeTime;
+            pindexNew->hashProofOfStake = diskindex.hashProofOfStake;
+
+            if (pindexNew->IsProofOfStake()) {
+                // This is a PoS Block
+                // ppcoin: build setStakeSeen
+                setStakeSeen.insert(make_pair(pindexNew->prevoutStake, pindexNew->nStakeTime));
+            }
+            else if (!pindexNew->IsProofOfStake()) {
+                // This is a PoW Block
+                if (!CheckProofOfWork(pindexNew->GetBlockHash(), pindexNew->nBits)) {
+                    return error("LoadBlockIndex() : CheckProofOfWork failed: %s", pindexNew->ToString());
+                }
+            }
+        }
+        nRecords += vRanges[i].size();
+        std::vector<std::pair<uint256, CDiskBlockIndex> >().swap(vRanges[i]);
+    }
 
+    LogPrintf("%s : %u entries, read %dms on %d threads, linked %dms\n", __func__,
+        nRecords, nRead - nStart, nThreads, GetTimeMillis() - nRead);
     return true;
 }
@@ -6,6 +6,7 @@
 #ifndef BITCOIN_TXDB_H
 #define BITCOIN_TXDB_H
 
+#include "addressindex.h"
 #include "leveldbwrapper.h"
 #include "main.h"
 
@@ -14,6 +15,11 @@
 #include <utility>
 #include <vector>
 
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
 class CCoins;
 class uint256;
 
@@ -24,7 +30,25 @@ static const int64_t nMaxDbCache = sizeof(void*) > 4 ? 4096 : 1024;
 //! min. -dbcache in (MiB)
 static const int64_t nMinDbCache = 4;
 
-/** CCoinsView backed by the LevelDB coin database (chainstate/) */
+//! -backgroundflush default
+static const bool DEFAULT_BACKGROUND_FLUSH = true;
+
+/**
+ * CCoinsView backed by the LevelDB coin database (chainstate/).
+ *
+ * Every unspent output is its own record, next to a small record per
+ * transaction with its metadata and which of its outputs are unspent.
+ * Spending an output rewrites that record and deletes one output record
+ * instead of rewriting all remaining outputs of the transaction. Lookups
+ * are point reads, so the bloom filters answer those for unknown
+ * transactions.
+ *
+ * A BatchWrite can be handed to a flush thread instead: the entries are kept
+ * as a frozen layer that reads go through until the thread has written them
+ * in chunks. While it runs, a marker in the database names the block being
+ * written and the block the database held before, so an interrupted flush
+ * can be replayed from the block files (ReplayInterruptedFlush).
+ */
 class CCoinsViewDB : public CCoinsView
 {
 protected:
@@ -32,12 +56,44 @@ protected:
 
 public:
     CCoinsViewDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+    ~CCoinsViewDB();
 
     bool GetCoins(const uint256& txid, CCoins& coins) const;
     bool HaveCoins(const uint256& txid) const;
     uint256 GetBestBlock() const;
     bool BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock);
     bool GetStats(CCoinsStats& stats) const;
+
+    //! Convert per-transaction records left by older versions to per-output records
+    bool Upgrade();
+
+    //! Have the next BatchWrite return at once and leave the writing to the flush thread
+    void WriteNextBatchInBackground();
+
+    //! Wait until the flush thread is idle; false if its last flush failed
+    bool WaitForBackgroundWrite() const;
+
+    //! Number of entries the flush thread has yet to write
+    size_t GetBackgroundBacklog() const;
+
+    //! Bring the database to the block an interrupted background flush was writing
+    bool ReplayInterruptedFlush();
+
+private:
+    void BatchWriteCoins(CLevelDBBatch& batch, const uint256& txid, const CCoinsCacheEntry& entry, size_t& nWritten, size_t& nErased);
+    bool BatchWriteNow(CCoinsMap& mapCoins, const uint256& hashBlock);
+    void ThreadFlush();
+
+    mutable boost::mutex mutexFlush;
+    mutable boost::condition_variable condFlush;
+    //! Entries being written by the flush thread; erased once on disk
+    CCoinsMap mapFlushing;
+    //! Block mapFlushing brings the database to, 0 while the flush thread is idle
+    uint256 hashFlushing;
+    bool fFlushFailed;
+    bool fStopFlush;
+    bool fNextInBackground;
+    boost::scoped_ptr<boost::thread> threadFlush;
 };
 
 /** Access to the block database (blocks/index/) */
@@ -62,7 +118,16 @@ public:
     bool WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos> >& list);
     bool WriteFlag(const std::string& name, bool fValue);
     bool ReadFlag(const std::string& name, bool& fValue);
+    bool WriteAddressIndexUpdate(const CAddressIndexUpdate& update);
+    bool ReadAddressIndex(const uint160& hashBytes, int nType, std::vector<std::pair<CAddressIndexKey, CAmount> >& vAddressIndex, int nStart = 0, int nEnd = 0);
+    bool ReadAddressUnspentIndex(const uint160& hashBytes, int nType, std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> >& vUnspent);
+    //! Total an address received over the whole chain, 0 if it received nothing
+    bool ReadAddressReceived(const uint160& hashBytes, int nType, CAmount& nReceived);
+    bool ReadSpentIndex(const CSpentIndexKey& key, CSpentIndexValue& value);
     bool LoadBlockIndexGuts();
+
+private:
+    void ReadBlockIndexRange(int nBegin, int nEnd, std::vector<std::pair<uint256, CDiskBlockIndex> >& vIndex, std::string& strError);
 };
 
 #endif // BITCOIN_TXDB_H
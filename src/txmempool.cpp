@@ -16,16 +16,33 @@
 
 using namespace std;
 
-CTxMemPoolEntry::CTxMemPoolEntry() : nFee(0), nTxSize(0), nModSize(0), nTime(0), dPriority(0.0)
+CTxMemPoolEntry::CTxMemPoolEntry() : nFee(0), nTxSize(0), nModSize(0), nTime(0), dPriority(0.0), nFeeDelta(0), nCountWithAncestors(0), nSizeWithAncestors(0), nModFeesWithAncestors(0)
 {
     nHeight = MEMPOOL_HEIGHT;
 }
 
-CTxMemPoolEntry::CTxMemPoolEntry(const CTransaction& _tx, const CAmount& _nFee, int64_t _nTime, double _dPriority, unsigned int _nHeight) : tx(_tx), nFee(_nFee), nTime(_nTime), dPriority(_dPriority), nHeight(_nHeight)
+CTxMemPoolEntry::CTxMemPoolEntry(const CTransaction& _tx, const CAmount& _nFee, int64_t _nTime, double _dPriority, unsigned int _nHeight) : tx(MakeTransactionRef(_tx)), nFee(_nFee), nTime(_nTime), dPriority(_dPriority), nHeight(_nHeight)
 {
-    nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
+    nTxSize = ::GetSerializeSize(*tx, SER_NETWORK, PROTOCOL_VERSION);
 
-    nModSize = tx.CalculateModifiedSize(nTxSize);
+    nModSize = tx->CalculateModifiedSize(nTxSize);
+
+    nFeeDelta = 0;
+    nCountWithAncestors = 1;
+    nSizeWithAncestors = nTxSize;
+    nModFeesWithAncestors = nFee;
+}
+
+CTxMemPoolEntry::CTxMemPoolEntry(const CTransactionRef& _tx, const CAmount& _nFee, int64_t _nTime, double _dPriority, unsigned int _nHeight) : tx(_tx), nFee(_nFee), nTime(_nTime), dPriority(_dPriority), nHeight(_nHeight)
+{
+    nTxSize = ::GetSerializeSize(*tx, SER_NETWORK, PROTOCOL_VERSION);
+
+    nModSize = tx->CalculateModifiedSize(nTxSize);
+
+    nFeeDelta = 0;
+    nCountWithAncestors = 1;
+    nSizeWithAncestors = nTxSize;
+    nModFeesWithAncestors = nFee;
 }
 
 CTxMemPoolEntry::CTxMemPoolEntry(const CTxMemPoolEntry& other)
@@ -36,12 +53,25 @@ CTxMemPoolEntry::CTxMemPoolEntry(const CTxMemPoolEntry& other)
 double
 CTxMemPoolEntry::GetPriority(unsigned int currentHeight) const
 {
-    CAmount nValueIn = tx.GetValueOut() + nFee;
+    CAmount nValueIn = tx->GetValueOut() + nFee;
     double deltaPriority = ((double)(currentHeight - nHeight) * nValueIn) / nModSize;
     double dResult = dPriority + deltaPriority;
     return dResult;
 }
 
+void CTxMemPoolEntry::UpdateFeeDelta(CAmount nNewFeeDelta)
+{
+    nModFeesWithAncestors += nNewFeeDelta - nFeeDelta;
+    nFeeDelta = nNewFeeDelta;
+}
+
+void CTxMemPoolEntry::UpdateAncestorState(int64_t nSizeDelta, CAmount nModFeesDelta, int nCountDelta)
+{
+    nSizeWithAncestors += nSizeDelta;
+    nModFeesWithAncestors += nModFeesDelta;
+    nCountWithAncestors += nCountDelta;
+}
+
 /**
  * Keep track of fee/priority for transactions confirmed within N blocks
  */
@@ -401,6 +431,68 @@ void CTxMemPool::AddTransactionsUpdated(unsigned int n)
 }
 
 
+void CTxMemPool::CalculateAncestors(const CTransaction& tx, std::set<uint256>& setAncestors) const
+{
+    std::deque<const CTransaction*> vToVisit;
+    vToVisit.push_back(&tx);
+    while (!vToVisit.empty()) {
+        const CTransaction* ptx = vToVisit.front();
+        vToVisit.pop_front();
+        BOOST_FOREACH (const CTxIn& txin, ptx->vin) {
+            std::map<uint256, CTxMemPoolEntry>::const_iterator it = mapTx.find(txin.prevout.hash);
+            if (it != mapTx.end() && setAncestors.insert(it->first).second)
+                vToVisit.push_back(&it->second.GetTx());
+        }
+    }
+}
+
+void CTxMemPool::CalculateDescendants(const uint256& hash, std::set<uint256>& setDescendants) const
+{
+    std::deque<uint256> vToVisit;
+    vToVisit.push_back(hash);
+    while (!vToVisit.empty()) {
+        uint256 hashVisit = vToVisit.front();
+        vToVisit.pop_front();
+        // Spends are found through mapNextTx, so this works for a transaction that is no longer in mapTx
+        std::map<COutPoint, CInPoint>::const_iterator it = mapNextTx.lower_bound(COutPoint(hashVisit, 0));
+        for (; it != mapNextTx.end() && it->first.hash == hashVisit; ++it) {
+            uint256 hashSpender = it->second.ptx->GetHash();
+            if (setDescendants.insert(hashSpender).second)
+                vToVisit.push_back(hashSpender);
+        }
+    }
+}
+
+void CTxMemPool::UpdateEntryAncestorState(const uint256& hash, int64_t nSizeDelta, CAmount nModFeesDelta, int nCountDelta)
+{
+    std::map<uint256, CTxMemPoolEntry>::iterator it = mapTx.find(hash);
+    if (it == mapTx.end())
+        return;
+    setAncestorFeeRate.erase(CAncestorFeeRateKey(hash, it->second));
+    it->second.UpdateAncestorState(nSizeDelta, nModFeesDelta, nCountDelta);
+    setAncestorFeeRate.insert(CAncestorFeeRateKey(hash, it->second));
+}
+
+void CTxMemPool::RecalculateAncestorState(const uint256& hash)
+{
+    std::map<uint256, CTxMemPoolEntry>::iterator it = mapTx.find(hash);
+    if (it == mapTx.end())
+        return;
+    CTxMemPoolEntry& entry = it->second;
+    std::set<uint256> setAncestors;
+    CalculateAncestors(entry.GetTx(), setAncestors);
+    int64_t nSize = entry.GetTxSize();
+    CAmount nModFees = entry.GetModifiedFee();
+    BOOST_FOREACH (const uint256& hashAncestor, setAncestors) {
+        const CTxMemPoolEntry& ancestor = mapTx.find(hashAncestor)->second;
+        nSize += ancestor.GetTxSize();
+        nModFees += ancestor.GetModifiedFee();
+    }
+    setAncestorFeeRate.erase(CAncestorFeeRateKey(hash, entry));
+    entry.UpdateAncestorState(nSize - (int64_t)entry.GetSizeWithAncestors(), nModFees - entry.GetModFeesWithAncestors(), 1 + (int)setAncestors.size() - (int)entry.GetCountWithAncestors());
+    setAncestorFeeRate.insert(CAncestorFeeRateKey(hash, entry));
+}
+
 bool CTxMemPool::addUnchecked(const uint256& hash, const CTxMemPoolEntry& entry)
 {
     // Add to memory pool without checking anything.
@@ -408,18 +500,34 @@ bool CTxMemPool::addUnchecked(const uint256& hash, const CTxMemPoolEntry& entry)
     // all the appropriate checks.
     LOCK(cs);
     {
+        std::map<uint256, CTxMemPoolEntry>::iterator itOld = mapTx.find(hash);
+        if (itOld != mapTx.end())
+            setAncestorFeeRate.erase(CAncestorFeeRateKey(hash, itOld->second));
         mapTx[hash] = entry;
-        const CTransaction& tx = mapTx[hash].GetTx();
+        CTxMemPoolEntry& newEntry = mapTx[hash];
+        const CTransaction& tx = newEntry.GetTx();
         for (unsigned int i = 0; i < tx.vin.size(); i++)
             mapNextTx[tx.vin[i].prevout] = CInPoint(&tx, i);
         nTransactionsUpdated++;
         totalTxSize += entry.GetTxSize();
+
+        std::map<uint256, std::pair<double, CAmount> >::const_iterator itDelta = mapDeltas.find(hash);
+        if (itDelta != mapDeltas.end())
+            newEntry.UpdateFeeDelta(itDelta->second.second);
+        RecalculateAncestorState(hash);
+
+        // After a reorg, transactions of a disconnected block are put back
+        // while their spenders are still in the pool; those gain ancestors.
+        std::set<uint256> setDescendants;
+        CalculateDescendants(hash, setDescendants);
+        BOOST_FOREACH (const uint256& hashDescendant, setDescendants)
+            RecalculateAncestorState(hashDescendant);
     }
     return true;
 }
 
 
-void CTxMemPool::remove(const CTransaction& origTx, std::list<CTransaction>& removed, bool fRecursive)
+void CTxMemPool::remove(const CTransaction& origTx, std::list<CTransactionRef>& removed, bool fRecursive)
 {
     // Remove transaction from memory pool
     {
@@ -455,8 +563,16 @@ void CTxMemPool::remove(const CTransaction& origTx, std::list<CTransaction>& rem
             BOOST_FOREACH (const CTxIn& txin, tx.vin)
                 mapNextTx.erase(txin.prevout);
 
-            removed.push_back(tx);
-            totalTxSize -= mapTx[hash].GetTxSize();
+            // Whatever still spends it no longer has it as an ancestor
+            const CTxMemPoolEntry& entry = mapTx[hash];
+            std::set<uint256> setDescendants;
+            CalculateDescendants(hash, setDescendants);
+            BOOST_FOREACH (const uint256& hashDescendant, setDescendants)
+                UpdateEntryAncestorState(hashDescendant, -(int64_t)entry.GetTxSize(), -entry.GetModifiedFee(), -1);
+            setAncestorFeeRate.erase(CAncestorFeeRateKey(hash, entry));
+
+            removed.push_back(entry.GetSharedTx());
+            totalTxSize -= entry.GetTxSize();
             mapTx.erase(hash);
             nTransactionsUpdated++;
         }
@@ -467,7 +583,7 @@ void CTxMemPool::removeCoinbaseSpends(const CCoinsViewCache* pcoins, unsigned in
 {
     // Remove transactions spending a coinbase which are now immature
     LOCK(cs);
-    list<CTransaction> transactionsToRemove;
+    list<CTransactionRef> transactionsToRemove;
     for (std::map<uint256, CTxMemPoolEntry>::const_iterator it = mapTx.begin(); it != mapTx.end(); it++) {
         const CTransaction& tx = it->second.GetTx();
         BOOST_FOREACH (const CTxIn& txin, tx.vin) {
@@ -477,21 +593,20 @@ void CTxMemPool::removeCoinbaseSpends(const CCoinsViewCache* pcoins, unsigned in
             const CCoins* coins = pcoins->AccessCoins(txin.prevout.hash);
             if (fSanityCheck) assert(coins);
             if (!coins || ((coins->IsCoinBase() || coins->IsCoinStake()) && nMemPoolHeight - coins->nHeight < Params().COINBASE_MATURITY())) {
-                transactionsToRemove.push_back(tx);
+                transactionsToRemove.push_back(it->second.GetSharedTx());
                 break;
             }
         }
     }
-    BOOST_FOREACH (const CTransaction& tx, transactionsToRemove) {
-        list<CTransaction> removed;
-        remove(tx, removed, true);
+    BOOST_FOREACH (const CTransactionRef& tx, transactionsToRemove) {
+        list<CTransactionRef> removed;
+        remove(*tx, removed, true);
     }
 }
 
-void CTxMemPool::removeConflicts(const CTransaction& tx, std::list<CTransaction>& removed)
+void CTxMemPool::removeConflicts(const CTransaction& tx, std::list<CTransactionRef>& removed)
 {
     // Remove transactions which depend on inputs of tx, recursively
-    list<CTransaction> result;
     LOCK(cs);
     BOOST_FOREACH (const CTxIn& txin, tx.vin) {
         std::map<COutPoint, CInPoint>::iterator it = mapNextTx.find(txin.prevout);
@@ -507,18 +622,19 @@ void CTxMemPool::removeConflicts(const CTransaction& tx, std::list<CTransaction>
 /**
  * Called when a block is connected. Removes from mempool and updates the miner fee estimator.
  */
-void CTxMemPool::removeForBlock(const std::vector<CTransaction>& vtx, unsigned int nBlockHeight, std::list<CTransaction>& conflicts)
+void CTxMemPool::removeForBlock(const std::vector<CTransactionRef>& vtx, unsigned int nBlockHeight, std::list<CTransactionRef>& conflicts)
 {
     LOCK(cs);
     std::vector<CTxMemPoolEntry> entries;
-    BOOST_FOREACH (const CTransaction& tx, vtx) {
-        uint256 hash = tx.GetHash();
+    BOOST_FOREACH (const CTransactionRef& ptx, vtx) {
+        uint256 hash = ptx->GetHash();
         if (mapTx.count(hash))
             entries.push_back(mapTx[hash]);
     }
     minerPolicyEstimator->seenBlock(entries, nBlockHeight, minRelayFee);
-    BOOST_FOREACH (const CTransaction& tx, vtx) {
-        std::list<CTransaction> dummy;
+    BOOST_FOREACH (const CTransactionRef& ptx, vtx) {
+        const CTransaction& tx = *ptx;
+        std::list<CTransactionRef> dummy;
         remove(tx, dummy, false);
         removeConflicts(tx, conflicts);
         ClearPrioritisation(tx.GetHash());
@@ -531,6 +647,7 @@ void CTxMemPool::clear()
     LOCK(cs);
     mapTx.clear();
     mapNextTx.clear();
+    setAncestorFeeRate.clear();
     totalTxSize = 0;
     ++nTransactionsUpdated;
 }
@@ -606,6 +723,24 @@ void CTxMemPool::check(const CCoinsViewCache* pcoins) const
         assert(it->first == it->second.ptx->vin[it->second.n].prevout);
     }
 
+    // The ancestor totals and the fee rate index match the pool
+    assert(setAncestorFeeRate.size() == mapTx.size());
+    for (std::map<uint256, CTxMemPoolEntry>::const_iterator it = mapTx.begin(); it != mapTx.end(); it++) {
+        const CTxMemPoolEntry& entry = it->second;
+        std::set<uint256> setAncestors;
+        CalculateAncestors(entry.GetTx(), setAncestors);
+        uint64_t nSize = entry.GetTxSize();
+        CAmount nModFees = entry.GetModifiedFee();
+        BOOST_FOREACH (const uint256& hashAncestor, setAncestors) {
+            nSize += mapTx.find(hashAncestor)->second.GetTxSize();
+            nModFees += mapTx.find(hashAncestor)->second.GetModifiedFee();
+        }
+        assert(entry.GetCountWithAncestors() == setAncestors.size() + 1);
+        assert(entry.GetSizeWithAncestors() == nSize);
+        assert(entry.GetModFeesWithAncestors() == nModFees);
+        assert(setAncestorFeeRate.count(CAncestorFeeRateKey(it->first, entry)));
+    }
+
     assert(totalTxSize == checkTotal);
 }
 
@@ -628,6 +763,15 @@ bool CTxMemPool::lookup(uint256 hash, CTransaction& result) const
     return true;
 }
 
+CTransactionRef CTxMemPool::get(const uint256& hash) const
+{
+    LOCK(cs);
+    map<uint256, CTxMemPoolEntry>::const_iterator i = mapTx.find(hash);
+    if (i == mapTx.end())
+        return CTransactionRef();
+    return i->second.GetSharedTx();
+}
+
 CFeeRate CTxMemPool::estimateFee(int nBlocks) const
 {
     LOCK(cs);
@@ -677,6 +821,18 @@ void CTxMemPool::PrioritiseTransaction(const uint256 hash, const string strHash,
         std::pair<double, CAmount>& deltas = mapDeltas[hash];
         deltas.first += dPriorityDelta;
         deltas.second += nFeeDelta;
+        std::map<uint256, CTxMemPoolEntry>::iterator it = mapTx.find(hash);
+        if (it != mapTx.end() && nFeeDelta != 0) {
+            setAncestorFeeRate.erase(CAncestorFeeRateKey(hash, it->second));
+            it->second.UpdateFeeDelta(deltas.second);
+            setAncestorFeeRate.insert(CAncestorFeeRateKey(hash, it->second));
+            std::set<uint256> setDescendants;
+            CalculateDescendants(hash, setDescendants);
+            BOOST_FOREACH (const uint256& hashDescendant, setDescendants)
+                UpdateEntryAncestorState(hashDescendant, 0, nFeeDelta, 0);
+        }
+        // Templates picked before the change are out of date
+        nTransactionsUpdated++;
     }
     LogPrintf("PrioritiseTransaction: %s priority += %f, fee += %d\n", strHash, dPriorityDelta, FormatMoney(nFeeDelta));
 }
@@ -706,9 +862,9 @@ bool CCoinsViewMemPool::GetCoins(const uint256& txid, CCoins& coins) const
     // If an entry in the mempool exists, always return that one, as it's guaranteed to never
     // conflict with the underlying cache, and it cannot have pruned entries (as it contains full)
     // transactions. First checking the underlying cache risks returning a pruned entry instead.
-    CTransaction tx;
-    if (mempool.lookup(txid, tx)) {
-        coins = CCoins(tx, MEMPOOL_HEIGHT);
+    CTransactionRef ptx = mempool.get(txid);
+    if (ptx) {
+        coins = CCoins(*ptx, MEMPOOL_HEIGHT);
         return true;
     }
     return (base->GetCoins(txid, coins) && !coins.IsPruned());
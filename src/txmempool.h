@@ -7,6 +7,7 @@
 #define BITCOIN_TXMEMPOOL_H
 
 #include <list>
+#include <set>
 
 #include "amount.h"
 #include "coins.h"
@@ -37,25 +38,69 @@ static const unsigned int MEMPOOL_HEIGHT = 0x7FFFFFFF;
 class CTxMemPoolEntry
 {
 private:
-    CTransaction tx;
+    CTransactionRef tx;   //! Shared with whoever else holds the transaction; null only in default constructed entries
     CAmount nFee;         //! Cached to avoid expensive parent-transaction lookups
     size_t nTxSize;       //! ... and avoid recomputing tx size
     size_t nModSize;      //! ... and modified size for priority
     int64_t nTime;        //! Local time when entering the mempool
     double dPriority;     //! Priority when entering the mempool
     unsigned int nHeight; //! Chain height when entering the mempool
+    CAmount nFeeDelta;    //! Fee delta from PrioritiseTransaction
+
+    //! Totals over this transaction and its unconfirmed ancestors, kept up to date by CTxMemPool
+    unsigned int nCountWithAncestors;
+    uint64_t nSizeWithAncestors;
+    CAmount nModFeesWithAncestors;
 
 public:
     CTxMemPoolEntry(const CTransaction& _tx, const CAmount& _nFee, int64_t _nTime, double _dPriority, unsigned int _nHeight);
+    CTxMemPoolEntry(const CTransactionRef& _tx, const CAmount& _nFee, int64_t _nTime, double _dPriority, unsigned int _nHeight);
     CTxMemPoolEntry();
     CTxMemPoolEntry(const CTxMemPoolEntry& other);
 
-    const CTransaction& GetTx() const { return this->tx; }
+    const CTransaction& GetTx() const { return *this->tx; }
+    const CTransactionRef& GetSharedTx() const { return this->tx; }
     double GetPriority(unsigned int currentHeight) const;
     CAmount GetFee() const { return nFee; }
     size_t GetTxSize() const { return nTxSize; }
     int64_t GetTime() const { return nTime; }
     unsigned int GetHeight() const { return nHeight; }
+    CAmount GetModifiedFee() const { return nFee + nFeeDelta; }
+
+    unsigned int GetCountWithAncestors() const { return nCountWithAncestors; }
+    uint64_t GetSizeWithAncestors() const { return nSizeWithAncestors; }
+    CAmount GetModFeesWithAncestors() const { return nModFeesWithAncestors; }
+
+    void UpdateFeeDelta(CAmount nNewFeeDelta);
+    void UpdateAncestorState(int64_t nSizeDelta, CAmount nModFeesDelta, int nCountDelta);
+};
+
+/**
+ * Position of a mempool transaction in CTxMemPool::setAncestorFeeRate: by
+ * the fee rate of the transaction together with its unconfirmed ancestors,
+ * highest first. A copy of the entry's totals is kept, so that the key can
+ * be found and erased after the entry changed.
+ */
+class CAncestorFeeRateKey
+{
+public:
+    CAmount nModFeesWithAncestors;
+    uint64_t nSizeWithAncestors;
+    uint256 hash;
+
+    CAncestorFeeRateKey(const uint256& hashIn, const CTxMemPoolEntry& entry) : nModFeesWithAncestors(entry.GetModFeesWithAncestors()), nSizeWithAncestors(entry.GetSizeWithAncestors()), hash(hashIn) {}
+
+    CFeeRate GetFeeRate() const { return CFeeRate(nModFeesWithAncestors, nSizeWithAncestors); }
+
+    friend bool operator<(const CAncestorFeeRateKey& a, const CAncestorFeeRateKey& b)
+    {
+        // Compare a.fees/a.size with b.fees/b.size without dividing
+        double f1 = (double)a.nModFeesWithAncestors * b.nSizeWithAncestors;
+        double f2 = (double)b.nModFeesWithAncestors * a.nSizeWithAncestors;
+        if (f1 != f2)
+            return f1 > f2;
+        return a.hash < b.hash;
+    }
 };
 
 class CMinerPolicyEstimator;
@@ -101,11 +146,18 @@ private:
     CFeeRate minRelayFee; //! Passed to constructor to avoid dependency on main
     uint64_t totalTxSize; //! sum of all mempool tx' byte sizes
 
+    void CalculateAncestors(const CTransaction& tx, std::set<uint256>& setAncestors) const;
+    void CalculateDescendants(const uint256& hash, std::set<uint256>& setDescendants) const;
+    void UpdateEntryAncestorState(const uint256& hash, int64_t nSizeDelta, CAmount nModFeesDelta, int nCountDelta);
+    void RecalculateAncestorState(const uint256& hash);
+
 public:
     mutable CCriticalSection cs;
     std::map<uint256, CTxMemPoolEntry> mapTx;
     std::map<COutPoint, CInPoint> mapNextTx;
     std::map<uint256, std::pair<double, CAmount> > mapDeltas;
+    //! Every transaction in mapTx, best ancestor fee rate first, for block assembly
+    std::set<CAncestorFeeRateKey> setAncestorFeeRate;
 
     CTxMemPool(const CFeeRate& _minRelayFee);
     ~CTxMemPool();
@@ -120,10 +172,10 @@ public:
     void setSanityCheck(bool _fSanityCheck) { fSanityCheck = _fSanityCheck; }
 
     bool addUnchecked(const uint256& hash, const CTxMemPoolEntry& entry);
-    void remove(const CTransaction& tx, std::list<CTransaction>& removed, bool fRecursive = false);
+    void remove(const CTransaction& tx, std::list<CTransactionRef>& removed, bool fRecursive = false);
     void removeCoinbaseSpends(const CCoinsViewCache* pcoins, unsigned int nMemPoolHeight);
-    void removeConflicts(const CTransaction& tx, std::list<CTransaction>& removed);
-    void removeForBlock(const std::vector<CTransaction>& vtx, unsigned int nBlockHeight, std::list<CTransaction>& conflicts);
+    void removeConflicts(const CTransaction& tx, std::list<CTransactionRef>& removed);
+    void removeForBlock(const std::vector<CTransactionRef>& vtx, unsigned int nBlockHeight, std::list<CTransactionRef>& conflicts);
     void clear();
     void queryHashes(std::vector<uint256>& vtxid);
     void pruneSpent(const uint256& hash, CCoins& coins);
@@ -153,6 +205,8 @@ public:
     }
 
     bool lookup(uint256 hash, CTransaction& result) const;
+    //! The pooled transaction itself rather than a copy, or null if it isn't in the pool
+    CTransactionRef get(const uint256& hash) const;
 
     /** Estimate fee rate needed to get into the next nBlocks */
     CFeeRate estimateFee(int nBlocks) const;
@@ -13,6 +13,7 @@
 
 #include "allocators.h"
 #include "chainparamsbase.h"
+#include "perfstats.h"
 #include "random.h"
 #include "serialize.h"
 #include "sync.h"
@@ -41,6 +42,7 @@
 #endif // __linux__
 
 #include <algorithm>
+#include <atomic>
 #include <fcntl.h>
 #include <sys/resource.h>
 #include <sys/stat.h>
@@ -216,49 +218,146 @@ static void DebugPrintInit()
     mutexDebugLog = new boost::mutex();
 }
 
-bool LogAcceptCategory(const char* category)
+/**
+ * LogPrint categories, sorted by name. Each has a bit in
+ * nLogCategoryMask, so while no -debug output is asked for a LogPrint
+ * costs one load and test, and otherwise a search of this table.
+ */
+static const char* const pszLogCategories[] = {
+    "addrman", "alert", "bench", "blockfiles", "coindb", "coinmix", "db", "debug", "estimatefee", "fastsend", "lock", "masternode",
+    "mempool", "mnbudget", "mnpayments", "net", "pow", "qt", "rand", "reindex", "rpc", "selectcoins", "staking", "zmq"};
+//! Shared by categories missing from the table, which are only logged along with everything else
+static const uint64_t LOG_CATEGORY_OTHER = (uint64_t)1 << 63;
+static const uint64_t LOG_CATEGORY_ALL = ~(uint64_t)0;
+
+static std::atomic<uint64_t> nLogCategoryMask(0);
+static std::atomic<bool> fLogCategoriesInit(false);
+
+static uint64_t LogCategoryBit(const char* category)
+{
+    int nBegin = 0;
+    int nEnd = ARRAYLEN(pszLogCategories);
+    while (nBegin < nEnd) {
+        int nMid = (nBegin + nEnd) / 2;
+        int nCmp = strcmp(category, pszLogCategories[nMid]);
+        if (nCmp == 0)
+            return (uint64_t)1 << nMid;
+        if (nCmp < 0)
+            nEnd = nMid;
+        else
+            nBegin = nMid + 1;
+    }
+    return LOG_CATEGORY_OTHER;
+}
+
+//! Bits for a -debug or logging RPC argument, 0 if it names no category
+static uint64_t LogCategoryMask(const std::string& category)
 {
-    if (category != NULL) {
-        if (!fDebug)
-            return false;
-
-        // Give each thread quick access to -debug settings.
-        // This helps prevent issues debugging global destructors,
-        // where mapMultiArgs might be deleted before another
-        // global destructor calls LogPrint()
-        static boost::thread_specific_ptr<set<string> > ptrCategory;
-        if (ptrCategory.get() == NULL) {
-            const vector<string>& categories = mapMultiArgs["-debug"];
-            ptrCategory.reset(new set<string>(categories.begin(), categories.end()));
-            // thread_specific_ptr automatically deletes the set when the thread ends.
-            // "sling" is a composite category enabling all Sling-related debug output
-            if (ptrCategory->count(string("sling"))) {
-                ptrCategory->insert(string("coinmix"));
-                ptrCategory->insert(string("fastsend"));
-                ptrCategory->insert(string("masternode"));
-                ptrCategory->insert(string("mnpayments"));
-                ptrCategory->insert(string("mnbudget"));
-            }
-        }
-        const set<string>& setCategories = *ptrCategory.get();
+    if (category == "" || category == "1" || category == "all")
+        return LOG_CATEGORY_ALL;
+    // "sling" is a composite category enabling all Sling-related debug output
+    if (category == "sling")
+        return LogCategoryBit("coinmix") | LogCategoryBit("fastsend") | LogCategoryBit("masternode") | LogCategoryBit("mnpayments") | LogCategoryBit("mnbudget");
+    uint64_t nBit = LogCategoryBit(category.c_str());
+    return nBit == LOG_CATEGORY_OTHER ? 0 : nBit;
+}
 
-        // if not debugging everything and not debugging specific category, LogPrint does nothing.
-        if (setCategories.count(string("")) == 0 &&
-            setCategories.count(string(category)) == 0)
-            return false;
+void InitLogCategories()
+{
+    uint64_t nMask = 0;
+    if (fDebug) {
+        const vector<string>& categories = mapMultiArgs["-debug"];
+        BOOST_FOREACH (const string& category, categories)
+            nMask |= LogCategoryMask(category);
     }
+    nLogCategoryMask.store(nMask, std::memory_order_relaxed);
+    fLogCategoriesInit.store(true, std::memory_order_release);
+}
+
+bool LogAcceptCategory(const char* category)
+{
+    if (category == NULL)
+        return true;
+    // Settings are read from -debug the first time, in case InitLogCategories wasn't called
+    if (!fLogCategoriesInit.load(std::memory_order_acquire))
+        InitLogCategories();
+    uint64_t nMask = nLogCategoryMask.load(std::memory_order_relaxed);
+    return nMask != 0 && (nMask & LogCategoryBit(category)) != 0;
+}
+
+bool SetLogCategory(const std::string& category, bool fEnable)
+{
+    uint64_t nBits = LogCategoryMask(category);
+    if (nBits == 0)
+        return false;
+    if (!fLogCategoriesInit.load(std::memory_order_acquire))
+        InitLogCategories();
+    if (fEnable)
+        nLogCategoryMask.fetch_or(nBits);
+    else
+        nLogCategoryMask.fetch_and(~nBits);
     return true;
 }
 
-int LogPrintStr(const std::string& str)
+std::vector<std::pair<std::string, bool> > GetLogCategories()
+{
+    uint64_t nMask = nLogCategoryMask.load(std::memory_order_relaxed);
+    std::vector<std::pair<std::string, bool> > vCategories;
+    for (unsigned int i = 0; i < ARRAYLEN(pszLogCategories); i++)
+        vCategories.push_back(std::make_pair(std::string(pszLogCategories[i]), (nMask & ((uint64_t)1 << i)) != 0));
+    return vCategories;
+}
+
+/**
+ * Once StartLogWriter has run, LogPrintStr only appends the line to
+ * vLogQueue, and the log writer thread takes the whole queue at a time and
+ * writes it with one call. Lines logged before the thread starts or after
+ * it stops are written by the caller. The queue holds at most
+ * MAX_LOG_QUEUE_BYTES; lines beyond that are dropped and counted.
+ */
+static const size_t MAX_LOG_QUEUE_BYTES = 16 * 1024 * 1024;
+
+struct CLogLine {
+    int64_t nTime;
+    std::string str;
+
+    CLogLine(int64_t nTimeIn, const std::string& strIn) : nTime(nTimeIn), str(strIn) {}
+};
+
+static boost::once_flag logQueueInitFlag = BOOST_ONCE_INIT;
+static boost::mutex* mutexLogQueue = NULL;
+static boost::condition_variable* condLogQueue = NULL;
+static std::vector<CLogLine>* pvLogQueue = NULL;
+static size_t nLogQueueBytes = 0;
+static boost::thread* pthreadLogWriter = NULL;
+static bool fLogWriterRunning = false;
+static bool fLogWriterStop = false;
+
+static CPerfCounter counterLogDropped("log.dropped_lines", "Log lines dropped because the log writer fell behind");
+static CPerfCounter counterLogWritten("log.written_lines", "Log lines written by the log writer thread");
+static CPerfCounter counterLogBatches("log.batches", "Writes of queued log lines by the log writer thread");
+
+static void LogQueueInit()
+{
+    // Never deleted, like mutexDebugLog, so that logging from global destructors works
+    mutexLogQueue = new boost::mutex();
+    condLogQueue = new boost::condition_variable();
+    pvLogQueue = new std::vector<CLogLine>();
+}
+
+//! Write lines to the console or debug.log, a timestamp in front of every line begun
+static int WriteLogLines(const std::vector<CLogLine>& vLines)
 {
     int ret = 0; // Returns total number of characters written
     if (fPrintToConsole) {
         // print to console
-        ret = fwrite(str.data(), 1, str.size(), stdout);
+        for (unsigned int i = 0; i < vLines.size(); i++)
+            ret += fwrite(vLines[i].str.data(), 1, vLines[i].str.size(), stdout);
         fflush(stdout);
     } else if (fPrintToDebugLog && AreBaseParamsConfigured()) {
         static bool fStartedNewLine = true;
+        static int64_t nLastTime = 0;
+        static std::string strLastTime;
         boost::call_once(&DebugPrintInit, debugPrintInitFlag);
 
         if (fileout == NULL)
@@ -274,20 +373,104 @@ int LogPrintStr(const std::string& str)
                 setbuf(fileout, NULL); // unbuffered
         }
 
-        // Debug print useful for profiling
-        if (fLogTimestamps && fStartedNewLine)
-            ret += fprintf(fileout, "%s ", DateTimeStrFormat("%Y-%m-%d %H:%M:%S", GetTime()).c_str());
-        if (!str.empty() && str[str.size() - 1] == '\n')
-            fStartedNewLine = true;
-        else
-            fStartedNewLine = false;
+        std::string strOut;
+        for (unsigned int i = 0; i < vLines.size(); i++) {
+            const std::string& str = vLines[i].str;
+            // Debug print useful for profiling
+            if (fLogTimestamps && fStartedNewLine) {
+                if (vLines[i].nTime != nLastTime || strLastTime.empty()) {
+                    nLastTime = vLines[i].nTime;
+                    strLastTime = DateTimeStrFormat("%Y-%m-%d %H:%M:%S", nLastTime) + " ";
+                }
+                strOut += strLastTime;
+            }
+            if (!str.empty() && str[str.size() - 1] == '\n')
+                fStartedNewLine = true;
+            else
+                fStartedNewLine = false;
+            strOut += str;
+        }
 
-        ret = fwrite(str.data(), 1, str.size(), fileout);
+        ret = fwrite(strOut.data(), 1, strOut.size(), fileout);
     }
 
     return ret;
 }
 
+static void ThreadLogWriter()
+{
+    RenameThread("sling-log");
+    std::vector<CLogLine> vBatch;
+    while (true) {
+        {
+            boost::mutex::scoped_lock lock(*mutexLogQueue);
+            while (pvLogQueue->empty() && !fLogWriterStop)
+                condLogQueue->wait(lock);
+            if (pvLogQueue->empty()) {
+                // Stopping, and all is written; from here on callers write their own lines
+                fLogWriterRunning = false;
+                return;
+            }
+            vBatch.swap(*pvLogQueue);
+            nLogQueueBytes = 0;
+        }
+        WriteLogLines(vBatch);
+        counterLogWritten.Inc(vBatch.size());
+        counterLogBatches.Inc();
+        vBatch.clear();
+    }
+}
+
+void StartLogWriter()
+{
+    boost::call_once(&LogQueueInit, logQueueInitFlag);
+    boost::mutex::scoped_lock lock(*mutexLogQueue);
+    if (pthreadLogWriter)
+        return;
+    fLogWriterStop = false;
+    fLogWriterRunning = true;
+    pthreadLogWriter = new boost::thread(&ThreadLogWriter);
+}
+
+void StopLogWriter()
+{
+    boost::call_once(&LogQueueInit, logQueueInitFlag);
+    boost::thread* pthread = NULL;
+    {
+        boost::mutex::scoped_lock lock(*mutexLogQueue);
+        pthread = pthreadLogWriter;
+        pthreadLogWriter = NULL;
+        fLogWriterStop = true;
+        condLogQueue->notify_all();
+    }
+    if (pthread) {
+        pthread->join();
+        delete pthread;
+    }
+}
+
+int LogPrintStr(const std::string& str)
+{
+    boost::call_once(&LogQueueInit, logQueueInitFlag);
+    {
+        boost::mutex::scoped_lock lock(*mutexLogQueue);
+        if (fLogWriterRunning) {
+            if (nLogQueueBytes + str.size() > MAX_LOG_QUEUE_BYTES) {
+                counterLogDropped.Inc();
+                return 0;
+            }
+            // The writer only waits while the queue is empty
+            if (pvLogQueue->empty())
+                condLogQueue->notify_one();
+            pvLogQueue->push_back(CLogLine(GetTime(), str));
+            nLogQueueBytes += str.size();
+            return str.size();
+        }
+    }
+
+    return WriteLogLines(std::vector<CLogLine>(1, CLogLine(GetTime(), str)));
+}
+
 /** Interpret string as boolean, for argument parsing */
 static bool InterpretBool(const std::string& strValue)
 {
@@ -61,8 +61,19 @@ void SetupEnvironment();
 
 /** Return true if log accepts specified category */
 bool LogAcceptCategory(const char* category);
+/** Read the enabled categories from -debug, once fDebug is set */
+void InitLogCategories();
+/** Turn a category ("all" and "sling" included) on or off at runtime; false if there is no such category.
+ *  fDebug, which gates output outside the categories, keeps the value -debug gave it. */
+bool SetLogCategory(const std::string& category, bool fEnable);
+/** Every category and whether it is logged */
+std::vector<std::pair<std::string, bool> > GetLogCategories();
 /** Send a string to the log output */
 int LogPrintStr(const std::string& str);
+/** Hand log output to a background thread, which writes it out in batches */
+void StartLogWriter();
+/** Write out what is queued and stop the log writer thread; callers write their own lines again */
+void StopLogWriter();
 
 #define LogPrintf(...) LogPrint(NULL, __VA_ARGS__)
 
@@ -14,6 +14,7 @@
 #include "kernel.h"
 #include "masternode-budget.h"
 #include "net.h"
+#include "perfstats.h"
 #include "script/script.h"
 #include "script/sign.h"
 #include "spork.h"
@@ -39,6 +40,9 @@ unsigned int nTxConfirmTarget = 1;
 bool bSpendZeroConfChange = true;
 bool fSendFreeTransactions = false;
 bool fPayAtLeastCustomFee = true;
+int64_t nWalletWriteDelay = DEFAULT_WALLET_WRITE_DELAY;
+
+static CPerfHistogram histJournalFlush("wallet.journal_flush", "Time to write the queued wallet records in one database transaction");
 
 /** 
  * Fees smaller than this (in duffs) are considered zero fee (for transaction creation)
@@ -289,6 +293,9 @@ bool CWallet::ChangeWalletPassphrase(const SecureString& strOldWalletPassphrase,
 
 void CWallet::SetBestChain(const CBlockLocator& loc)
 {
+    // Never let the locator get ahead of the transactions found up to it,
+    // or a crash would lose them without a rescan bringing them back
+    FlushWalletJournal();
     CWalletDB walletdb(strWalletFile);
     walletdb.WriteBestBlock(loc);
 }
@@ -415,6 +422,15 @@ void CWallet::AddToSpends(const COutPoint& outpoint, const uint256& wtxid)
 }
 
 
+void CWallet::LinkLoadedTransactions()
+{
+    AssertLockHeld(cs_wallet); // mapWallet
+    for (map<uint256, CWalletTx>::iterator it = mapWallet.begin(); it != mapWallet.end(); ++it) {
+        it->second.BindWallet(this);
+        AddToSpends(it->first);
+    }
+}
+
 void CWallet::AddToSpends(const uint256& wtxid)
 {
     assert(mapWallet.count(wtxid));
@@ -586,33 +602,49 @@ int64_t CWallet::IncOrderPosNext(CWalletDB* pwalletdb)
     int64_t nRet = nOrderPosNext++;
     if (pwalletdb) {
         pwalletdb->WriteOrderPosNext(nOrderPosNext);
+        fJournalOrderPosNext = false;
+    } else if (fFileBacked && nWalletWriteDelay > 0) {
+        if (!nJournalSince)
+            nJournalSince = GetTimeMillis();
+        fJournalOrderPosNext = true;
     } else {
         CWalletDB(strWalletFile).WriteOrderPosNext(nOrderPosNext);
     }
     return nRet;
 }
 
-CWallet::TxItems CWallet::OrderedTxItems(std::list<CAccountingEntry>& acentries, std::string strAccount)
+void CWallet::BuildOrderedTxItems(CWalletDB& walletdb)
 {
     AssertLockHeld(cs_wallet); // mapWallet
-    CWalletDB walletdb(strWalletFile);
-
-    // First: get all CWalletTx and CAccountingEntry into a sorted-by-order multimap.
-    TxItems txOrdered;
 
-    // Note: maintaining indices in the database of (account,time) --> txid and (account, time) --> acentry
-    // would make this much faster for applications that do this a lot.
+    wtxOrdered.clear();
+    laccentries.clear();
     for (map<uint256, CWalletTx>::iterator it = mapWallet.begin(); it != mapWallet.end(); ++it) {
         CWalletTx* wtx = &((*it).second);
-        txOrdered.insert(make_pair(wtx->nOrderPos, TxPair(wtx, (CAccountingEntry*)0)));
+        wtxOrdered.insert(make_pair(wtx->nOrderPos, TxPair(wtx, (CAccountingEntry*)0)));
     }
-    acentries.clear();
-    walletdb.ListAccountCreditDebit(strAccount, acentries);
-    BOOST_FOREACH (CAccountingEntry& entry, acentries) {
-        txOrdered.insert(make_pair(entry.nOrderPos, TxPair((CWalletTx*)0, &entry)));
+    walletdb.ListAccountCreditDebit("*", laccentries);
+    BOOST_FOREACH (CAccountingEntry& entry, laccentries) {
+        wtxOrdered.insert(make_pair(entry.nOrderPos, TxPair((CWalletTx*)0, &entry)));
     }
+}
+
+bool CWallet::AddAccountingEntry(const CAccountingEntry& acentry, CWalletDB& walletdb)
+{
+    AssertLockHeld(cs_wallet); // wtxOrdered
+    if (!walletdb.WriteAccountingEntry(acentry))
+        return false;
 
-    return txOrdered;
+    LoadAccountingEntry(acentry);
+    return true;
+}
+
+void CWallet::LoadAccountingEntry(const CAccountingEntry& acentry)
+{
+    AssertLockHeld(cs_wallet); // wtxOrdered
+    laccentries.push_back(acentry);
+    CAccountingEntry& entry = laccentries.back();
+    wtxOrdered.insert(make_pair(entry.nOrderPos, TxPair((CWalletTx*)0, &entry)));
 }
 
 void CWallet::MarkDirty()
@@ -629,9 +661,8 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet)
     uint256 hash = wtxIn.GetHash();
 
     if (fFromLoadWallet) {
+        // Bound and indexed by LinkLoadedTransactions once all are loaded
         mapWallet[hash] = wtxIn;
-        mapWallet[hash].BindWallet(this);
-        AddToSpends(hash);
     } else {
         LOCK(cs_wallet);
         // Inserts only if not already there, returns tx inserted or tx found
@@ -642,6 +673,7 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet)
         if (fInsertedNew) {
             wtx.nTimeReceived = GetAdjustedTime();
             wtx.nOrderPos = IncOrderPosNext();
+            wtxOrdered.insert(make_pair(wtx.nOrderPos, TxPair(&wtx, (CAccountingEntry*)0)));
 
             wtx.nTimeSmart = wtx.nTimeReceived;
             if (wtxIn.hashBlock != 0) {
@@ -651,9 +683,7 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet)
                     {
                         // Tolerate times up to the last timestamp in the wallet not more than 5 minutes into the future
                         int64_t latestTolerated = latestNow + 300;
-                        std::list<CAccountingEntry> acentries;
-                        TxItems txOrdered = OrderedTxItems(acentries);
-                        for (TxItems::reverse_iterator it = txOrdered.rbegin(); it != txOrdered.rend(); ++it) {
+                        for (TxItems::reverse_iterator it = wtxOrdered.rbegin(); it != wtxOrdered.rend(); ++it) {
                             CWalletTx* const pwtx = (*it).second.first;
                             if (pwtx == &wtx)
                                 continue;
@@ -682,6 +712,7 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet)
                         wtxIn.hashBlock.ToString());
             }
             AddToSpends(hash);
+            UpdateCoinMixRounds(hash);
         }
 
         bool fUpdated = false;
@@ -749,8 +780,9 @@ bool CWallet::AddToWalletIfInvolvingMe(const CTransaction& tx, const CBlock* pbl
     return false;
 }
 
-void CWallet::SyncTransaction(const CTransaction& tx, const CBlock* pblock)
+void CWallet::SyncTransaction(const CTransactionRef& ptx, const CBlock* pblock)
 {
+    const CTransaction& tx = *ptx;
     LOCK2(cs_main, cs_wallet);
     if (!AddToWalletIfInvolvingMe(tx, pblock, true))
         return; // Not one of ours
@@ -770,12 +802,99 @@ void CWallet::EraseFromWallet(const uint256& hash)
         return;
     {
         LOCK(cs_wallet);
-        if (mapWallet.erase(hash))
-            CWalletDB(strWalletFile).EraseTx(hash);
+        map<uint256, CWalletTx>::iterator mi = mapWallet.find(hash);
+        if (mi == mapWallet.end())
+            return;
+        std::pair<TxItems::iterator, TxItems::iterator> range = wtxOrdered.equal_range(mi->second.nOrderPos);
+        for (TxItems::iterator it = range.first; it != range.second; ++it) {
+            if (it->second.first == &mi->second) {
+                wtxOrdered.erase(it);
+                break;
+            }
+        }
+        // Its spenders lose an input of ours, which can shorten their chains
+        std::vector<uint256> vSpenders;
+        for (unsigned int i = 0; i < mi->second.vout.size(); i++) {
+            std::pair<TxSpends::const_iterator, TxSpends::const_iterator> range = mapTxSpends.equal_range(COutPoint(hash, i));
+            for (TxSpends::const_iterator it = range.first; it != range.second; ++it)
+                vSpenders.push_back(it->second);
+        }
+        mapWallet.erase(mi);
+        setJournalTx.erase(hash);
+        setJournalRounds.erase(hash);
+        mapCoinMixRounds.erase(hash);
+        CWalletDB(strWalletFile).EraseTx(hash);
+        CWalletDB(strWalletFile).EraseCoinMixRounds(hash);
+        BOOST_FOREACH (const uint256& hashSpender, vSpenders)
+            UpdateCoinMixRounds(hashSpender);
     }
     return;
 }
 
+bool CWallet::QueueTxWrite(const uint256& hash) const
+{
+    LOCK(cs_wallet);
+    if (!nJournalSince)
+        nJournalSince = GetTimeMillis();
+    setJournalTx.insert(hash);
+    if (setJournalTx.size() >= MAX_WALLET_JOURNAL_SIZE)
+        return FlushWalletJournal();
+    return true;
+}
+
+bool CWallet::FlushWalletJournal() const
+{
+    LOCK(cs_wallet);
+    if (setJournalTx.empty() && setJournalRounds.empty() && !fJournalOrderPosNext)
+        return true;
+
+    CPerfTimer timer(histJournalFlush);
+    CWalletDB walletdb(strWalletFile);
+    if (!walletdb.TxnBegin())
+        return error("%s : could not begin a database transaction", __func__);
+    BOOST_FOREACH (const uint256& hash, setJournalTx) {
+        map<uint256, CWalletTx>::const_iterator mi = mapWallet.find(hash);
+        if (mi != mapWallet.end() && !walletdb.WriteTx(hash, mi->second)) {
+            walletdb.TxnAbort();
+            return error("%s : failed to write transaction %s", __func__, hash.ToString());
+        }
+    }
+    BOOST_FOREACH (const uint256& hash, setJournalRounds) {
+        map<uint256, std::vector<int8_t> >::const_iterator mi = mapCoinMixRounds.find(hash);
+        if (mi != mapCoinMixRounds.end() && !walletdb.WriteCoinMixRounds(hash, mi->second)) {
+            walletdb.TxnAbort();
+            return error("%s : failed to write the CoinMix rounds of %s", __func__, hash.ToString());
+        }
+    }
+    if (fJournalOrderPosNext && !walletdb.WriteOrderPosNext(nOrderPosNext)) {
+        walletdb.TxnAbort();
+        return error("%s : failed to write the next order position", __func__);
+    }
+    if (!walletdb.TxnCommit())
+        return error("%s : could not commit the database transaction", __func__);
+
+    LogPrint("db", "%s : wrote %u transactions, %dms after the first was queued\n", __func__, setJournalTx.size(), GetTimeMillis() - nJournalSince);
+    setJournalTx.clear();
+    setJournalRounds.clear();
+    fJournalOrderPosNext = false;
+    nJournalSince = 0;
+    return true;
+}
+
+void CWallet::FlushWalletJournalIfDue() const
+{
+    // Try again on the next call rather than wait for a busy wallet
+    TRY_LOCK(cs_wallet, lockWallet);
+    if (lockWallet && nJournalSince && GetTimeMillis() - nJournalSince >= nWalletWriteDelay)
+        FlushWalletJournal();
+}
+
+size_t CWallet::GetJournalSize() const
+{
+    LOCK(cs_wallet);
+    return setJournalTx.size();
+}
+
 
 isminetype CWallet::IsMine(const CTxIn& txin) const
 {
@@ -806,68 +925,50 @@ CAmount CWallet::GetDebit(const CTxIn& txin, const isminefilter& filter) const
     return 0;
 }
 
-// Recursively determine the rounds of a given input (How deep is the CoinMix chain for a given input)
+// Determine the rounds of a given input (How deep is the CoinMix chain for a given input)
 int CWallet::GetRealInputCoinMixRounds(CTxIn in, int rounds) const
 {
-    static std::map<uint256, CMutableTransaction> mDenomWtxes;
-
     if (rounds >= 16) return 15; // 16 rounds max
 
     uint256 hash = in.prevout.hash;
     unsigned int nout = in.prevout.n;
 
     const CWalletTx* wtx = GetWalletTx(hash);
-    if (wtx != NULL) {
-        std::map<uint256, CMutableTransaction>::const_iterator mdwi = mDenomWtxes.find(hash);
-        // not known yet, let's add it
-        if (mdwi == mDenomWtxes.end()) {
-            LogPrint("coinmix", "GetInputCoinMixRounds INSERTING %s\n", hash.ToString());
-            mDenomWtxes[hash] = CMutableTransaction(*wtx);
-        }
-        // found and it's not an initial value, just return it
-        else if (mDenomWtxes[hash].vout[nout].nRounds != -10) {
-            return mDenomWtxes[hash].vout[nout].nRounds;
-        }
-
+    if (wtx == NULL)
+        return rounds - 1;
 
-        // bounds check
-        if (nout >= wtx->vout.size()) {
-            // should never actually hit this
-            LogPrint("coinmix", "GetInputCoinMixRounds UPDATED   %s %3d %3d\n", hash.ToString(), nout, -4);
-            return -4;
-        }
+    // bounds check
+    if (nout >= wtx->vout.size()) {
+        // should never actually hit this
+        LogPrint("coinmix", "GetInputCoinMixRounds UPDATED   %s %3d %3d\n", hash.ToString(), nout, -4);
+        return -4;
+    }
 
-        if (pwalletMain->IsCollateralAmount(wtx->vout[nout].nValue)) {
-            mDenomWtxes[hash].vout[nout].nRounds = -3;
-            LogPrint("coinmix", "GetInputCoinMixRounds UPDATED   %s %3d %3d\n", hash.ToString(), nout, mDenomWtxes[hash].vout[nout].nRounds);
-            return mDenomWtxes[hash].vout[nout].nRounds;
-        }
+    std::map<uint256, std::vector<int8_t> >::const_iterator mi = mapCoinMixRounds.find(hash);
+    if (mi == mapCoinMixRounds.end() || mi->second.size() != wtx->vout.size())
+        mi = CalculateCoinMixRounds(*wtx, rounds);
+    return mi->second[nout];
+}
 
-        //make sure the final output is non-denominate
-        if (/*rounds == 0 && */ !IsDenominatedAmount(wtx->vout[nout].nValue)) //NOT DENOM
-        {
-            mDenomWtxes[hash].vout[nout].nRounds = -2;
-            LogPrint("coinmix", "GetInputCoinMixRounds UPDATED   %s %3d %3d\n", hash.ToString(), nout, mDenomWtxes[hash].vout[nout].nRounds);
-            return mDenomWtxes[hash].vout[nout].nRounds;
-        }
+std::map<uint256, std::vector<int8_t> >::const_iterator CWallet::CalculateCoinMixRounds(const CWalletTx& wtx, int rounds) const
+{
+    AssertLockHeld(cs_wallet);
+    uint256 hash = wtx.GetHash();
 
-        bool fAllDenoms = true;
-        BOOST_FOREACH (CTxOut out, wtx->vout) {
-            fAllDenoms = fAllDenoms && IsDenominatedAmount(out.nValue);
-        }
-        // this one is denominated but there is another non-denominated output found in the same tx
-        if (!fAllDenoms) {
-            mDenomWtxes[hash].vout[nout].nRounds = 0;
-            LogPrint("coinmix", "GetInputCoinMixRounds UPDATED   %s %3d %3d\n", hash.ToString(), nout, mDenomWtxes[hash].vout[nout].nRounds);
-            return mDenomWtxes[hash].vout[nout].nRounds;
-        }
+    bool fAllDenoms = true;
+    BOOST_FOREACH (const CTxOut& out, wtx.vout) {
+        fAllDenoms = fAllDenoms && IsDenominatedAmount(out.nValue);
+    }
 
+    // Denominated outputs of a transaction paying out nothing else are one
+    // round further than the shortest chain among its own inputs
+    int nChainRounds = 0;
+    if (fAllDenoms) {
         int nShortest = -10; // an initial value, should be no way to get this by calculations
         bool fDenomFound = false;
-        // only denoms here so let's look up
-        BOOST_FOREACH (CTxIn in2, wtx->vin) {
-            if (IsMine(in2)) {
-                int n = GetRealInputCoinMixRounds(in2, rounds + 1);
+        BOOST_FOREACH (const CTxIn& in, wtx.vin) {
+            if (IsMine(in)) {
+                int n = GetRealInputCoinMixRounds(in, rounds + 1);
                 // denom found, find the shortest chain or initially assign nShortest with the first found value
                 if (n >= 0 && (n < nShortest || nShortest == -10)) {
                     nShortest = n;
@@ -875,14 +976,101 @@ int CWallet::GetRealInputCoinMixRounds(CTxIn in, int rounds) const
                 }
             }
         }
-        mDenomWtxes[hash].vout[nout].nRounds = fDenomFound ? (nShortest >= 15 ? 16 : nShortest + 1) // good, we a +1 to the shortest one but only 16 rounds max allowed
-                                                             :
-                                                             0; // too bad, we are the fist one in that chain
-        LogPrint("coinmix", "GetInputCoinMixRounds UPDATED   %s %3d %3d\n", hash.ToString(), nout, mDenomWtxes[hash].vout[nout].nRounds);
-        return mDenomWtxes[hash].vout[nout].nRounds;
+        nChainRounds = fDenomFound ? (nShortest >= 15 ? 16 : nShortest + 1) // good, we a +1 to the shortest one but only 16 rounds max allowed
+                                     :
+                                     0; // too bad, we are the fist one in that chain
+    }
+
+    std::vector<int8_t> vRounds(wtx.vout.size());
+    for (unsigned int i = 0; i < wtx.vout.size(); i++) {
+        if (pwalletMain->IsCollateralAmount(wtx.vout[i].nValue))
+            vRounds[i] = -3;
+        else if (!IsDenominatedAmount(wtx.vout[i].nValue)) //NOT DENOM
+            vRounds[i] = -2;
+        else
+            vRounds[i] = nChainRounds; // 0 if there is another non-denominated output found in the same tx
+    }
+    LogPrint("coinmix", "GetInputCoinMixRounds UPDATED   %s %3d\n", hash.ToString(), nChainRounds);
+
+    std::vector<int8_t>& vStored = mapCoinMixRounds[hash];
+    vStored.swap(vRounds);
+    return mapCoinMixRounds.find(hash);
+}
+
+void CWallet::WriteCoinMixRounds(const uint256& hash)
+{
+    AssertLockHeld(cs_wallet);
+    const CWalletTx* wtx = GetWalletTx(hash);
+    std::map<uint256, std::vector<int8_t> >::const_iterator mi = mapCoinMixRounds.find(hash);
+    if (!fFileBacked || !wtx || mi == mapCoinMixRounds.end())
+        return;
+
+    // Rounds of other transactions don't depend on the inputs and are cheap to work out again
+    BOOST_FOREACH (const CTxOut& out, wtx->vout) {
+        if (!IsDenominatedAmount(out.nValue))
+            return;
+    }
+    if (nWalletWriteDelay > 0) {
+        if (!nJournalSince)
+            nJournalSince = GetTimeMillis();
+        setJournalRounds.insert(hash);
+    } else {
+        CWalletDB(strWalletFile).WriteCoinMixRounds(hash, mi->second);
+    }
+}
+
+void CWallet::UpdateCoinMixRounds(const uint256& hash)
+{
+    AssertLockHeld(cs_wallet);
+    std::deque<uint256> vToUpdate;
+    vToUpdate.push_back(hash);
+    while (!vToUpdate.empty()) {
+        uint256 hashUpdate = vToUpdate.front();
+        vToUpdate.pop_front();
+        const CWalletTx* wtx = GetWalletTx(hashUpdate);
+        if (!wtx)
+            continue;
+        std::vector<int8_t> vOld;
+        std::map<uint256, std::vector<int8_t> >::iterator mi = mapCoinMixRounds.find(hashUpdate);
+        if (mi != mapCoinMixRounds.end()) {
+            vOld.swap(mi->second);
+            mapCoinMixRounds.erase(mi);
+        }
+        if (CalculateCoinMixRounds(*wtx, 0)->second == vOld)
+            continue;
+        WriteCoinMixRounds(hashUpdate);
+
+        // A transaction that arrived after its spenders changes their rounds too
+        for (unsigned int i = 0; i < wtx->vout.size(); i++) {
+            std::pair<TxSpends::const_iterator, TxSpends::const_iterator> range = mapTxSpends.equal_range(COutPoint(hashUpdate, i));
+            for (TxSpends::const_iterator it = range.first; it != range.second; ++it)
+                vToUpdate.push_back(it->second);
+        }
     }
+}
 
-    return rounds - 1;
+void CWallet::LoadCoinMixRounds(const uint256& hash, const std::vector<int8_t>& vRounds)
+{
+    mapCoinMixRounds[hash] = vRounds;
+}
+
+void CWallet::ResetCoinMixRounds()
+{
+    LOCK(cs_wallet);
+    // Only inputs that are ours count, so a new key can change the rounds of any transaction
+    std::map<uint256, std::vector<int8_t> > mapOld;
+    mapOld.swap(mapCoinMixRounds);
+    for (std::map<uint256, std::vector<int8_t> >::const_iterator it = mapOld.begin(); it != mapOld.end(); ++it) {
+        const CWalletTx* wtx = GetWalletTx(it->first);
+        if (!wtx)
+            continue;
+        // Working out one transaction fills in the ones it spends on the way
+        std::map<uint256, std::vector<int8_t> >::const_iterator mi = mapCoinMixRounds.find(it->first);
+        if (mi == mapCoinMixRounds.end())
+            mi = CalculateCoinMixRounds(*wtx, 0);
+        if (mi->second != it->second)
+            WriteCoinMixRounds(it->first);
+    }
 }
 
 // respect current settings
@@ -1074,6 +1262,9 @@ void CWalletTx::GetAccountAmounts(const string& strAccount, CAmount& nReceived,
 
 bool CWalletTx::WriteToDisk()
 {
+    // Written along with the wallet's other changes within -walletwritedelay
+    if (pwallet->fFileBacked && nWalletWriteDelay > 0)
+        return pwallet->QueueTxWrite(GetHash());
     return CWalletDB(pwallet->strWalletFile).WriteTx(GetHash(), *this);
 }
 
@@ -1105,8 +1296,8 @@ int CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate)
 
             CBlock block;
             ReadBlockFromDisk(block, pindex);
-            BOOST_FOREACH (CTransaction& tx, block.vtx) {
-                if (AddToWalletIfInvolvingMe(tx, &block, fUpdate))
+            BOOST_FOREACH (const CTransactionRef& ptx, block.vtx) {
+                if (AddToWalletIfInvolvingMe(*ptx, &block, fUpdate))
                     ret++;
             }
             pindex = chainActive.Next(pindex);
@@ -1155,7 +1346,7 @@ void CWalletTx::RelayWalletTransaction(std::string strCommand)
             LogPrintf("Relaying wtx %s\n", hash.ToString());
 
             if (strCommand == "ix") {
-                mapTxLockReq.insert(make_pair(hash, (CTransaction) * this));
+                mapTxLockReq.insert(make_pair(hash, MakeTransactionRef((CTransaction) * this)));
                 CreateNewLock(((CTransaction) * this));
                 RelayTransactionLockReq((CTransaction) * this, true);
             } else {
@@ -2336,20 +2527,21 @@ bool CWallet::CreateCoinStake(const CKeyStore& keystore, unsigned int nBits, int
     scriptEmpty.clear();
     txNew.vout.push_back(CTxOut(0, scriptEmpty));
 
-    // Choose coins to use
-    CAmount nBalance = GetBalance();
-
     if (mapArgs.count("-reservebalance") && !ParseMoney(mapArgs["-reservebalance"], nReserveBalance))
         return error("CreateCoinStake : invalid reserve balance amount");
 
-    if (nBalance <= nReserveBalance)
-        return false;
-
     // presstab HyperStake - Initialize as static and don't update the set on every run of CreateCoinStake() in order to lighten resource use
     static std::set<pair<const CWalletTx*, unsigned int> > setStakeCoins;
     static int nLastStakeSetUpdate = 0;
 
+    // The balance walks the whole wallet, so it is only taken to pick the
+    // stake coins and to check a kernel that was found
+    CAmount nBalance = 0;
     if (GetTime() - nLastStakeSetUpdate > nStakeSetUpdateTime) {
+        nBalance = GetBalance();
+        if (nBalance <= nReserveBalance)
+            return false;
+
         setStakeCoins.clear();
         if (!SelectStakeCoins(setStakeCoins, nBalance - nReserveBalance))
             return false;
@@ -2452,7 +2644,11 @@ bool CWallet::CreateCoinStake(const CKeyStore& keystore, unsigned int nBits, int
         if (fKernelFound)
             break; // if kernel is found stop searching
     }
-    if (nCredit == 0 || nCredit > nBalance - nReserveBalance)
+    if (nCredit == 0)
+        return false;
+    if (!nBalance)
+        nBalance = GetBalance();
+    if (nCredit > nBalance - nReserveBalance)
         return false;
 
     // Calculate reward
@@ -2745,6 +2941,12 @@ DBErrors CWallet::LoadWallet(bool& fFirstRunRet)
         return nLoadWalletRet;
     fFirstRunRet = !vchDefaultKey.IsValid();
 
+    {
+        LOCK(cs_wallet);
+        CWalletDB walletdb(strWalletFile);
+        BuildOrderedTxItems(walletdb);
+    }
+
     uiInterface.LoadWallet(this);
 
     return DB_LOAD_OK;
@@ -2756,6 +2958,12 @@ DBErrors CWallet::ZapWalletTx(std::vector<CWalletTx>& vWtx)
     if (!fFileBacked)
         return DB_LOAD_OK;
     DBErrors nZapWalletTxRet = CWalletDB(strWalletFile, "cr+").ZapWalletTx(this, vWtx);
+    {
+        // The records of the rounds went with the transactions
+        LOCK(cs_wallet);
+        mapCoinMixRounds.clear();
+        setJournalRounds.clear();
+    }
     if (nZapWalletTxRet == DB_NEED_REWRITE) {
         if (CDB::Rewrite(strWalletFile, "\x04pool")) {
             LOCK(cs_wallet);
@@ -3539,7 +3747,7 @@ int CMerkleTx::SetMerkleBranch(const CBlock& block)
 
     // Locate the transaction
     for (nIndex = 0; nIndex < (int)block.vtx.size(); nIndex++)
-        if (block.vtx[nIndex] == *(CTransaction*)this)
+        if (*block.vtx[nIndex] == *(CTransaction*)this)
             break;
     if (nIndex == (int)block.vtx.size()) {
         vMerkleBranch.clear();
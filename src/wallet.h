@@ -24,6 +24,7 @@
 #include "walletdb.h"
 
 #include <algorithm>
+#include <list>
 #include <map>
 #include <set>
 #include <stdexcept>
@@ -41,6 +42,7 @@ extern unsigned int nTxConfirmTarget;
 extern bool bSpendZeroConfChange;
 extern bool fSendFreeTransactions;
 extern bool fPayAtLeastCustomFee;
+extern int64_t nWalletWriteDelay;
 
 //! -paytxfee default
 static const CAmount DEFAULT_TRANSACTION_FEE = 0;
@@ -52,6 +54,10 @@ static const CAmount DEFAULT_TRANSACTION_MAXFEE = 1 * COIN;
 static const CAmount nHighTransactionMaxFeeWarning = 100 * nHighTransactionFeeWarning;
 //! Largest (in bytes) free transaction we're willing to create
 static const unsigned int MAX_FREE_TRANSACTION_CREATE_SIZE = 1000;
+//! -walletwritedelay default, in milliseconds
+static const int64_t DEFAULT_WALLET_WRITE_DELAY = 1000;
+//! Queued transaction writes at which the wallet journal is written out regardless of its age
+static const unsigned int MAX_WALLET_JOURNAL_SIZE = 1000;
 
 class CAccountingEntry;
 class CCoinControl;
@@ -147,6 +153,37 @@ private:
     int64_t nNextResend;
     int64_t nLastResend;
 
+    /**
+     * Write-behind journal: wallet transactions changed in memory whose
+     * records haven't been written to the wallet file yet, and whether
+     * nOrderPosNext needs writing. Queued records are written together in
+     * one database transaction, from the current mapWallet entry, so a
+     * transaction changed several times before a flush is written once.
+     * Mutable as it only tracks what the file lags behind the wallet.
+     */
+    mutable std::set<uint256> setJournalTx;
+    mutable bool fJournalOrderPosNext;
+    //! When the oldest queued record was queued, in milliseconds (0 while empty)
+    mutable int64_t nJournalSince;
+    //! Transactions whose CoinMix rounds record waits for the journal flush
+    mutable std::set<uint256> setJournalRounds;
+
+    /**
+     * CoinMix rounds of the outputs of wallet transactions, one byte per
+     * output, so a query doesn't walk the inputs again. Entries are made as
+     * transactions enter or leave the wallet, or on the first query for
+     * transactions loaded from a file that has none. Only transactions whose
+     * outputs are all denominated have rounds that depend on their inputs;
+     * those entries are kept in the wallet file. Guarded by cs_wallet.
+     */
+    mutable std::map<uint256, std::vector<int8_t> > mapCoinMixRounds;
+    //! Work out the rounds of a transaction into mapCoinMixRounds, without writing them
+    std::map<uint256, std::vector<int8_t> >::const_iterator CalculateCoinMixRounds(const CWalletTx& wtx, int rounds) const;
+    //! Work out the rounds of a transaction again and of the wallet transactions spending it
+    void UpdateCoinMixRounds(const uint256& hash);
+    //! Keep the rounds of a transaction in the wallet file, if they depend on its inputs
+    void WriteCoinMixRounds(const uint256& hash);
+
     /**
      * Used to keep track of spent outpoints, and
      * detect and report conflicts (double-spends or
@@ -238,6 +275,8 @@ public:
         nOrderPosNext = 0;
         nNextResend = 0;
         nLastResend = 0;
+        fJournalOrderPosNext = false;
+        nJournalSince = 0;
         nTimeFirstKey = 0;
         fWalletUnlockAnonymizeOnly = false;
 
@@ -274,6 +313,14 @@ public:
 
     std::map<uint256, CWalletTx> mapWallet;
 
+    typedef std::pair<CWalletTx*, CAccountingEntry*> TxPair;
+    typedef std::multimap<int64_t, TxPair> TxItems;
+
+    //! Wallet transactions and accounting entries by nOrderPos, updated as they are added
+    TxItems wtxOrdered;
+    //! Accounting entries referenced from wtxOrdered
+    std::list<CAccountingEntry> laccentries;
+
     int64_t nOrderPosNext;
     std::map<uint256, int> mapRequestCount;
 
@@ -365,21 +412,28 @@ public:
      */
     int64_t IncOrderPosNext(CWalletDB* pwalletdb = NULL);
 
-    typedef std::pair<CWalletTx*, CAccountingEntry*> TxPair;
-    typedef std::multimap<int64_t, TxPair> TxItems;
-
-    /**
-     * Get the wallet's activity log
-     * @return multimap of ordered transactions and accounting entries
-     * @warning Returned pointers are *only* valid within the scope of passed acentries
-     */
-    TxItems OrderedTxItems(std::list<CAccountingEntry>& acentries, std::string strAccount = "");
+    //! Fill wtxOrdered from mapWallet and the accounting entries on disk, once the wallet is loaded
+    void BuildOrderedTxItems(CWalletDB& walletdb);
+    //! Write an accounting entry and add it to wtxOrdered
+    bool AddAccountingEntry(const CAccountingEntry& acentry, CWalletDB& walletdb);
+    //! Add an accounting entry that is already on disk to wtxOrdered, e.g. once its database transaction committed
+    void LoadAccountingEntry(const CAccountingEntry& acentry);
 
     void MarkDirty();
     bool AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet = false);
-    void SyncTransaction(const CTransaction& tx, const CBlock* pblock);
+    //! Bind the transactions added by LoadWallet to this wallet and record what they spend
+    void LinkLoadedTransactions();
+    void SyncTransaction(const CTransactionRef& ptx, const CBlock* pblock);
     bool AddToWalletIfInvolvingMe(const CTransaction& tx, const CBlock* pblock, bool fUpdate);
     void EraseFromWallet(const uint256& hash);
+    //! Queue the record of a wallet transaction for the next journal flush
+    bool QueueTxWrite(const uint256& hash) const;
+    //! Write everything queued in the journal to the wallet file in one database transaction
+    bool FlushWalletJournal() const;
+    //! Flush the journal if its oldest record has waited -walletwritedelay
+    void FlushWalletJournalIfDue() const;
+    //! Number of transaction records waiting in the journal
+    size_t GetJournalSize() const;
     int ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate = false);
     void ReacceptWalletTransactions();
     void ResendWalletTransactions();
@@ -435,6 +489,9 @@ public:
 
     // get the CoinMix chain depth for a given input
     int GetRealInputCoinMixRounds(CTxIn in, int rounds) const;
+    void LoadCoinMixRounds(const uint256& hash, const std::vector<int8_t>& vRounds);
+    //! Work out the rounds of every transaction again, after keys were added
+    void ResetCoinMixRounds();
     // respect current settings
     int GetInputCoinMixRounds(CTxIn in) const;
 
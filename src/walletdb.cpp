@@ -19,6 +19,7 @@
 #include <boost/foreach.hpp>
 #include <boost/scoped_ptr.hpp>
 #include <boost/thread.hpp>
+#include <deque>
 #include <fstream>
 
 using namespace boost;
@@ -68,6 +69,18 @@ bool CWalletDB::EraseTx(uint256 hash)
     return Erase(std::make_pair(std::string("tx"), hash));
 }
 
+bool CWalletDB::WriteCoinMixRounds(const uint256& hash, const std::vector<int8_t>& vRounds)
+{
+    nWalletDBUpdated++;
+    return Write(std::make_pair(std::string("mixrounds"), hash), vRounds);
+}
+
+bool CWalletDB::EraseCoinMixRounds(const uint256& hash)
+{
+    nWalletDBUpdated++;
+    return Erase(std::make_pair(std::string("mixrounds"), hash));
+}
+
 bool CWalletDB::WriteKey(const CPubKey& vchPubKey, const CPrivKey& vchPrivKey, const CKeyMetadata& keyMeta)
 {
     nWalletDBUpdated++;
@@ -381,6 +394,9 @@ DBErrors CWalletDB::ReorderTransactions(CWallet* pwallet)
     }
     WriteOrderPosNext(nOrderPosNext);
 
+    // The positions changed, so the in-memory order has to be rebuilt
+    pwallet->BuildOrderedTxItems(*this);
+
     return DB_LOAD_OK;
 }
 
@@ -404,6 +420,109 @@ public:
     }
 };
 
+// The decoding of "tx" and "key"/"wkey" records doesn't touch the wallet, so
+// LoadWallet can run it on several threads before loading the results.
+static bool DecodeTxRecord(CDataStream& ssKey, CDataStream& ssValue, uint256& hash, CWalletTx& wtx, bool& fUpgraded, string& strErr)
+{
+    ssKey >> hash;
+    ssValue >> wtx;
+    CValidationState state;
+    if (!(CheckTransaction(wtx, state) && (wtx.GetHash() == hash) && state.IsValid()))
+        return false;
+
+    // Undo serialize changes in 31600
+    fUpgraded = false;
+    if (31404 <= wtx.fTimeReceivedIsTxTime && wtx.fTimeReceivedIsTxTime <= 31703) {
+        if (!ssValue.empty()) {
+            char fTmp;
+            char fUnused;
+            ssValue >> fTmp >> fUnused >> wtx.strFromAccount;
+            strErr = strprintf("LoadWallet() upgrading tx ver=%d %d '%s' %s",
+                wtx.fTimeReceivedIsTxTime, fTmp, wtx.strFromAccount, hash.ToString());
+            wtx.fTimeReceivedIsTxTime = fTmp;
+        } else {
+            strErr = strprintf("LoadWallet() repairing tx ver=%d %s", wtx.fTimeReceivedIsTxTime, hash.ToString());
+            wtx.fTimeReceivedIsTxTime = 0;
+        }
+        fUpgraded = true;
+    }
+    return true;
+}
+
+static void LoadTxRecord(CWallet* pwallet, const uint256& hash, const CWalletTx& wtx, bool fUpgraded, CWalletScanState& wss)
+{
+    if (fUpgraded)
+        wss.vWalletUpgrade.push_back(hash);
+
+    if (wtx.nOrderPos == -1)
+        wss.fAnyUnordered = true;
+
+    pwallet->AddToWallet(wtx, true);
+}
+
+static bool DecodeKeyRecord(const string& strType, CDataStream& ssKey, CDataStream& ssValue, CPubKey& vchPubKey, CKey& key, string& strErr)
+{
+    ssKey >> vchPubKey;
+    if (!vchPubKey.IsValid()) {
+        strErr = "Error reading wallet database: CPubKey corrupt";
+        return false;
+    }
+    CPrivKey pkey;
+    uint256 hash = 0;
+
+    if (strType == "key") {
+        ssValue >> pkey;
+    } else {
+        CWalletKey wkey;
+        ssValue >> wkey;
+        pkey = wkey.vchPrivKey;
+    }
+
+    // Old wallets store keys as "key" [pubkey] => [privkey]
+    // ... which was slow for wallets with lots of keys, because the public key is re-derived from the private key
+    // using EC operations as a checksum.
+    // Newer wallets store keys as "key"[pubkey] => [privkey][hash(pubkey,privkey)], which is much faster while
+    // remaining backwards-compatible.
+    try {
+        ssValue >> hash;
+    } catch (...) {
+    }
+
+    bool fSkipCheck = false;
+
+    if (hash != 0) {
+        // hash pubkey/privkey to accelerate wallet load
+        std::vector<unsigned char> vchKey;
+        vchKey.reserve(vchPubKey.size() + pkey.size());
+        vchKey.insert(vchKey.end(), vchPubKey.begin(), vchPubKey.end());
+        vchKey.insert(vchKey.end(), pkey.begin(), pkey.end());
+
+        if (Hash(vchKey.begin(), vchKey.end()) != hash) {
+            strErr = "Error reading wallet database: CPubKey/CPrivKey corrupt";
+            return false;
+        }
+
+        fSkipCheck = true;
+    }
+
+    if (!key.Load(pkey, vchPubKey, fSkipCheck)) {
+        strErr = "Error reading wallet database: CPrivKey corrupt";
+        return false;
+    }
+    return true;
+}
+
+static bool LoadKeyRecord(CWallet* pwallet, const string& strType, const CPubKey& vchPubKey, const CKey& key, CWalletScanState& wss, string& strErr)
+{
+    if (strType == "key")
+        wss.nKeys++;
+    if (!pwallet->LoadKey(key, vchPubKey)) {
+        strErr = "Error reading wallet database: LoadKey failed";
+        return false;
+    }
+    return true;
+}
+
 bool ReadKeyValue(CWallet* pwallet, CDataStream& ssKey, CDataStream& ssValue, CWalletScanState& wss, string& strType, string& strErr)
 {
     try {
@@ -421,33 +540,11 @@ bool ReadKeyValue(CWallet* pwallet, CDataStream& ssKey, CDataStream& ssValue, CW
             ssValue >> pwallet->mapAddressBook[CBitcoinAddress(strAddress).Get()].purpose;
         } else if (strType == "tx") {
             uint256 hash;
-            ssKey >> hash;
             CWalletTx wtx;
-            ssValue >> wtx;
-            CValidationState state;
-            if (!(CheckTransaction(wtx, state) && (wtx.GetHash() == hash) && state.IsValid()))
+            bool fUpgraded;
+            if (!DecodeTxRecord(ssKey, ssValue, hash, wtx, fUpgraded, strErr))
                 return false;
-
-            // Undo serialize changes in 31600
-            if (31404 <= wtx.fTimeReceivedIsTxTime && wtx.fTimeReceivedIsTxTime <= 31703) {
-                if (!ssValue.empty()) {
-                    char fTmp;
-                    char fUnused;
-                    ssValue >> fTmp >> fUnused >> wtx.strFromAccount;
-                    strErr = strprintf("LoadWallet() upgrading tx ver=%d %d '%s' %s",
-                        wtx.fTimeReceivedIsTxTime, fTmp, wtx.strFromAccount, hash.ToString());
-                    wtx.fTimeReceivedIsTxTime = fTmp;
-                } else {
-                    strErr = strprintf("LoadWallet() repairing tx ver=%d %s", wtx.fTimeReceivedIsTxTime, hash.ToString());
-                    wtx.fTimeReceivedIsTxTime = 0;
-                }
-                wss.vWalletUpgrade.push_back(hash);
-            }
-
-            if (wtx.nOrderPos == -1)
-                wss.fAnyUnordered = true;
-
-            pwallet->AddToWallet(wtx, true);
+            LoadTxRecord(pwallet, hash, wtx, fUpgraded, wss);
         } else if (strType == "acentry") {
             string strAccount;
             ssKey >> strAccount;
@@ -475,59 +572,11 @@ bool ReadKeyValue(CWallet* pwallet, CDataStream& ssKey, CDataStream& ssValue, CW
             pwallet->nTimeFirstKey = 1;
         } else if (strType == "key" || strType == "wkey") {
             CPubKey vchPubKey;
-            ssKey >> vchPubKey;
-            if (!vchPubKey.IsValid()) {
-                strErr = "Error reading wallet database: CPubKey corrupt";
-                return false;
-            }
             CKey key;
-            CPrivKey pkey;
-            uint256 hash = 0;
-
-            if (strType == "key") {
-                wss.nKeys++;
-                ssValue >> pkey;
-            } else {
-                CWalletKey wkey;
-                ssValue >> wkey;
-                pkey = wkey.vchPrivKey;
-            }
-
-            // Old wallets store keys as "key" [pubkey] => [privkey]
-            // ... which was slow for wallets with lots of keys, because the public key is re-derived from the private key
-            // using EC operations as a checksum.
-            // Newer wallets store keys as "key"[pubkey] => [privkey][hash(pubkey,privkey)], which is much faster while
-            // remaining backwards-compatible.
-            try {
-                ssValue >> hash;
-            } catch (...) {
-            }
-
-            bool fSkipCheck = false;
-
-            if (hash != 0) {
-                // hash pubkey/privkey to accelerate wallet load
-                std::vector<unsigned char> vchKey;
-                vchKey.reserve(vchPubKey.size() + pkey.size());
-                vchKey.insert(vchKey.end(), vchPubKey.begin(), vchPubKey.end());
-                vchKey.insert(vchKey.end(), pkey.begin(), pkey.end());
-
-                if (Hash(vchKey.begin(), vchKey.end()) != hash) {
-                    strErr = "Error reading wallet database: CPubKey/CPrivKey corrupt";
-                    return false;
-                }
-
-                fSkipCheck = true;
-            }
-
-            if (!key.Load(pkey, vchPubKey, fSkipCheck)) {
-                strErr = "Error reading wallet database: CPrivKey corrupt";
+            if (!DecodeKeyRecord(strType, ssKey, ssValue, vchPubKey, key, strErr))
                 return false;
-            }
-            if (!pwallet->LoadKey(key, vchPubKey)) {
-                strErr = "Error reading wallet database: LoadKey failed";
+            if (!LoadKeyRecord(pwallet, strType, vchPubKey, key, wss, strErr))
                 return false;
-            }
         } else if (strType == "mkey") {
             unsigned int nID;
             ssKey >> nID;
@@ -595,6 +644,12 @@ bool ReadKeyValue(CWallet* pwallet, CDataStream& ssKey, CDataStream& ssValue, CW
             }
         } else if (strType == "orderposnext") {
             ssValue >> pwallet->nOrderPosNext;
+        } else if (strType == "mixrounds") {
+            uint256 hash;
+            ssKey >> hash;
+            std::vector<int8_t> vRounds;
+            ssValue >> vRounds;
+            pwallet->LoadCoinMixRounds(hash, vRounds);
         } else if (strType == "stakeSplitThreshold") //presstab HyperStake
         {
             ssValue >> pwallet->nStakeSplitThreshold;
@@ -646,6 +701,56 @@ static bool IsKeyType(string strType)
             strType == "mkey" || strType == "ckey");
 }
 
+/** A wallet record as read by the cursor, with its transaction or key decoded ahead of loading */
+class CWalletRecord
+{
+public:
+    CDataStream ssKey;
+    CDataStream ssValue;
+    string strType;
+
+    bool fDecoded;
+    bool fDecodeOK;
+    string strErr;
+    //! "tx" records
+    uint256 hash;
+    CWalletTx wtx;
+    bool fUpgraded;
+    //! "key" and "wkey" records
+    CPubKey vchPubKey;
+    CKey key;
+
+    CWalletRecord() : ssKey(SER_DISK, CLIENT_VERSION), ssValue(SER_DISK, CLIENT_VERSION), fDecoded(false), fDecodeOK(false), fUpgraded(false) {}
+};
+
+static void DecodeWalletRecords(const vector<CWalletRecord*>& vRecords, size_t nBegin, size_t nEnd)
+{
+    for (size_t i = nBegin; i < nEnd; i++) {
+        CWalletRecord& record = *vRecords[i];
+        record.fDecoded = true;
+        try {
+            if (record.strType == "tx")
+                record.fDecodeOK = DecodeTxRecord(record.ssKey, record.ssValue, record.hash, record.wtx, record.fUpgraded, record.strErr);
+            else
+                record.fDecodeOK = DecodeKeyRecord(record.strType, record.ssKey, record.ssValue, record.vchPubKey, record.key, record.strErr);
+        } catch (...) {
+            record.fDecodeOK = false;
+        }
+    }
+}
+
+static bool LoadDecodedRecord(CWallet* pwallet, CWalletRecord& record, CWalletScanState& wss, string& strErr)
+{
+    strErr = record.strErr;
+    if (!record.fDecodeOK)
+        return false;
+    if (record.strType == "tx") {
+        LoadTxRecord(pwallet, record.hash, record.wtx, record.fUpgraded, wss);
+        return true;
+    }
+    return LoadKeyRecord(pwallet, record.strType, record.vchPubKey, record.key, wss, strErr);
+}
+
 DBErrors CWalletDB::LoadWallet(CWallet* pwallet)
 {
     pwallet->vchDefaultKey = CPubKey();
@@ -669,21 +774,62 @@ DBErrors CWalletDB::LoadWallet(CWallet* pwallet)
             return DB_CORRUPT;
         }
 
+        // Read every record first; decoding transactions and checking keys
+        // is what makes large wallets slow to open, and it is split across
+        // threads before anything is loaded into the wallet.
+        int64_t nStart = GetTimeMillis();
+        deque<CWalletRecord> vRecords;
+        vector<CWalletRecord*> vDecode;
         while (true) {
-            // Read next record
-            CDataStream ssKey(SER_DISK, CLIENT_VERSION);
-            CDataStream ssValue(SER_DISK, CLIENT_VERSION);
-            int ret = ReadAtCursor(pcursor, ssKey, ssValue);
-            if (ret == DB_NOTFOUND)
+            vRecords.push_back(CWalletRecord());
+            CWalletRecord& record = vRecords.back();
+            int ret = ReadAtCursor(pcursor, record.ssKey, record.ssValue);
+            if (ret == DB_NOTFOUND) {
+                vRecords.pop_back();
                 break;
-            else if (ret != 0) {
+            } else if (ret != 0) {
                 LogPrintf("Error reading next record from wallet database\n");
+                pcursor->close();
                 return DB_CORRUPT;
             }
 
+            try {
+                CDataStream ssType(record.ssKey);
+                ssType >> record.strType;
+            } catch (...) {
+                // Left for ReadKeyValue to fail on
+                continue;
+            }
+            if (record.strType == "tx" || record.strType == "key" || record.strType == "wkey") {
+                record.ssKey >> record.strType;
+                vDecode.push_back(&record);
+            }
+        }
+        pcursor->close();
+        size_t nRecords = vRecords.size();
+        int64_t nRead = GetTimeMillis();
+
+        int nThreads = std::max(1, std::min(8, (int)boost::thread::hardware_concurrency()));
+        if (nThreads == 1 || vDecode.size() < 1000) {
+            nThreads = 1;
+            DecodeWalletRecords(vDecode, 0, vDecode.size());
+        } else {
+            boost::thread_group decoders;
+            for (int i = 0; i < nThreads; i++)
+                decoders.create_thread(boost::bind(&DecodeWalletRecords, boost::cref(vDecode), vDecode.size() * i / nThreads, vDecode.size() * (i + 1) / nThreads));
+            decoders.join_all();
+        }
+        int64_t nDecoded = GetTimeMillis();
+
+        // Load the records in file order
+        while (!vRecords.empty()) {
+            CWalletRecord& record = vRecords.front();
+
             // Try to be tolerant of single corrupt records:
-            string strType, strErr;
-            if (!ReadKeyValue(pwallet, ssKey, ssValue, wss, strType, strErr)) {
+            string strType = record.strType, strErr;
+            bool fLoaded = record.fDecoded ? LoadDecodedRecord(pwallet, record, wss, strErr) : ReadKeyValue(pwallet, record.ssKey, record.ssValue, wss, strType, strErr);
+            vRecords.pop_front();
+            if (!fLoaded) {
                 // losing keys is considered a catastrophic error, anything else
                 // we assume the user can live with:
                 if (IsKeyType(strType))
@@ -699,7 +845,13 @@ DBErrors CWalletDB::LoadWallet(CWallet* pwallet)
             if (!strErr.empty())
                 LogPrintf("%s\n", strErr);
         }
-        pcursor->close();
+        int64_t nLoaded = GetTimeMillis();
+
+        // Now that every transaction is in place, bind them to the wallet and index what they spend
+        pwallet->LinkLoadedTransactions();
+
+        LogPrintf("%s : %u records, read %dms, decoded %u on %d threads %dms, loaded %dms, linked %dms\n", __func__,
+            nRecords, nRead - nStart, vDecode.size(), nThreads, nDecoded - nRead, nLoaded - nDecoded, GetTimeMillis() - nLoaded);
     } catch (boost::thread_interrupted) {
         throw;
     } catch (...) {
@@ -811,12 +963,13 @@ DBErrors CWalletDB::ZapWalletTx(CWallet* pwallet, vector<CWalletTx>& vWtx)
     BOOST_FOREACH (uint256& hash, vTxHash) {
         if (!EraseTx(hash))
             return DB_CORRUPT;
+        EraseCoinMixRounds(hash);
     }
 
     return DB_LOAD_OK;
 }
 
-void ThreadFlushWalletDB(const string& strFile)
+void ThreadFlushWalletDB(CWallet* pwallet)
 {
     // Make this thread recognisable as the wallet flushing thread
     RenameThread("sling-wallet");
@@ -825,14 +978,20 @@ void ThreadFlushWalletDB(const string& strFile)
     if (fOneThread)
         return;
     fOneThread = true;
-    if (!GetBoolArg("-flushwallet", true))
+    bool fFlushDb = GetBoolArg("-flushwallet", true);
+    if (!fFlushDb && nWalletWriteDelay <= 0)
         return;
 
     unsigned int nLastSeen = nWalletDBUpdated;
     unsigned int nLastFlushed = nWalletDBUpdated;
     int64_t nLastWalletUpdate = GetTime();
     while (true) {
-        MilliSleep(500);
+        MilliSleep(nWalletWriteDelay > 0 ? std::min<int64_t>(500, nWalletWriteDelay) : 500);
+
+        // Write out queued wallet records once the oldest is -walletwritedelay old
+        pwallet->FlushWalletJournalIfDue();
+        if (!fFlushDb)
+            continue;
 
         if (nLastSeen != nWalletDBUpdated) {
             nLastSeen = nWalletDBUpdated;
@@ -852,6 +1011,7 @@ void ThreadFlushWalletDB(const string& strFile)
 
                 if (nRefCount == 0) {
                     boost::this_thread::interruption_point();
+                    const string& strFile = pwallet->strWalletFile;
                     map<string, int>::iterator mi = bitdb.mapFileUseCount.find(strFile);
                     if (mi != bitdb.mapFileUseCount.end()) {
                         LogPrint("db", "Flushing wallet.dat\n");
@@ -875,6 +1035,9 @@ bool BackupWallet(const CWallet& wallet, const string& strDest)
 {
     if (!wallet.fFileBacked)
         return false;
+    // The copy has to include the changes still queued in memory
+    if (!wallet.FlushWalletJournal())
+        return false;
     while (true) {
         {
             LOCK(bitdb.cs_db);
@@ -5,6 +5,7 @@
 #include "chainparams.h"
 #include "zmqpublishnotifier.h"
 #include "main.h"
+#include "rpcserver.h"
 #include "util.h"
 #include "crypto/common.h"
 
@@ -16,6 +17,7 @@ static const char *MSG_HASHTXLOCK = "hashtxlock";
 static const char *MSG_RAWBLOCK   = "rawblock";
 static const char *MSG_RAWTX      = "rawtx";
 static const char *MSG_RAWTXLOCK = "rawtxlock";
+static const char *MSG_PERFSTATS  = "perfstats";
 
 // Internal function to send multipart message
 static int zmq_send_multipart(void *sock, const void* data, size_t size, ...)
@@ -212,3 +214,10 @@ bool CZMQPublishRawTransactionLockNotifier::NotifyTransactionLock(const CTransac
     ss << transaction;
     return SendMessage(MSG_RAWTXLOCK, &(*ss.begin()), ss.size());
 }
+
+bool CZMQPublishPerfStatsNotifier::NotifyBlock(const CBlockIndex *pindex)
+{
+    LogPrint("zmq", "zmq: Publish perfstats at height %d\n", pindex->nHeight);
+    std::string strStats = json_spirit::write_string(json_spirit::Value(PerfStatsToJSON()), false);
+    return SendMessage(MSG_PERFSTATS, strStats.data(), strStats.size());
+}
@@ -64,4 +64,11 @@ public:
     bool NotifyTransactionLock(const CTransaction &transaction);
 };
 
+/** Publishes the getperfstats JSON each time the tip changes */
+class CZMQPublishPerfStatsNotifier : public CZMQAbstractPublishNotifier
+{
+public:
+    bool NotifyBlock(const CBlockIndex *pindex);
+};
+
 #endif // BITCOIN_ZMQ_ZMQPUBLISHNOTIFIER_H